@@ -80,3 +80,23 @@ macro(execute_qt_rcc origin_dir replace_dir ${rcc_path})
         execute_process(COMMAND rcc ${RCC_FILE} -o ${H_FILE} WORKING_DIRECTORY ${QT_SDK_DIR}/bin)
     endforeach()
 endmacro()
+
+macro(execute_glslc shader_dir)
+    # the spv files are committed, glslc only refreshes the ones whose shader source changed
+    find_program(GLSLC_EXECUTABLE glslc HINTS "$ENV{VULKAN_SDK}/bin" "$ENV{VULKAN_SDK}/Bin")
+    if(NOT GLSLC_EXECUTABLE)
+        message(STATUS "not found glslc, use the committed spv files")
+    else()
+        # name.vert -> name_vert.spv, the spv files are embedded by rcc
+        foreach(SHADER_NAME ${ARGN})
+            string(REPLACE "." "_" SPV_NAME ${SHADER_NAME})
+            if(${shader_dir}/${SHADER_NAME} IS_NEWER_THAN ${shader_dir}/${SPV_NAME}.spv)
+                execute_process(COMMAND ${GLSLC_EXECUTABLE} ${shader_dir}/${SHADER_NAME} -o ${shader_dir}/${SPV_NAME}.spv
+                                RESULT_VARIABLE GLSLC_RESULT)
+                if(NOT GLSLC_RESULT EQUAL 0)
+                    message(WARNING "compile shader failed: ${SHADER_NAME}, use the committed spv file")
+                endif()
+            endif()
+        endforeach()
+    endif()
+endmacro()
@@ -3,6 +3,7 @@
 
 #include <QSize>
 #include <QColor>
+#include <QStringList>
 
 class IDrawInterface
 {
@@ -16,7 +17,8 @@ public:
     virtual void setWheelScale(float wheelScale) = 0;
     virtual void startAnimation(int animationType) = 0;
     virtual void stopAnimation() = 0;
-    virtual QString getModelPath() const = 0;
+    // models drawn by the window, a grid of viewports draws several
+    virtual QStringList getModelPaths() const = 0;
 };
 
 
@@ -1,4 +1,5 @@
 ﻿#include "main_window.h"
+#include "utils/benchmark.h"
 #include <QApplication>
 #include <QTranslator>
 #ifdef WIN32
@@ -24,11 +25,16 @@ int main(int argc, char *argv[])
 {
     ensureConsole();
 
+    // textures uploaded by one opengl window stay valid for the windows created later
+    QApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
     QApplication a(argc, argv);
     QTranslator qtTranslator;
     if (qtTranslator.load(":/ZH_CN.qm"))
         a.installTranslator(&qtTranslator);
 
+    if (a.arguments().contains("--benchmark"))
+        return Benchmark::run(a.arguments());
+
     MainWindow w;
     w.show();
     return a.exec();
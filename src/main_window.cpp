@@ -83,13 +83,17 @@ void MainWindow::onDrawModeChanged(int index)
 
 void MainWindow::onLoadModel()
 {
-    QString modelPath = QFileDialog::getOpenFileName(
-        nullptr, tr("open 3D model"), QCoreApplication::applicationDirPath(), "*.glb;*.obj", nullptr, QFileDialog::ReadOnly);
-    if (modelPath.isEmpty())
+    // selecting several models compares them side by side
+    QStringList modelPaths = QFileDialog::getOpenFileNames(
+        nullptr, tr("open 3D model"), QCoreApplication::applicationDirPath(), "*.glb;*.obj;*.ply;*.stl", nullptr, QFileDialog::ReadOnly);
+    if (modelPaths.isEmpty())
         return;
 
-    m_renderContainer->loadModel(modelPath);
-    setWindowTitle(QString("%1 - %2").arg(QFileInfo(modelPath).fileName()).arg(m_title));
+    m_renderContainer->loadModels(modelPaths);
+    if (modelPaths.size() == 1)
+        setWindowTitle(QString("%1 - %2").arg(QFileInfo(modelPaths.front()).fileName()).arg(m_title));
+    else
+        setWindowTitle(QString("%1 %2 - %3").arg(modelPaths.size()).arg(tr("models")).arg(m_title));
     m_wheelScaleCom->setCurrentIndex(-1);
     m_animationCom->setCurrentIndex(-1);
 }
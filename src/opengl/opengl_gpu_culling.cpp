@@ -0,0 +1,320 @@
+﻿#include "opengl_gpu_culling.h"
+#include "opengl_program_registry.h"
+#include "spdlog/spdlog.h"
+#include <QtMath>
+#include <map>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#define CULL_WORK_GROUP_SIZE 64
+#define HIZ_WORK_GROUP_SIZE 8
+
+OpenGLGpuCulling::~OpenGLGpuCulling()
+{
+    if (!m_functionsReady)
+        return;
+    releaseDepthTargets();
+    glDeleteVertexArrays(1, &m_VAO);
+    glDeleteBuffers(1, &m_VBO);
+    glDeleteBuffers(1, &m_EBO);
+    glDeleteBuffers(1, &m_instanceVBO);
+    glDeleteBuffers(1, &m_boundsBuffer);
+    glDeleteBuffers(1, &m_commandBuffer);
+}
+
+bool OpenGLGpuCulling::initialize(const std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> &modelMeshsPtr, const std::vector<std::vector<unsigned int>> &textureIds,
+                                  const std::shared_ptr<OpenGLUploadRing::Batch> &uploads)
+{
+    const QVector<ModelLoadManager::ModelMesh> &modelMeshs = *modelMeshsPtr;
+    m_functionsReady = initializeOpenGLFunctions();
+    if (!m_functionsReady)
+    {
+        spdlog::info("gpu culling needs an OpenGL 4.3 context, meshes are drawn one by one.");
+        return false;
+    }
+    m_cullProgram = OpenGLProgramRegistry::instance()->computeProgram(":/gpu_cull.comp");
+    m_hizProgram = OpenGLProgramRegistry::instance()->computeProgram(":/hiz_build.comp");
+    if (!m_cullProgram || !m_hizProgram)
+        return false;
+
+    // group the meshes by their textures so that every group is one multi draw
+    std::map<std::vector<unsigned int>, std::vector<int>> textureGroups;
+    size_t vertexCount = 0, indexCount = 0;
+    const ModelLoadManager::ModelMesh *layout = nullptr; // the meshes of a model share their vertex layout
+    for (int i = 0; i < modelMeshs.size(); ++i)
+    {
+        textureGroups[i < (int)textureIds.size() ? textureIds[i] : std::vector<unsigned int>()].emplace_back(i);
+        vertexCount += modelMeshs[i].vertexCount();
+        indexCount += modelMeshs[i].m_indices.size();
+        if (!layout && modelMeshs[i].vertexCount())
+            layout = &modelMeshs[i];
+    }
+    if (!layout)
+        return false;
+
+    std::vector<DrawCommand> commands;
+    std::vector<float> instances;
+    glGenVertexArrays(1, &m_VAO);
+    glGenBuffers(1, &m_VBO);
+    glGenBuffers(1, &m_EBO);
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    glBufferData(GL_ARRAY_BUFFER, layout->vertexBytes(vertexCount), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+
+    size_t baseVertex = 0, firstIndex = 0;
+    for (const auto &textureGroup : textureGroups)
+    {
+        DrawGroup group;
+        group.m_meshIndex = textureGroup.second.front();
+        group.m_firstCommand = (int)commands.size();
+        for (int meshIndex : textureGroup.second)
+        {
+            const auto &modelMesh = modelMeshs[meshIndex];
+            if (modelMesh.m_indices.empty())
+                continue;
+
+            // every stream of the mesh goes to its place in the stream of the whole model
+            const qint64 meshVertexCount = modelMesh.vertexCount();
+            if (modelMesh.m_streams.empty())
+            {
+                OpenGLUploadRing::instance()->uploadBuffer(m_VBO, baseVertex * sizeof(ModelLoadManager::Vertex), meshVertexCount * sizeof(ModelLoadManager::Vertex),
+                                                           OpenGLUploadRing::copyFrom(modelMesh.m_vertices.data(), modelMeshsPtr), uploads);
+            }
+            else
+            {
+                for (int stream = 0; stream < VertexStreams::StreamCount; ++stream)
+                {
+                    const VertexStreams::Attribute attribute = layout->vertexAttribute((VertexStreams::Stream)stream, vertexCount);
+                    if (attribute.m_components)
+                        OpenGLUploadRing::instance()->uploadBuffer(m_VBO, attribute.m_offset + baseVertex * attribute.m_stride, meshVertexCount * attribute.m_stride,
+                                                                   OpenGLUploadRing::copyFrom(modelMesh.m_streams.data((VertexStreams::Stream)stream), modelMeshsPtr), uploads);
+                }
+            }
+            const qint64 indexBytes = modelMesh.m_indices.size() * sizeof(unsigned int);
+            OpenGLUploadRing::instance()->uploadBuffer(m_EBO, firstIndex * sizeof(unsigned int), indexBytes,
+                                                       OpenGLUploadRing::copyFrom(modelMesh.m_indices.data(), modelMeshsPtr), uploads);
+
+            float bmin[3], bmax[3];
+            VertexStreams::bounds(modelMesh.positions(), meshVertexCount, bmin, bmax);
+
+            // one command per instance, so that every instance is culled on its own
+            for (int instanceIndex = 0; instanceIndex < modelMesh.instanceCount(); ++instanceIndex)
+            {
+                DrawCommand command;
+                command.m_count = (unsigned int)modelMesh.m_indices.size();
+                command.m_instanceCount = 1;
+                command.m_firstIndex = (unsigned int)firstIndex;
+                command.m_baseVertex = (int)baseVertex;
+                command.m_baseInstance = (unsigned int)(instances.size() / INSTANCE_FLOAT_COUNT);
+                commands.emplace_back(command);
+                instances.insert(instances.end(), modelMesh.m_instances.begin() + instanceIndex * INSTANCE_FLOAT_COUNT,
+                                 modelMesh.m_instances.begin() + (instanceIndex + 1) * INSTANCE_FLOAT_COUNT);
+                m_instanceNodes.emplace_back(modelMesh.m_instanceNodes[instanceIndex]);
+                m_localBounds.insert(m_localBounds.end(), {bmin[0], bmin[1], bmin[2], bmax[0], bmax[1], bmax[2]});
+            }
+            baseVertex += meshVertexCount;
+            firstIndex += modelMesh.m_indices.size();
+        }
+        group.m_commandCount = (int)commands.size() - group.m_firstCommand;
+        if (group.m_commandCount)
+            m_drawGroups.emplace_back(group);
+    }
+    m_drawCount = (unsigned int)commands.size();
+    std::vector<float> bounds(m_drawCount * 8);
+    for (unsigned int i = 0; i < m_drawCount; ++i)
+        transformBounds(&instances[i * INSTANCE_FLOAT_COUNT], &m_localBounds[i * 6], &bounds[i * 8]);
+
+    // same attributes as the per mesh vertex arrays
+    for (int location = 0; location < VertexStreams::StreamCount; ++location)
+    {
+        const VertexStreams::Attribute attribute = layout->vertexAttribute((VertexStreams::Stream)location, vertexCount);
+        if (!attribute.m_components)
+            continue;
+        if (attribute.m_integer)
+            glVertexAttribIPointer(location, attribute.m_components, GL_INT, attribute.m_stride, (void *)attribute.m_offset);
+        else
+            glVertexAttribPointer(location, attribute.m_components, GL_FLOAT, GL_FALSE, attribute.m_stride, (void *)attribute.m_offset);
+        glEnableVertexAttribArray(location);
+    }
+
+    // the base instance of every command selects its transform
+    glGenBuffers(1, &m_instanceVBO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(float), instances.data(), GL_DYNAMIC_DRAW);
+    for (int column = 0; column < 4; ++column)
+    {
+        glVertexAttribPointer(7 + column, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOAT_COUNT * sizeof(float), (void *)(column * 4 * sizeof(float)));
+        glEnableVertexAttribArray(7 + column);
+        glVertexAttribDivisor(7 + column, 1);
+    }
+    glBindVertexArray(0);
+
+    glGenBuffers(1, &m_boundsBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_boundsBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(float), bounds.data(), GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &m_commandBuffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_commandBuffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, commands.size() * sizeof(DrawCommand), commands.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    spdlog::info("gpu culling enabled. mesh instances: {0}, draw groups: {1}", m_drawCount, m_drawGroups.size());
+    return true;
+}
+
+void OpenGLGpuCulling::updateTransforms(const SceneGraph &sceneGraph)
+{
+    if (!m_drawCount)
+        return;
+
+    std::vector<float> instances(m_drawCount * INSTANCE_FLOAT_COUNT), bounds(m_drawCount * 8);
+    sceneGraph.gatherWorlds(m_instanceNodes, instances.data());
+    for (unsigned int i = 0; i < m_drawCount; ++i)
+        transformBounds(&instances[i * INSTANCE_FLOAT_COUNT], &m_localBounds[i * 6], &bounds[i * 8]);
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_instanceVBO);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(float), instances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_boundsBuffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bounds.size() * sizeof(float), bounds.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    // moved instances may be hidden by their old depth
+    m_hizValid = false;
+}
+
+void OpenGLGpuCulling::transformBounds(const float *matrix, const float *localBounds, float *bounds)
+{
+    // column-major matrix, bounds are written as min.xyz1 max.xyz1
+    float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        const float x = localBounds[corner & 1 ? 3 : 0], y = localBounds[corner & 2 ? 4 : 1], z = localBounds[corner & 4 ? 5 : 2];
+        for (int i = 0; i < 3; ++i)
+        {
+            const float position = matrix[i] * x + matrix[4 + i] * y + matrix[8 + i] * z + matrix[12 + i];
+            bmin[i] = qMin(bmin[i], position);
+            bmax[i] = qMax(bmax[i], position);
+        }
+    }
+    const float result[8] = {bmin[0], bmin[1], bmin[2], 1.0f, bmax[0], bmax[1], bmax[2], 1.0f};
+    memcpy(bounds, result, sizeof(result));
+}
+
+bool OpenGLGpuCulling::cull(const QMatrix4x4 &mvp)
+{
+    if (!m_drawCount)
+        return true;
+
+    glUseProgram(m_cullProgram);
+    glUniformMatrix4fv(glGetUniformLocation(m_cullProgram, "mvp"), 1, GL_FALSE, mvp.constData());
+    glUniformMatrix4fv(glGetUniformLocation(m_cullProgram, "hizMvp"), 1, GL_FALSE, m_hizMvp.constData());
+    glUniform1i(glGetUniformLocation(m_cullProgram, "useHiz"), m_hizValid);
+    glUniform1ui(glGetUniformLocation(m_cullProgram, "drawCount"), m_drawCount);
+    glUniform1i(glGetUniformLocation(m_cullProgram, "hizTexture"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_hizValid ? m_hizTexture : 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_boundsBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_commandBuffer);
+    glDispatchCompute((m_drawCount + CULL_WORK_GROUP_SIZE - 1) / CULL_WORK_GROUP_SIZE, 1, 1);
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return !m_hizValid || m_hizMvp == mvp;
+}
+
+void OpenGLGpuCulling::bindGeometry()
+{
+    glBindVertexArray(m_VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+}
+
+void OpenGLGpuCulling::draw(const DrawGroup &group)
+{
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)(group.m_firstCommand * sizeof(DrawCommand)), group.m_commandCount, 0);
+}
+
+void OpenGLGpuCulling::unbindGeometry()
+{
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void OpenGLGpuCulling::buildDepthPyramid(unsigned int framebuffer, int x, int y, int width, int height, const QMatrix4x4 &mvp)
+{
+    if (!m_drawCount || width <= 0 || height <= 0)
+        return;
+    if (width != m_hizWidth || height != m_hizHeight)
+        createDepthTargets(width, height);
+
+    // the scissor of the viewport would clip the copy at the origin of the depth target
+    const GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+    glDisable(GL_SCISSOR_TEST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFramebuffer);
+    glBlitFramebuffer(x, y, x + width, y + height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (scissor)
+        glEnable(GL_SCISSOR_TEST);
+
+    glUseProgram(m_hizProgram);
+    glUniform1i(glGetUniformLocation(m_hizProgram, "depthTexture"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    for (int level = 0; level < m_hizLevels; ++level)
+    {
+        int levelWidth = qMax(1, width >> level);
+        int levelHeight = qMax(1, height >> level);
+        glUniform1i(glGetUniformLocation(m_hizProgram, "copyDepth"), level == 0);
+        glBindImageTexture(0, m_hizTexture, qMax(0, level - 1), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindImageTexture(1, m_hizTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((levelWidth + HIZ_WORK_GROUP_SIZE - 1) / HIZ_WORK_GROUP_SIZE, (levelHeight + HIZ_WORK_GROUP_SIZE - 1) / HIZ_WORK_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_hizMvp = mvp;
+    m_hizValid = true;
+}
+
+void OpenGLGpuCulling::createDepthTargets(int width, int height)
+{
+    releaseDepthTargets();
+    m_hizWidth = width;
+    m_hizHeight = height;
+    m_hizLevels = (int)qFloor(std::log2((float)qMax(width, height))) + 1;
+
+    // same format as the depth attachment of QOpenGLWidget, a blit needs matching depth formats
+    glGenTextures(1, &m_depthTexture);
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH24_STENCIL8, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenFramebuffers(1, &m_depthFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_depthFramebuffer);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+    glDrawBuffer(GL_NONE);
+
+    glGenTextures(1, &m_hizTexture);
+    glBindTexture(GL_TEXTURE_2D, m_hizTexture);
+    glTexStorage2D(GL_TEXTURE_2D, m_hizLevels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void OpenGLGpuCulling::releaseDepthTargets()
+{
+    if (m_depthFramebuffer)
+        glDeleteFramebuffers(1, &m_depthFramebuffer);
+    if (m_depthTexture)
+        glDeleteTextures(1, &m_depthTexture);
+    if (m_hizTexture)
+        glDeleteTextures(1, &m_hizTexture);
+    m_depthFramebuffer = m_depthTexture = m_hizTexture = 0;
+    m_hizWidth = m_hizHeight = m_hizLevels = 0;
+    m_hizValid = false;
+}
@@ -0,0 +1,83 @@
+﻿#ifndef __OPENGL_GPU_CULLING_H__
+#define __OPENGL_GPU_CULLING_H__
+
+#include "opengl_upload_ring.h"
+#include "utils/model_loader_manager.h"
+#include <QOpenGLFunctions_4_3_Core>
+#include <QMatrix4x4>
+#include <vector>
+
+// gpu driven culling of the mesh path, needs a GL 4.3 context (llvmpipe provides one without a GPU)
+// all meshes share one vertex and index buffer, a compute pass tests the bounds of every instance against the frustum and a Hi-Z pyramid
+// built from the depth of the previous frame, and writes the indirect commands drawn by glMultiDrawElementsIndirect
+class OpenGLGpuCulling : protected QOpenGLFunctions_4_3_Core
+{
+public:
+    // meshes with the same textures are drawn by one multi draw
+    struct DrawGroup
+    {
+        int m_meshIndex = 0; // mesh whose textures are bound for the group
+        int m_firstCommand = 0;
+        int m_commandCount = 0;
+    };
+
+public:
+    // the context of initialize must be current when the object is destroyed
+    ~OpenGLGpuCulling();
+    // vertices and indices go through the upload ring as part of uploads, they are drawable once the batch is done
+    // textureIds are the gl names of the textures of every mesh, meshes with the same names share a draw group
+    bool initialize(const std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> &modelMeshsPtr, const std::vector<std::vector<unsigned int>> &textureIds,
+                    const std::shared_ptr<OpenGLUploadRing::Batch> &uploads);
+    // uploads the world matrices and bounds of every instance after nodes of the scene graph moved
+    void updateTransforms(const SceneGraph &sceneGraph);
+    // returns false if the pyramid was built from another camera, the next frame must be drawn again to catch disocclusions
+    bool cull(const QMatrix4x4 &mvp);
+    void bindGeometry();
+    void draw(const DrawGroup &group);
+    void unbindGeometry();
+    // reads the depth of the finished frame inside the viewport at x, y, framebuffer is bound again afterwards
+    void buildDepthPyramid(unsigned int framebuffer, int x, int y, int width, int height, const QMatrix4x4 &mvp);
+    // the next cull tests the frustum only, e.g. when the last pyramid came from another viewport
+    void invalidateDepthPyramid() { m_hizValid = false; }
+    const std::vector<DrawGroup> &drawGroups() const { return m_drawGroups; }
+
+private:
+    struct DrawCommand
+    {
+        unsigned int m_count;
+        unsigned int m_instanceCount;
+        unsigned int m_firstIndex;
+        int m_baseVertex;
+        unsigned int m_baseInstance;
+    };
+
+    static void transformBounds(const float *matrix, const float *localBounds, float *bounds);
+    void createDepthTargets(int width, int height);
+    void releaseDepthTargets();
+
+private:
+    bool m_functionsReady = false;
+    unsigned int m_cullProgram = 0; // owned by OpenGLProgramRegistry
+    unsigned int m_hizProgram = 0;
+    unsigned int m_VAO = 0;
+    unsigned int m_VBO = 0;
+    unsigned int m_EBO = 0;
+    unsigned int m_instanceVBO = 0;
+    unsigned int m_boundsBuffer = 0;
+    unsigned int m_commandBuffer = 0;
+    unsigned int m_drawCount = 0;
+    std::vector<int> m_instanceNodes; // scene graph node of every command
+    std::vector<float> m_localBounds; // mesh bounds of every command, min.xyz max.xyz
+    std::vector<DrawGroup> m_drawGroups;
+
+    unsigned int m_depthFramebuffer = 0;
+    unsigned int m_depthTexture = 0;
+    unsigned int m_hizTexture = 0;
+    int m_hizWidth = 0;
+    int m_hizHeight = 0;
+    int m_hizLevels = 0;
+    bool m_hizValid = false;
+    QMatrix4x4 m_hizMvp;
+};
+
+#endif
@@ -0,0 +1,613 @@
+﻿#include "opengl_model.h"
+#include "opengl_texture_registry.h"
+#include "utils/cluster_octree.h"
+#include "spdlog/spdlog.h"
+#include <QVector2D>
+#include <cfloat>
+
+OpenGLModel::OpenGLModel(const QString &modelPath)
+    : m_modelPath(modelPath)
+{
+    if (modelPath.isEmpty())
+        return;
+
+    if (ModelLoadManager::instance()->openPagedModel(modelPath, m_pageFilePtr))
+        m_pageResidency.reset(new ModelPageResidency(ModelLoadManager::instance()->streamingOptions().m_residencyBudget));
+    else if (!ModelLoadManager::instance()->isStreamingModel(modelPath))
+        ModelLoadManager::instance()->import3DModel(modelPath, m_modelMeshsPtr);
+}
+
+OpenGLModel::~OpenGLModel()
+{
+    if (!m_initialized)
+        return;
+
+    // copies not issued yet must not reach the deleted buffers
+    m_uploads->m_cancelled = true;
+    ModelLoadManager::instance()->addGpuBytes(-m_gpuBytes);
+    if (m_modelMeshsPtr)
+        OpenGLTextureRegistry::instance()->release(m_modelPath);
+    m_gpuCulling.reset();
+    while (!m_glPages.empty())
+        releasePage(m_glPages.begin()->first);
+    while (!m_loadingPages.empty())
+        releasePage(m_loadingPages.begin()->first);
+    if (m_boneTexture)
+        glDeleteTextures(1, &m_boneTexture);
+    if (m_boneBuffer)
+        glDeleteBuffers(1, &m_boneBuffer);
+
+    for (const auto &meshBuffers : m_meshBuffers)
+    {
+        glDeleteVertexArrays(1, &meshBuffers.m_VAO);
+        glDeleteBuffers(1, &meshBuffers.m_VBO);
+        glDeleteBuffers(1, &meshBuffers.m_EBO);
+        glDeleteBuffers(1, &meshBuffers.m_instanceVBO);
+    }
+}
+
+void OpenGLModel::initialize(unsigned int whiteTexture)
+{
+    if (m_initialized)
+        return;
+
+    initializeOpenGLFunctions();
+    m_initialized = true;
+    m_whiteTexture = whiteTexture;
+    m_uploads = std::make_shared<OpenGLUploadRing::Batch>();
+    initializeMesh();
+    releaseGeometry();
+}
+
+void OpenGLModel::uploadBakedTexture(unsigned int textureId, const std::shared_ptr<BakedTexture> &baked)
+{
+    // every level comes from the cache, the driver neither compresses nor builds mips
+    // a streamed texture starts at its first loaded mip, the streamer lowers the base level as larger ones arrive
+    const GLenum internalFormat = OpenGLTextureStreamer::internalFormat(baked->m_format);
+    const int firstLevel = baked->firstLoadedLevel();
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, firstLevel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, baked->mipCount() - 1);
+    for (int level = firstLevel; level < baked->mipCount(); ++level)
+    {
+        const BakedTexture::Mip &mip = baked->m_mips[level];
+        OpenGLUploadRing::instance()->uploadTexture(textureId, level, internalFormat, mip.m_width, mip.m_height, mip.m_data.size(),
+                                                    OpenGLUploadRing::copyFrom(mip.m_data.constData(), baked), m_uploads);
+    }
+}
+
+void OpenGLModel::uploadTextures()
+{
+    // the cached meshes are only read, the decoded images stay with them for the next model that uploads the textures
+    m_textureIds.assign(m_modelMeshsPtr->size(), std::vector<unsigned int>());
+    for (int i = 0; i < m_modelMeshsPtr->size(); ++i)
+    {
+        for (const auto &texture : (*m_modelMeshsPtr)[i].m_textures)
+        {
+            unsigned int textureID = 0;
+            if (!texture.m_data && !texture.m_baked)
+            {
+                spdlog::error("image data is null.");
+                m_textureIds[i].emplace_back(textureID);
+                continue;
+            }
+
+            glGenTextures(1, &textureID);
+            glBindTexture(GL_TEXTURE_2D, textureID);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            if (texture.m_baked)
+            {
+                uploadBakedTexture(textureID, texture.m_baked);
+            }
+            else
+            {
+                // images the driver has to build mips for are uploaded right away, glGenerateMipmap needs their data
+                GLenum format = GL_RGBA;
+                if (texture.m_channel == 1)
+                    format = GL_RED;
+                else if (texture.m_channel == 3)
+                    format = GL_RGB;
+                else if (texture.m_channel == 4)
+                    format = GL_RGBA;
+
+                glTexImage2D(GL_TEXTURE_2D, 0, format, texture.m_width, texture.m_height, 0, format, GL_UNSIGNED_BYTE, texture.m_data.get());
+                glGenerateMipmap(GL_TEXTURE_2D);
+            }
+
+            m_textureIds[i].emplace_back(textureID);
+            if (!texture.m_bakedPath.isEmpty())
+                OpenGLTextureStreamer::instance()->addTexture(textureID, texture.m_bakedPath, texture.m_baked);
+        }
+    }
+}
+
+void OpenGLModel::initializeMesh()
+{
+    if (!m_modelMeshsPtr)
+        return;
+
+    // every model with meshes is counted, the textures of its path live as long as one of them
+    // contexts share their textures, a model of the path shown by an earlier window already uploaded them
+    if (!OpenGLTextureRegistry::instance()->retain(m_modelPath, m_textureIds))
+    {
+        uploadTextures();
+        OpenGLTextureRegistry::instance()->add(m_modelPath, m_textureIds);
+    }
+
+    initializeMeshBounds();
+
+    // the instance buffers start from the pose of the import, updateTransforms uploads the nodes that move later
+    ModelLoadManager::instance()->getSceneGraph(m_modelPath, m_sceneGraph);
+    if (ModelLoadManager::instance()->getAnimation(m_modelPath, m_animation))
+        initializeBones();
+
+    for (const auto &modelMesh : *m_modelMeshsPtr)
+        m_gpuBytes += modelMesh.vertexBytes(modelMesh.vertexCount()) + modelMesh.m_indices.size() * sizeof(unsigned int);
+    ModelLoadManager::instance()->addGpuBytes(m_gpuBytes);
+
+    // draw every mesh with one indirect multi draw per texture set if the context supports it
+    // skinned meshes leave the bounds the culling pass tests, they are drawn one by one
+    if (!m_boneBuffer)
+    {
+        m_gpuCulling.reset(new OpenGLGpuCulling);
+        if (m_gpuCulling->initialize(m_modelMeshsPtr, m_textureIds, m_uploads))
+            return;
+        m_gpuCulling.reset();
+    }
+
+    m_meshBuffers.resize(m_modelMeshsPtr->size());
+    for (int i = 0; i < m_modelMeshsPtr->size(); ++i)
+    {
+        const auto &modelMesh = (*m_modelMeshsPtr)[i];
+        auto &meshBuffers = m_meshBuffers[i];
+        glGenVertexArrays(1, &meshBuffers.m_VAO);
+        glGenBuffers(1, &meshBuffers.m_VBO);
+        glGenBuffers(1, &meshBuffers.m_EBO);
+        meshBuffers.m_indexCount = (int)modelMesh.m_indices.size();
+
+        glBindVertexArray(meshBuffers.m_VAO);
+        // the storage is allocated here, worker threads fill it through the upload ring
+        const qint64 vertexCount = modelMesh.vertexCount();
+        const qint64 vertexBytes = modelMesh.vertexBytes(vertexCount);
+        const qint64 indexBytes = modelMesh.m_indices.size() * sizeof(unsigned int);
+        glBindBuffer(GL_ARRAY_BUFFER, meshBuffers.m_VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshBuffers.m_EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr, GL_STATIC_DRAW);
+        if (modelMesh.m_streams.empty())
+        {
+            OpenGLUploadRing::instance()->uploadBuffer(meshBuffers.m_VBO, 0, vertexBytes, OpenGLUploadRing::copyFrom(modelMesh.m_vertices.data(), m_modelMeshsPtr), m_uploads);
+        }
+        else
+        {
+            for (int stream = 0; stream < VertexStreams::StreamCount; ++stream)
+            {
+                const VertexStreams::Attribute attribute = modelMesh.vertexAttribute((VertexStreams::Stream)stream, vertexCount);
+                if (attribute.m_components)
+                    OpenGLUploadRing::instance()->uploadBuffer(meshBuffers.m_VBO, attribute.m_offset, attribute.m_stride * vertexCount,
+                                                               OpenGLUploadRing::copyFrom(modelMesh.m_streams.data((VertexStreams::Stream)stream), m_modelMeshsPtr), m_uploads);
+            }
+        }
+        OpenGLUploadRing::instance()->uploadBuffer(meshBuffers.m_EBO, 0, indexBytes, OpenGLUploadRing::copyFrom(modelMesh.m_indices.data(), m_modelMeshsPtr), m_uploads);
+
+        // positions, normals, texture coords, tangents, bitangents, bone ids and weights, interleaved or one stream each
+        for (int location = 0; location < VertexStreams::StreamCount; ++location)
+        {
+            const VertexStreams::Attribute attribute = modelMesh.vertexAttribute((VertexStreams::Stream)location, vertexCount);
+            if (!attribute.m_components)
+                continue;
+            if (attribute.m_integer)
+                glVertexAttribIPointer(location, attribute.m_components, GL_INT, attribute.m_stride, (void *)attribute.m_offset);
+            else
+                glVertexAttribPointer(location, attribute.m_components, GL_FLOAT, GL_FALSE, attribute.m_stride, (void *)attribute.m_offset);
+            glEnableVertexAttribArray(location);
+        }
+
+        // instance transforms, one column per location
+        glGenBuffers(1, &meshBuffers.m_instanceVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, meshBuffers.m_instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, modelMesh.m_instances.size() * sizeof(float), modelMesh.m_instances.data(), GL_DYNAMIC_DRAW);
+        for (int column = 0; column < 4; ++column)
+        {
+            glVertexAttribPointer(7 + column, 4, GL_FLOAT, GL_FALSE, INSTANCE_FLOAT_COUNT * sizeof(float), (void *)(column * 4 * sizeof(float)));
+            glEnableVertexAttribArray(7 + column);
+            glVertexAttribDivisor(7 + column, 1);
+        }
+
+        glBindVertexArray(0);
+    }
+}
+
+void OpenGLModel::releaseGeometry()
+{
+    if (!m_modelMeshsPtr || ModelLoadManager::instance()->residency(m_modelPath) == ModelLoadManager::ResidencyOptions::KeepCpu)
+        return;
+
+    // the upload ring holds the meshes until their copies are issued, the draws only need the textures and the instances
+    std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> drawMeshsPtr = std::make_shared<QVector<ModelLoadManager::ModelMesh>>(m_modelMeshsPtr->size());
+    for (int i = 0; i < m_modelMeshsPtr->size(); ++i)
+    {
+        const auto &modelMesh = (*m_modelMeshsPtr)[i];
+        auto &drawMesh = (*drawMeshsPtr)[i];
+        drawMesh.m_textures = modelMesh.m_textures;
+        for (auto &texture : drawMesh.m_textures)
+            texture.m_data.reset();
+        drawMesh.m_instances = modelMesh.m_instances;
+        drawMesh.m_instanceNodes = modelMesh.m_instanceNodes;
+        drawMesh.m_skinned = modelMesh.m_skinned;
+    }
+    m_modelMeshsPtr = drawMeshsPtr;
+    ModelLoadManager::instance()->releaseGeometry(m_modelPath);
+}
+
+void OpenGLModel::initializeMeshBounds()
+{
+    bool streamed = false;
+    for (const auto &modelMesh : *m_modelMeshsPtr)
+    {
+        for (const auto &texture : modelMesh.m_textures)
+            streamed = streamed || !texture.m_bakedPath.isEmpty();
+    }
+    if (!streamed)
+        return;
+
+    // the corners of the mesh bounds are placed by every instance
+    m_meshBounds.resize(m_modelMeshsPtr->size());
+    for (int i = 0; i < m_modelMeshsPtr->size(); ++i)
+    {
+        const auto &modelMesh = (*m_modelMeshsPtr)[i];
+        MeshBounds &meshBounds = m_meshBounds[i];
+        float min[3], max[3];
+        VertexStreams::bounds(modelMesh.positions(), modelMesh.vertexCount(), min, max);
+        const QVector3D bmin(min[0], min[1], min[2]), bmax(max[0], max[1], max[2]);
+        QVector3D worldMin(FLT_MAX, FLT_MAX, FLT_MAX), worldMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (int instance = 0; instance < modelMesh.instanceCount() && modelMesh.vertexCount(); ++instance)
+        {
+            QMatrix4x4 matrix = modelMesh.instanceMatrix(instance);
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                QVector3D position = matrix.map(QVector3D(corner & 1 ? bmax.x() : bmin.x(), corner & 2 ? bmax.y() : bmin.y(), corner & 4 ? bmax.z() : bmin.z()));
+                worldMin = QVector3D(qMin(worldMin.x(), position.x()), qMin(worldMin.y(), position.y()), qMin(worldMin.z(), position.z()));
+                worldMax = QVector3D(qMax(worldMax.x(), position.x()), qMax(worldMax.y(), position.y()), qMax(worldMax.z(), position.z()));
+            }
+        }
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            meshBounds.m_min[axis] = worldMin[axis];
+            meshBounds.m_max[axis] = worldMax[axis];
+        }
+    }
+}
+
+void OpenGLModel::requestTextures(const QMatrix4x4 &mvp, const QRect &viewport)
+{
+    if (m_meshBounds.empty())
+        return;
+
+    // the pixels a visible mesh covers choose the mips of its textures, a camera inside the bounds needs the largest one
+    Frustum frustum(mvp);
+    OpenGLTextureStreamer *streamer = OpenGLTextureStreamer::instance();
+    for (int i = 0; i < (int)m_meshBounds.size(); ++i)
+    {
+        const MeshBounds &meshBounds = m_meshBounds[i];
+        const auto &textures = (*m_modelMeshsPtr)[i].m_textures;
+        if (textures.empty() || meshBounds.m_min[0] > meshBounds.m_max[0] || !frustum.intersects(meshBounds.m_min, meshBounds.m_max))
+            continue;
+
+        float screenSize = (float)qMax(viewport.width(), viewport.height());
+        QVector2D ndcMin(FLT_MAX, FLT_MAX), ndcMax(-FLT_MAX, -FLT_MAX);
+        bool behind = false;
+        for (int corner = 0; corner < 8 && !behind; ++corner)
+        {
+            QVector4D clip = mvp * QVector4D(corner & 1 ? meshBounds.m_max[0] : meshBounds.m_min[0], corner & 2 ? meshBounds.m_max[1] : meshBounds.m_min[1],
+                                             corner & 4 ? meshBounds.m_max[2] : meshBounds.m_min[2], 1.0f);
+            behind = clip.w() <= 0.0f;
+            QVector2D ndc(clip.x() / clip.w(), clip.y() / clip.w());
+            ndcMin = QVector2D(qMin(ndcMin.x(), ndc.x()), qMin(ndcMin.y(), ndc.y()));
+            ndcMax = QVector2D(qMax(ndcMax.x(), ndc.x()), qMax(ndcMax.y(), ndc.y()));
+        }
+        if (!behind)
+            screenSize = qMax((ndcMax.x() - ndcMin.x()) * 0.5f * viewport.width(), (ndcMax.y() - ndcMin.y()) * 0.5f * viewport.height());
+
+        for (unsigned int textureId : m_textureIds[i])
+            streamer->request(textureId, screenSize);
+    }
+}
+
+void OpenGLModel::initializeBones()
+{
+    if (!m_animation->boneCount())
+        return;
+
+    m_bonePalette.resize(m_animation->boneCount() * SCENE_MATRIX_FLOAT_COUNT);
+    SkeletalAnimation::computePalette(*m_animation, m_sceneGraph, m_bonePalette.data());
+    glGenBuffers(1, &m_boneBuffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_boneBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, m_bonePalette.size() * sizeof(float), m_bonePalette.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenTextures(1, &m_boneTexture);
+    glBindTexture(GL_TEXTURE_BUFFER, m_boneTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_boneBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void OpenGLModel::advanceAnimation(double seconds)
+{
+    m_clipSeconds += seconds;
+    if (m_initialized && m_modelMeshsPtr)
+        updateTransforms();
+}
+
+void OpenGLModel::updateTransforms()
+{
+    if (hasClips())
+        SkeletalAnimation::sample(m_animation->m_clips.front(), m_clipSeconds, m_sceneGraph);
+
+    // only the subtrees of nodes whose local matrix changed are recomputed
+    if (!m_sceneGraph.update())
+        return;
+
+    if (m_boneBuffer)
+    {
+        SkeletalAnimation::computePalette(*m_animation, m_sceneGraph, m_bonePalette.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, m_boneBuffer);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, m_bonePalette.size() * sizeof(float), m_bonePalette.data());
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    if (m_gpuCulling)
+    {
+        m_gpuCulling->updateTransforms(m_sceneGraph);
+        return;
+    }
+
+    for (int i = 0; i < (int)m_meshBuffers.size(); ++i)
+    {
+        const auto &modelMesh = (*m_modelMeshsPtr)[i];
+        m_transforms.resize(modelMesh.m_instanceNodes.size() * INSTANCE_FLOAT_COUNT);
+        m_sceneGraph.gatherWorlds(modelMesh.m_instanceNodes, m_transforms.data());
+        glBindBuffer(GL_ARRAY_BUFFER, m_meshBuffers[i].m_instanceVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, m_transforms.size() * sizeof(float), m_transforms.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+bool OpenGLModel::paint(unsigned int programId, const QMatrix4x4 &mvp, const QVector3D &eye, unsigned int framebuffer, const QRect &viewport, bool useDepthPyramid)
+{
+    if (!m_initialized)
+        return true;
+    if (m_pageFilePtr)
+        return paintPages(programId, mvp, eye);
+    if (!m_modelMeshsPtr)
+        return true;
+    // the model shows up once every copy of its attach is issued, they come before the draws in the command stream
+    if (m_uploads->m_pending)
+        return false;
+
+    glUniform1i(glGetUniformLocation(programId, "skinned"), GL_FALSE);
+    requestTextures(mvp, viewport);
+    if (m_gpuCulling)
+        return paintMeshIndirect(programId, mvp, framebuffer, viewport, useDepthPyramid);
+
+    paintMesh(programId);
+    return true;
+}
+
+void OpenGLModel::paintMesh(unsigned int programId)
+{
+    if (m_boneTexture)
+    {
+        glActiveTexture(GL_TEXTURE0 + BONE_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, m_boneTexture);
+    }
+
+    for (int i = 0; i < (int)m_meshBuffers.size(); ++i)
+    {
+        const auto &modelMesh = (*m_modelMeshsPtr)[i];
+
+        // bind appropriate textures
+        bindTextures(programId, modelMesh.m_textures, m_textureIds[i]);
+        glUniform1i(glGetUniformLocation(programId, "skinned"), modelMesh.m_skinned && m_boneTexture);
+
+        // draw mesh
+        glBindVertexArray(m_meshBuffers[i].m_VAO);
+        glDrawElementsInstanced(GL_TRIANGLES, m_meshBuffers[i].m_indexCount, GL_UNSIGNED_INT, 0, modelMesh.instanceCount());
+        glBindVertexArray(0);
+
+        // set everything back to defaults once configured.
+        glActiveTexture(GL_TEXTURE0);
+    }
+}
+
+bool OpenGLModel::paintMeshIndirect(unsigned int programId, const QMatrix4x4 &mvp, unsigned int framebuffer, const QRect &viewport, bool useDepthPyramid)
+{
+    // the compute pass fills the instance counts of the indirect commands
+    if (!useDepthPyramid)
+        m_gpuCulling->invalidateDepthPyramid();
+    bool converged = m_gpuCulling->cull(mvp);
+    glUseProgram(programId);
+
+    m_gpuCulling->bindGeometry();
+    for (const auto &group : m_gpuCulling->drawGroups())
+    {
+        bindTextures(programId, (*m_modelMeshsPtr)[group.m_meshIndex].m_textures, m_textureIds[group.m_meshIndex]);
+        m_gpuCulling->draw(group);
+        glActiveTexture(GL_TEXTURE0);
+    }
+    m_gpuCulling->unbindGeometry();
+
+    // the depth of this frame culls the next one
+    if (useDepthPyramid)
+    {
+        m_gpuCulling->buildDepthPyramid(framebuffer, viewport.x(), viewport.y(), viewport.width(), viewport.height(), mvp);
+        glUseProgram(programId);
+    }
+
+    // meshes hidden by the pyramid of the previous camera may be visible now, draw again with an up to date pyramid
+    return converged;
+}
+
+void OpenGLModel::bindTextures(unsigned int programId, const std::vector<ModelLoadManager::Texture> &textures, const std::vector<unsigned int> &textureIds)
+{
+    unsigned int diffuseNr = 1;
+    unsigned int specularNr = 1;
+    unsigned int normalNr = 1;
+    unsigned int heightNr = 1;
+    for (unsigned int i = 0; i < textures.size(); i++)
+    {
+        unsigned int number = 1;
+        glActiveTexture(GL_TEXTURE0 + i);
+        if ("texture_diffuse" == textures[i].m_type)
+            number = diffuseNr++;
+        else if ("texture_specular" == textures[i].m_type)
+            number = specularNr++;
+        else if ("texture_normal" == textures[i].m_type)
+            number = normalNr++;
+        else if ("texture_height" == textures[i].m_type)
+            number = heightNr++;
+
+        // set the sampler to the correct texture unit
+        glUniform1i(glGetUniformLocation(programId, (textures[i].m_type + std::to_string(number)).c_str()), i);
+
+        // bind the texture
+        glBindTexture(GL_TEXTURE_2D, i < textureIds.size() ? textureIds[i] : 0);
+    }
+}
+
+bool OpenGLModel::paintPages(unsigned int programId, const QMatrix4x4 &mvp, const QVector3D &eye)
+{
+    if (!m_pageResidency)
+        return true;
+
+    // visible pages, nearest first
+    Frustum frustum(mvp);
+    std::vector<std::pair<float, int>> visibleDepths;
+    for (int i = 0; i < m_pageFilePtr->pageCount(); ++i)
+    {
+        const ModelPageFile::PageEntry &page = m_pageFilePtr->page(i);
+        if (!frustum.intersects(page.m_min, page.m_max))
+            continue;
+        QVector3D center = (QVector3D(page.m_min[0], page.m_min[1], page.m_min[2]) + QVector3D(page.m_max[0], page.m_max[1], page.m_max[2])) * 0.5f;
+        visibleDepths.emplace_back((mvp * QVector4D(center, 1.0f)).w(), i);
+    }
+    std::sort(visibleDepths.begin(), visibleDepths.end());
+
+    std::vector<int> visiblePages, loadPages, releasePages;
+    visiblePages.reserve(visibleDepths.size());
+    for (const auto &visibleDepth : visibleDepths)
+        visiblePages.emplace_back(visibleDepth.second);
+    m_pageResidency->update(visiblePages, *m_pageFilePtr, loadPages, releasePages);
+    for (int page : releasePages)
+        releasePage(page);
+    for (int page : loadPages)
+        uploadPage(page);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_whiteTexture);
+    glUniform1i(glGetUniformLocation(programId, "texture_diffuse1"), 0);
+    glUniform1i(glGetUniformLocation(programId, "skinned"), GL_FALSE);
+    // pages are not instanced, the instance transform is the identity
+    for (int column = 0; column < 4; ++column)
+        glVertexAttrib4f(7 + column, column == 0, column == 1, column == 2, column == 3);
+    // back facing clusters are skipped by their normal cone, so the remaining triangles are culled the same way
+    glEnable(GL_CULL_FACE);
+    for (int page : visiblePages)
+    {
+        auto it = m_glPages.find(page);
+        if (it == m_glPages.end())
+            continue;
+        glBindVertexArray(it->second.m_VAO);
+
+        // adjacent visible clusters are merged into one draw
+        const ModelPageFile::PageEntry &pageEntry = m_pageFilePtr->page(page);
+        GLint runFirst = 0;
+        GLsizei runCount = 0;
+        for (quint32 i = 0; i < pageEntry.m_clusterCount; ++i)
+        {
+            const ModelPageFile::ClusterEntry &cluster = m_pageFilePtr->cluster(pageEntry.m_firstCluster + i);
+            if (!ClusterOctree::isClusterVisible(cluster, frustum, eye))
+                continue;
+            if (runCount && (GLint)cluster.m_firstVertex == runFirst + runCount)
+            {
+                runCount += cluster.m_vertexCount;
+                continue;
+            }
+            if (runCount)
+                glDrawArrays(GL_TRIANGLES, runFirst, runCount);
+            runFirst = cluster.m_firstVertex;
+            runCount = cluster.m_vertexCount;
+        }
+        if (runCount)
+            glDrawArrays(GL_TRIANGLES, runFirst, runCount);
+    }
+    glBindVertexArray(0);
+    glDisable(GL_CULL_FACE);
+
+    // keep paging in until the visible set is resident
+    return !m_pageResidency->hasPending() && m_loadingPages.empty();
+}
+
+void OpenGLModel::uploadPage(int page)
+{
+    // workers of the upload ring read and decode the page straight into the ring, it is drawn once its copies are issued
+    const qint64 byteCount = m_pageFilePtr->pageByteCount(page);
+    GLPage glPage;
+    glPage.m_vertexCount = byteCount / PAGE_VERTEX_BYTE_COUNT;
+    glPage.m_uploads = std::make_shared<OpenGLUploadRing::Batch>();
+    glGenVertexArrays(1, &glPage.m_VAO);
+    glGenBuffers(1, &glPage.m_VBO);
+    glBindVertexArray(glPage.m_VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, glPage.m_VBO);
+    glBufferData(GL_ARRAY_BUFFER, byteCount, nullptr, GL_STATIC_DRAW);
+
+    // x, y, z, u, v, nx, ny, nz
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, PAGE_VERTEX_BYTE_COUNT, (void *)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, PAGE_VERTEX_BYTE_COUNT, (void *)(5 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, PAGE_VERTEX_BYTE_COUNT, (void *)(3 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+
+    m_loadingPages[page] = glPage;
+    std::shared_ptr<const ModelPageFile> pageFilePtr = m_pageFilePtr;
+    OpenGLUploadRing::instance()->uploadBuffer(
+        glPage.m_VBO, 0, byteCount,
+        [pageFilePtr, page](char *dst, qint64 offset, qint64 bytes)
+        { return pageFilePtr->loadPage(page, offset, bytes, dst); },
+        glPage.m_uploads, [this, page](bool ok)
+        { finishPage(page, ok); });
+}
+
+void OpenGLModel::finishPage(int page, bool ok)
+{
+    auto it = m_loadingPages.find(page);
+    if (it == m_loadingPages.end())
+        return;
+
+    const GLPage glPage = it->second;
+    m_loadingPages.erase(it);
+    if (!ok)
+    {
+        glDeleteVertexArrays(1, &glPage.m_VAO);
+        glDeleteBuffers(1, &glPage.m_VBO);
+        return;
+    }
+    m_glPages[page] = glPage;
+}
+
+void OpenGLModel::releasePage(int page)
+{
+    std::unordered_map<int, GLPage> &pages = m_glPages.count(page) ? m_glPages : m_loadingPages;
+    auto it = pages.find(page);
+    if (it == pages.end())
+        return;
+    // a page still loading drops the copies not issued yet, the ones issued are ordered before the delete
+    it->second.m_uploads->m_cancelled = true;
+    glDeleteVertexArrays(1, &it->second.m_VAO);
+    glDeleteBuffers(1, &it->second.m_VBO);
+    pages.erase(it);
+}
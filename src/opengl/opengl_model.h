@@ -0,0 +1,99 @@
+﻿#ifndef __OPENGL_MODEL_H__
+#define __OPENGL_MODEL_H__
+
+#include "opengl_gpu_culling.h"
+#include "opengl_texture_registry.h"
+#include "opengl_texture_streamer.h"
+#include "utils/model_loader_manager.h"
+#include <QOpenGLExtraFunctions>
+#include <QMatrix4x4>
+#include <QRect>
+#include <unordered_map>
+
+#define BONE_TEXTURE_UNIT 15 // texture unit of the bone palette, shared by every model of the program
+
+// gpu resources of one model drawn by an OpenGLWindow, the viewports of a window showing the same model share one instance
+// the model is imported by the constructor, everything else needs the context of the window to be current, the destructor too
+class OpenGLModel : protected QOpenGLExtraFunctions
+{
+public:
+    explicit OpenGLModel(const QString &modelPath);
+    ~OpenGLModel();
+    void initialize(unsigned int whiteTexture);
+    const QString &modelPath() const { return m_modelPath; }
+    bool isEmpty() const { return (!m_modelMeshsPtr || m_modelMeshsPtr->isEmpty()) && !m_pageFilePtr; }
+    bool isPaged() const { return m_pageFilePtr != nullptr; }
+    bool hasClips() const { return m_animation && !m_animation->m_clips.empty(); }
+    // moves the clips and uploads the nodes that moved, called once per frame whatever the number of viewports
+    void advanceAnimation(double seconds);
+    // draws into the bound framebuffer with the light and camera uniforms already set on programId
+    // viewport is in framebuffer pixels, occlusion culling reads its depth back when useDepthPyramid is set
+    // returns false if the model needs another frame to finish, e.g. pages are still loading or its uploads are not issued yet
+    bool paint(unsigned int programId, const QMatrix4x4 &mvp, const QVector3D &eye, unsigned int framebuffer, const QRect &viewport, bool useDepthPyramid);
+
+private:
+    struct MeshBuffers
+    {
+        unsigned int m_VAO = 0;
+        unsigned int m_VBO = 0;
+        unsigned int m_EBO = 0;
+        unsigned int m_instanceVBO = 0;
+        int m_indexCount = 0;
+    };
+
+    // import pose bounds of a mesh with all its instances, sizes the mips its textures need on screen
+    struct MeshBounds
+    {
+        float m_min[3];
+        float m_max[3];
+    };
+
+    struct GLPage
+    {
+        unsigned int m_VAO = 0;
+        unsigned int m_VBO = 0;
+        int m_vertexCount = 0;
+        std::shared_ptr<OpenGLUploadRing::Batch> m_uploads; // cancelled if the page is released while it loads
+    };
+
+    void initializeMesh();
+    void releaseGeometry();
+    void uploadTextures();
+    void uploadBakedTexture(unsigned int textureId, const std::shared_ptr<BakedTexture> &baked);
+    void initializeMeshBounds();
+    void requestTextures(const QMatrix4x4 &mvp, const QRect &viewport);
+    void initializeBones();
+    void updateTransforms();
+    void paintMesh(unsigned int programId);
+    bool paintMeshIndirect(unsigned int programId, const QMatrix4x4 &mvp, unsigned int framebuffer, const QRect &viewport, bool useDepthPyramid);
+    void bindTextures(unsigned int programId, const std::vector<ModelLoadManager::Texture> &textures, const std::vector<unsigned int> &textureIds);
+    bool paintPages(unsigned int programId, const QMatrix4x4 &mvp, const QVector3D &eye);
+    void uploadPage(int page);
+    void finishPage(int page, bool ok);
+    void releasePage(int page);
+
+private:
+    QString m_modelPath;
+    bool m_initialized = false;
+    std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> m_modelMeshsPtr; // without vertices and indices once uploaded, unless the model keeps them
+    OpenGLTextureRegistry::TextureIds m_textureIds; // gl names of the textures of every mesh, shared with the other models of the path
+    qint64 m_gpuBytes = 0; // vertex and index buffers, counted by ModelLoadManager::residencyStats
+    std::vector<MeshBuffers> m_meshBuffers;
+    std::shared_ptr<OpenGLUploadRing::Batch> m_uploads; // vertices, indices and textures on their way through the upload ring
+    std::vector<MeshBounds> m_meshBounds; // only filled if a texture of the model is streamed
+    std::unique_ptr<OpenGLGpuCulling> m_gpuCulling;
+    SceneGraph m_sceneGraph;
+    std::vector<float> m_transforms;
+    std::shared_ptr<const ModelAnimation> m_animation;
+    std::vector<float> m_bonePalette;
+    unsigned int m_boneBuffer = 0;  // bone matrices read by the vertex shader through m_boneTexture
+    unsigned int m_boneTexture = 0;
+    double m_clipSeconds = 0.0;
+    std::shared_ptr<ModelPageFile> m_pageFilePtr;
+    std::unique_ptr<ModelPageResidency> m_pageResidency;
+    std::unordered_map<int, GLPage> m_glPages;
+    std::unordered_map<int, GLPage> m_loadingPages; // pages the upload ring is still reading and decoding
+    unsigned int m_whiteTexture = 0;
+};
+
+#endif
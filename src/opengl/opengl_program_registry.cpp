@@ -0,0 +1,201 @@
+﻿#include "opengl_program_registry.h"
+#include "utils/model_disk_cache.h"
+#include "spdlog/spdlog.h"
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <cstring>
+
+OpenGLProgramRegistry *OpenGLProgramRegistry::instance()
+{
+    static OpenGLProgramRegistry sRegistry;
+    return &sRegistry;
+}
+
+unsigned int OpenGLProgramRegistry::program(const QString &vertPath, const QString &fragPath)
+{
+    std::vector<ShaderSource> sources(2);
+    sources[0].m_type = GL_VERTEX_SHADER;
+    sources[0].m_path = vertPath;
+    sources[1].m_type = GL_FRAGMENT_SHADER;
+    sources[1].m_path = fragPath;
+    return findOrBuild(sources);
+}
+
+unsigned int OpenGLProgramRegistry::computeProgram(const QString &path)
+{
+    std::vector<ShaderSource> sources(1);
+    sources[0].m_type = GL_COMPUTE_SHADER;
+    sources[0].m_path = path;
+    return findOrBuild(sources);
+}
+
+unsigned int OpenGLProgramRegistry::findOrBuild(const std::vector<ShaderSource> &sources)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context)
+    {
+        spdlog::error("no current context, program is not built.");
+        return 0;
+    }
+    initializeOpenGLFunctions();
+
+    QString name;
+    for (const auto &source : sources)
+        name += source.m_path + ';';
+    QOpenGLContextGroup *group = context->shareGroup();
+    auto it = m_programs.find(std::make_pair(group, name));
+    if (it != m_programs.end())
+        return it->second;
+
+    // the programs of a group are gone with its last context
+    auto sameGroup = [group](const std::pair<const std::pair<QOpenGLContextGroup *, QString>, unsigned int> &entry)
+    { return entry.first.first == group; };
+    if (std::none_of(m_programs.begin(), m_programs.end(), sameGroup))
+    {
+        QObject::connect(group, &QObject::destroyed, [this, group]()
+                         {
+                             for (auto entry = m_programs.begin(); entry != m_programs.end();)
+                                 entry = entry->first.first == group ? m_programs.erase(entry) : std::next(entry); });
+    }
+
+    unsigned int program = build(sources);
+    if (program)
+        m_programs[std::make_pair(group, name)] = program;
+    return program;
+}
+
+unsigned int OpenGLProgramRegistry::build(std::vector<ShaderSource> sources)
+{
+    for (auto &source : sources)
+    {
+        QFile file(source.m_path);
+        if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        {
+            spdlog::error("open shader file failed. path: {}", source.m_path.toStdString());
+            return 0;
+        }
+        source.m_code = file.readAll();
+    }
+
+    const QString path = binaryPath(sources);
+    if (!path.isEmpty())
+    {
+        unsigned int program = glCreateProgram();
+        if (loadBinary(program, path))
+            return program;
+        glDeleteProgram(program);
+    }
+
+    unsigned int program = compileProgram(sources);
+    if (program && !path.isEmpty())
+        saveBinary(program, path);
+    return program;
+}
+
+unsigned int OpenGLProgramRegistry::compileProgram(const std::vector<ShaderSource> &sources)
+{
+    GLint success = 0;
+    unsigned int program = glCreateProgram();
+    std::vector<unsigned int> shaders;
+    for (const auto &source : sources)
+    {
+        // QByteArray 必须存在，不能是临时的
+        const char *shaderCode = source.m_code.constData();
+        unsigned int shader = glCreateShader(source.m_type);
+        shaders.emplace_back(shader);
+        glShaderSource(shader, 1, &shaderCode, NULL);
+        glCompileShader(shader);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success)
+        {
+            char log[1024];
+            glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+            spdlog::error("compile shader failed. path: {0}, log: {1}", source.m_path.toStdString(), log);
+            break;
+        }
+        glAttachShader(program, shader);
+    }
+
+    if (success)
+    {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+            spdlog::error("link program failed. path: {}", sources.front().m_path.toStdString());
+    }
+
+    // delete the shaders as they're linked into our program now and no longer necessary
+    for (unsigned int shader : shaders)
+        glDeleteShader(shader);
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+QString OpenGLProgramRegistry::binaryPath(const std::vector<ShaderSource> &sources)
+{
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    if (formatCount <= 0)
+        return QString();
+
+    // a binary is only valid for the driver that produced it
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray(reinterpret_cast<const char *>(glGetString(GL_VENDOR))));
+    hash.addData(QByteArray(reinterpret_cast<const char *>(glGetString(GL_RENDERER))));
+    hash.addData(QByteArray(reinterpret_cast<const char *>(glGetString(GL_VERSION))));
+    for (const auto &source : sources)
+        hash.addData(source.m_code);
+
+    const QString dir = ModelDiskCache::cacheDir() + "/shader_cache";
+    if (!QDir().mkpath(dir))
+        return QString();
+    return QString("%1/%2.bin").arg(dir, QString::fromLatin1(hash.result().toHex()));
+}
+
+bool OpenGLProgramRegistry::loadBinary(unsigned int program, const QString &path)
+{
+    // GLenum format followed by the binary of glGetProgramBinary
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    const QByteArray data = file.readAll();
+    if (data.size() <= (qsizetype)sizeof(GLenum))
+        return false;
+
+    GLenum format = 0;
+    memcpy(&format, data.constData(), sizeof(format));
+    glProgramBinary(program, format, data.constData() + sizeof(format), (GLsizei)(data.size() - sizeof(format)));
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        spdlog::info("program binary is rejected by the driver, compiling again. path: {}", path.toStdString());
+        return false;
+    }
+    return true;
+}
+
+void OpenGLProgramRegistry::saveBinary(unsigned int program, const QString &path)
+{
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    QByteArray data(sizeof(GLenum) + length, Qt::Uninitialized);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, data.data() + sizeof(GLenum));
+    memcpy(data.data(), &format, sizeof(format));
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+        spdlog::warn("save program binary failed. path: {}", path.toStdString());
+}
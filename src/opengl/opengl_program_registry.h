@@ -0,0 +1,43 @@
+﻿#ifndef __OPENGL_PROGRAM_REGISTRY_H__
+#define __OPENGL_PROGRAM_REGISTRY_H__
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLContext>
+#include <QString>
+#include <QByteArray>
+#include <map>
+#include <vector>
+
+// shader programs shared by every OpenGL window of the process
+// a program is compiled once per share group (Qt::AA_ShareOpenGLContexts puts all windows in one group),
+// and its linked binary is kept on disk so that later runs load it with glProgramBinary instead of compiling
+class OpenGLProgramRegistry : protected QOpenGLExtraFunctions
+{
+public:
+    static OpenGLProgramRegistry *instance();
+    // the context must be current, returns 0 if the program failed to build
+    // programs belong to the registry and live as long as their share group
+    unsigned int program(const QString &vertPath, const QString &fragPath);
+    unsigned int computeProgram(const QString &path);
+
+private:
+    struct ShaderSource
+    {
+        GLenum m_type = 0;
+        QString m_path;
+        QByteArray m_code;
+    };
+
+    OpenGLProgramRegistry() = default;
+    unsigned int findOrBuild(const std::vector<ShaderSource> &sources);
+    unsigned int build(std::vector<ShaderSource> sources);
+    unsigned int compileProgram(const std::vector<ShaderSource> &sources);
+    QString binaryPath(const std::vector<ShaderSource> &sources);
+    bool loadBinary(unsigned int program, const QString &path);
+    void saveBinary(unsigned int program, const QString &path);
+
+private:
+    std::map<std::pair<QOpenGLContextGroup *, QString>, unsigned int> m_programs;
+};
+
+#endif
@@ -0,0 +1,51 @@
+﻿#include "opengl_texture_registry.h"
+#include "opengl_texture_streamer.h"
+
+OpenGLTextureRegistry *OpenGLTextureRegistry::instance()
+{
+    static OpenGLTextureRegistry sRegistry;
+    return &sRegistry;
+}
+
+bool OpenGLTextureRegistry::retain(const QString &modelPath, TextureIds &textureIds)
+{
+    auto it = m_models.find(modelPath);
+    if (it == m_models.end())
+        return false;
+    ++it->second.m_users;
+    textureIds = it->second.m_textureIds;
+    return true;
+}
+
+void OpenGLTextureRegistry::add(const QString &modelPath, const TextureIds &textureIds)
+{
+    ModelTextures &modelTextures = m_models[modelPath];
+    ++modelTextures.m_users;
+    modelTextures.m_textureIds = textureIds;
+}
+
+void OpenGLTextureRegistry::release(const QString &modelPath)
+{
+    auto it = m_models.find(modelPath);
+    if (it == m_models.end() || --it->second.m_users > 0)
+        return;
+
+    std::vector<unsigned int> textureIds;
+    for (const auto &meshTextureIds : it->second.m_textureIds)
+    {
+        for (unsigned int textureId : meshTextureIds)
+        {
+            if (textureId)
+                textureIds.emplace_back(textureId);
+        }
+    }
+    m_models.erase(it);
+    if (textureIds.empty())
+        return;
+
+    // the streamer cancels the mips still on their way before the names are deleted
+    initializeOpenGLFunctions();
+    for (unsigned int textureId : textureIds)
+        OpenGLTextureStreamer::instance()->removeTexture(textureId);
+    glDeleteTextures((GLsizei)textureIds.size(), textureIds.data());
+}
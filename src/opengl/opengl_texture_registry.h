@@ -0,0 +1,39 @@
+﻿#ifndef __OPENGL_TEXTURE_REGISTRY_H__
+#define __OPENGL_TEXTURE_REGISTRY_H__
+
+#include <QOpenGLExtraFunctions>
+#include <QString>
+#include <map>
+#include <vector>
+
+// gl textures of the imported models, by model path, mesh index and index in ModelMesh::m_textures
+// the OpenGLModels showing a path share its names, the first uploads them and the last deletes them
+// the loader caches never hold gl names, a model shown again after that uploads its textures again
+// like the other registries it assumes one share group (Qt::AA_ShareOpenGLContexts), one of its contexts must be current
+class OpenGLTextureRegistry : protected QOpenGLExtraFunctions
+{
+public:
+    // one name per texture of every mesh, 0 for a texture that could not be uploaded
+    using TextureIds = std::vector<std::vector<unsigned int>>;
+
+    static OpenGLTextureRegistry *instance();
+    // a model of modelPath uses the textures another model of the path added, false if there is none
+    bool retain(const QString &modelPath, TextureIds &textureIds);
+    // the first model of modelPath hands in the textures it uploaded
+    void add(const QString &modelPath, const TextureIds &textureIds);
+    void release(const QString &modelPath);
+
+private:
+    struct ModelTextures
+    {
+        int m_users = 0;
+        TextureIds m_textureIds;
+    };
+
+    OpenGLTextureRegistry() = default;
+
+private:
+    std::map<QString, ModelTextures> m_models;
+};
+
+#endif
@@ -0,0 +1,219 @@
+﻿#include "opengl_texture_streamer.h"
+#include "opengl_upload_ring.h"
+#include "utils/model_loader_manager.h"
+#include "spdlog/spdlog.h"
+#include <algorithm>
+#include <cmath>
+
+OpenGLTextureStreamer *OpenGLTextureStreamer::instance()
+{
+    static OpenGLTextureStreamer sStreamer;
+    return &sStreamer;
+}
+
+GLenum OpenGLTextureStreamer::internalFormat(BakedTexture::Format format)
+{
+    switch (format)
+    {
+    case BakedTexture::BC1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case BakedTexture::BC3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case BakedTexture::BC5:
+        return GL_COMPRESSED_RG_RGTC2;
+    default:
+        return GL_RGBA8;
+    }
+}
+
+void OpenGLTextureStreamer::addTexture(unsigned int textureId, const QString &bakedPath, const std::shared_ptr<const BakedTexture> &baked)
+{
+    if (!textureId || !baked || m_textures.count(textureId))
+        return;
+
+    StreamedTexture texture;
+    texture.m_bakedPath = bakedPath;
+    texture.m_baked = baked;
+    texture.m_tailLevel = baked->firstLoadedLevel();
+    texture.m_residentLevel = texture.m_tailLevel;
+    texture.m_wantedLevel = texture.m_tailLevel;
+    texture.m_uploads = std::make_shared<OpenGLUploadRing::Batch>();
+    m_textures[textureId] = texture;
+    m_residentBytes += baked->byteCount(texture.m_tailLevel);
+}
+
+void OpenGLTextureStreamer::removeTexture(unsigned int textureId)
+{
+    auto it = m_textures.find(textureId);
+    if (it == m_textures.end())
+        return;
+
+    // a cancelled upload never calls finishLoad, its counts are taken back here
+    const StreamedTexture &texture = it->second;
+    if (texture.m_loading)
+    {
+        texture.m_uploads->m_cancelled = true;
+        --m_pendingLoads;
+        m_loadingBytes -= texture.m_baked->m_mips[texture.m_residentLevel - 1].m_byteCount;
+    }
+    m_residentBytes -= texture.m_baked->byteCount(texture.m_residentLevel);
+    m_textures.erase(it);
+}
+
+void OpenGLTextureStreamer::request(unsigned int textureId, float screenSize)
+{
+    auto it = m_textures.find(textureId);
+    if (it == m_textures.end())
+        return;
+
+    // the mip whose size matches the pixels the mesh covers, at most the tail
+    StreamedTexture &texture = it->second;
+    const int size = qMax(texture.m_baked->width(), texture.m_baked->height());
+    const int level = qBound(0, (int)std::floor(std::log2(size / qMax(screenSize, 1.0f))), texture.m_tailLevel);
+    if (texture.m_lastRequestFrame != m_frame)
+    {
+        texture.m_lastRequestFrame = m_frame;
+        texture.m_wantedLevel = level;
+        texture.m_priority = screenSize;
+        return;
+    }
+    texture.m_wantedLevel = qMin(texture.m_wantedLevel, level);
+    texture.m_priority = qMax(texture.m_priority, screenSize);
+}
+
+bool OpenGLTextureStreamer::update()
+{
+    if (m_textures.empty())
+        return false;
+
+    initializeOpenGLFunctions();
+    const bool uploaded = m_uploaded;
+    m_uploaded = false;
+    glActiveTexture(GL_TEXTURE0);
+    startLoads(ModelLoadManager::instance()->textureOptions().m_residencyBudget);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // off screen textures only need their tail
+    m_requestedBytes = 0;
+    for (const auto &entry : m_textures)
+    {
+        const StreamedTexture &texture = entry.second;
+        m_requestedBytes += texture.m_baked->byteCount(isVisible(texture) ? texture.m_wantedLevel : texture.m_tailLevel);
+    }
+    ++m_frame;
+    return uploaded;
+}
+
+void OpenGLTextureStreamer::startLoads(qint64 budgetBytes)
+{
+    // textures larger on screen first, every one grows by one mip at a time from the smallest to the largest
+    std::vector<std::pair<float, unsigned int>> candidates;
+    for (const auto &entry : m_textures)
+    {
+        const StreamedTexture &texture = entry.second;
+        if (isVisible(texture) && !texture.m_loading && !texture.m_failed && texture.m_residentLevel > texture.m_wantedLevel)
+            candidates.emplace_back(texture.m_priority, entry.first);
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, unsigned int> &a, const std::pair<float, unsigned int> &b)
+              { return a.first > b.first; });
+
+    m_waitingLoads = false;
+    for (const auto &candidate : candidates)
+    {
+        if (m_pendingLoads >= TEXTURE_MAX_PENDING_LOADS)
+        {
+            m_waitingLoads = true;
+            break;
+        }
+
+        StreamedTexture &texture = m_textures[candidate.second];
+        const int level = texture.m_residentLevel - 1;
+        const BakedTexture::Mip mip = texture.m_baked->m_mips[level];
+        // the budget is taken by textures at least as large on screen, the remaining ones keep their mips
+        if (!evict(mip.m_byteCount, budgetBytes, texture))
+            break;
+
+        texture.m_loading = true;
+        ++m_pendingLoads;
+        m_loadingBytes += mip.m_byteCount;
+        // the worker reads the mip from the cache file straight into the mapped ring
+        const unsigned int textureId = candidate.second;
+        const QString bakedPath = texture.m_bakedPath;
+        OpenGLUploadRing::instance()->uploadTexture(
+            textureId, level, internalFormat(texture.m_baked->m_format), mip.m_width, mip.m_height, mip.m_byteCount,
+            [bakedPath, mip](char *dst, qint64, qint64)
+            { return TextureBaker::loadMip(bakedPath, mip, dst); },
+            texture.m_uploads, [this, textureId, level](bool ok)
+            { finishLoad(textureId, level, ok); });
+    }
+}
+
+void OpenGLTextureStreamer::finishLoad(unsigned int textureId, int level, bool ok)
+{
+    auto it = m_textures.find(textureId);
+    if (it == m_textures.end())
+        return;
+
+    StreamedTexture &texture = it->second;
+    const qint64 bytes = texture.m_baked->m_mips[level].m_byteCount;
+    texture.m_loading = false;
+    --m_pendingLoads;
+    m_loadingBytes -= bytes;
+    if (!ok)
+    {
+        spdlog::error("read texture mip failed. path: {0}, level: {1}", texture.m_bakedPath.toStdString(), level);
+        texture.m_failed = true;
+        return;
+    }
+
+    // the copy is issued before any later draw, the texture samples the new level from now on
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texture.m_residentLevel = level;
+    m_residentBytes += bytes;
+    m_uploaded = true;
+}
+
+bool OpenGLTextureStreamer::evict(qint64 bytes, qint64 budgetBytes, const StreamedTexture &loading)
+{
+    while (m_residentBytes + m_loadingBytes + bytes > budgetBytes)
+    {
+        // off screen textures go first, then mips larger than needed, then textures smaller on screen than the loading one
+        auto victim = m_textures.end();
+        int victimRank = 0;
+        for (auto it = m_textures.begin(); it != m_textures.end(); ++it)
+        {
+            const StreamedTexture &texture = it->second;
+            if (&texture == &loading || texture.m_loading || texture.m_residentLevel >= texture.m_tailLevel)
+                continue;
+            const int rank = !isVisible(texture) ? 0 : (texture.m_residentLevel < texture.m_wantedLevel ? 1 : 2);
+            if (rank == 2 && texture.m_priority >= loading.m_priority)
+                continue;
+            if (victim == m_textures.end() || rank < victimRank || (rank == victimRank && texture.m_priority < victim->second.m_priority))
+            {
+                victim = it;
+                victimRank = rank;
+            }
+        }
+        if (victim == m_textures.end())
+            return false;
+
+        StreamedTexture &texture = victim->second;
+        releaseMip(victim->first, texture, texture.m_residentLevel);
+        m_residentBytes -= texture.m_baked->m_mips[texture.m_residentLevel].m_byteCount;
+        ++texture.m_residentLevel;
+    }
+    return true;
+}
+
+void OpenGLTextureStreamer::releaseMip(unsigned int textureId, const StreamedTexture &texture, int level)
+{
+    // the mip is redefined empty so that the driver frees it, the base level keeps the texture complete
+    glBindTexture(GL_TEXTURE_2D, textureId);
+    if (texture.m_baked->m_format == BakedTexture::RGBA8)
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    else
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat(texture.m_baked->m_format), 0, 0, 0, 0, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+}
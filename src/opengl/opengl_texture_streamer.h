@@ -0,0 +1,81 @@
+﻿#ifndef __OPENGL_TEXTURE_STREAMER_H__
+#define __OPENGL_TEXTURE_STREAMER_H__
+
+#include "opengl_upload_ring.h"
+#include "utils/texture_baker.h"
+#include <QOpenGLExtraFunctions>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// block compressed formats of the baked textures, core profile headers may leave them out
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+
+#define TEXTURE_REQUEST_FRAMES 4    // a texture requested in one of the last updates is on screen
+#define TEXTURE_MAX_PENDING_LOADS 8 // mips read on the thread pool at the same time
+
+// streams the larger mips of baked textures into their gl textures, under one budget for the whole process
+// a texture starts with the small mips read at import, models request the mip their meshes need on screen while they draw,
+// update reads the missing mips by on-screen priority into the upload ring on worker threads, one level at a time
+// textures belong to the share group of the windows (Qt::AA_ShareOpenGLContexts), one of its contexts must be current
+class OpenGLTextureStreamer : protected QOpenGLExtraFunctions
+{
+public:
+    static OpenGLTextureStreamer *instance();
+    static GLenum internalFormat(BakedTexture::Format format);
+    // the texture already holds the loaded mips of baked, the larger ones are read from bakedPath
+    void addTexture(unsigned int textureId, const QString &bakedPath, const std::shared_ptr<const BakedTexture> &baked);
+    // called before the texture is deleted, a mip still on its way is cancelled
+    void removeTexture(unsigned int textureId);
+    // screenSize is the size in pixels of a mesh drawn with the texture, the largest request of a frame wins
+    void request(unsigned int textureId, float screenSize);
+    // starts the reads of the mips that are needed next
+    // returns true if a texture got a larger mip since the last call, the views showing it should be drawn again
+    bool update();
+    bool hasPending() const { return m_pendingLoads > 0 || m_waitingLoads; }
+    int textureCount() const { return (int)m_textures.size(); }
+    qint64 residentBytes() const { return m_residentBytes; }
+    qint64 requestedBytes() const { return m_requestedBytes; }
+
+private:
+    struct StreamedTexture
+    {
+        QString m_bakedPath;
+        std::shared_ptr<const BakedTexture> m_baked;
+        int m_tailLevel = 0;            // mips from this one on are never released
+        int m_residentLevel = 0;        // largest mip in the texture
+        int m_wantedLevel = 0;          // largest mip needed on screen
+        float m_priority = 0.0f;        // screen size of the last request
+        quint64 m_lastRequestFrame = 0;
+        bool m_loading = false;         // the mip above m_residentLevel is on its way through the upload ring
+        bool m_failed = false;          // the cache file is gone, the texture keeps what it has
+        std::shared_ptr<OpenGLUploadRing::Batch> m_uploads;
+    };
+
+    OpenGLTextureStreamer() = default;
+    bool isVisible(const StreamedTexture &texture) const { return texture.m_lastRequestFrame + TEXTURE_REQUEST_FRAMES > m_frame; }
+    void startLoads(qint64 budgetBytes);
+    void finishLoad(unsigned int textureId, int level, bool ok);
+    bool evict(qint64 bytes, qint64 budgetBytes, const StreamedTexture &loading);
+    void releaseMip(unsigned int textureId, const StreamedTexture &texture, int level);
+
+private:
+    std::unordered_map<unsigned int, StreamedTexture> m_textures;
+    int m_pendingLoads = 0;
+    bool m_uploaded = false;             // a larger mip arrived since the last update
+    bool m_waitingLoads = false;         // visible textures wait for a free read slot
+    qint64 m_residentBytes = 0;
+    qint64 m_loadingBytes = 0;
+    qint64 m_requestedBytes = 0;
+    quint64 m_frame = TEXTURE_REQUEST_FRAMES;
+};
+
+#endif
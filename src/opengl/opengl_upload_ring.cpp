@@ -0,0 +1,319 @@
+﻿#include "opengl_upload_ring.h"
+#include "spdlog/spdlog.h"
+#include <QThreadPool>
+#include <QByteArray>
+#include <cstring>
+#include <vector>
+
+OpenGLUploadRing *OpenGLUploadRing::instance()
+{
+    static OpenGLUploadRing sRing;
+    return &sRing;
+}
+
+OpenGLUploadRing::FillFunction OpenGLUploadRing::copyFrom(const void *data, const std::shared_ptr<const void> &owner)
+{
+    return [data, owner](char *dst, qint64 offset, qint64 bytes)
+    {
+        memcpy(dst, static_cast<const char *>(data) + offset, bytes);
+        return true;
+    };
+}
+
+void OpenGLUploadRing::uploadBuffer(unsigned int buffer, qint64 dstOffset, qint64 bytes, const FillFunction &fill,
+                                    const std::shared_ptr<Batch> &batch, const DoneFunction &done)
+{
+    std::shared_ptr<Upload> upload = std::make_shared<Upload>();
+    upload->m_target = buffer;
+    upload->m_dstOffset = dstOffset;
+    upload->m_bytes = bytes;
+    upload->m_fill = fill;
+    upload->m_done = done;
+    upload->m_batch = batch;
+    submit(upload);
+}
+
+void OpenGLUploadRing::uploadTexture(unsigned int texture, int level, GLenum internalFormat, int width, int height, qint64 bytes, const FillFunction &fill,
+                                     const std::shared_ptr<Batch> &batch, const DoneFunction &done)
+{
+    std::shared_ptr<Upload> upload = std::make_shared<Upload>();
+    upload->m_texture = true;
+    upload->m_target = texture;
+    upload->m_bytes = bytes;
+    upload->m_level = level;
+    upload->m_internalFormat = internalFormat;
+    upload->m_width = width;
+    upload->m_height = height;
+    upload->m_fill = fill;
+    upload->m_done = done;
+    upload->m_batch = batch;
+    submit(upload);
+}
+
+void OpenGLUploadRing::submit(const std::shared_ptr<Upload> &upload)
+{
+    if (upload->m_batch)
+        ++upload->m_batch->m_pending;
+
+    // a texture level is copied by one command, it has to fit in the ring at once
+    if (!ensureRing() || upload->m_bytes <= 0 || (upload->m_texture && upload->m_bytes > UPLOAD_RING_BYTES))
+    {
+        uploadNow(*upload);
+        return;
+    }
+    m_queued.emplace_back(upload);
+    startFills();
+}
+
+bool OpenGLUploadRing::ensureRing()
+{
+    initializeOpenGLFunctions();
+    if (m_checked)
+        return m_mapped != nullptr;
+    m_checked = true;
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!context->isOpenGLES() && (context->format().version() >= qMakePair(4, 4) || context->hasExtension("GL_ARB_buffer_storage")))
+        m_glBufferStorage = reinterpret_cast<BufferStorageFunction>(context->getProcAddress("glBufferStorage"));
+    if (!m_glBufferStorage)
+    {
+        spdlog::info("no persistently mapped buffers, uploads are done on the gl thread.");
+        return false;
+    }
+
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+    m_glBufferStorage(GL_COPY_READ_BUFFER, UPLOAD_RING_BYTES, nullptr, flags);
+    m_mapped = static_cast<char *>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, UPLOAD_RING_BYTES, flags));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    if (!m_mapped)
+    {
+        spdlog::error("map upload ring failed, uploads are done on the gl thread.");
+        glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+        return false;
+    }
+
+    // the buffer and its mapping are gone with the share group, the workers must be done with them first
+    QObject::connect(context->shareGroup(), &QObject::destroyed, [this]()
+                     { release(); });
+    return true;
+}
+
+bool OpenGLUploadRing::allocate(qint64 bytes, qint64 &begin)
+{
+    bytes = (bytes + UPLOAD_RING_ALIGNMENT - 1) / UPLOAD_RING_ALIGNMENT * UPLOAD_RING_ALIGNMENT;
+    if (m_regions.empty())
+    {
+        if (bytes > UPLOAD_RING_BYTES)
+            return false;
+        begin = 0;
+        m_head = bytes == UPLOAD_RING_BYTES ? 0 : bytes;
+        return true;
+    }
+
+    // the head catching up with the oldest region means the ring is full
+    const qint64 tail = m_regions.front()->m_begin;
+    if (m_head == tail)
+        return false;
+    if (m_head > tail)
+    {
+        if (m_head + bytes <= UPLOAD_RING_BYTES)
+            begin = m_head;
+        else if (bytes <= tail)
+            begin = 0;
+        else
+            return false;
+    }
+    else if (m_head + bytes <= tail)
+    {
+        begin = m_head;
+    }
+    else
+    {
+        return false;
+    }
+    m_head = begin + bytes;
+    if (m_head == UPLOAD_RING_BYTES && tail > 0)
+        m_head = 0;
+    return true;
+}
+
+void OpenGLUploadRing::startFills()
+{
+    while (!m_queued.empty())
+    {
+        Upload &upload = *m_queued.front();
+        if (upload.m_batch && upload.m_batch->m_cancelled)
+        {
+            // the remaining chunks are dropped, regions already filling finish the upload
+            upload.m_failed = true;
+            upload.m_bytes = upload.m_queuedBytes;
+            if (!upload.m_openRegions)
+                finish(upload);
+            m_queued.pop_front();
+            continue;
+        }
+
+        const qint64 bytes = upload.m_texture ? upload.m_bytes : qMin<qint64>(upload.m_bytes - upload.m_queuedBytes, UPLOAD_RING_CHUNK_BYTES);
+        qint64 begin = 0;
+        if (!allocate(bytes, begin))
+            break;
+
+        std::shared_ptr<Region> region = std::make_shared<Region>();
+        region->m_upload = m_queued.front();
+        region->m_begin = begin;
+        region->m_sourceOffset = upload.m_queuedBytes;
+        region->m_bytes = bytes;
+        m_regions.emplace_back(region);
+        upload.m_queuedBytes += bytes;
+        ++upload.m_openRegions;
+        if (upload.m_queuedBytes == upload.m_bytes)
+            m_queued.pop_front();
+
+        char *dst = m_mapped + begin;
+        {
+            QMutexLocker locker(&m_fillMutex);
+            ++m_runningFills;
+        }
+        QThreadPool::globalInstance()->start([this, region, dst]()
+                                             {
+                                                 const bool ok = region->m_upload->m_fill(dst, region->m_sourceOffset, region->m_bytes);
+                                                 region->m_state = ok ? Filled : FillFailed;
+                                                 QMutexLocker locker(&m_fillMutex);
+                                                 if (!--m_runningFills)
+                                                     m_fillsDone.wakeAll(); });
+    }
+}
+
+void OpenGLUploadRing::update()
+{
+    if (!m_mapped)
+        return;
+    initializeOpenGLFunctions();
+
+    // regions are copied as soon as their data arrived, whatever their order in the ring
+    // done functions may upload again, they run after the walk over the regions
+    std::vector<std::shared_ptr<Upload>> finished;
+    for (const auto &region : m_regions)
+    {
+        if (region->m_issued || region->m_state == Filling)
+            continue;
+
+        Upload &upload = *region->m_upload;
+        const bool cancelled = upload.m_batch && upload.m_batch->m_cancelled;
+        if (region->m_state == Filled && !cancelled && !upload.m_failed)
+        {
+            copy(upload, region->m_sourceOffset, region->m_bytes, reinterpret_cast<const char *>(region->m_begin), true);
+            region->m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        else
+        {
+            upload.m_failed = true;
+        }
+        region->m_issued = true;
+        if (!--upload.m_openRegions && upload.m_queuedBytes == upload.m_bytes)
+            finished.emplace_back(region->m_upload);
+    }
+    for (const auto &upload : finished)
+        finish(*upload);
+
+    // the oldest regions are written again once the gpu read them
+    while (!m_regions.empty())
+    {
+        const std::shared_ptr<Region> &region = m_regions.front();
+        if (!region->m_issued)
+            break;
+        if (region->m_fence)
+        {
+            if (glClientWaitSync(region->m_fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                break;
+            glDeleteSync(region->m_fence);
+        }
+        m_regions.pop_front();
+    }
+    startFills();
+}
+
+bool OpenGLUploadRing::hasPending() const
+{
+    if (!m_queued.empty())
+        return true;
+    for (const auto &region : m_regions)
+    {
+        if (!region->m_issued)
+            return true;
+    }
+    return false;
+}
+
+void OpenGLUploadRing::uploadNow(Upload &upload)
+{
+    QByteArray data(upload.m_bytes, Qt::Uninitialized);
+    upload.m_failed = upload.m_bytes > 0 && !upload.m_fill(data.data(), 0, upload.m_bytes);
+    if (!upload.m_failed && upload.m_bytes > 0)
+        copy(upload, 0, upload.m_bytes, data.constData(), false);
+    finish(upload);
+}
+
+void OpenGLUploadRing::copy(const Upload &upload, qint64 sourceOffset, qint64 bytes, const char *source, bool fromRing)
+{
+    if (!upload.m_texture)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, upload.m_target);
+        if (fromRing)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, m_buffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)source, upload.m_dstOffset + sourceOffset, bytes);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        else
+        {
+            glBufferSubData(GL_COPY_WRITE_BUFFER, upload.m_dstOffset + sourceOffset, bytes, source);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return;
+    }
+
+    // source is an offset into the bound unpack buffer when the level comes from the ring
+    if (fromRing)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_buffer);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindTexture(GL_TEXTURE_2D, upload.m_target);
+    if (upload.m_internalFormat == GL_RGBA8)
+        glTexImage2D(GL_TEXTURE_2D, upload.m_level, GL_RGBA8, upload.m_width, upload.m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, source);
+    else
+        glCompressedTexImage2D(GL_TEXTURE_2D, upload.m_level, upload.m_internalFormat, upload.m_width, upload.m_height, 0, (GLsizei)bytes, source);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (fromRing)
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void OpenGLUploadRing::finish(Upload &upload)
+{
+    const bool cancelled = upload.m_batch && upload.m_batch->m_cancelled;
+    if (upload.m_failed && !cancelled)
+        spdlog::error("upload failed. target: {0}, bytes: {1}", upload.m_target, upload.m_bytes);
+    if (upload.m_batch)
+        --upload.m_batch->m_pending;
+    if (upload.m_done && !cancelled)
+        upload.m_done(!upload.m_failed);
+}
+
+void OpenGLUploadRing::release()
+{
+    {
+        // other users of the global pool, e.g. imports or page loads of other windows, are not waited for
+        QMutexLocker locker(&m_fillMutex);
+        while (m_runningFills)
+            m_fillsDone.wait(&m_fillMutex);
+    }
+    m_queued.clear();
+    m_regions.clear();
+    m_buffer = 0;
+    m_mapped = nullptr;
+    m_head = 0;
+    m_checked = false;
+}
@@ -0,0 +1,119 @@
+﻿#ifndef __OPENGL_UPLOAD_RING_H__
+#define __OPENGL_UPLOAD_RING_H__
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLContext>
+#include <QMutex>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+#define UPLOAD_RING_BYTES (64 * 1024 * 1024)
+#define UPLOAD_RING_CHUNK_BYTES (UPLOAD_RING_BYTES / 4) // buffer uploads are split so that several stream at once
+#define UPLOAD_RING_ALIGNMENT 256
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// staging memory for buffer and texture uploads, a ring in one persistently mapped buffer
+// worker threads of the global pool write the data straight into the ring, the gl thread only issues the copies
+// from it and fences them, a region is written again once its fence signaled, so attaching a model never waits on the driver
+// needs glBufferStorage (GL 4.4 or GL_ARB_buffer_storage), without it the data is produced and uploaded on the gl thread
+// like the other registries it assumes one share group (Qt::AA_ShareOpenGLContexts), one of its contexts must be current
+class OpenGLUploadRing : protected QOpenGLExtraFunctions
+{
+public:
+    // uploads of one owner, the owner cancels them before it deletes their targets
+    struct Batch
+    {
+        int m_pending = 0; // uploads whose copies are not all issued
+        bool m_cancelled = false;
+    };
+    // writes the bytes of the source from offset on to dst, called on a worker thread
+    using FillFunction = std::function<bool(char *dst, qint64 offset, qint64 bytes)>;
+    // called on the gl thread once the copy is issued, ok is false if the data could not be produced
+    using DoneFunction = std::function<void(bool ok)>;
+
+public:
+    static OpenGLUploadRing *instance();
+    // fill function copying from memory that owner keeps alive until the upload is done
+    static FillFunction copyFrom(const void *data, const std::shared_ptr<const void> &owner);
+    // the buffer must already have its storage, e.g. from glBufferData with null data
+    void uploadBuffer(unsigned int buffer, qint64 dstOffset, qint64 bytes, const FillFunction &fill,
+                      const std::shared_ptr<Batch> &batch, const DoneFunction &done = DoneFunction());
+    // defines one level of the texture, block compressed unless internalFormat is GL_RGBA8
+    void uploadTexture(unsigned int texture, int level, GLenum internalFormat, int width, int height, qint64 bytes, const FillFunction &fill,
+                       const std::shared_ptr<Batch> &batch, const DoneFunction &done = DoneFunction());
+    // issues the copies of the filled regions and recycles the ones the gpu finished, called once per frame
+    void update();
+    bool hasPending() const;
+
+private:
+    struct Upload
+    {
+        bool m_texture = false;
+        unsigned int m_target = 0; // buffer or texture name
+        qint64 m_dstOffset = 0;
+        qint64 m_bytes = 0;
+        int m_level = 0;
+        GLenum m_internalFormat = 0;
+        int m_width = 0;
+        int m_height = 0;
+        FillFunction m_fill;
+        DoneFunction m_done;
+        std::shared_ptr<Batch> m_batch;
+        qint64 m_queuedBytes = 0; // bytes already given to regions
+        int m_openRegions = 0;    // regions whose copy is not issued
+        bool m_failed = false;
+    };
+
+    enum RegionState
+    {
+        Filling = 0,
+        Filled,
+        FillFailed,
+    };
+
+    struct Region
+    {
+        std::shared_ptr<Upload> m_upload;
+        qint64 m_begin = 0;        // ring offset
+        qint64 m_sourceOffset = 0; // offset of the chunk in the upload
+        qint64 m_bytes = 0;
+        std::atomic<int> m_state{Filling}; // written by the worker
+        bool m_issued = false;
+        GLsync m_fence = nullptr;
+    };
+
+    OpenGLUploadRing() = default;
+    void submit(const std::shared_ptr<Upload> &upload);
+    bool ensureRing();
+    bool allocate(qint64 bytes, qint64 &begin);
+    void startFills();
+    void uploadNow(Upload &upload);
+    void copy(const Upload &upload, qint64 sourceOffset, qint64 bytes, const char *source, bool fromRing);
+    void finish(Upload &upload);
+    void release();
+
+private:
+    typedef void (QOPENGLF_APIENTRYP BufferStorageFunction)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+    BufferStorageFunction m_glBufferStorage = nullptr;
+    bool m_checked = false;
+    unsigned int m_buffer = 0;
+    char *m_mapped = nullptr;
+    qint64 m_head = 0;
+    // fill tasks of this ring still running on the global pool, release waits for them only
+    QMutex m_fillMutex;
+    QWaitCondition m_fillsDone;
+    int m_runningFills = 0;
+    std::deque<std::shared_ptr<Upload>> m_queued;  // uploads waiting for ring space
+    std::deque<std::shared_ptr<Region>> m_regions; // in ring order, the oldest first
+};
+
+#endif
@@ -1,52 +1,96 @@
 ﻿#include "opengl_window.h"
+#include "opengl_program_registry.h"
+#include "opengl_texture_streamer.h"
+#include "opengl_upload_ring.h"
+#include "utils/model_import_queue.h"
 #include "spdlog/spdlog.h"
-#include <QFile>
+#include <QtMath>
+#include <algorithm>
+#include <cmath>
 
 #define WHEEL_MIN (0.1 * 0.1)
 #define WHEEL_MAX (10 * 10 * 10 * 10)
 #define TIMER_ROTATE_ANGLE 45
 #define TIMER_ROTATE_NUM 50
 #define TIMER_HOVER_HEIGHT 3
-#define ANIMATION_TIME_INTERVAL 200
+#define ANIMATION_TIME_INTERVAL 200 // the camera animations move by one step per interval, scaled by the measured frame time
 
 static const std::array<float, 3> sLightPos{1.2f, 1.0f, 2.0f};
 static const std::array<float, 3> sLightColorLoc{1.0f, 1.0f, 1.0f};
 
 OpenGLWindow::OpenGLWindow(const QString &modelPath, const QColor &color, QWidget *parent)
-    : QOpenGLWidget(parent)
+    : OpenGLWindow(modelPath.isEmpty() ? QStringList() : QStringList{modelPath}, color, parent)
+{
+}
+
+OpenGLWindow::OpenGLWindow(const QStringList &modelPaths, const QColor &color, QWidget *parent)
+    : QOpenGLWidget(parent),
+      m_modelPaths(modelPaths),
+      m_frameScheduler([this]()
+                       { update(); })
 {
     setFocusPolicy(Qt::StrongFocus);
     setMouseTracking(true);
+    // the framebuffer keeps the image of the viewports that are not drawn again
+    setUpdateBehavior(QOpenGLWidget::PartialUpdate);
     initializeFpsLabel();
 
     QRgb rgba = color.rgba();
     m_bgColor = {(float)qRed(rgba) / 255, (float)qGreen(rgba) / 255, (float)qBlue(rgba) / 255, (float)qAlpha(rgba) / 255};
 
-    m_modelPath = modelPath;
-    if (!modelPath.isEmpty())
+    // the models are read on every core first, each OpenGLModel then finds its pages or its meshes in the caches
+    if (m_modelPaths.size() > 1)
+    {
+        ModelImportQueue importQueue;
+        importQueue.setImportFunction([](const QString &modelPath)
+                                      {
+                                          std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> modelMeshsPtr;
+                                          std::shared_ptr<ModelPageFile> pageFilePtr;
+                                          if (!ModelLoadManager::instance()->openPagedModel(modelPath, pageFilePtr) &&
+                                              !ModelLoadManager::instance()->isStreamingModel(modelPath))
+                                              ModelLoadManager::instance()->import3DModel(modelPath, modelMeshsPtr);
+                                          return modelMeshsPtr; });
+        for (const auto &modelPath : QSet<QString>(m_modelPaths.begin(), m_modelPaths.end()))
+            importQueue.push(modelPath);
+        importQueue.waitForDone();
+    }
+
+    for (const auto &modelPath : m_modelPaths)
+    {
+        // viewports of the same model draw from one upload, paged models keep their residency per viewport
+        Viewport viewport;
+        auto it = std::find_if(m_viewports.begin(), m_viewports.end(), [&modelPath](const Viewport &other)
+                               { return other.m_model->modelPath() == modelPath && !other.m_model->isPaged(); });
+        if (it != m_viewports.end())
+        {
+            viewport.m_model = it->m_model;
+            viewport.m_sharedModel = it->m_sharedModel = true;
+        }
+        else
+        {
+            viewport.m_model = std::make_shared<OpenGLModel>(modelPath);
+            m_models.emplace_back(viewport.m_model);
+        }
+        initializeZoom(viewport);
+        m_viewports.emplace_back(viewport);
+    }
+
+    if (!m_viewports.empty())
     {
-        ModelLoadManager::instance()->import3DModel(modelPath, m_modelMeshsPtr);
         m_fpsLabel->show();
         m_fpsTimer.setInterval(1000);
         m_fpsTimer.start();
     }
-
-    initializeZoom();
     connect(&m_fpsTimer, &QTimer::timeout, this, &OpenGLWindow::onFpsTimeOut);
-    connect(&m_animationTimer, &QTimer::timeout, this, &OpenGLWindow::onAnimationTimeOut);
 }
 
 OpenGLWindow::~OpenGLWindow()
 {
-    if (m_modelMeshsPtr)
-    {
-        for (const auto &modelMesh : *m_modelMeshsPtr)
-        {
-            glDeleteVertexArrays(1, &modelMesh.m_VAO);
-            glDeleteBuffers(1, &modelMesh.m_VBO);
-            glDeleteBuffers(1, &modelMesh.m_EBO);
-        }
-    }
+    makeCurrent();
+    m_viewports.clear();
+    m_models.clear();
+    if (m_whiteTexture)
+        glDeleteTextures(1, &m_whiteTexture);
 }
 
 void OpenGLWindow::initializeFpsLabel()
@@ -59,53 +103,61 @@ void OpenGLWindow::initializeFpsLabel()
     m_fpsLabel->setFont(font);
     m_fpsLabel->move(10, 10);
     m_fpsLabel->hide();
+
+    m_textureLabel = new QLabel(this);
+    m_textureLabel->setFixedSize(300, 30);
+    m_textureLabel->setFont(font);
+    m_textureLabel->move(10, 40);
+    m_textureLabel->hide();
 }
 
-void OpenGLWindow::initializeZoom()
+void OpenGLWindow::initializeZoom(Viewport &viewport)
 {
-    if (!m_modelMeshsPtr || m_modelMeshsPtr->isEmpty())
+    if (viewport.m_model->isEmpty())
         return;
 
-    float maxPosition = ModelLoadManager::instance()->getModelMaxPos(m_modelPath);
+    CameraParam &camera = viewport.m_camera;
+    int &cameraDistance = viewport.m_cameraDistance;
+    float maxPosition = ModelLoadManager::instance()->getModelMaxPos(viewport.m_model->modelPath());
     spdlog::info("model max position is {}.", maxPosition);
     if (maxPosition < 5)
     {
-        m_cameraDistance = maxPosition * 5;
-        m_camera.m_zNear = 0.01;
-        m_camera.m_zFar = maxPosition * 100;
+        cameraDistance = maxPosition * 5;
+        camera.m_zNear = 0.01;
+        camera.m_zFar = maxPosition * 100;
     }
     else if (maxPosition < 100)
     {
-        m_cameraDistance = maxPosition * 3;
-        m_camera.m_zNear = 0.05;
-        m_camera.m_zFar = maxPosition * 50;
+        cameraDistance = maxPosition * 3;
+        camera.m_zNear = 0.05;
+        camera.m_zFar = maxPosition * 50;
     }
     else if (maxPosition < 1000)
     {
-        m_cameraDistance = maxPosition * 3;
-        m_camera.m_zNear = 0.05;
-        m_camera.m_zFar = maxPosition * 30;
+        cameraDistance = maxPosition * 3;
+        camera.m_zNear = 0.05;
+        camera.m_zFar = maxPosition * 30;
     }
     else if (maxPosition < 2000)
     {
-        m_cameraDistance = maxPosition * 4;
-        m_camera.m_zNear = 0.07;
-        m_camera.m_zFar = maxPosition * 10;
+        cameraDistance = maxPosition * 4;
+        camera.m_zNear = 0.07;
+        camera.m_zFar = maxPosition * 10;
     }
     else if (maxPosition < 3000)
     {
-        m_cameraDistance = maxPosition * 4.5;
-        m_camera.m_zNear = 0.4;
-        m_camera.m_zFar = maxPosition * 10;
+        cameraDistance = maxPosition * 4.5;
+        camera.m_zNear = 0.4;
+        camera.m_zFar = maxPosition * 10;
     }
     else
     {
-        m_cameraDistance = maxPosition * 4.5;
-        m_camera.m_zNear = 0.5;
-        m_camera.m_zFar = maxPosition * 10;
+        cameraDistance = maxPosition * 4.5;
+        camera.m_zNear = 0.5;
+        camera.m_zFar = maxPosition * 10;
     }
 
-    m_camera.m_eye.setZ(m_camera.m_zoom * m_cameraDistance);
+    camera.m_eye.setZ(camera.m_zoom * cameraDistance);
 }
 
 void OpenGLWindow::initializeGL()
@@ -114,49 +166,159 @@ void OpenGLWindow::initializeGL()
     glEnable(GL_DEPTH_TEST);
     if (compileGLSL())
     {
-        initializeMesh();
+        initializeWhiteTexture();
+        for (const auto &model : m_models)
+            model->initialize(m_whiteTexture);
     }
+    m_frameScheduler.setAnimating(m_cameraAnimating || hasClips());
+    markDirty();
 }
 
 void OpenGLWindow::paintGL()
 {
-    glClearColor(m_bgColor[0], m_bgColor[1], m_bgColor[2], m_bgColor[3]);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
     ++m_frameCount;
+    ++m_totalFrameCount;
+    if (!m_fpsTimer.isActive() && !m_viewports.empty())
+        m_fpsTimer.start();
+    advanceAnimation(m_frameScheduler.beginFrame());
+    // copies of the data the workers wrote since the last frame go before the draws
+    OpenGLUploadRing::instance()->update();
 
     glUseProgram(m_glslProgramId);
+    glClearColor(m_bgColor[0], m_bgColor[1], m_bgColor[2], m_bgColor[3]);
+    if (m_viewports.empty())
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+    // only viewports whose camera or model changed are cleared and drawn, the others keep their last image
+    bool pending = false;
+    glEnable(GL_SCISSOR_TEST);
+    for (auto &viewport : m_viewports)
+    {
+        if (!viewport.m_dirty && !viewport.m_model->hasClips())
+            continue;
+
+        const QRect &rect = viewport.m_pixelRect;
+        glViewport(rect.x(), rect.y(), rect.width(), rect.height());
+        glScissor(rect.x(), rect.y(), rect.width(), rect.height());
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        viewport.m_dirty = !paintViewport(viewport);
+        pending = pending || viewport.m_dirty;
+    }
+    glDisable(GL_SCISSOR_TEST);
+
+    // larger mips arrived, the viewports are drawn again with them
+    OpenGLTextureStreamer *streamer = OpenGLTextureStreamer::instance();
+    if (streamer->update())
+    {
+        for (auto &viewport : m_viewports)
+            viewport.m_dirty = true;
+        pending = true;
+    }
+    pending = pending || streamer->hasPending() || OpenGLUploadRing::instance()->hasPending();
+
+    // pages still loading or a culling pass that has not converged need one more frame
+    if (pending)
+        m_frameScheduler.requestFrame();
+    m_frameScheduler.endFrame();
+}
+
+bool OpenGLWindow::paintViewport(Viewport &viewport)
+{
+    const CameraParam &camera = viewport.m_camera;
     QMatrix4x4 rotation;
-    rotation.rotate(qreal(m_camera.m_zRot) / 16.0f, 0.0f, 0.0f, 1.0f);
-    rotation.rotate(qreal(m_camera.m_yRot) / 16.0f, 0.0f, 1.0f, 0.0f);
-    rotation.rotate(qreal(m_camera.m_xRot) / 16.0f, 1.0f, 0.0f, 0.0f);
-    rotation *= m_camera.m_rotation;
+    rotation.rotate(qreal(camera.m_zRot) / 16.0f, 0.0f, 0.0f, 1.0f);
+    rotation.rotate(qreal(camera.m_yRot) / 16.0f, 0.0f, 1.0f, 0.0f);
+    rotation.rotate(qreal(camera.m_xRot) / 16.0f, 1.0f, 0.0f, 0.0f);
+    rotation *= camera.m_rotation;
 
     QMatrix4x4 m1, m2;
-    m1.lookAt(m_camera.m_eye, m_camera.m_center, m_camera.m_up);
+    m1.lookAt(camera.m_eye, camera.m_center, camera.m_up);
     m1 *= rotation;
-    m2.translate(m_camera.m_xTrans, -1.0 * m_camera.m_yTrans, 0);
-    m2 *= m_camera.m_translation;
+    m2.translate(camera.m_xTrans, -1.0 * camera.m_yTrans, 0);
+    m2 *= camera.m_translation;
 
-    glUniformMatrix4fv(glGetUniformLocation(m_glslProgramId, "projection"), 1, GL_FALSE, m_camera.m_projection.data());
+    glUniformMatrix4fv(glGetUniformLocation(m_glslProgramId, "projection"), 1, GL_FALSE, camera.m_projection.data());
     glUniformMatrix4fv(glGetUniformLocation(m_glslProgramId, "view"), 1, GL_FALSE, m2.data());
     glUniformMatrix4fv(glGetUniformLocation(m_glslProgramId, "model"), 1, GL_FALSE, m1.data());
+    setLightUniforms(camera);
 
-    paintMesh();
+    // a pyramid built in one viewport would cull the other viewports of a shared model with the wrong camera
+    return viewport.m_model->paint(m_glslProgramId, camera.m_projection * m2 * m1, (m2 * m1).inverted().map(QVector3D(0.0f, 0.0f, 0.0f)),
+                                   defaultFramebufferObject(), viewport.m_pixelRect, !viewport.m_sharedModel);
 }
 
 void OpenGLWindow::resizeGL(int w, int h)
 {
-    qreal aspect = qreal(w) / qreal(h ? h : 1);
-    m_camera.m_projection.setToIdentity();
-    m_camera.m_projection.perspective(m_camera.m_fovy, aspect, m_camera.m_zNear, m_camera.m_zFar);
+    Q_UNUSED(w);
+    Q_UNUSED(h);
+    layoutViewports();
+}
+
+void OpenGLWindow::layoutViewports()
+{
+    // the most square grid that holds every viewport
+    const int count = (int)m_viewports.size();
+    if (!count)
+        return;
+    const int columns = qCeil(qSqrt((qreal)count));
+    const int rows = (count + columns - 1) / columns;
+    const qreal ratio = devicePixelRatioF();
+    const int pixelWidth = qRound(width() * ratio);
+    const int pixelHeight = qRound(height() * ratio);
+    for (int i = 0; i < count; ++i)
+    {
+        const int column = i % columns;
+        const int row = i / columns;
+        Viewport &viewport = m_viewports[i];
+        viewport.m_rect.setCoords(width() * column / columns, height() * row / rows,
+                                  width() * (column + 1) / columns - 1, height() * (row + 1) / rows - 1);
+
+        // rows of the framebuffer start at the bottom
+        const int left = pixelWidth * column / columns;
+        const int right = pixelWidth * (column + 1) / columns;
+        const int top = pixelHeight * row / rows;
+        const int bottom = pixelHeight * (row + 1) / rows;
+        viewport.m_pixelRect = QRect(left, pixelHeight - bottom, right - left, bottom - top);
+
+        qreal aspect = qreal(viewport.m_rect.width()) / qreal(viewport.m_rect.height() ? viewport.m_rect.height() : 1);
+        viewport.m_camera.m_projection.setToIdentity();
+        viewport.m_camera.m_projection.perspective(viewport.m_camera.m_fovy, aspect, viewport.m_camera.m_zNear, viewport.m_camera.m_zFar);
+        viewport.m_dirty = true;
+    }
+}
+
+int OpenGLWindow::viewportAt(const QPoint &pos) const
+{
+    for (int i = 0; i < (int)m_viewports.size(); ++i)
+    {
+        if (m_viewports[i].m_rect.contains(pos))
+            return i;
+    }
+    return -1;
+}
+
+void OpenGLWindow::markDirty()
+{
+    for (auto &viewport : m_viewports)
+        viewport.m_dirty = true;
+    m_frameScheduler.requestFrame();
+}
+
+bool OpenGLWindow::hasClips() const
+{
+    for (const auto &model : m_models)
+    {
+        if (model->hasClips())
+            return true;
+    }
+    return false;
 }
 
 void OpenGLWindow::mousePressEvent(QMouseEvent *e)
 {
     m_mousePress = true;
     m_mousePos = e->pos();
+    m_activeViewport = viewportAt(e->pos());
     switch (e->button())
     {
     case Qt::LeftButton:
@@ -174,35 +336,39 @@ void OpenGLWindow::mousePressEvent(QMouseEvent *e)
 void OpenGLWindow::mouseReleaseEvent(QMouseEvent *e)
 {
     m_mousePress = false;
-    releasePos(e->button());
+    if (m_activeViewport >= 0)
+        releasePos(m_viewports[m_activeViewport].m_camera, e->button());
 }
 
 void OpenGLWindow::mouseMoveEvent(QMouseEvent *e)
 {
-    if (!m_mousePress)
+    if (!m_mousePress || m_activeViewport < 0)
         return;
 
+    Viewport &viewport = m_viewports[m_activeViewport];
+    CameraParam &camera = viewport.m_camera;
     QPoint diff = e->pos() - m_mousePos;
     switch (m_mouseFlag)
     {
     case Qt::LeftButton:
     case Qt::MiddleButton:
-        m_camera.m_yRot = setRotation(4 * diff.x());
-        m_camera.m_xRot = setRotation(4 * diff.y());
+        camera.m_yRot = setRotation(4 * diff.x());
+        camera.m_xRot = setRotation(4 * diff.y());
         break;
     case Qt::RightButton:
     {
-        qreal w_h_ratio = (qreal)(this->width()) / (qreal)(this->height());
-        qreal cube_view_height = 2 * m_camera.m_zoom * m_cameraDistance * qTan(qDegreesToRadians(m_camera.m_fovy / 2));
+        qreal w_h_ratio = (qreal)(viewport.m_rect.width()) / (qreal)(viewport.m_rect.height());
+        qreal cube_view_height = 2 * camera.m_zoom * viewport.m_cameraDistance * qTan(qDegreesToRadians(camera.m_fovy / 2));
         qreal cube_view_width = w_h_ratio * cube_view_height;
-        m_camera.m_xTrans = cube_view_width / qreal(width()) * qreal(diff.x());
-        m_camera.m_yTrans = cube_view_height / qreal(height()) * qreal(diff.y());
+        camera.m_xTrans = cube_view_width / qreal(viewport.m_rect.width()) * qreal(diff.x());
+        camera.m_yTrans = cube_view_height / qreal(viewport.m_rect.height()) * qreal(diff.y());
         break;
     }
     default:
         return;
     }
-    repaint();
+    viewport.m_dirty = true;
+    m_frameScheduler.requestFrame();
 }
 
 void OpenGLWindow::wheelEvent(QWheelEvent *e)
@@ -210,19 +376,26 @@ void OpenGLWindow::wheelEvent(QWheelEvent *e)
     if (m_mousePress)
         return;
 
+    const int index = viewportAt(e->position().toPoint());
+    if (index < 0)
+        return;
+
+    Viewport &viewport = m_viewports[index];
+    CameraParam &camera = viewport.m_camera;
     if (e->angleDelta().y() > 0)
-        m_camera.m_zoom -= m_wheelScale;
+        camera.m_zoom -= m_wheelScale;
     else
-        m_camera.m_zoom += m_wheelScale;
+        camera.m_zoom += m_wheelScale;
 
-    if (m_camera.m_zoom >= WHEEL_MAX)
-        m_camera.m_zoom = WHEEL_MAX;
-    else if (m_camera.m_zoom <= WHEEL_MIN)
-        m_camera.m_zoom = WHEEL_MIN;
+    if (camera.m_zoom >= WHEEL_MAX)
+        camera.m_zoom = WHEEL_MAX;
+    else if (camera.m_zoom <= WHEEL_MIN)
+        camera.m_zoom = WHEEL_MIN;
 
-    m_camera.m_eye.setZ(m_camera.m_zoom * m_cameraDistance * 0.25);
+    camera.m_eye.setZ(camera.m_zoom * viewport.m_cameraDistance * 0.25);
 
-    repaint();
+    viewport.m_dirty = true;
+    m_frameScheduler.requestFrame();
 }
 
 int OpenGLWindow::setRotation(int angle)
@@ -234,161 +407,52 @@ int OpenGLWindow::setRotation(int angle)
     return angle;
 }
 
-void OpenGLWindow::releasePos(Qt::MouseButton mbType)
+void OpenGLWindow::releasePos(CameraParam &camera, Qt::MouseButton mbType)
 {
     QMatrix4x4 mat;
     switch (mbType)
     {
     case Qt::LeftButton:
     case Qt::MiddleButton:
-        mat.rotate(qreal(m_camera.m_zRot) / 16.0f, 0.0f, 0.0f, 1.0f);
-        mat.rotate(qreal(m_camera.m_yRot) / 16.0f, 0.0f, 1.0f, 0.0f);
-        mat.rotate(qreal(m_camera.m_xRot) / 16.0f, 1.0f, 0.0f, 0.0f);
-        m_camera.m_rotation = mat * m_camera.m_rotation;
-        m_camera.m_xRot = 0;
-        m_camera.m_yRot = 0;
-        m_camera.m_zRot = 0;
+        mat.rotate(qreal(camera.m_zRot) / 16.0f, 0.0f, 0.0f, 1.0f);
+        mat.rotate(qreal(camera.m_yRot) / 16.0f, 0.0f, 1.0f, 0.0f);
+        mat.rotate(qreal(camera.m_xRot) / 16.0f, 1.0f, 0.0f, 0.0f);
+        camera.m_rotation = mat * camera.m_rotation;
+        camera.m_xRot = 0;
+        camera.m_yRot = 0;
+        camera.m_zRot = 0;
         break;
     case Qt::RightButton:
-        mat.translate(m_camera.m_xTrans, -1.0 * m_camera.m_yTrans, 0);
-        m_camera.m_translation = mat * m_camera.m_translation;
-        m_camera.m_xTrans = 0;
-        m_camera.m_yTrans = 0;
+        mat.translate(camera.m_xTrans, -1.0 * camera.m_yTrans, 0);
+        camera.m_translation = mat * camera.m_translation;
+        camera.m_xTrans = 0;
+        camera.m_yTrans = 0;
         break;
     default:
         break;
     }
 }
 
-void OpenGLWindow::initializeMesh()
+void OpenGLWindow::setLightUniforms(const CameraParam &camera)
 {
-    if (!m_modelMeshsPtr)
-        return;
-
-    for (auto &modelMesh : *m_modelMeshsPtr)
-    {
-        for (auto &texture : modelMesh.m_textures)
-        {
-            unsigned int textureID;
-            glGenTextures(1, &textureID);
-            if (!texture.m_data)
-            {
-                spdlog::error("image data is null.");
-                continue;
-            }
-
-            GLenum format = GL_RGBA;
-            if (texture.m_channel == 1)
-                format = GL_RED;
-            else if (texture.m_channel == 3)
-                format = GL_RGB;
-            else if (texture.m_channel == 4)
-                format = GL_RGBA;
-
-            glBindTexture(GL_TEXTURE_2D, textureID);
-            glTexImage2D(GL_TEXTURE_2D, 0, format, texture.m_width, texture.m_height, 0, format, GL_UNSIGNED_BYTE, texture.m_data);
-            glGenerateMipmap(GL_TEXTURE_2D);
-
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-            ModelLoadManager::instance()->cleanImageData(texture.m_data);
-
-            texture.m_id = textureID;
-        }
-
-        glGenVertexArrays(1, &modelMesh.m_VAO);
-        glGenBuffers(1, &modelMesh.m_VBO);
-        glGenBuffers(1, &modelMesh.m_EBO);
-
-        glBindVertexArray(modelMesh.m_VAO);
-        glBindBuffer(GL_ARRAY_BUFFER, modelMesh.m_VBO);
-        glBufferData(GL_ARRAY_BUFFER, modelMesh.m_vertices.size() * sizeof(ModelLoadManager::Vertex), &modelMesh.m_vertices[0], GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, modelMesh.m_EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, modelMesh.m_indices.size() * sizeof(unsigned int), &modelMesh.m_indices[0], GL_STATIC_DRAW);
-
-        // vertex Positions
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ModelLoadManager::Vertex), (void *)0);
-        glEnableVertexAttribArray(0);
-
-        // vertex normals
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(ModelLoadManager::Vertex), (void *)offsetof(ModelLoadManager::Vertex, m_normals));
-        glEnableVertexAttribArray(1);
-
-        // vertex texture coords
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(ModelLoadManager::Vertex), (void *)offsetof(ModelLoadManager::Vertex, m_texCoords));
-        glEnableVertexAttribArray(2);
-
-        // vertex tangent
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(ModelLoadManager::Vertex), (void *)offsetof(ModelLoadManager::Vertex, m_tangents));
-        glEnableVertexAttribArray(3);
-
-        // vertex bitangent
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(ModelLoadManager::Vertex), (void *)offsetof(ModelLoadManager::Vertex, m_bitangents));
-        glEnableVertexAttribArray(4);
-
-        // ids
-        glVertexAttribIPointer(5, 4, GL_INT, sizeof(ModelLoadManager::Vertex), (void *)offsetof(ModelLoadManager::Vertex, m_boneIDs));
-        glEnableVertexAttribArray(5);
-
-        // weights
-        glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(ModelLoadManager::Vertex), (void *)offsetof(ModelLoadManager::Vertex, m_weights));
-        glEnableVertexAttribArray(6);
-
-        glBindVertexArray(0);
-    }
+    glUniform3f(glGetUniformLocation(m_glslProgramId, "lightPos"),
+                sLightPos[0], sLightPos[1], sLightPos[2]);
+    glUniform3f(glGetUniformLocation(m_glslProgramId, "lightColor"),
+                sLightColorLoc[0], sLightColorLoc[1], sLightColorLoc[2]);
+    glUniform3f(glGetUniformLocation(m_glslProgramId, "viewPos"),
+                camera.m_eye.x(), camera.m_eye.y(), camera.m_eye.z());
 }
 
-void OpenGLWindow::paintMesh()
+void OpenGLWindow::initializeWhiteTexture()
 {
-    if (!m_modelMeshsPtr)
-        return;
-
-    for (const auto &modelMesh : *m_modelMeshsPtr)
-    {
-        // bind appropriate textures
-        unsigned int diffuseNr = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr = 1;
-        unsigned int heightNr = 1;
-        for (unsigned int i = 0; i < modelMesh.m_textures.size(); i++)
-        {
-            unsigned int number = 1;
-            glActiveTexture(GL_TEXTURE0 + i);
-            if ("texture_diffuse" == modelMesh.m_textures[i].m_type)
-                number = diffuseNr++;
-            else if ("texture_specular" == modelMesh.m_textures[i].m_type)
-                number = specularNr++;
-            else if ("texture_normal" == modelMesh.m_textures[i].m_type)
-                number = normalNr++;
-            else if ("texture_height" == modelMesh.m_textures[i].m_type)
-                number = heightNr++;
-
-            // set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(m_glslProgramId, (modelMesh.m_textures[i].m_type + std::to_string(number)).c_str()), i);
-
-            // bind the texture
-            glBindTexture(GL_TEXTURE_2D, modelMesh.m_textures[i].m_id);
-        }
-
-        // light
-        glUniform3f(glGetUniformLocation(m_glslProgramId, "lightPos"),
-                    sLightPos[0], sLightPos[1], sLightPos[2]);
-        glUniform3f(glGetUniformLocation(m_glslProgramId, "lightColor"),
-                    sLightColorLoc[0], sLightColorLoc[1], sLightColorLoc[2]);
-        glUniform3f(glGetUniformLocation(m_glslProgramId, "viewPos"),
-                    m_camera.m_eye.x(), m_camera.m_eye.y(), m_camera.m_eye.z());
-
-        // draw mesh
-        glBindVertexArray(modelMesh.m_VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(modelMesh.m_indices.size()), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
-    }
+    // pages carry no material, they are shaded with a white diffuse texture
+    const unsigned char white[4] = {255, 255, 255, 255};
+    glGenTextures(1, &m_whiteTexture);
+    glBindTexture(GL_TEXTURE_2D, m_whiteTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 void OpenGLWindow::resizeEx(const QSize& size)
@@ -410,7 +474,7 @@ void OpenGLWindow::setBgColor(const QColor &color)
 {
     QRgb rgba = color.rgba();
     m_bgColor = {(float)qRed(rgba) / 255, (float)qGreen(rgba) / 255, (float)qBlue(rgba) / 255, (float)qAlpha(rgba) / 255};
-    repaint();
+    markDirty();
 }
 
 void OpenGLWindow::setWheelScale(float wheelScale)
@@ -420,18 +484,18 @@ void OpenGLWindow::setWheelScale(float wheelScale)
 
 void OpenGLWindow::startAnimation(int animationType)
 {
-    m_animationPos = 0;
-    m_animationLoopNum = 0;
+    m_animationSeconds = 0.0;
     m_animationType = (AnimationHelper::AnimationType)animationType;
-    m_animationTimer.setInterval(ANIMATION_TIME_INTERVAL);
-    m_animationTimer.start();
+    m_cameraAnimating = true;
+    m_frameScheduler.setAnimating(true);
 }
 
 void OpenGLWindow::stopAnimation()
 {
-    if (m_animationTimer.isActive())
+    if (m_cameraAnimating)
     {
-        m_animationTimer.stop();
+        m_cameraAnimating = false;
+        m_frameScheduler.setAnimating(hasClips());
 
         Qt::MouseButton mbType;
         switch (m_animationType)
@@ -446,7 +510,9 @@ void OpenGLWindow::stopAnimation()
         default:
             return;
         }
-        releasePos(mbType);
+        for (auto &viewport : m_viewports)
+            releasePos(viewport.m_camera, mbType);
+        markDirty();
     }
 }
 
@@ -457,103 +523,70 @@ void OpenGLWindow::onFpsTimeOut()
     m_fpsLabel->setPalette(pe);
     m_fpsLabel->setText(QString("%1(FPS): %2").arg(tr("frame rate")).arg(m_frameCount));
 
+    OpenGLTextureStreamer *streamer = OpenGLTextureStreamer::instance();
+    if (streamer->textureCount())
+    {
+        m_textureLabel->setPalette(pe);
+        m_textureLabel->setText(QString("%1(MB): %2 / %3").arg(tr("texture resident / requested"))
+                                    .arg(streamer->residentBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+                                    .arg(streamer->requestedBytes() / (1024.0 * 1024.0), 0, 'f', 1));
+        m_textureLabel->show();
+    }
+
+    // an idle window draws nothing, the counter sleeps until the next frame
+    if (!m_frameCount)
+        m_fpsTimer.stop();
     m_frameCount = 0;
 }
 
-void OpenGLWindow::onAnimationTimeOut()
+void OpenGLWindow::advanceAnimation(double seconds)
 {
-    switch (m_animationType)
-    {
-    case AnimationHelper::Turntable:
-        m_animationPos += TIMER_ROTATE_ANGLE;
-        m_camera.m_yRot = setRotation(m_animationPos);
-        break;
-    case AnimationHelper::Sway:
-        m_animationLoopNum = m_animationLoopNum % TIMER_ROTATE_NUM;
-        if (m_animationLoopNum < TIMER_ROTATE_NUM / 2)
-            m_animationPos += TIMER_ROTATE_ANGLE;
-        else
-            m_animationPos -= TIMER_ROTATE_ANGLE;
-        ++m_animationLoopNum;
-        m_camera.m_yRot = setRotation(m_animationPos);
-        break;
-    case AnimationHelper::Hover:
-    {
-        m_animationLoopNum = m_animationLoopNum % TIMER_ROTATE_NUM;
-        if (m_animationLoopNum < TIMER_ROTATE_NUM / 2)
-            m_animationPos -= TIMER_HOVER_HEIGHT;
-        else
-            m_animationPos += TIMER_HOVER_HEIGHT;
-        ++m_animationLoopNum;
-        qreal w_h_ratio = (qreal)(this->width()) / (qreal)(this->height());
-        qreal cube_view_height = 2 * m_camera.m_zoom * m_cameraDistance * qTan(qDegreesToRadians(m_camera.m_fovy / 2));
-        qreal cube_view_width = w_h_ratio * cube_view_height;
-        m_camera.m_yTrans = cube_view_height / qreal(height()) * qreal(m_animationPos);
-        break;
-    }
-    default:
+    // a model shown by several viewports moves once per frame
+    for (const auto &model : m_models)
+        model->advanceAnimation(seconds);
+    if (!m_cameraAnimating)
         return;
+
+    // sway and hover go back and forth over TIMER_ROTATE_NUM steps
+    m_animationSeconds += seconds;
+    const double steps = m_animationSeconds * 1000.0 / ANIMATION_TIME_INTERVAL;
+    const double phase = std::fmod(steps, (double)TIMER_ROTATE_NUM);
+    const double swing = phase < TIMER_ROTATE_NUM / 2 ? phase : TIMER_ROTATE_NUM - phase;
+    for (auto &viewport : m_viewports)
+    {
+        CameraParam &camera = viewport.m_camera;
+        switch (m_animationType)
+        {
+        case AnimationHelper::Turntable:
+            camera.m_yRot = setRotation(qRound(std::fmod(steps * TIMER_ROTATE_ANGLE, 360.0 * 16)));
+            break;
+        case AnimationHelper::Sway:
+            camera.m_yRot = setRotation(qRound(swing * TIMER_ROTATE_ANGLE));
+            break;
+        case AnimationHelper::Hover:
+        {
+            qreal cube_view_height = 2 * camera.m_zoom * viewport.m_cameraDistance * qTan(qDegreesToRadians(camera.m_fovy / 2));
+            camera.m_yTrans = cube_view_height / qreal(viewport.m_rect.height() ? viewport.m_rect.height() : 1) * (-swing * TIMER_HOVER_HEIGHT);
+            break;
+        }
+        default:
+            break;
+        }
+        viewport.m_dirty = true;
     }
-    repaint();
 }
 
 bool OpenGLWindow::compileGLSL()
 {
-    QFile vertFile(":/shader.vert");
-    QFile fragFile(":/shader.frag");
-    if (!vertFile.open(QIODevice::ReadOnly | QIODevice::Text))
-    {
-        spdlog::error("open vert file failed. path: {}", vertFile.fileName().toStdString());
+    // every window draws with the program of the registry, it is built once per process
+    m_glslProgramId = OpenGLProgramRegistry::instance()->program(":/shader.vert", ":/shader.frag");
+    if (!m_glslProgramId)
         return false;
-    }
-    if (!fragFile.open(QIODevice::ReadOnly | QIODevice::Text))
-    {
-        spdlog::error("open frag file failed. path: {}", fragFile.fileName().toStdString());
-        return false;
-    }
-    QByteArray vShaderBA = vertFile.readAll();
-    QByteArray fShaderBA = fragFile.readAll();
-    // QByteArray 必须存在，不能是临时的
-    const char *vShaderCode = vShaderBA.constData();
-    const char *fShaderCode = fShaderBA.constData();
-    
-    // compile shaders
-    GLint success = 0;
-    unsigned int vertex, fragment;
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        spdlog::error("compile vertex shader failed. id: {}.", vertex);
-        return false;
-    }
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        spdlog::error("compile fragment shader failed. id: {}.", fragment);
-        return false;
-    }
 
-    // shader Program
-    m_glslProgramId = glCreateProgram();
-    glAttachShader(m_glslProgramId, vertex);
-    glAttachShader(m_glslProgramId, fragment);
-    glLinkProgram(m_glslProgramId);
-    glGetProgramiv(m_glslProgramId, GL_LINK_STATUS, &success);
-    if (!success)
-    {
-        spdlog::error("compile program failed. id: {}, error: {}", m_glslProgramId, success);
-        return false;
-    }
-
-    // delete the shaders as they're linked into our program now and no longer necessary
-    glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    // the bone sampler keeps its own unit, samplers of different types must not share one
+    glUseProgram(m_glslProgramId);
+    glUniform1i(glGetUniformLocation(m_glslProgramId, "boneMatrices"), BONE_TEXTURE_UNIT);
+    glUseProgram(0);
 
     return true;
 }
@@ -2,8 +2,10 @@
 #define __OPENGL_WINDOW_H__
 
 #include "i_draw_interface.h"
+#include "opengl_model.h"
 #include "utils/model_loader_manager.h"
 #include "utils/utils.h"
+#include "utils/frame_scheduler.h"
 #include <QTimer>
 #include <QMouseEvent>
 #include <QOpenGLWidget>
@@ -39,8 +41,22 @@ public:
         float m_zFar = 10000.0;             // 透视矩阵视野最大值
     };
 
+    // one model drawn into a cell of the window, every viewport has its own camera
+    struct Viewport
+    {
+        std::shared_ptr<OpenGLModel> m_model;
+        CameraParam m_camera;
+        int m_cameraDistance = 20;
+        QRect m_rect;               // widget coordinates, picks the viewport under the mouse
+        QRect m_pixelRect;          // framebuffer pixels, the origin is the bottom left corner
+        bool m_dirty = true;        // the image of the viewport is out of date
+        bool m_sharedModel = false; // another viewport draws the same model
+    };
+
 public:
     explicit OpenGLWindow(const QString &modelPath, const QColor &color, QWidget *parent = Q_NULLPTR);
+    // draws every model in its own viewport of a grid, models listed twice are uploaded once
+    explicit OpenGLWindow(const QStringList &modelPaths, const QColor &color, QWidget *parent = Q_NULLPTR);
     ~OpenGLWindow();
     void resizeEx(const QSize &size) override;
     void showEx() override;
@@ -49,7 +65,8 @@ public:
     void setWheelScale(float wheelScale) override;
     void startAnimation(int animationType) override;
     void stopAnimation() override;
-    QString getModelPath() const override { return m_modelPath; }
+    QStringList getModelPaths() const override { return m_modelPaths; }
+    quint64 frameCount() const { return m_totalFrameCount; }
 
 protected:
     void initializeGL() override;
@@ -62,23 +79,29 @@ protected:
 
 public slots:
     void onFpsTimeOut();
-    void onAnimationTimeOut();
 
 private:
     void initializeFpsLabel();
-    void initializeZoom();
-    void initializeMesh();
-    void paintMesh();
+    void initializeZoom(Viewport &viewport);
+    void initializeWhiteTexture();
+    void layoutViewports();
+    int viewportAt(const QPoint &pos) const;
+    void markDirty();
+    bool hasClips() const;
+    void advanceAnimation(double seconds);
+    bool paintViewport(Viewport &viewport);
+    void setLightUniforms(const CameraParam &camera);
     bool compileGLSL();
-    void releasePos(Qt::MouseButton mbType);
+    void releasePos(CameraParam &camera, Qt::MouseButton mbType);
     int setRotation(int angle);
 
 private:
-    QString m_modelPath;
+    QStringList m_modelPaths;
     QScopedPointer<QOpenGLShaderProgram> m_shaderProgram;
-    std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> m_modelMeshsPtr;
-    int m_cameraDistance = 20;
-    CameraParam m_camera;
+    std::vector<std::shared_ptr<OpenGLModel>> m_models;
+    std::vector<Viewport> m_viewports;
+    int m_activeViewport = -1; // viewport the mouse is dragging
+    unsigned int m_whiteTexture = 0;
     std::array<GLclampf, 4> m_bgColor;
     
     int m_mouseFlag = Qt::NoButton;
@@ -86,14 +109,16 @@ private:
     QPoint m_mousePos;
 
     QTimer m_fpsTimer;
-    QTimer m_animationTimer;
+    FrameScheduler m_frameScheduler;
     int m_frameCount = 0;
+    quint64 m_totalFrameCount = 0;
     float m_wheelScale = 1.0;
     AnimationHelper::AnimationType m_animationType = AnimationHelper::Turntable;
-    int m_animationPos;
-    int m_animationLoopNum = 0;
+    bool m_cameraAnimating = false;
+    double m_animationSeconds = 0.0;
     unsigned int m_glslProgramId = 0;
     QLabel *m_fpsLabel = nullptr;
+    QLabel *m_textureLabel = nullptr; // resident and requested bytes of the streamed textures
 };
 
 #endif
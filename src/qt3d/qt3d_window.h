@@ -26,7 +26,8 @@ public:
     void showEx() override;
     void hideEx() override;
     void setBgColor(const QColor &color) override;
-    QString getModelPath() const override { return m_modelPath; }
+    QString getModelPath() const { return m_modelPath; }
+    QStringList getModelPaths() const override { return m_modelPath.isEmpty() ? QStringList() : QStringList{m_modelPath}; }
     void setWheelScale(float wheelScale){}
     void startAnimation(int animationType){}
     void stopAnimation(){}
@@ -7,6 +7,9 @@
 
 static const std::array<float, 7> gWheelScales{0.10, 0.40, 0.70, 1.0, 2.0, 5.0, 10.0};
 
+// models kept uploaded per backend, switching back to one of them only shows its window again
+#define RENDER_WINDOW_CACHE_SIZE 3
+
 RenderContainer::RenderContainer(RenderMode renderMode, QWidget *parent)
     : QWidget(parent), m_renderMode(renderMode)
 {
@@ -15,46 +18,52 @@ RenderContainer::RenderContainer(RenderMode renderMode, QWidget *parent)
 
 RenderContainer::~RenderContainer()
 {
-    for (const auto renderWindow : m_renderWindows)
+    for (const auto &renderWindows : m_renderWindows)
     {
-        if (renderWindow != nullptr)
+        for (const auto renderWindow : renderWindows)
             delete renderWindow;
     }
 }
 
 void RenderContainer::resizeEvent(QResizeEvent *e)
 {
-    m_renderWindows[m_renderMode]->resizeEx(e->size());
+    currentWindow()->resizeEx(e->size());
     return QWidget::resizeEvent(e);
 }
 
 void RenderContainer::setDrawMode(RenderMode renderMode)
 {
-    m_renderWindows[m_renderMode]->hideEx();
+    currentWindow()->hideEx();
     m_renderMode = (RenderMode)renderMode;
     reloadRenderWindow();
-    m_renderWindows[m_renderMode]->resizeEx(size());
-    m_renderWindows[m_renderMode]->showEx();
+    currentWindow()->resizeEx(size());
+    currentWindow()->showEx();
 }
 
 void RenderContainer::loadModel(const QString &modelPath)
 {
-    if (modelPath.isEmpty() || !m_modelPath.compare(modelPath))
+    loadModels(modelPath.isEmpty() ? QStringList() : QStringList{modelPath});
+}
+
+void RenderContainer::loadModels(const QStringList &modelPaths)
+{
+    if (modelPaths.isEmpty() || m_modelPaths == modelPaths)
     {
-        spdlog::warn("modelPath is error. modelPath: {}, m_modelPath: {}", modelPath.toStdString(), m_modelPath.toStdString());
+        spdlog::warn("modelPaths is error. modelPaths: {}, m_modelPaths: {}", modelPaths.join(";").toStdString(), m_modelPaths.join(";").toStdString());
         return;
     }
 
-    m_modelPath = modelPath;
+    currentWindow()->hideEx();
+    m_modelPaths = modelPaths;
     reloadRenderWindow();
-    m_renderWindows[m_renderMode]->resizeEx(size());
-    m_renderWindows[m_renderMode]->showEx();
+    currentWindow()->resizeEx(size());
+    currentWindow()->showEx();
 }
 
 void RenderContainer::setBgColor(const QColor &color)
 {
     m_color = color;
-    m_renderWindows[m_renderMode]->setBgColor(m_color);
+    currentWindow()->setBgColor(m_color);
 }
 
 void RenderContainer::setWheelScale(int index)
@@ -65,47 +74,65 @@ void RenderContainer::setWheelScale(int index)
         return;
     }
 
-    m_renderWindows[m_renderMode]->setWheelScale(gWheelScales[index]);
+    m_wheelScale = gWheelScales[index];
+    currentWindow()->setWheelScale(m_wheelScale);
 }
 
 void RenderContainer::startAnimation(int index)
 {
     m_animationType = index;
-    m_renderWindows[m_renderMode]->stopAnimation();
-    m_renderWindows[m_renderMode]->startAnimation(m_animationType);
+    currentWindow()->stopAnimation();
+    currentWindow()->startAnimation(m_animationType);
 }
 
 void RenderContainer::stopAnimation()
 {
-    m_renderWindows[m_renderMode]->stopAnimation();
+    currentWindow()->stopAnimation();
 }
 
 void RenderContainer::reloadRenderWindow()
 {
     emit sigRenderWindowChange(m_renderMode);
 
-    auto it = m_renderWindows.find(m_renderMode);
-    if (m_renderWindows.end() != it && !(*it)->getModelPath().compare(m_modelPath))
-        return;
-    
-    if (m_renderWindows.end() == it)
-        m_renderWindows.insert(m_renderMode, nullptr);
-    else if (nullptr != m_renderWindows[m_renderMode])
+    // only the opengl backend draws a grid, the others show the first model
+    QStringList modelPaths = m_modelPaths;
+    if (OPNEGL_MODE != m_renderMode && modelPaths.size() > 1)
     {
-        delete m_renderWindows[m_renderMode];
-        m_renderWindows[m_renderMode] = nullptr;
+        spdlog::warn("viewports are drawn by the opengl backend only, {} models are not shown.", modelPaths.size() - 1);
+        modelPaths = modelPaths.mid(0, 1);
     }
+    const QString modelPath = modelPaths.value(0);
 
+    QList<IDrawInterface*> &renderWindows = m_renderWindows[m_renderMode];
+    for (int i = 0; i < renderWindows.size(); ++i)
+    {
+        if (renderWindows[i]->getModelPaths() != modelPaths)
+            continue;
+
+        // the model is still uploaded, only the settings changed while it was hidden are applied
+        renderWindows.move(i, 0);
+        renderWindows.front()->setBgColor(m_color);
+        renderWindows.front()->setWheelScale(m_wheelScale);
+        return;
+    }
+
+    IDrawInterface *renderWindow = nullptr;
     switch (m_renderMode)
     {
     case VULKAN_MODE:
-        m_renderWindows[m_renderMode] = new VulkanWindowContainer(m_modelPath, m_color, this);
+        renderWindow = new VulkanWindowContainer(modelPath, m_color, this);
         break;
     case QT3D_MODE:
-        m_renderWindows[m_renderMode] = new Qt3DWindowContainer(m_modelPath, m_color, this);
+        renderWindow = new Qt3DWindowContainer(modelPath, m_color, this);
         break;
     default:
-        m_renderWindows[m_renderMode] = new OpenGLWindow(m_modelPath, m_color, this);
+        renderWindow = new OpenGLWindow(modelPaths, m_color, this);
         break;
     }
+    renderWindow->setWheelScale(m_wheelScale);
+    renderWindows.prepend(renderWindow);
+
+    // the least recently shown model gives its gpu memory back
+    while (renderWindows.size() > RENDER_WINDOW_CACHE_SIZE)
+        delete renderWindows.takeLast();
 }
@@ -20,6 +20,8 @@ public:
     ~RenderContainer();
     void setDrawMode(RenderMode drawmode);
     void loadModel(const QString &modelPath);
+    // several models are drawn side by side in a grid of viewports sharing one context
+    void loadModels(const QStringList &modelPaths);
     void setBgColor(const QColor &color);
     void setWheelScale(int index);
     void startAnimation(int index);
@@ -33,13 +35,16 @@ protected:
 
 private:
     void reloadRenderWindow();
+    IDrawInterface *currentWindow() const { return m_renderWindows.value(m_renderMode).front(); }
 
 private:
-    QMap<RenderMode, IDrawInterface*> m_renderWindows;
+    // windows of every backend, most recently used first, a hidden window keeps the gpu resources of its model
+    QMap<RenderMode, QList<IDrawInterface*>> m_renderWindows;
     RenderMode m_renderMode;
     QColor m_color;
+    float m_wheelScale = 1.0;
     int m_animationType = 0;
-    QString m_modelPath;
+    QStringList m_modelPaths;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,32 @@
+#version 440
+
+layout(location = 0) in vec4 position;
+layout(location = 1) in vec3 normal;
+
+// per-instance model matrix, one column per location
+layout(location = 2) in vec4 instModel0;
+layout(location = 3) in vec4 instModel1;
+layout(location = 4) in vec4 instModel2;
+layout(location = 5) in vec4 instModel3;
+
+layout(location = 0) out vec3 vECVertNormal;
+layout(location = 1) out vec3 vECVertPos;
+layout(location = 2) flat out vec3 vDiffuseAdjust;
+
+layout(std140, binding = 0) uniform buf {
+    mat4 vp;
+    mat4 model;
+    mat3 modelNormal;
+} ubuf;
+
+out gl_PerVertex { vec4 gl_Position; };
+
+void main()
+{
+    mat4 instModel = mat4(instModel0, instModel1, instModel2, instModel3);
+    mat4 model = ubuf.model * instModel;
+    vECVertNormal = normalize(ubuf.modelNormal * transpose(inverse(mat3(instModel))) * normal);
+    vECVertPos = vec3(model * position);
+    vDiffuseAdjust = vec3(0.0);
+    gl_Position = ubuf.vp * model * position;
+}
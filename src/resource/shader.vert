@@ -2,6 +2,9 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 5) in ivec4 aBoneIDs;
+layout (location = 6) in vec4 aWeights;
+layout (location = 7) in mat4 aInstance;
 
 out vec3 FragPos;
 out vec3 Normal;
@@ -10,11 +13,30 @@ out vec2 TexCoords;
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
+uniform bool skinned;
+uniform samplerBuffer boneMatrices; // four texels per bone, one per column
+
+mat4 boneMatrix(int bone)
+{
+    return mat4(texelFetch(boneMatrices, bone * 4), texelFetch(boneMatrices, bone * 4 + 1),
+                texelFetch(boneMatrices, bone * 4 + 2), texelFetch(boneMatrices, bone * 4 + 3));
+}
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
-    FragPos = vec3(model * vec4(aPos, 1.0f));
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    vec4 position = vec4(aPos, 1.0f);
+    vec3 normal = aNormal;
+    if (skinned)
+    {
+        mat4 skin = aWeights.x * boneMatrix(aBoneIDs.x) + aWeights.y * boneMatrix(aBoneIDs.y) +
+                    aWeights.z * boneMatrix(aBoneIDs.z) + aWeights.w * boneMatrix(aBoneIDs.w);
+        position = skin * position;
+        normal = mat3(skin) * normal;
+    }
+
+    mat4 instanceModel = model * aInstance;
+    gl_Position = projection * view * instanceModel * position;
+    FragPos = vec3(instanceModel * position);
+    Normal = mat3(transpose(inverse(instanceModel))) * normal;
     TexCoords = vec2(aTexCoords.x, aTexCoords.y * (-1.0f));
-}
\ No newline at end of file
+}
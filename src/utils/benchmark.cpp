@@ -0,0 +1,883 @@
+﻿#include "benchmark.h"
+#include "model_loader_manager.h"
+#include "model_import_queue.h"
+#include "block_codec.h"
+#include "model_disk_cache.h"
+#include "parallel_for.h"
+#include "tangent_space.h"
+#include "opengl/opengl_window.h"
+#include "vulkan/vulkan_window.h"
+#include <spdlog/spdlog.h>
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QThread>
+#include <atomic>
+#include <QEventLoop>
+#include <QTimer>
+#include <QtMath>
+#include <cstring>
+#include <cfloat>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define BENCHMARK_FRAME_RATE 60
+#define BENCHMARK_WARMUP_FRAMES 10
+#define BENCHMARK_FRAMES 120
+#define BENCHMARK_MAX_CHARACTERS (1 << 20)
+#define BENCHMARK_IDLE_SETTLE_MS 2000
+#define BENCHMARK_IDLE_MEASURE_MS 5000
+#define BENCHMARK_VIEWPORTS 16
+#define BENCHMARK_IMPORTS 5
+#define BENCHMARK_NORMAL_MEAN_DEGREES 1.0  // mean angle to assimp's smooth normals above which the tangent space benchmark fails
+#define BENCHMARK_TANGENT_MEAN_DEGREES 5.0 // assimp's tangents are not MikkTSpace, they differ more
+#define BENCHMARK_SCAN_TRIANGLES 20000000ll        // triangles of the synthetic scans, --benchmark scans <count> sets another count
+#define BENCHMARK_SCAN_ASSIMP_TRIANGLES 10000000ll // larger scans are not read by assimp as well, it takes minutes and tens of GB
+
+namespace
+{
+    static void waitEvents(int msecs)
+    {
+        QEventLoop loop;
+        QTimer::singleShot(msecs, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+
+    // a wavy height field over the unit square, like the surface a scanner sees
+    static void scanPosition(int side, int x, int y, float *position)
+    {
+        position[0] = (float)x / side;
+        position[1] = (float)y / side;
+        position[2] = 0.02f * std::sin(x * 0.05f) * std::cos(y * 0.03f);
+    }
+
+    // two triangles per grid cell, every triangle repeats its corners like scanners write them, the facet normals are left zero
+    static bool writeScanStl(const QString &path, int side)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        const char header[80] = {};
+        const quint32 triangleCount = (quint32)((qint64)side * side * 2);
+        file.write(header, sizeof(header));
+        file.write(reinterpret_cast<const char *>(&triangleCount), sizeof(triangleCount));
+        QByteArray row(side * 2 * 50, 0);
+        for (int y = 0; y < side; ++y)
+        {
+            char *record = row.data();
+            for (int x = 0; x < side; ++x)
+            {
+                const int triangles[2][3][2] = {{{x, y}, {x + 1, y}, {x + 1, y + 1}}, {{x, y}, {x + 1, y + 1}, {x, y + 1}}};
+                for (const auto &triangle : triangles)
+                {
+                    float values[12] = {};
+                    for (int corner = 0; corner < 3; ++corner)
+                        scanPosition(side, triangle[corner][0], triangle[corner][1], values + 3 + corner * 3);
+                    memcpy(record, values, sizeof(values));
+                    record += 50;
+                }
+            }
+            if (file.write(row) != row.size())
+                return false;
+        }
+        return true;
+    }
+
+    // the same grid as an indexed mesh with vertex normals
+    static bool writeScanPly(const QString &path, int side)
+    {
+        QFile file(path);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        const qint64 vertexCount = (qint64)(side + 1) * (side + 1);
+        file.write(QString("ply\nformat binary_little_endian 1.0\nelement vertex %1\nproperty float x\nproperty float y\nproperty float z\n"
+                           "property float nx\nproperty float ny\nproperty float nz\nelement face %2\nproperty list uchar int vertex_indices\nend_header\n")
+                       .arg(vertexCount)
+                       .arg((qint64)side * side * 2)
+                       .toLatin1());
+        QByteArray row((side + 1) * 6 * (int)sizeof(float), 0);
+        for (int y = 0; y <= side; ++y)
+        {
+            float *vertex = reinterpret_cast<float *>(row.data());
+            for (int x = 0; x <= side; ++x, vertex += 6)
+            {
+                // normal from the neighbours of the vertex
+                float dx[2][3], dy[2][3];
+                scanPosition(side, x - 1, y, dx[0]);
+                scanPosition(side, x + 1, y, dx[1]);
+                scanPosition(side, x, y - 1, dy[0]);
+                scanPosition(side, x, y + 1, dy[1]);
+                const QVector3D normal = QVector3D::crossProduct(QVector3D(dx[1][0] - dx[0][0], dx[1][1] - dx[0][1], dx[1][2] - dx[0][2]),
+                                                                 QVector3D(dy[1][0] - dy[0][0], dy[1][1] - dy[0][1], dy[1][2] - dy[0][2]))
+                                             .normalized();
+                scanPosition(side, x, y, vertex);
+                vertex[3] = normal.x();
+                vertex[4] = normal.y();
+                vertex[5] = normal.z();
+            }
+            if (file.write(row) != row.size())
+                return false;
+        }
+        row.resize(side * 2 * 13);
+        for (int y = 0; y < side; ++y)
+        {
+            char *face = row.data();
+            for (int x = 0; x < side; ++x)
+            {
+                const qint32 a = y * (side + 1) + x, b = a + 1, c = a + side + 2, d = a + side + 1;
+                const qint32 triangles[2][3] = {{a, b, c}, {a, c, d}};
+                for (const auto &triangle : triangles)
+                {
+                    *face = 3;
+                    memcpy(face + 1, triangle, sizeof(triangle));
+                    face += 13;
+                }
+            }
+            if (file.write(row) != row.size())
+                return false;
+        }
+        return true;
+    }
+}
+
+int Benchmark::run(const QStringList &arguments)
+{
+    const int index = arguments.indexOf("--benchmark");
+    if (index < 0 || index + 1 >= arguments.size())
+    {
+        spdlog::error("benchmark needs a model path. usage: --benchmark <model path>");
+        return 1;
+    }
+    const QString modelPath = arguments[index + 1];
+    if (modelPath == "scans")
+        return runScanImport(index + 2 < arguments.size() ? arguments[index + 2].toLongLong() : BENCHMARK_SCAN_TRIANGLES);
+    if (QFileInfo(modelPath).isDir())
+        return runBatchImport(modelPath);
+    if (const int result = runGlbImport(modelPath))
+        return result;
+    if (const int result = runImportProfiles(modelPath))
+        return result;
+    if (const int result = runTangentSpace(modelPath))
+        return result;
+    if (const int result = runBlockCodec(modelPath))
+        return result;
+    if (const int result = runMeshCodec(modelPath))
+        return result;
+    if (const int result = runVertexStreams(modelPath))
+        return result;
+    std::shared_ptr<const ModelAnimation> animationPtr;
+    if (ModelLoadManager::instance()->getAnimation(modelPath, animationPtr))
+    {
+        if (const int result = runSkinning(modelPath))
+            return result;
+    }
+    else
+        spdlog::info("model has no animation, skinning benchmark skipped. path: {}", modelPath.toStdString());
+    if (const int result = runIdle(modelPath))
+        return result;
+    return runViewports(modelPath);
+}
+
+int Benchmark::runSkinning(const QString &modelPath)
+{
+    // every character owns its pose, the clip and skeleton are shared
+    struct Character
+    {
+        SceneGraph m_sceneGraph;
+        std::vector<float> m_palette;
+        double m_phase = 0.0;
+    };
+
+    std::shared_ptr<const ModelAnimation> animationPtr;
+    SceneGraph sceneGraph;
+    if (!ModelLoadManager::instance()->getAnimation(modelPath, animationPtr) || !ModelLoadManager::instance()->getSceneGraph(modelPath, sceneGraph))
+    {
+        spdlog::error("model has no skeleton or animation. path: {}", modelPath.toStdString());
+        return 1;
+    }
+    const ModelAnimation &animation = *animationPtr;
+    const int clip = animation.m_clips.empty() ? -1 : 0;
+    spdlog::info("skinning benchmark. model: {0}, bones: {1}, nodes: {2}, clips: {3}", modelPath.toStdString(), animation.boneCount(),
+                 sceneGraph.nodeCount(), animation.m_clips.size());
+
+    // doubles the characters until the pose of one frame no longer fits into the frame time
+    const double frameBudget = 1000.0 / BENCHMARK_FRAME_RATE;
+    std::vector<Character> characters;
+    double perCharacter = 0.0;
+    int fittingCount = 0;
+    for (int count = 1; count <= BENCHMARK_MAX_CHARACTERS; count *= 2)
+    {
+        while ((int)characters.size() < count)
+        {
+            Character character;
+            character.m_sceneGraph = sceneGraph;
+            character.m_palette.resize(animation.boneCount() * SCENE_MATRIX_FLOAT_COUNT);
+            character.m_phase = characters.size() * 0.37;
+            characters.emplace_back(std::move(character));
+        }
+
+        QElapsedTimer timer;
+        for (int frame = -BENCHMARK_WARMUP_FRAMES; frame < BENCHMARK_FRAMES; ++frame)
+        {
+            if (!frame)
+                timer.start();
+            const double seconds = (double)frame / BENCHMARK_FRAME_RATE;
+            parallelFor(0, count, [&](int i)
+                        {
+                            Character &character = characters[i];
+                            SkeletalAnimation::evaluate(animation, clip, seconds + character.m_phase, character.m_sceneGraph, character.m_palette.data()); },
+                        16);
+        }
+        const double frameTime = timer.nsecsElapsed() / 1e6 / BENCHMARK_FRAMES;
+        perCharacter = frameTime / count;
+        spdlog::info("characters: {0}, pose time per frame: {1:.3f} ms", count, frameTime);
+        if (frameTime > frameBudget)
+            break;
+        fittingCount = count;
+    }
+
+    const int estimate = perCharacter > 0.0 ? (int)(frameBudget / perCharacter) : fittingCount;
+    spdlog::info("skinned characters per frame at {0} FPS: {1} measured, about {2} by the last per character cost. "
+                 "poses are evaluated on {3} threads, skinning itself runs in the vertex shader.",
+                 BENCHMARK_FRAME_RATE, fittingCount, estimate, QThreadPool::globalInstance()->maxThreadCount());
+    return 0;
+}
+
+int Benchmark::runVertexStreams(const QString &modelPath)
+{
+    // the cpu passes over positions and normals of both layouts of the same vertices, the model is imported interleaved
+    std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> modelMeshsPtr;
+    if (!ModelLoadManager::instance()->import3DModel(modelPath, modelMeshsPtr))
+    {
+        spdlog::error("import model failed. path: {}", modelPath.toStdString());
+        return 1;
+    }
+    std::vector<const ModelLoadManager::ModelMesh *> interleaved;
+    qint64 vertexCount = 0;
+    for (const auto &modelMesh : *modelMeshsPtr)
+    {
+        if (!modelMesh.m_vertices.empty())
+            interleaved.emplace_back(&modelMesh);
+        vertexCount += modelMesh.m_vertices.size();
+    }
+    if (!vertexCount)
+    {
+        spdlog::info("model has no interleaved vertices, vertex streams benchmark skipped. path: {}", modelPath.toStdString());
+        return 0;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<ModelLoadManager::ModelMesh> streamed(interleaved.size());
+    for (size_t i = 0; i < interleaved.size(); ++i)
+        ModelLoadManager::toVertexStreams(interleaved[i]->m_vertices, interleaved[i]->m_skinned, streamed[i].m_streams);
+    const double splitTime = timer.nsecsElapsed() / 1e6;
+
+    // bounds of every mesh, and the position and normal streams the vulkan renderer binds
+    std::vector<float> packed(vertexCount * 6);
+    float checksum = 0.0f;
+    auto measure = [&](const std::function<const ModelLoadManager::ModelMesh &(size_t)> &mesh, double &boundsTime, double &packTime)
+    {
+        QElapsedTimer passTimer;
+        passTimer.start();
+        for (int frame = 0; frame < BENCHMARK_FRAMES; ++frame)
+        {
+            for (size_t i = 0; i < interleaved.size(); ++i)
+            {
+                float min[3], max[3];
+                VertexStreams::bounds(mesh(i).positions(), mesh(i).vertexCount(), min, max);
+                checksum += max[0] - min[0];
+            }
+        }
+        boundsTime = passTimer.nsecsElapsed() / 1e6 / BENCHMARK_FRAMES;
+        passTimer.restart();
+        for (int frame = 0; frame < BENCHMARK_FRAMES; ++frame)
+        {
+            float *positions = packed.data();
+            float *normals = positions + vertexCount * 3;
+            for (size_t i = 0; i < interleaved.size(); ++i)
+            {
+                const ModelLoadManager::ModelMesh &modelMesh = mesh(i);
+                const int count = modelMesh.vertexCount();
+                if (!modelMesh.m_streams.empty())
+                {
+                    memcpy(positions, modelMesh.m_streams.m_positions.data(), count * 3 * sizeof(float));
+                    memcpy(normals, modelMesh.m_streams.m_normals.data(), count * 3 * sizeof(float));
+                }
+                else
+                {
+                    const VertexStreams::View p = modelMesh.positions(), n = modelMesh.normals();
+                    for (int v = 0; v < count; ++v)
+                    {
+                        memcpy(positions + v * 3, p[v], 3 * sizeof(float));
+                        memcpy(normals + v * 3, n[v], 3 * sizeof(float));
+                    }
+                }
+                positions += count * 3;
+                normals += count * 3;
+            }
+            checksum += packed[frame % packed.size()];
+        }
+        packTime = passTimer.nsecsElapsed() / 1e6 / BENCHMARK_FRAMES;
+    };
+
+    double interleavedBounds = 0.0, interleavedPack = 0.0, streamBounds = 0.0, streamPack = 0.0;
+    measure([&](size_t i) -> const ModelLoadManager::ModelMesh &
+            { return *interleaved[i]; },
+            interleavedBounds, interleavedPack);
+    measure([&](size_t i) -> const ModelLoadManager::ModelMesh &
+            { return streamed[i]; },
+            streamBounds, streamPack);
+    spdlog::info("vertex streams benchmark. model: {0}, vertices: {1}, split into streams: {2:.3f} ms, avx2: {3}",
+                 modelPath.toStdString(), vertexCount, splitTime, VertexStreams::hasAvx2());
+    spdlog::info("bounds: interleaved {0:.3f} ms, streams {1:.3f} ms, speedup {2:.2f}x", interleavedBounds, streamBounds,
+                 interleavedBounds / qMax(streamBounds, 1e-6));
+    spdlog::info("position and normal streams: interleaved {0:.3f} ms, streams {1:.3f} ms, speedup {2:.2f}x (checksum {3})", interleavedPack,
+                 streamPack, interleavedPack / qMax(streamPack, 1e-6), checksum);
+    return 0;
+}
+
+int Benchmark::runGlbImport(const QString &modelPath)
+{
+    if (QFileInfo(modelPath).suffix().compare("glb", Qt::CaseInsensitive))
+    {
+        spdlog::info("model is not a glb file, glb import benchmark skipped. path: {}", modelPath.toStdString());
+        return 0;
+    }
+
+    // both readers decode the same textures, the difference is reading the file and building the meshes
+    auto measure = [&](bool nativeGlb, double &time, qint64 &vertexCount)
+    {
+        QVector<ModelLoadManager::ModelMesh> modelMeshs;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < BENCHMARK_IMPORTS; ++i)
+        {
+            ModelLoadManager::ImportOptions options = ModelLoadManager::instance()->importOptions();
+            options.m_nativeGlb = nativeGlb;
+            if (!ModelLoadManager::instance()->importUncached(modelPath, options, modelMeshs))
+                return false;
+        }
+        time = timer.nsecsElapsed() / 1e6 / BENCHMARK_IMPORTS;
+        vertexCount = 0;
+        for (const auto &modelMesh : modelMeshs)
+            vertexCount += modelMesh.m_vertices.size();
+        return true;
+    };
+
+    double nativeTime = 0.0, assimpTime = 0.0;
+    qint64 nativeVertices = 0, assimpVertices = 0;
+    if (!measure(true, nativeTime, nativeVertices) || !measure(false, assimpTime, assimpVertices))
+    {
+        spdlog::error("import model failed. path: {}", modelPath.toStdString());
+        return 1;
+    }
+    spdlog::info("glb import benchmark. model: {0}, vertices: native {1}, assimp {2}", modelPath.toStdString(), nativeVertices, assimpVertices);
+    spdlog::info("load time: native {0:.3f} ms, assimp {1:.3f} ms, speedup {2:.2f}x", nativeTime, assimpTime, assimpTime / qMax(nativeTime, 1e-6));
+    return 0;
+}
+
+int Benchmark::runScanImport(qint64 triangleCount)
+{
+    const int side = qMax(1, (int)std::sqrt(triangleCount / 2.0));
+    const QString folder = ModelDiskCache::cacheDir() + "/scan_benchmark";
+    const QString stlPath = folder + "/scan.stl", plyPath = folder + "/scan.ply";
+    QDir().mkpath(folder);
+    spdlog::info("scan import benchmark. triangles: {0}, grid vertices: {1}, threads: {2}, folder: {3}", (qint64)side * side * 2,
+                 (qint64)(side + 1) * (side + 1), QThreadPool::globalInstance()->maxThreadCount(), folder.toStdString());
+    if (!writeScanStl(stlPath, side) || !writeScanPly(plyPath, side))
+    {
+        spdlog::error("write scan files failed. folder: {}", folder.toStdString());
+        return 1;
+    }
+
+    // the files were just written, both readers find them in the page cache
+    auto measure = [&](const QString &path, bool nativeScans, double &time, qint64 &vertexCount)
+    {
+        ModelLoadManager::ImportOptions options = ModelLoadManager::instance()->importOptions();
+        options.m_nativeScans = nativeScans;
+        QVector<ModelLoadManager::ModelMesh> modelMeshs;
+        QElapsedTimer timer;
+        timer.start();
+        if (!ModelLoadManager::instance()->importUncached(path, options, modelMeshs))
+            return false;
+        time = timer.nsecsElapsed() / 1e9;
+        vertexCount = 0;
+        for (const auto &modelMesh : modelMeshs)
+            vertexCount += modelMesh.vertexCount();
+        return true;
+    };
+
+    int result = 0;
+    for (const QString &path : {stlPath, plyPath})
+    {
+        const double gigabytes = QFileInfo(path).size() / 1e9;
+        double nativeTime = 0.0, assimpTime = 0.0;
+        qint64 nativeVertices = 0, assimpVertices = 0;
+        if (!measure(path, true, nativeTime, nativeVertices))
+        {
+            spdlog::error("import scan failed. path: {}", path.toStdString());
+            result = 1;
+            continue;
+        }
+        // the stl corners are welded back into the grid
+        if (nativeVertices != (qint64)(side + 1) * (side + 1))
+        {
+            spdlog::error("scan has {0} vertices instead of the grid vertices. path: {1}", nativeVertices, path.toStdString());
+            result = 1;
+        }
+        spdlog::info("{0}: {1:.2f} GB, native {2:.3f} s, {3:.2f} GB/s, {4:.1f} M triangles/s", QFileInfo(path).fileName().toStdString(), gigabytes,
+                     nativeTime, gigabytes / qMax(nativeTime, 1e-9), side * (side * 2.0) / 1e6 / qMax(nativeTime, 1e-9));
+        if ((qint64)side * side * 2 > BENCHMARK_SCAN_ASSIMP_TRIANGLES)
+            continue;
+        if (!measure(path, false, assimpTime, assimpVertices))
+        {
+            spdlog::error("assimp import scan failed. path: {}", path.toStdString());
+            result = 1;
+            continue;
+        }
+        spdlog::info("{0}: assimp {1:.3f} s, {2:.2f} GB/s, vertices {3}, speedup {4:.2f}x", QFileInfo(path).fileName().toStdString(), assimpTime,
+                     gigabytes / qMax(assimpTime, 1e-9), assimpVertices, assimpTime / qMax(nativeTime, 1e-9));
+    }
+    QFile::remove(stlPath);
+    QFile::remove(plyPath);
+    return result;
+}
+
+int Benchmark::runImportProfiles(const QString &modelPath)
+{
+    // assimp reads the model in every profile, the native glb reader ignores them
+    ModelLoadManager::ImportOptions options = ModelLoadManager::instance()->importOptions();
+    options.m_nativeGlb = false;
+    QVector<ModelLoadManager::ModelMesh> modelMeshs;
+    if (!ModelLoadManager::instance()->importUncached(modelPath, options, modelMeshs))
+    {
+        spdlog::error("import model failed. path: {}", modelPath.toStdString());
+        return 1;
+    }
+
+    spdlog::info("import profiles benchmark. model: {0}, normal maps: {1}", modelPath.toStdString(), options.m_normalMaps);
+    for (int profile = 0; profile < ModelLoadManager::ImportOptions::ProfileCount; ++profile)
+    {
+        options.m_profile = (ModelLoadManager::ImportOptions::Profile)profile;
+        QElapsedTimer timer;
+        timer.start();
+        for (int i = 0; i < BENCHMARK_IMPORTS; ++i)
+            ModelLoadManager::instance()->importUncached(modelPath, options, modelMeshs);
+        const double loadTime = timer.nsecsElapsed() / 1e6 / BENCHMARK_IMPORTS;
+
+        // what the renderers upload, the vertex and index buffers of every mesh and the full mip chain of every texture
+        qint64 vertexCount = 0, indexCount = 0, geometryBytes = 0, textureBytes = 0;
+        for (const auto &modelMesh : modelMeshs)
+        {
+            vertexCount += modelMesh.vertexCount();
+            indexCount += modelMesh.m_indices.size();
+            geometryBytes += modelMesh.vertexBytes(modelMesh.vertexCount()) + modelMesh.m_indices.size() * sizeof(unsigned int);
+            for (const auto &texture : modelMesh.m_textures)
+                textureBytes += texture.m_baked ? texture.m_baked->byteCount() : (qint64)texture.m_width * texture.m_height * 4 * 4 / 3;
+        }
+        spdlog::info("{0}: load {1:.3f} ms, meshes {2}, vertices {3}, indices {4}, geometry {5:.2f} MB, textures {6:.2f} MB",
+                     ModelLoadManager::profileName(options.m_profile), loadTime, modelMeshs.size(), vertexCount, indexCount, geometryBytes / 1048576.0,
+                     textureBytes / 1048576.0);
+    }
+    return 0;
+}
+
+int Benchmark::runTangentSpace(const QString &modelPath)
+{
+    // both sides start from the same triangulated vertices, assimp's serial steps are the reference
+    struct Mesh
+    {
+        std::vector<float> m_positions, m_texCoords, m_normals, m_tangents, m_bitangents;
+        std::vector<unsigned int> m_indices;
+    };
+    Assimp::Importer importer;
+    QElapsedTimer timer;
+    timer.start();
+    const aiScene *scene = importer.ReadFile(modelPath.toStdString(), aiProcess_Triangulate);
+    const double readTime = timer.nsecsElapsed() / 1e6;
+    if (!scene || !scene->mRootNode)
+    {
+        spdlog::error("import model failed. path: {0}, error: {1}", modelPath.toStdString(), importer.GetErrorString());
+        return 1;
+    }
+    std::vector<Mesh> meshes(scene->mNumMeshes);
+    for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+    {
+        const aiMesh *mesh = scene->mMeshes[i];
+        Mesh &copy = meshes[i];
+        copy.m_positions.resize(mesh->mNumVertices * 3);
+        memcpy(copy.m_positions.data(), mesh->mVertices, mesh->mNumVertices * sizeof(aiVector3D));
+        if (mesh->mTextureCoords[0])
+        {
+            copy.m_texCoords.resize(mesh->mNumVertices * 3);
+            memcpy(copy.m_texCoords.data(), mesh->mTextureCoords[0], mesh->mNumVertices * sizeof(aiVector3D));
+        }
+        for (unsigned int j = 0; j < mesh->mNumFaces; ++j)
+        {
+            // points and lines are left to assimp, they have no tangent space
+            if (mesh->mFaces[j].mNumIndices == 3)
+                copy.m_indices.insert(copy.m_indices.end(), mesh->mFaces[j].mIndices, mesh->mFaces[j].mIndices + 3);
+        }
+        copy.m_normals.resize(copy.m_positions.size());
+        copy.m_tangents.resize(copy.m_texCoords.size());
+        copy.m_bitangents.resize(copy.m_texCoords.size());
+    }
+    importer.FreeScene();
+
+    double ownTime = 0.0;
+    for (int i = 0; i < BENCHMARK_IMPORTS; ++i)
+    {
+        timer.restart();
+        for (Mesh &mesh : meshes)
+        {
+            const qint64 vertexCount = mesh.m_positions.size() / 3;
+            TangentSpace::generateNormals(mesh.m_positions.data(), 3, vertexCount, mesh.m_indices.data(), mesh.m_indices.size(), mesh.m_normals.data(), 3);
+            if (!mesh.m_texCoords.empty())
+                TangentSpace::generateTangents(mesh.m_positions.data(), 3, mesh.m_normals.data(), 3, mesh.m_texCoords.data(), 3, vertexCount,
+                                               mesh.m_indices.data(), mesh.m_indices.size(), mesh.m_tangents.data(), 3, mesh.m_bitangents.data(), 3);
+        }
+        ownTime += timer.nsecsElapsed() / 1e6;
+    }
+    ownTime /= BENCHMARK_IMPORTS;
+
+    timer.restart();
+    scene = importer.ReadFile(modelPath.toStdString(),
+                              aiProcess_Triangulate | aiProcess_ForceGenNormals | aiProcess_GenSmoothNormals | aiProcess_CalcTangentSpace);
+    const double assimpTime = timer.nsecsElapsed() / 1e6 - readTime;
+    if (!scene || scene->mNumMeshes != meshes.size())
+    {
+        spdlog::error("import model failed. path: {0}, error: {1}", modelPath.toStdString(), importer.GetErrorString());
+        return 1;
+    }
+
+    // angles in degrees between the generated vectors and assimp's, vertices without a tangent on either side are skipped
+    double normalError = 0.0, normalMax = 0.0, tangentError = 0.0, tangentMax = 0.0;
+    qint64 normalCount = 0, tangentCount = 0;
+    auto compare = [](const float *a, const aiVector3D &b, double &sum, double &max, qint64 &count)
+    {
+        const double lengths = std::sqrt((double)(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) * (b.x * b.x + b.y * b.y + b.z * b.z));
+        if (lengths < 1e-12 || !std::isfinite(b.x + b.y + b.z))
+            return;
+        const double angle = qRadiansToDegrees(std::acos(qBound(-1.0, (a[0] * b.x + a[1] * b.y + a[2] * b.z) / lengths, 1.0)));
+        sum += angle;
+        max = qMax(max, angle);
+        ++count;
+    };
+    qint64 vertexCount = 0;
+    for (unsigned int i = 0; i < scene->mNumMeshes; ++i)
+    {
+        const aiMesh *mesh = scene->mMeshes[i];
+        const Mesh &own = meshes[i];
+        if (mesh->mNumVertices * 3 != own.m_positions.size())
+            continue;
+        vertexCount += mesh->mNumVertices;
+        for (unsigned int j = 0; j < mesh->mNumVertices; ++j)
+        {
+            if (mesh->mNormals)
+                compare(&own.m_normals[j * 3], mesh->mNormals[j], normalError, normalMax, normalCount);
+            if (mesh->mTangents && !own.m_tangents.empty())
+                compare(&own.m_tangents[j * 3], mesh->mTangents[j], tangentError, tangentMax, tangentCount);
+        }
+    }
+    spdlog::info("tangent space benchmark. model: {0}, vertices: {1}, threads: {2}", modelPath.toStdString(), vertexCount,
+                 QThreadPool::globalInstance()->maxThreadCount());
+    spdlog::info("normals and tangents: parallel {0:.3f} ms, assimp {1:.3f} ms, speedup {2:.2f}x", ownTime, assimpTime,
+                 assimpTime / qMax(ownTime, 1e-6));
+    const double normalMean = normalCount ? normalError / normalCount : 0.0, tangentMean = tangentCount ? tangentError / tangentCount : 0.0;
+    spdlog::info("angle to assimp: normals mean {0:.3f} max {1:.3f} degrees, tangents mean {2:.3f} max {3:.3f} degrees", normalMean, normalMax,
+                 tangentMean, tangentMax);
+    // single vertices may differ a lot, e.g. at mirrored uv seams, the means show a broken generator
+    if (normalMean > BENCHMARK_NORMAL_MEAN_DEGREES || tangentMean > BENCHMARK_TANGENT_MEAN_DEGREES)
+    {
+        spdlog::error("normals or tangents differ from assimp. path: {0}, allowed mean: normals {1} tangents {2} degrees", modelPath.toStdString(),
+                      BENCHMARK_NORMAL_MEAN_DEGREES, BENCHMARK_TANGENT_MEAN_DEGREES);
+        return 1;
+    }
+    return 0;
+}
+
+int Benchmark::runBlockCodec(const QString &modelPath)
+{
+    // the vertex and index buffers of every mesh back to back, as the renderers upload them
+    QVector<ModelLoadManager::ModelMesh> modelMeshs;
+    if (!ModelLoadManager::instance()->importUncached(modelPath, ModelLoadManager::instance()->importOptions(), modelMeshs))
+    {
+        spdlog::error("import model failed. path: {}", modelPath.toStdString());
+        return 1;
+    }
+    std::vector<ModelLoadManager::Vertex> vertices;
+    std::vector<unsigned int> indices;
+    for (const auto &modelMesh : modelMeshs)
+    {
+        vertices.insert(vertices.end(), modelMesh.m_vertices.begin(), modelMesh.m_vertices.end());
+        indices.insert(indices.end(), modelMesh.m_indices.begin(), modelMesh.m_indices.end());
+    }
+
+    spdlog::info("block codec benchmark. model: {0}, vertices: {1}, indices: {2}, threads: {3}", modelPath.toStdString(), vertices.size(),
+                 indices.size(), QThreadPool::globalInstance()->maxThreadCount());
+    const struct
+    {
+        const char *m_name;
+        const char *m_data;
+        qint64 m_size;
+        int m_elementBytes;
+    } buffers[] = {{"vertices", reinterpret_cast<const char *>(vertices.data()), (qint64)(vertices.size() * sizeof(ModelLoadManager::Vertex)),
+                    (int)sizeof(ModelLoadManager::Vertex)},
+                   {"indices", reinterpret_cast<const char *>(indices.data()), (qint64)(indices.size() * sizeof(unsigned int)), (int)sizeof(unsigned int)}};
+    for (const auto &buffer : buffers)
+    {
+        std::vector<char> decoded(buffer.m_size);
+        for (int codec = 0; codec < BlockCodec::CodecCount; ++codec)
+        {
+            QElapsedTimer timer;
+            timer.start();
+            const QByteArray packed = BlockCodec::encode(buffer.m_data, buffer.m_size, buffer.m_elementBytes, (BlockCodec::Codec)codec);
+            const double encodeTime = timer.nsecsElapsed() / 1e6;
+            bool decodedAll = true;
+            timer.restart();
+            for (int i = 0; i < BENCHMARK_IMPORTS; ++i)
+                decodedAll &= BlockCodec::decode(packed.constData(), packed.size(), decoded.data(), buffer.m_size);
+            const double decodeTime = timer.nsecsElapsed() / 1e9 / BENCHMARK_IMPORTS;
+            if (!decodedAll || memcmp(decoded.data(), buffer.m_data, buffer.m_size))
+            {
+                spdlog::error("block codec round trip failed. codec: {0}, buffer: {1}", BlockCodec::codecName((BlockCodec::Codec)codec), buffer.m_name);
+                return 1;
+            }
+            spdlog::info("{0} {1}: {2:.2f} MB, ratio {3:.2f}, encode {4:.3f} ms, decode {5:.2f} GB/s", buffer.m_name,
+                         BlockCodec::codecName((BlockCodec::Codec)codec), buffer.m_size / 1048576.0, buffer.m_size / (double)qMax(packed.size(), 1),
+                         encodeTime, buffer.m_size / 1e9 / qMax(decodeTime, 1e-9));
+        }
+    }
+    return 0;
+}
+
+int Benchmark::runMeshCodec(const QString &modelPath)
+{
+    QVector<ModelLoadManager::ModelMesh> modelMeshs;
+    if (!ModelLoadManager::instance()->importUncached(modelPath, ModelLoadManager::instance()->importOptions(), modelMeshs))
+    {
+        spdlog::error("import model failed. path: {}", modelPath.toStdString());
+        return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<ModelLoadManager::PackedMesh> packedMeshs(modelMeshs.size());
+    parallelFor(0, (int)modelMeshs.size(), [&](int i)
+                { ModelLoadManager::packMesh(modelMeshs[i], true, packedMeshs[i]); });
+    const double encodeTime = timer.nsecsElapsed() / 1e6;
+
+    QVector<ModelLoadManager::ModelMesh> unpackedMeshs(modelMeshs.size());
+    bool unpackedAll = true;
+    timer.restart();
+    for (int i = 0; i < BENCHMARK_IMPORTS; ++i)
+    {
+        for (int j = 0; j < modelMeshs.size(); ++j)
+            unpackedAll &= ModelLoadManager::unpackMesh(packedMeshs[j], false, unpackedMeshs[j]);
+    }
+    const double decodeTime = timer.nsecsElapsed() / 1e9 / BENCHMARK_IMPORTS;
+    if (!unpackedAll)
+    {
+        spdlog::error("mesh codec round trip failed. path: {}", modelPath.toStdString());
+        return 1;
+    }
+
+    // the triangles keep their order but may start at another corner, each is compared at the rotation closest to the original
+    qint64 vertexCount = 0, indexCount = 0, vertexBytes = 0, indexBytes = 0, blockBytes = 0;
+    double positionError = 0.0, extent = 0.0;
+    for (int i = 0; i < modelMeshs.size(); ++i)
+    {
+        const auto &modelMesh = modelMeshs[i];
+        const auto &unpackedMesh = unpackedMeshs[i];
+        const auto &packedMesh = packedMeshs[i];
+        if (unpackedMesh.m_indices.size() != modelMesh.m_indices.size())
+        {
+            spdlog::error("mesh codec round trip failed. path: {}", modelPath.toStdString());
+            return 1;
+        }
+        for (size_t j = 0; j + 2 < modelMesh.m_indices.size(); j += 3)
+        {
+            double triangleError = DBL_MAX;
+            for (int rotation = 0; rotation < 3; ++rotation)
+            {
+                double error = 0.0;
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    const float *a = modelMesh.m_vertices[modelMesh.m_indices[j + corner]].m_positions;
+                    const float *b = unpackedMesh.m_vertices[unpackedMesh.m_indices[j + (corner + rotation) % 3]].m_positions;
+                    for (int k = 0; k < 3; ++k)
+                        error = qMax(error, (double)qAbs(a[k] - b[k]));
+                }
+                triangleError = qMin(triangleError, error);
+            }
+            positionError = qMax(positionError, triangleError);
+        }
+        for (int k = 0; k < 3; ++k)
+            extent = qMax(extent, packedMesh.m_positionScale[k] * 65535.0);
+        vertexCount += packedMesh.m_vertexCount;
+        indexCount += packedMesh.m_indexCount;
+        vertexBytes += packedMesh.m_vertices.size();
+        indexBytes += packedMesh.m_indices.size();
+        blockBytes += BlockCodec::encode(reinterpret_cast<const char *>(modelMesh.m_vertices.data()), modelMesh.m_vertices.size() * sizeof(ModelLoadManager::Vertex),
+                                         sizeof(ModelLoadManager::Vertex), BlockCodec::Fast)
+                          .size();
+        blockBytes += BlockCodec::encode(reinterpret_cast<const char *>(modelMesh.m_indices.data()), modelMesh.m_indices.size() * sizeof(unsigned int),
+                                         sizeof(unsigned int), BlockCodec::Fast)
+                          .size();
+    }
+
+    const qint64 rawBytes = vertexCount * sizeof(ModelLoadManager::Vertex) + indexCount * sizeof(unsigned int);
+    spdlog::info("mesh codec benchmark. model: {0}, vertices: {1}, triangles: {2}, threads: {3}", modelPath.toStdString(), vertexCount,
+                 indexCount / 3, QThreadPool::globalInstance()->maxThreadCount());
+    spdlog::info("indices: {0:.2f} bits per triangle, vertices: {1:.2f} bytes per vertex of {2}", indexBytes * 8.0 / qMax<qint64>(indexCount / 3, 1),
+                 vertexBytes / (double)qMax<qint64>(vertexCount, 1), sizeof(ModelLoadManager::Vertex));
+    spdlog::info("packed {0:.2f} MB of {1:.2f} MB, ratio {2:.2f}, block codec {3} ratio {4:.2f}", (vertexBytes + indexBytes) / 1048576.0,
+                 rawBytes / 1048576.0, rawBytes / (double)qMax<qint64>(vertexBytes + indexBytes, 1), BlockCodec::codecName(BlockCodec::Fast),
+                 rawBytes / (double)qMax<qint64>(blockBytes, 1));
+    spdlog::info("encode {0:.3f} ms, decode {1:.2f} GB/s, position error {2:.6f} of extent {3:.3f}", encodeTime,
+                 rawBytes / 1e9 / qMax(decodeTime, 1e-9), positionError, extent);
+    return 0;
+}
+
+int Benchmark::runBatchImport(const QString &folder)
+{
+    QStringList modelPaths;
+    Assimp::Importer importer;
+    for (const QFileInfo &fileInfo : QDir(folder).entryInfoList(QDir::Files, QDir::Name))
+    {
+        if (importer.IsExtensionSupported(fileInfo.suffix().toLower().toStdString()))
+            modelPaths.append(fileInfo.absoluteFilePath());
+    }
+    if (modelPaths.isEmpty())
+    {
+        spdlog::error("folder has no model files. folder: {}", folder.toStdString());
+        return 1;
+    }
+
+    // the first pass bakes the textures and warms the page cache, both measured passes start from there
+    // both passes read every model without the caches of the loader, they only differ in the number of threads
+    auto importSerial = [&]()
+    {
+        int failedCount = 0;
+        QVector<ModelLoadManager::ModelMesh> modelMeshs;
+        for (const auto &modelPath : modelPaths)
+        {
+            if (!ModelLoadManager::instance()->importUncached(modelPath, ModelLoadManager::instance()->importOptions(), modelMeshs))
+                ++failedCount;
+        }
+        return failedCount;
+    };
+    importSerial();
+    QElapsedTimer timer;
+    timer.start();
+    const int failedCount = importSerial();
+    const double serialTime = timer.nsecsElapsed() / 1e6;
+
+    std::atomic<int> queuedFailedCount(0);
+    timer.restart();
+    {
+        ModelImportQueue queue([&](const QString &, const std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> &modelMeshsPtr)
+                               {
+                                   if (!modelMeshsPtr)
+                                       ++queuedFailedCount; });
+        queue.setImportFunction([](const QString &modelPath)
+                                {
+                                    auto modelMeshsPtr = std::make_shared<QVector<ModelLoadManager::ModelMesh>>();
+                                    if (!ModelLoadManager::instance()->importUncached(modelPath, ModelLoadManager::instance()->importOptions(), *modelMeshsPtr))
+                                        modelMeshsPtr.reset();
+                                    return modelMeshsPtr; });
+        for (const auto &modelPath : modelPaths)
+            queue.push(modelPath);
+        queue.waitForDone();
+    }
+    const double queuedTime = timer.nsecsElapsed() / 1e6;
+
+    spdlog::info("batch import benchmark. folder: {0}, models: {1}, failed: {2}, threads: {3}", folder.toStdString(), modelPaths.size(), failedCount,
+                 QThread::idealThreadCount());
+    spdlog::info("import time: serial {0:.1f} ms, queued {1:.1f} ms ({2} failed), speedup {3:.2f}x", serialTime, queuedTime, queuedFailedCount.load(),
+                 serialTime / qMax(queuedTime, 1e-6));
+    return 0;
+}
+
+int Benchmark::runIdle(const QString &modelPath)
+{
+    // a static model must not draw frames or burn cpu once it is on screen
+    {
+        OpenGLWindow window(modelPath, Qt::gray);
+        window.resize(800, 600);
+        window.show();
+        measureIdle("opengl", [&window]()
+                    { return window.frameCount(); });
+    }
+    {
+        VulkanWindowContainer window(modelPath, Qt::gray);
+        window.resize(800, 600);
+        window.show();
+        measureIdle("vulkan", [&window]()
+                    { return window.frameCount(); });
+    }
+    return 0;
+}
+
+int Benchmark::runViewports(const QString &modelPath)
+{
+    // every viewport turns its camera, so each frame draws the whole grid
+    QStringList modelPaths;
+    for (int i = 0; i < BENCHMARK_VIEWPORTS; ++i)
+        modelPaths.append(modelPath);
+    OpenGLWindow window(modelPaths, Qt::gray);
+    window.resize(1600, 1200);
+    window.show();
+    window.startAnimation(AnimationHelper::Turntable);
+    waitEvents(BENCHMARK_IDLE_SETTLE_MS);
+
+    QElapsedTimer timer;
+    timer.start();
+    const quint64 framesStart = window.frameCount();
+    waitEvents(BENCHMARK_IDLE_MEASURE_MS);
+    const double fps = (window.frameCount() - framesStart) * 1e9 / qMax<qint64>(timer.nsecsElapsed(), 1);
+    spdlog::info("viewports: {0}, frame rate {1:.1f} FPS, target {2} FPS", BENCHMARK_VIEWPORTS, fps, BENCHMARK_FRAME_RATE);
+    return 0;
+}
+
+void Benchmark::measureIdle(const char *backend, const std::function<quint64()> &frameCount)
+{
+    waitEvents(BENCHMARK_IDLE_SETTLE_MS);
+
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 cpuStart = processCpuNsecs();
+    const quint64 framesStart = frameCount();
+    waitEvents(BENCHMARK_IDLE_MEASURE_MS);
+    const double cpuPercent = 100.0 * (processCpuNsecs() - cpuStart) / qMax<qint64>(timer.nsecsElapsed(), 1);
+    spdlog::info("idle {0}: cpu usage {1:.2f}% of one core, frames drawn {2} in {3} ms", backend, cpuPercent, frameCount() - framesStart,
+                 BENCHMARK_IDLE_MEASURE_MS);
+}
+
+qint64 Benchmark::processCpuNsecs()
+{
+#ifdef WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+        return 0;
+    ULARGE_INTEGER kernel, user;
+    kernel.LowPart = kernelTime.dwLowDateTime;
+    kernel.HighPart = kernelTime.dwHighDateTime;
+    user.LowPart = userTime.dwLowDateTime;
+    user.HighPart = userTime.dwHighDateTime;
+    return (qint64)(kernel.QuadPart + user.QuadPart) * 100;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+    return (qint64)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ll + (qint64)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000;
+#endif
+}
@@ -0,0 +1,33 @@
+﻿#ifndef __BENCHMARK_H__
+#define __BENCHMARK_H__
+
+#include <QStringList>
+#include <functional>
+
+// command line benchmarks, started with --benchmark <model path> instead of the main window
+// a folder instead of a model runs the batch import benchmark over the models in it, "scans [triangle count]" the scan import
+// benchmark over synthetic binary PLY and STL files
+class Benchmark
+{
+public:
+    // returns the exit code of the process
+    static int run(const QStringList &arguments);
+
+private:
+    static int runSkinning(const QString &modelPath);
+    static int runVertexStreams(const QString &modelPath);
+    static int runGlbImport(const QString &modelPath);
+    static int runScanImport(qint64 triangleCount);
+    static int runImportProfiles(const QString &modelPath);
+    static int runTangentSpace(const QString &modelPath);
+    static int runBlockCodec(const QString &modelPath);
+    static int runMeshCodec(const QString &modelPath);
+    static int runBatchImport(const QString &folder);
+    static int runIdle(const QString &modelPath);
+    static int runViewports(const QString &modelPath);
+    // cpu time of the process over a few seconds of an idle window, frameCount reads the frames the window drew
+    static void measureIdle(const char *backend, const std::function<quint64()> &frameCount);
+    static qint64 processCpuNsecs();
+};
+
+#endif
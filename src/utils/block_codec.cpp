@@ -0,0 +1,375 @@
+﻿#include "block_codec.h"
+#include "parallel_for.h"
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5 // the format ends every block with literals
+#define LZ4_MF_LIMIT 12     // and no match starts in its last bytes
+#define LZ4_HASH_BITS 14
+#define LZ4_MAX_OFFSET 65535
+
+namespace
+{
+    static quint32 read32(const uchar *p)
+    {
+        quint32 value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    static uchar *writeLength(uchar *op, qint64 length)
+    {
+        for (; length >= 255; length -= 255)
+            *op++ = 255;
+        *op++ = (uchar)length;
+        return op;
+    }
+
+    static bool readLength(const uchar *&ip, const uchar *srcEnd, qint64 &length)
+    {
+        uchar byte;
+        do
+        {
+            if (ip == srcEnd)
+                return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+
+    static uchar *writeSequence(uchar *op, const uchar *literals, qint64 literalLength, int offset, qint64 matchLength)
+    {
+        uchar *token = op++;
+        *token = (uchar)(qMin<qint64>(literalLength, 15) << 4);
+        if (literalLength >= 15)
+            op = writeLength(op, literalLength - 15);
+        memcpy(op, literals, literalLength);
+        op += literalLength;
+        if (!matchLength)
+            return op;
+
+        *op++ = (uchar)(offset & 0xff);
+        *op++ = (uchar)(offset >> 8);
+        matchLength -= LZ4_MIN_MATCH;
+        *token |= (uchar)qMin<qint64>(matchLength, 15);
+        if (matchLength >= 15)
+            op = writeLength(op, matchLength - 15);
+        return op;
+    }
+
+    static qint64 lz4Bound(qint64 size)
+    {
+        return size + size / 255 + 16;
+    }
+
+    // greedy LZ4 block compressor, dst holds lz4Bound(srcSize) bytes
+    static qint64 lz4Compress(const uchar *src, qint64 srcSize, uchar *dst)
+    {
+        uchar *op = dst;
+        qint64 anchor = 0;
+        if (srcSize > LZ4_MF_LIMIT)
+        {
+            thread_local std::vector<qint64> table;
+            table.assign(1 << LZ4_HASH_BITS, -1);
+            const qint64 matchLimit = srcSize - LZ4_LAST_LITERALS;
+            const qint64 ipLimit = srcSize - LZ4_MF_LIMIT;
+            qint64 ip = 0;
+            while (ip < ipLimit)
+            {
+                const quint32 sequence = read32(src + ip);
+                const quint32 hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+                qint64 ref = table[hash];
+                table[hash] = ip;
+                if (ref < 0 || ip - ref > LZ4_MAX_OFFSET || read32(src + ref) != sequence)
+                {
+                    // data that does not compress is skipped faster the longer it goes on
+                    ip += 1 + ((ip - anchor) >> 6);
+                    continue;
+                }
+
+                while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1])
+                {
+                    --ip;
+                    --ref;
+                }
+                qint64 length = LZ4_MIN_MATCH;
+                while (ip + length < matchLimit && src[ip + length] == src[ref + length])
+                    ++length;
+                op = writeSequence(op, src + anchor, ip - anchor, (int)(ip - ref), length);
+                ip += length;
+                anchor = ip;
+            }
+        }
+        op = writeSequence(op, src + anchor, srcSize - anchor, 0, 0);
+        return op - dst;
+    }
+
+    static bool lz4Decompress(const uchar *src, qint64 srcSize, uchar *dst, qint64 dstSize)
+    {
+        const uchar *ip = src;
+        const uchar *srcEnd = src + srcSize;
+        uchar *op = dst;
+        uchar *dstEnd = dst + dstSize;
+        while (ip < srcEnd)
+        {
+            const int token = *ip++;
+            qint64 literalLength = token >> 4;
+            if (literalLength == 15 && !readLength(ip, srcEnd, literalLength))
+                return false;
+            if (literalLength > srcEnd - ip || literalLength > dstEnd - op)
+                return false;
+            // short runs are copied with a fixed size where the buffers have room, it compiles to two moves
+            if (literalLength <= 16 && srcEnd - ip >= 16 && dstEnd - op >= 16)
+                memcpy(op, ip, 16);
+            else
+                memcpy(op, ip, literalLength);
+            ip += literalLength;
+            op += literalLength;
+            if (ip == srcEnd)
+                break;
+
+            if (srcEnd - ip < 2)
+                return false;
+            const qint64 offset = ip[0] | ip[1] << 8;
+            ip += 2;
+            qint64 matchLength = token & 15;
+            if (matchLength == 15 && !readLength(ip, srcEnd, matchLength))
+                return false;
+            matchLength += LZ4_MIN_MATCH;
+            if (!offset || offset > op - dst || matchLength > dstEnd - op)
+                return false;
+            const uchar *match = op - offset;
+            if (offset >= 16 && matchLength <= 16 && dstEnd - op >= 16)
+                memcpy(op, match, 16);
+            else if (offset >= matchLength)
+                memcpy(op, match, matchLength);
+            else
+            {
+                // the match overlaps what it writes, a repeated pattern, copied in runs that double in length
+                memcpy(op, match, offset);
+                for (qint64 copied = offset; copied < matchLength; copied *= 2)
+                    memcpy(op + copied, op, qMin(copied, matchLength - copied));
+            }
+            op += matchLength;
+        }
+        return op == dstEnd;
+    }
+
+    // delta of the 32 bit words of consecutive elements, then the bytes shuffled into one run per byte of an element
+    // elements that are not made of words are only shuffled, the bytes after the last whole element are kept as they are
+    static void filterBlock(const uchar *src, qint64 size, int elementBytes, uchar *dst)
+    {
+        const qint64 count = size / elementBytes;
+        const bool words = elementBytes % 4 == 0;
+        for (int lane = 0; lane < elementBytes; ++lane)
+        {
+            uchar *out = dst + lane * count;
+            const uchar *in = src + (words ? lane & ~3 : lane);
+            if (words)
+            {
+                const int shift = (lane & 3) * 8;
+                quint32 previous = 0;
+                for (qint64 i = 0; i < count; ++i, in += elementBytes)
+                {
+                    const quint32 value = read32(in);
+                    out[i] = (uchar)((value - previous) >> shift);
+                    previous = value;
+                }
+            }
+            else
+            {
+                for (qint64 i = 0; i < count; ++i, in += elementBytes)
+                    out[i] = *in;
+            }
+        }
+        memcpy(dst + count * elementBytes, src + count * elementBytes, size - count * elementBytes);
+    }
+
+    static void unfilterBlock(const uchar *src, qint64 size, int elementBytes, uchar *dst)
+    {
+        const qint64 count = size / elementBytes;
+        if (elementBytes % 4 == 0)
+        {
+            for (int word = 0; word < elementBytes; word += 4)
+            {
+                const uchar *b0 = src + word * count;
+                const uchar *b1 = b0 + count;
+                const uchar *b2 = b1 + count;
+                const uchar *b3 = b2 + count;
+                uchar *out = dst + word;
+                quint32 previous = 0;
+                for (qint64 i = 0; i < count; ++i, out += elementBytes)
+                {
+                    previous += b0[i] | b1[i] << 8 | b2[i] << 16 | (quint32)b3[i] << 24;
+                    memcpy(out, &previous, sizeof(previous));
+                }
+            }
+        }
+        else
+        {
+            for (int lane = 0; lane < elementBytes; ++lane)
+            {
+                const uchar *in = src + lane * count;
+                for (qint64 i = 0; i < count; ++i)
+                    dst[i * elementBytes + lane] = in[i];
+            }
+        }
+        memcpy(dst + count * elementBytes, src + count * elementBytes, size - count * elementBytes);
+    }
+
+    // offsets[i] is where block i starts in packed, offsets has one more entry for the end of the last block
+    static bool readDirectory(const char *packed, qint64 packedSize, qint64 size, BlockCodec::Header &header, std::vector<qint64> &offsets)
+    {
+        if (packedSize < (qint64)sizeof(header))
+            return false;
+        memcpy(&header, packed, sizeof(header));
+        if (!header.m_blockBytes || !header.m_elementBytes || header.m_codec >= BlockCodec::CodecCount ||
+            header.m_blockCount != (quint64)((size + header.m_blockBytes - 1) / header.m_blockBytes) ||
+            packedSize < (qint64)(sizeof(header) + header.m_blockCount * sizeof(quint32)))
+            return false;
+
+        offsets.resize(header.m_blockCount + 1);
+        offsets[0] = sizeof(header) + header.m_blockCount * sizeof(quint32);
+        for (quint32 i = 0; i < header.m_blockCount; ++i)
+        {
+            quint32 packedBytes;
+            memcpy(&packedBytes, packed + sizeof(header) + i * sizeof(quint32), sizeof(packedBytes));
+            offsets[i + 1] = offsets[i] + packedBytes;
+        }
+        return offsets.back() <= packedSize;
+    }
+
+    static bool decodeBlock(const BlockCodec::Header &header, const char *packed, const std::vector<qint64> &offsets, int i, qint64 size, uchar *out)
+    {
+        const uchar *src = reinterpret_cast<const uchar *>(packed) + offsets[i];
+        const qint64 packedBytes = offsets[i + 1] - offsets[i];
+        const qint64 rawBytes = qMin<qint64>(header.m_blockBytes, size - (qint64)i * header.m_blockBytes);
+        if (packedBytes == rawBytes)
+        {
+            memcpy(out, src, rawBytes);
+            return true;
+        }
+
+        thread_local std::vector<uchar> filtered;
+        const uchar *unpacked = nullptr;
+        QByteArray inflated;
+        if (header.m_codec == BlockCodec::Fast)
+        {
+            filtered.resize(rawBytes);
+            if (lz4Decompress(src, packedBytes, filtered.data(), rawBytes))
+                unpacked = filtered.data();
+        }
+        else if (header.m_codec == BlockCodec::Small)
+        {
+            inflated = qUncompress(src, packedBytes);
+            if (inflated.size() == rawBytes)
+                unpacked = reinterpret_cast<const uchar *>(inflated.constData());
+        }
+        if (!unpacked)
+            return false;
+        unfilterBlock(unpacked, rawBytes, header.m_elementBytes, out);
+        return true;
+    }
+}
+
+const char *BlockCodec::codecName(Codec codec)
+{
+    switch (codec)
+    {
+    case Raw:
+        return "raw";
+    case Fast:
+        return "lz4";
+    case Small:
+        return "deflate";
+    default:
+        return "unknown";
+    }
+}
+
+QByteArray BlockCodec::encode(const char *data, qint64 size, int elementBytes, Codec codec)
+{
+    Header header;
+    header.m_elementBytes = (quint16)qBound(1, elementBytes, 0xffff);
+    header.m_blockBytes = qMax<quint32>(BLOCK_CODEC_BLOCK_BYTES / header.m_elementBytes, 1) * header.m_elementBytes;
+    header.m_blockCount = (quint32)((size + header.m_blockBytes - 1) / header.m_blockBytes);
+    header.m_codec = (quint16)codec;
+
+    std::vector<QByteArray> blocks(header.m_blockCount);
+    parallelFor(0, (int)header.m_blockCount, [&](int i)
+                {
+                    const uchar *src = reinterpret_cast<const uchar *>(data) + (qint64)i * header.m_blockBytes;
+                    const qint64 rawBytes = qMin<qint64>(header.m_blockBytes, size - (qint64)i * header.m_blockBytes);
+                    QByteArray &block = blocks[i];
+                    if (codec == Fast || codec == Small)
+                    {
+                        thread_local std::vector<uchar> filtered;
+                        filtered.resize(rawBytes);
+                        filterBlock(src, rawBytes, header.m_elementBytes, filtered.data());
+                        if (codec == Fast)
+                        {
+                            block.resize(lz4Bound(rawBytes));
+                            block.resize(lz4Compress(filtered.data(), rawBytes, reinterpret_cast<uchar *>(block.data())));
+                        }
+                        else
+                            block = qCompress(filtered.data(), rawBytes, 9);
+                    }
+                    if (block.isEmpty() || block.size() >= rawBytes)
+                        block = QByteArray(reinterpret_cast<const char *>(src), rawBytes); });
+
+    QByteArray packed(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const QByteArray &block : blocks)
+    {
+        const quint32 packedBytes = (quint32)block.size();
+        packed.append(reinterpret_cast<const char *>(&packedBytes), sizeof(packedBytes));
+    }
+    for (const QByteArray &block : blocks)
+        packed.append(block);
+    return packed;
+}
+
+bool BlockCodec::decode(const char *packed, qint64 packedSize, char *dst, qint64 size)
+{
+    Header header;
+    std::vector<qint64> offsets;
+    if (!readDirectory(packed, packedSize, size, header, offsets))
+        return false;
+
+    std::atomic<bool> decoded(true);
+    parallelFor(0, (int)header.m_blockCount, [&](int i)
+                {
+                    if (!decodeBlock(header, packed, offsets, i, size, reinterpret_cast<uchar *>(dst) + (qint64)i * header.m_blockBytes))
+                        decoded = false; });
+    return decoded;
+}
+
+bool BlockCodec::decode(const char *packed, qint64 packedSize, qint64 size, qint64 offset, qint64 bytes, char *dst)
+{
+    Header header;
+    std::vector<qint64> offsets;
+    if (offset < 0 || bytes <= 0 || offset + bytes > size || !readDirectory(packed, packedSize, size, header, offsets))
+        return false;
+
+    // blocks the range only partly covers are decoded aside
+    thread_local std::vector<uchar> partial;
+    for (qint64 i = offset / header.m_blockBytes; i * header.m_blockBytes < offset + bytes; ++i)
+    {
+        const qint64 blockBegin = i * header.m_blockBytes;
+        const qint64 blockEnd = qMin<qint64>(blockBegin + header.m_blockBytes, size);
+        if (blockBegin >= offset && blockEnd <= offset + bytes)
+        {
+            if (!decodeBlock(header, packed, offsets, (int)i, size, reinterpret_cast<uchar *>(dst) + blockBegin - offset))
+                return false;
+            continue;
+        }
+        partial.resize(blockEnd - blockBegin);
+        if (!decodeBlock(header, packed, offsets, (int)i, size, partial.data()))
+            return false;
+        const qint64 begin = qMax(blockBegin, offset), end = qMin(blockEnd, offset + bytes);
+        memcpy(dst + begin - offset, partial.data() + begin - blockBegin, end - begin);
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+﻿#ifndef __BLOCK_CODEC_H__
+#define __BLOCK_CODEC_H__
+
+#include <QByteArray>
+
+#define BLOCK_CODEC_BLOCK_BYTES (256 * 1024) // rounded down to whole elements
+
+/////////////////////////////////////////////////////////////////
+// compression of vertex and index buffers for the model cache, the buffer is cut into blocks packed independently
+// so that they are decoded in parallel, straight into the buffer the caller uploads
+// every block is filtered before it is compressed: the 32 bit words of an element are stored as the difference to
+// the same word of the previous element, then the bytes are shuffled so that each byte of an element forms one run
+class BlockCodec
+{
+public:
+    enum Codec
+    {
+        Raw = 0, // blocks stored as they are
+        Fast,    // LZ4 block format, decoded at several GB/s
+        Small,   // deflate, smaller and several times slower to decode
+        CodecCount,
+    };
+
+    struct Header
+    {
+        quint32 m_blockBytes;
+        quint32 m_blockCount;
+        quint16 m_elementBytes;
+        quint16 m_codec;
+        // followed by the packed size of every block, a block packed to its raw size is stored unfiltered, then the blocks
+    };
+
+public:
+    static const char *codecName(Codec codec);
+    // elementBytes is the vertex or index size the filter works on, size does not need to be a multiple of it
+    static QByteArray encode(const char *data, qint64 size, int elementBytes, Codec codec);
+    // dst receives exactly the size bytes that were encoded, false if packed is damaged
+    static bool decode(const char *packed, qint64 packedSize, char *dst, qint64 size);
+    // decodes bytes [offset, offset + bytes) of the size encoded ones to dst, only the blocks covering them and on the calling
+    // thread, for the worker threads of the global pool that fill one chunk of an upload
+    static bool decode(const char *packed, qint64 packedSize, qint64 size, qint64 offset, qint64 bytes, char *dst);
+};
+
+#endif
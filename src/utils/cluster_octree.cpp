@@ -0,0 +1,222 @@
+﻿#include "cluster_octree.h"
+#include <spdlog/spdlog.h>
+#include <QtMath>
+#include <algorithm>
+#include <array>
+#include <cfloat>
+
+namespace
+{
+    constexpr int VERTEX_FLOAT_COUNT = PAGE_VERTEX_BYTE_COUNT / sizeof(float);
+    constexpr int TRIANGLE_FLOAT_COUNT = 3 * VERTEX_FLOAT_COUNT;
+
+    struct Bounds
+    {
+        float m_min[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+        float m_max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+
+        void add(const float *p)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                m_min[i] = qMin(m_min[i], p[i]);
+                m_max[i] = qMax(m_max[i], p[i]);
+            }
+        }
+    };
+
+    // spreads the lower 10 bits so that three values can be interleaved into a morton code
+    static quint32 expandBits(quint32 v)
+    {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000FF;
+        v = (v | (v << 8)) & 0x0300F00F;
+        v = (v | (v << 4)) & 0x030C30C3;
+        v = (v | (v << 2)) & 0x09249249;
+        return v;
+    }
+
+    struct BuildContext
+    {
+        const float *m_vertices = nullptr;
+        std::vector<quint32> m_triangles;
+        std::vector<float> m_centroids;
+        ClusterOctree::Options m_options;
+        ModelPageWriter *m_writer = nullptr;
+    };
+
+    static void buildCluster(const float *vertices, quint32 triangleCount, ModelPageFile::ClusterEntry &cluster)
+    {
+        Bounds bounds;
+        QVector3D normalSum;
+        std::vector<QVector3D> normals;
+        normals.reserve(triangleCount);
+        for (quint32 t = 0; t < triangleCount; ++t)
+        {
+            const float *a = vertices + t * TRIANGLE_FLOAT_COUNT;
+            const float *b = a + VERTEX_FLOAT_COUNT;
+            const float *c = b + VERTEX_FLOAT_COUNT;
+            bounds.add(a);
+            bounds.add(b);
+            bounds.add(c);
+
+            QVector3D normal = QVector3D::crossProduct(QVector3D(b[0] - a[0], b[1] - a[1], b[2] - a[2]),
+                                                       QVector3D(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+            if (normal.lengthSquared() <= 0.0f)
+                continue; // degenerate triangles do not constrain the cone
+            normal.normalize();
+            normals.emplace_back(normal);
+            normalSum += normal;
+        }
+
+        memcpy(cluster.m_min, bounds.m_min, sizeof(cluster.m_min));
+        memcpy(cluster.m_max, bounds.m_max, sizeof(cluster.m_max));
+        memset(cluster.m_coneAxis, 0, sizeof(cluster.m_coneAxis));
+        cluster.m_coneCutoff = 2.0f;
+        if (normalSum.length() < 1e-6f)
+            return;
+
+        QVector3D axis = normalSum.normalized();
+        float minDot = 1.0f;
+        for (const auto &normal : normals)
+            minDot = qMin(minDot, QVector3D::dotProduct(normal, axis));
+        cluster.m_coneAxis[0] = axis.x();
+        cluster.m_coneAxis[1] = axis.y();
+        cluster.m_coneAxis[2] = axis.z();
+        // a cone wider than a hemisphere always has a front facing triangle
+        if (minDot > 0.0f)
+            cluster.m_coneCutoff = qSqrt(1.0f - minDot * minDot);
+    }
+
+    static bool writeLeaf(BuildContext &ctx, quint32 begin, quint32 end, const Bounds &bounds)
+    {
+        // order the triangles along a morton curve so that consecutive clusters are spatially compact
+        float scale[3];
+        for (int i = 0; i < 3; ++i)
+        {
+            float extent = bounds.m_max[i] - bounds.m_min[i];
+            scale[i] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+        }
+        std::vector<std::pair<quint32, quint32>> codes;
+        codes.reserve(end - begin);
+        for (quint32 i = begin; i < end; ++i)
+        {
+            const float *centroid = &ctx.m_centroids[(size_t)ctx.m_triangles[i] * 3];
+            quint32 code = 0;
+            for (int axis = 0; axis < 3; ++axis)
+                code |= expandBits((quint32)((centroid[axis] - bounds.m_min[axis]) * scale[axis])) << axis;
+            codes.emplace_back(code, ctx.m_triangles[i]);
+        }
+        std::sort(codes.begin(), codes.end());
+
+        std::vector<float> pageData;
+        pageData.reserve(codes.size() * TRIANGLE_FLOAT_COUNT);
+        for (const auto &code : codes)
+        {
+            const float *triangle = ctx.m_vertices + (quint64)code.second * TRIANGLE_FLOAT_COUNT;
+            pageData.insert(pageData.end(), triangle, triangle + TRIANGLE_FLOAT_COUNT);
+        }
+
+        std::vector<ModelPageFile::ClusterEntry> clusters;
+        const quint32 triangleCount = (quint32)codes.size();
+        for (quint32 first = 0; first < triangleCount; first += ctx.m_options.m_clusterTriangles)
+        {
+            ModelPageFile::ClusterEntry cluster;
+            quint32 count = qMin(ctx.m_options.m_clusterTriangles, triangleCount - first);
+            buildCluster(pageData.data() + first * TRIANGLE_FLOAT_COUNT, count, cluster);
+            cluster.m_firstVertex = first * 3;
+            cluster.m_vertexCount = count * 3;
+            clusters.emplace_back(cluster);
+        }
+
+        return ctx.m_writer->addPage(reinterpret_cast<const char *>(pageData.data()), triangleCount * 3, clusters);
+    }
+
+    static bool buildNode(BuildContext &ctx, quint32 begin, quint32 end, int depth)
+    {
+        Bounds bounds;
+        for (quint32 i = begin; i < end; ++i)
+            bounds.add(&ctx.m_centroids[(size_t)ctx.m_triangles[i] * 3]);
+
+        float maxExtent = 0.0f;
+        for (int i = 0; i < 3; ++i)
+            maxExtent = qMax(maxExtent, bounds.m_max[i] - bounds.m_min[i]);
+        if (end - begin <= ctx.m_options.m_leafTriangles || depth >= ctx.m_options.m_maxDepth || maxExtent <= 0.0f)
+            return writeLeaf(ctx, begin, end, bounds);
+
+        float center[3];
+        for (int i = 0; i < 3; ++i)
+            center[i] = (bounds.m_min[i] + bounds.m_max[i]) * 0.5f;
+        auto octant = [&ctx, &center](quint32 triangle)
+        {
+            const float *centroid = &ctx.m_centroids[(size_t)triangle * 3];
+            return (centroid[0] > center[0] ? 1 : 0) | (centroid[1] > center[1] ? 2 : 0) | (centroid[2] > center[2] ? 4 : 0);
+        };
+
+        // counting sort of the node range into its eight children
+        std::array<quint32, 9> offsets = {};
+        for (quint32 i = begin; i < end; ++i)
+            ++offsets[octant(ctx.m_triangles[i]) + 1];
+        for (int i = 1; i < 9; ++i)
+            offsets[i] += offsets[i - 1];
+        std::vector<quint32> source(ctx.m_triangles.begin() + begin, ctx.m_triangles.begin() + end);
+        std::array<quint32, 9> cursor = offsets;
+        for (quint32 triangle : source)
+            ctx.m_triangles[begin + cursor[octant(triangle)]++] = triangle;
+        std::vector<quint32>().swap(source);
+
+        for (int i = 0; i < 8; ++i)
+        {
+            if (offsets[i + 1] > offsets[i] && !buildNode(ctx, begin + offsets[i], begin + offsets[i + 1], depth + 1))
+                return false;
+        }
+        return true;
+    }
+}
+
+bool ClusterOctree::writePages(const float *vertices, quint64 vertexCount, ModelPageWriter &writer, const Options &options)
+{
+    const quint64 triangleCount = vertexCount / 3;
+    if (triangleCount > 0xffffffffull)
+    {
+        spdlog::error("too many triangles for a single octree. triangles: {}", triangleCount);
+        return false;
+    }
+
+    BuildContext ctx;
+    ctx.m_vertices = vertices;
+    ctx.m_options = options;
+    ctx.m_options.m_clusterTriangles = qMax(1u, ctx.m_options.m_clusterTriangles);
+    ctx.m_options.m_leafTriangles = qMax(ctx.m_options.m_clusterTriangles, ctx.m_options.m_leafTriangles);
+    ctx.m_writer = &writer;
+    ctx.m_triangles.resize(triangleCount);
+    ctx.m_centroids.resize(triangleCount * 3);
+    for (quint32 t = 0; t < triangleCount; ++t)
+    {
+        ctx.m_triangles[t] = t;
+        const float *a = vertices + (quint64)t * TRIANGLE_FLOAT_COUNT;
+        for (int i = 0; i < 3; ++i)
+            ctx.m_centroids[(size_t)t * 3 + i] = (a[i] + a[i + VERTEX_FLOAT_COUNT] + a[i + 2 * VERTEX_FLOAT_COUNT]) / 3.0f;
+    }
+
+    if (!triangleCount)
+        return true;
+    return buildNode(ctx, 0, (quint32)triangleCount, 0);
+}
+
+bool ClusterOctree::isClusterVisible(const ModelPageFile::ClusterEntry &cluster, const Frustum &frustum, const QVector3D &eye)
+{
+    if (!frustum.intersects(cluster.m_min, cluster.m_max))
+        return false;
+    if (cluster.m_coneCutoff > 1.0f)
+        return true;
+
+    // the whole cluster faces away from the eye if the view direction stays inside the normal cone
+    QVector3D bmin(cluster.m_min[0], cluster.m_min[1], cluster.m_min[2]);
+    QVector3D bmax(cluster.m_max[0], cluster.m_max[1], cluster.m_max[2]);
+    QVector3D center = (bmin + bmax) * 0.5f;
+    float radius = (bmax - bmin).length() * 0.5f;
+    QVector3D toCenter = center - eye;
+    QVector3D axis(cluster.m_coneAxis[0], cluster.m_coneAxis[1], cluster.m_coneAxis[2]);
+    return QVector3D::dotProduct(toCenter, axis) < cluster.m_coneCutoff * toCenter.length() + radius;
+}
@@ -0,0 +1,27 @@
+﻿#ifndef __CLUSTER_OCTREE_H__
+#define __CLUSTER_OCTREE_H__
+
+#include "model_page_file.h"
+#include "frustum.h"
+#include <QVector3D>
+
+// splits a triangle soup into an octree, every leaf is written as a page of fixed-size triangle clusters
+// each cluster carries its bounds and normal cone, so the renderers can frustum and backface cull it
+class ClusterOctree
+{
+public:
+    struct Options
+    {
+        quint32 m_clusterTriangles = 128;    // triangles per cluster
+        quint32 m_leafTriangles = 64 * 1024; // triangles per octree leaf (page)
+        int m_maxDepth = 12;
+    };
+
+public:
+    // vertices use the PAGE_VERTEX_BYTE_COUNT layout, vertexCount must be a multiple of 3
+    static bool writePages(const float *vertices, quint64 vertexCount, ModelPageWriter &writer, const Options &options);
+    // eye is the camera position in model space
+    static bool isClusterVisible(const ModelPageFile::ClusterEntry &cluster, const Frustum &frustum, const QVector3D &eye);
+};
+
+#endif
@@ -0,0 +1,46 @@
+﻿#include "frame_scheduler.h"
+
+// a frame that follows a stall must not jump the animations
+#define FRAME_SCHEDULER_MAX_DELTA 0.1
+
+FrameScheduler::FrameScheduler(std::function<void()> requestUpdate)
+    : m_requestUpdate(std::move(requestUpdate))
+{
+    m_clock.start();
+}
+
+void FrameScheduler::requestFrame()
+{
+    if (m_pending)
+        return;
+    m_pending = true;
+    m_requestUpdate();
+}
+
+void FrameScheduler::setAnimating(bool animating)
+{
+    if (m_animating == animating)
+        return;
+    m_animating = animating;
+    if (animating)
+        requestFrame();
+}
+
+double FrameScheduler::beginFrame()
+{
+    m_pending = false;
+    const qint64 now = m_clock.nsecsElapsed();
+    double seconds = 0.0;
+    if (m_lastFrame >= 0)
+        seconds = qMin((now - m_lastFrame) / 1e9, FRAME_SCHEDULER_MAX_DELTA);
+    m_lastFrame = m_animating ? now : -1;
+    return m_animating ? seconds : 0.0;
+}
+
+void FrameScheduler::endFrame()
+{
+    if (m_animating)
+        requestFrame();
+    else
+        m_lastFrame = -1;
+}
@@ -0,0 +1,32 @@
+﻿#ifndef __FRAME_SCHEDULER_H__
+#define __FRAME_SCHEDULER_H__
+
+#include <QElapsedTimer>
+#include <functional>
+
+// paces the redraws of a window to the display refresh
+// requests between two frames are coalesced into one update, animations keep requesting frames,
+// and nothing is scheduled when the scene is static, so an idle window costs no cpu
+class FrameScheduler
+{
+public:
+    // requestUpdate must schedule a frame that is throttled by the presentation, e.g. QWidget::update or QWindow::requestUpdate
+    explicit FrameScheduler(std::function<void()> requestUpdate);
+    // something changed, draw one more frame
+    void requestFrame();
+    void setAnimating(bool animating);
+    bool isAnimating() const { return m_animating; }
+    // call when a frame starts, returns the seconds the animations advance by
+    double beginFrame();
+    // call when the frame was submitted, keeps the loop running while animating
+    void endFrame();
+
+private:
+    std::function<void()> m_requestUpdate;
+    QElapsedTimer m_clock;
+    qint64 m_lastFrame = -1;
+    bool m_pending = false;
+    bool m_animating = false;
+};
+
+#endif
@@ -0,0 +1,55 @@
+﻿#ifndef __FRUSTUM_H__
+#define __FRUSTUM_H__
+
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <QVector4D>
+#include <array>
+
+// view frustum extracted from a (projection * view * model) matrix, used to cull bounding boxes
+class Frustum
+{
+public:
+    Frustum() = default;
+    explicit Frustum(const QMatrix4x4 &mvp)
+    {
+        const QVector4D r0 = mvp.row(0);
+        const QVector4D r1 = mvp.row(1);
+        const QVector4D r2 = mvp.row(2);
+        const QVector4D r3 = mvp.row(3);
+        m_planes = {r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2};
+        for (auto &plane : m_planes)
+        {
+            float len = plane.toVector3D().length();
+            if (len > 0.0f)
+                plane /= len;
+        }
+    }
+
+    // conservative test, returns false only if the box is completely outside of one plane
+    bool intersects(const float *bmin, const float *bmax) const
+    {
+        for (const auto &plane : m_planes)
+        {
+            // the box corner which is farthest along the plane normal
+            float x = plane.x() >= 0.0f ? bmax[0] : bmin[0];
+            float y = plane.y() >= 0.0f ? bmax[1] : bmin[1];
+            float z = plane.z() >= 0.0f ? bmax[2] : bmin[2];
+            if (plane.x() * x + plane.y() * y + plane.z() * z + plane.w() < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool intersects(const QVector3D &bmin, const QVector3D &bmax) const
+    {
+        const float minArr[3] = {bmin.x(), bmin.y(), bmin.z()};
+        const float maxArr[3] = {bmax.x(), bmax.y(), bmax.z()};
+        return intersects(minArr, maxArr);
+    }
+
+private:
+    std::array<QVector4D, 6> m_planes;
+};
+
+#endif
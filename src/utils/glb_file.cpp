@@ -0,0 +1,373 @@
+﻿#include "glb_file.h"
+#include <QJsonDocument>
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QUrl>
+#include <cstring>
+
+namespace
+{
+    static int componentCount(const QString &type)
+    {
+        if (type == "SCALAR")
+            return 1;
+        else if (type == "VEC2")
+            return 2;
+        else if (type == "VEC3")
+            return 3;
+        else if (type == "VEC4")
+            return 4;
+        else if (type == "MAT4")
+            return 16;
+        return 0;
+    }
+
+    static int componentBytes(int componentType)
+    {
+        switch (componentType)
+        {
+        case 5120: // byte
+        case 5121: // unsigned byte
+            return 1;
+        case 5122: // short
+        case 5123: // unsigned short
+            return 2;
+        case 5125: // unsigned int
+        case 5126: // float
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    static quint32 readUint32(const unsigned char *data)
+    {
+        quint32 value;
+        memcpy(&value, data, sizeof(value));
+        return value;
+    }
+}
+
+bool GlbFile::open(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail("open file failed");
+    const qint64 fileSize = m_file.size();
+    const unsigned char *file = fileSize >= 20 ? m_file.map(0, fileSize) : nullptr;
+    if (!file)
+        return fail("map file failed");
+
+    // 12 byte header, then the json chunk and the optional binary chunk
+    if (readUint32(file) != GLB_MAGIC || readUint32(file + 4) != 2 || readUint32(file + 8) > fileSize)
+        return fail("not a glTF 2.0 binary file");
+    const qint64 jsonSize = readUint32(file + 12);
+    if (readUint32(file + 16) != GLB_CHUNK_JSON || 20 + jsonSize > fileSize)
+        return fail("no json chunk");
+    const unsigned char *bin = nullptr;
+    qint64 binSize = 0;
+    const qint64 binChunk = 20 + ((jsonSize + 3) & ~3ll);
+    if (binChunk + 8 <= fileSize && readUint32(file + binChunk + 4) == GLB_CHUNK_BIN)
+    {
+        binSize = readUint32(file + binChunk);
+        bin = file + binChunk + 8;
+        if (binChunk + 8 + binSize > fileSize)
+            return fail("binary chunk is truncated");
+    }
+
+    QJsonParseError parseError;
+    const QJsonDocument document = QJsonDocument::fromJson(QByteArray::fromRawData(reinterpret_cast<const char *>(file + 20), jsonSize), &parseError);
+    if (!document.isObject())
+        return fail("parse json failed: " + parseError.errorString());
+    const QJsonObject json = document.object();
+
+    // the features assimp handles for us
+    for (const auto &extension : json["extensionsRequired"].toArray())
+    {
+        if (extension.toString() != "KHR_materials_pbrSpecularGlossiness")
+            return fail("required extension " + extension.toString());
+    }
+    if (!json["skins"].toArray().isEmpty() || !json["animations"].toArray().isEmpty())
+        return fail("skins or animations");
+    const QJsonArray buffers = json["buffers"].toArray();
+    if (buffers.size() > 1 || (!buffers.isEmpty() && buffers[0].toObject().contains("uri")))
+        return fail("external buffers");
+
+    m_bufferViews = json["bufferViews"].toArray();
+    m_materials = json["materials"].toArray();
+    m_textures = json["textures"].toArray();
+    return parseAccessors(json, bin, binSize) && parseMeshes(json) && parseNodes(json) && parseImages(json, bin, binSize);
+}
+
+int GlbFile::diffuseImage(int material) const
+{
+    if (material < 0 || material >= m_materials.size())
+        return -1;
+    const QJsonObject object = m_materials[material].toObject();
+    const QJsonObject specularGlossiness = object["extensions"].toObject()["KHR_materials_pbrSpecularGlossiness"].toObject();
+    if (specularGlossiness.contains("diffuseTexture"))
+        return textureImage(specularGlossiness["diffuseTexture"].toObject());
+    return textureImage(object["pbrMetallicRoughness"].toObject()["baseColorTexture"].toObject());
+}
+
+int GlbFile::specularImage(int material) const
+{
+    if (material < 0 || material >= m_materials.size())
+        return -1;
+    const QJsonObject specularGlossiness = m_materials[material].toObject()["extensions"].toObject()["KHR_materials_pbrSpecularGlossiness"].toObject();
+    return textureImage(specularGlossiness["specularGlossinessTexture"].toObject());
+}
+
+int GlbFile::textureImage(const QJsonObject &textureInfo) const
+{
+    const int texture = textureInfo["index"].toInt(-1);
+    if (texture < 0 || texture >= m_textures.size())
+        return -1;
+    const int image = m_textures[texture].toObject()["source"].toInt(-1);
+    return image < (int)m_images.size() ? image : -1;
+}
+
+qint64 GlbFile::count(int accessor) const
+{
+    return accessor >= 0 && accessor < (int)m_accessors.size() ? m_accessors[accessor].m_count : 0;
+}
+
+bool GlbFile::readFloats(int accessor, int components, float *dst, int dstStride) const
+{
+    if (accessor < 0 || accessor >= (int)m_accessors.size())
+        return false;
+    const Accessor &source = m_accessors[accessor];
+    if (source.m_componentType != 5126 || source.m_components < components)
+        return false;
+
+    // tightly packed streams of the same width are one copy
+    const int bytes = components * (int)sizeof(float);
+    if (source.m_stride == bytes && dstStride == components)
+    {
+        memcpy(dst, source.m_data, source.m_count * bytes);
+        return true;
+    }
+    for (qint64 i = 0; i < source.m_count; ++i)
+        memcpy(dst + i * dstStride, source.m_data + i * source.m_stride, bytes);
+    return true;
+}
+
+bool GlbFile::readIndices(int accessor, unsigned int *dst) const
+{
+    if (accessor < 0 || accessor >= (int)m_accessors.size())
+        return false;
+    const Accessor &source = m_accessors[accessor];
+    if (source.m_components != 1)
+        return false;
+
+    switch (source.m_componentType)
+    {
+    case 5121:
+        for (qint64 i = 0; i < source.m_count; ++i)
+            dst[i] = source.m_data[i * source.m_stride];
+        return true;
+    case 5123:
+        for (qint64 i = 0; i < source.m_count; ++i)
+        {
+            quint16 index;
+            memcpy(&index, source.m_data + i * source.m_stride, sizeof(index));
+            dst[i] = index;
+        }
+        return true;
+    case 5125:
+        if (source.m_stride == sizeof(unsigned int))
+        {
+            memcpy(dst, source.m_data, source.m_count * sizeof(unsigned int));
+            return true;
+        }
+        for (qint64 i = 0; i < source.m_count; ++i)
+            memcpy(dst + i, source.m_data + i * source.m_stride, sizeof(unsigned int));
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool GlbFile::fail(const QString &error)
+{
+    m_error = error;
+    return false;
+}
+
+bool GlbFile::bufferView(int index, const unsigned char *bin, qint64 binSize, const unsigned char *&data, qint64 &size, int &stride) const
+{
+    if (index < 0 || index >= m_bufferViews.size())
+        return false;
+    const QJsonObject view = m_bufferViews[index].toObject();
+    const qint64 offset = view["byteOffset"].toInteger(0);
+    size = view["byteLength"].toInteger(0);
+    stride = view["byteStride"].toInt(0);
+    if (!bin || view["buffer"].toInt(0) != 0 || offset < 0 || size < 0 || offset + size > binSize)
+        return false;
+    data = bin + offset;
+    return true;
+}
+
+bool GlbFile::parseAccessors(const QJsonObject &json, const unsigned char *bin, qint64 binSize)
+{
+    const QJsonArray accessors = json["accessors"].toArray();
+    m_accessors.resize(accessors.size());
+    for (int i = 0; i < accessors.size(); ++i)
+    {
+        const QJsonObject object = accessors[i].toObject();
+        Accessor &accessor = m_accessors[i];
+        accessor.m_count = object["count"].toInteger(0);
+        accessor.m_components = componentCount(object["type"].toString());
+        accessor.m_componentType = object["componentType"].toInt(0);
+        accessor.m_normalized = object["normalized"].toBool(false);
+        if (object.contains("sparse"))
+            return fail("sparse accessors");
+        const int elementBytes = accessor.m_components * componentBytes(accessor.m_componentType);
+        if (!elementBytes || accessor.m_count < 0)
+            return fail(QString("accessor %1 has an unknown type").arg(i));
+        // an accessor without buffer view reads as zeros, assimp fills those in
+        if (!object.contains("bufferView"))
+            return fail(QString("accessor %1 has no buffer view").arg(i));
+
+        qint64 viewSize = 0;
+        int viewStride = 0;
+        if (!bufferView(object["bufferView"].toInt(-1), bin, binSize, accessor.m_data, viewSize, viewStride))
+            return fail(QString("accessor %1 is outside the binary chunk").arg(i));
+        const qint64 offset = object["byteOffset"].toInteger(0);
+        accessor.m_stride = viewStride ? viewStride : elementBytes;
+        if (offset < 0 || (accessor.m_count && offset + (accessor.m_count - 1) * accessor.m_stride + elementBytes > viewSize))
+            return fail(QString("accessor %1 is outside its buffer view").arg(i));
+        accessor.m_data += offset;
+    }
+    return true;
+}
+
+bool GlbFile::parseMeshes(const QJsonObject &json)
+{
+    const QJsonArray meshes = json["meshes"].toArray();
+    m_meshes.resize(meshes.size());
+    for (int i = 0; i < meshes.size(); ++i)
+    {
+        const QJsonArray primitives = meshes[i].toObject()["primitives"].toArray();
+        for (const auto &value : primitives)
+        {
+            const QJsonObject object = value.toObject();
+            if (object["mode"].toInt(4) != 4)
+                return fail("primitives other than triangle lists");
+            if (!object["targets"].toArray().isEmpty())
+                return fail("morph targets");
+            const QJsonObject attributes = object["attributes"].toObject();
+            Primitive primitive;
+            primitive.m_position = attributes["POSITION"].toInt(-1);
+            primitive.m_normal = attributes["NORMAL"].toInt(-1);
+            primitive.m_texCoord = attributes["TEXCOORD_0"].toInt(-1);
+            primitive.m_tangent = attributes["TANGENT"].toInt(-1);
+            primitive.m_indices = object["indices"].toInt(-1);
+            primitive.m_material = object["material"].toInt(-1);
+            // only float attributes are read here, missing normals are generated by the loader
+            // and the tangents of a primitive without normals are ignored as the spec asks
+            if (primitive.m_normal < 0)
+                primitive.m_tangent = -1;
+            for (int accessor : {primitive.m_position, primitive.m_normal, primitive.m_texCoord, primitive.m_tangent})
+            {
+                if (accessor >= (int)m_accessors.size() || (accessor >= 0 && m_accessors[accessor].m_componentType != 5126))
+                    return fail("attributes other than floats");
+            }
+            if (primitive.m_position < 0 || primitive.m_indices >= (int)m_accessors.size() ||
+                (primitive.m_normal >= 0 && count(primitive.m_normal) != count(primitive.m_position)) ||
+                (primitive.m_texCoord >= 0 && count(primitive.m_texCoord) != count(primitive.m_position)) ||
+                (primitive.m_tangent >= 0 && count(primitive.m_tangent) != count(primitive.m_position)))
+                return fail("inconsistent primitive attributes");
+            m_meshes[i].emplace_back(primitive);
+        }
+    }
+    return true;
+}
+
+bool GlbFile::parseNodes(const QJsonObject &json)
+{
+    const QJsonArray nodes = json["nodes"].toArray();
+    m_nodes.resize(nodes.size());
+    std::vector<int> parentCounts(nodes.size(), 0);
+    for (int i = 0; i < nodes.size(); ++i)
+    {
+        const QJsonObject object = nodes[i].toObject();
+        Node &node = m_nodes[i];
+        node.m_name = object["name"].toString().toStdString();
+        node.m_mesh = object["mesh"].toInt(-1);
+        if (node.m_mesh >= (int)m_meshes.size())
+            return fail(QString("node %1 has an unknown mesh").arg(i));
+        for (const auto &child : object["children"].toArray())
+        {
+            const int index = child.toInt(-1);
+            if (index < 0 || index >= nodes.size() || ++parentCounts[index] > 1)
+                return fail(QString("node %1 is not a tree").arg(i));
+            node.m_children.emplace_back(index);
+        }
+
+        // the matrix is column-major, translation rotation scale are applied scale first
+        QMatrix4x4 local;
+        const QJsonArray matrix = object["matrix"].toArray();
+        if (matrix.size() == 16)
+        {
+            for (int j = 0; j < 16; ++j)
+                node.m_local[j] = (float)matrix[j].toDouble();
+            continue;
+        }
+        const QJsonArray translation = object["translation"].toArray();
+        const QJsonArray rotation = object["rotation"].toArray();
+        const QJsonArray scale = object["scale"].toArray();
+        if (translation.size() == 3)
+            local.translate(translation[0].toDouble(), translation[1].toDouble(), translation[2].toDouble());
+        if (rotation.size() == 4)
+            local.rotate(QQuaternion(rotation[3].toDouble(), rotation[0].toDouble(), rotation[1].toDouble(), rotation[2].toDouble()));
+        if (scale.size() == 3)
+            local.scale(scale[0].toDouble(), scale[1].toDouble(), scale[2].toDouble());
+        memcpy(node.m_local, local.constData(), sizeof(node.m_local));
+    }
+
+    // the default scene, or every node without parent if there is none
+    const QJsonArray scenes = json["scenes"].toArray();
+    const int scene = json["scene"].toInt(0);
+    if (scene < scenes.size())
+    {
+        for (const auto &value : scenes[scene].toObject()["nodes"].toArray())
+        {
+            const int index = value.toInt(-1);
+            if (index < 0 || index >= nodes.size() || parentCounts[index])
+                return fail("scene roots are not root nodes");
+            m_rootNodes.emplace_back(index);
+        }
+        return true;
+    }
+    for (int i = 0; i < nodes.size(); ++i)
+    {
+        if (!parentCounts[i])
+            m_rootNodes.emplace_back(i);
+    }
+    return true;
+}
+
+bool GlbFile::parseImages(const QJsonObject &json, const unsigned char *bin, qint64 binSize)
+{
+    const QJsonArray images = json["images"].toArray();
+    m_images.resize(images.size());
+    int embeddedCount = 0;
+    for (int i = 0; i < images.size(); ++i)
+    {
+        const QJsonObject object = images[i].toObject();
+        Image &image = m_images[i];
+        if (object.contains("bufferView"))
+        {
+            int stride = 0;
+            if (!bufferView(object["bufferView"].toInt(-1), bin, binSize, image.m_data, image.m_size, stride))
+                return fail(QString("image %1 is outside the binary chunk").arg(i));
+            image.m_name = "*" + std::to_string(embeddedCount++);
+            continue;
+        }
+        image.m_uri = QUrl::fromPercentEncoding(object["uri"].toString().toUtf8());
+        if (image.m_uri.startsWith("data:"))
+            return fail("data uri images");
+    }
+    return true;
+}
@@ -0,0 +1,96 @@
+﻿#ifndef __GLB_FILE_H__
+#define __GLB_FILE_H__
+
+#include <QFile>
+#include <QString>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <vector>
+#include <string>
+
+#define GLB_MAGIC 0x46546C67      // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A // "JSON"
+#define GLB_CHUNK_BIN 0x004E4942  // "BIN\0"
+
+/////////////////////////////////////////////////////////////////
+// reader of binary glTF 2.0 files, the file is mapped and accessors are read straight from the binary chunk
+// it covers static triangle meshes, files with skins, animations, sparse accessors, quantized attributes or
+// required extensions other than the specular glossiness materials are refused with a reason, the caller imports them with assimp instead
+class GlbFile
+{
+public:
+    struct Primitive
+    {
+        int m_position = -1; // accessor indices, -1 if absent
+        int m_normal = -1;
+        int m_texCoord = -1;
+        int m_tangent = -1;
+        int m_indices = -1;
+        int m_material = -1;
+    };
+
+    struct Node
+    {
+        std::string m_name;
+        float m_local[16]; // column-major
+        int m_mesh = -1;
+        std::vector<int> m_children;
+    };
+
+    struct Image
+    {
+        const unsigned char *m_data = nullptr; // in the mapped file, null if the image is an external file
+        qint64 m_size = 0;
+        QString m_uri;      // relative to the model
+        std::string m_name; // "*n" for the n-th embedded image, the name assimp gives it
+    };
+
+public:
+    bool open(const QString &path);
+    const QString &errorString() const { return m_error; }
+    const std::vector<Node> &nodes() const { return m_nodes; }
+    const std::vector<int> &rootNodes() const { return m_rootNodes; }
+    const std::vector<std::vector<Primitive>> &meshes() const { return m_meshes; }
+    const std::vector<Image> &images() const { return m_images; }
+    // images of the textures assimp reads as diffuse and specular maps, -1 if none
+    // the diffuse map is the base color, or the diffuse of a specular glossiness material
+    int diffuseImage(int material) const;
+    int specularImage(int material) const;
+    qint64 count(int accessor) const;
+    // converts the float components of an accessor into dst, dstStride in floats, false if it is not a float accessor
+    bool readFloats(int accessor, int components, float *dst, int dstStride) const;
+    bool readIndices(int accessor, unsigned int *dst) const;
+
+private:
+    struct Accessor
+    {
+        const unsigned char *m_data = nullptr;
+        qint64 m_count = 0;
+        int m_components = 0;
+        int m_componentType = 0;
+        int m_stride = 0; // bytes between elements
+        bool m_normalized = false;
+    };
+
+    bool fail(const QString &error);
+    int textureImage(const QJsonObject &textureInfo) const;
+    bool parseAccessors(const QJsonObject &json, const unsigned char *bin, qint64 binSize);
+    bool parseMeshes(const QJsonObject &json);
+    bool parseNodes(const QJsonObject &json);
+    bool parseImages(const QJsonObject &json, const unsigned char *bin, qint64 binSize);
+    bool bufferView(int index, const unsigned char *bin, qint64 binSize, const unsigned char *&data, qint64 &size, int &stride) const;
+
+private:
+    QFile m_file;
+    QString m_error;
+    QJsonArray m_bufferViews;
+    QJsonArray m_materials;
+    QJsonArray m_textures;
+    std::vector<Accessor> m_accessors;
+    std::vector<std::vector<Primitive>> m_meshes;
+    std::vector<Node> m_nodes;
+    std::vector<int> m_rootNodes;
+    std::vector<Image> m_images;
+};
+
+#endif
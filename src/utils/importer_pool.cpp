@@ -0,0 +1,44 @@
+﻿#include "importer_pool.h"
+#include <assimp/config.h>
+#include <assimp/scene.h>
+
+ImporterPool::Importer::Importer()
+    : m_ioSystem(new MappedIOSystem)
+{
+    m_importer.SetIOHandler(m_ioSystem);
+    // the renderers draw triangle lists, profiles that sort by primitive type drop points, lines and degenerate triangles
+    m_importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+    m_importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);
+}
+
+ImporterPool::Lease ImporterPool::acquire()
+{
+    std::unique_ptr<Importer> importer;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (!m_idle.empty())
+        {
+            importer = std::move(m_idle.back());
+            m_idle.pop_back();
+        }
+        else
+        {
+            ++m_createdCount;
+        }
+    }
+    if (!importer)
+        importer.reset(new Importer);
+
+    return Lease(importer.release(), [this](Importer *released)
+                 {
+                     // the scene of the import is not kept while the importer waits
+                     released->m_importer.FreeScene();
+                     QMutexLocker locker(&m_mutex);
+                     m_idle.emplace_back(released); });
+}
+
+int ImporterPool::createdCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_createdCount;
+}
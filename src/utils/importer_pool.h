@@ -0,0 +1,37 @@
+﻿#ifndef __IMPORTER_POOL_H__
+#define __IMPORTER_POOL_H__
+
+#include "mapped_io_system.h"
+#include <QMutex>
+#include <assimp/Importer.hpp>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/////////////////////////////////////////////////////////////////
+// assimp importers for concurrent imports, an importer holds the scene it read and serves one import at a time
+// importers are created when every one is leased and kept for the next imports once returned
+class ImporterPool
+{
+public:
+    struct Importer
+    {
+        Importer();
+
+        Assimp::Importer m_importer;
+        MappedIOSystem *m_ioSystem; // owned by m_importer
+    };
+
+    // returns the importer to the pool when it goes out of scope
+    using Lease = std::unique_ptr<Importer, std::function<void(Importer *)>>;
+
+    Lease acquire();
+    int createdCount() const;
+
+private:
+    mutable QMutex m_mutex;
+    std::vector<std::unique_ptr<Importer>> m_idle;
+    int m_createdCount = 0;
+};
+
+#endif
@@ -51,13 +51,42 @@ public:
             }
             DListNode<T1, T2>* newNode = new DListNode<T1, T2>(key, value);
             newNode->next = head;
-            head->prev = newNode;
+            if (head)
+                head->prev = newNode;
+            else
+                tail = newNode;
             head = newNode;
             cache[key] = newNode;
             size++;
         }
     }
 
+    // 删除元素，不存在则什么也不做
+    void remove(T1 key) {
+        auto it = cache.find(key);
+        if (it == cache.end())
+            return;
+        DListNode<T1, T2>* node = it->second;
+        if (node->prev)
+            node->prev->next = node->next;
+        else
+            head = node->next;
+        if (node->next)
+            node->next->prev = node->prev;
+        else
+            tail = node->prev;
+        cache.erase(it);
+        delete node;
+        size--;
+    }
+
+    // 遍历所有元素，不改变顺序
+    template <typename F>
+    void forEach(F function) const {
+        for (const auto& item : cache)
+            function(item.first, item.second->value);
+    }
+
 private:
     // 将节点移到链表头部
     void moveToHead(DListNode<T1, T2>* node) {
@@ -0,0 +1,164 @@
+﻿#include "mapped_io_system.h"
+#include <QFileInfo>
+#include <cstring>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // the hints only change how the os pages the file in, failures are ignored
+    static void adviseSequential(const unsigned char *data, qint64 size)
+    {
+#ifndef WIN32
+        const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+        const uintptr_t begin = (uintptr_t)data & ~(pageSize - 1);
+        madvise((void *)begin, (uintptr_t)data + size - begin, MADV_SEQUENTIAL);
+#else
+        Q_UNUSED(data);
+        Q_UNUSED(size);
+#endif
+    }
+
+    static void prefetch(const unsigned char *data, qint64 size)
+    {
+#ifdef WIN32
+        WIN32_MEMORY_RANGE_ENTRY range;
+        range.VirtualAddress = const_cast<unsigned char *>(data);
+        range.NumberOfBytes = (SIZE_T)size;
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+        const uintptr_t begin = (uintptr_t)data & ~(pageSize - 1);
+        madvise((void *)begin, (uintptr_t)data + size - begin, MADV_WILLNEED);
+#endif
+    }
+}
+
+class MappedIOSystem::Stream : public Assimp::IOStream
+{
+public:
+    Stream(MappedIOSystem *system) : m_system(system) {}
+    ~Stream() override
+    {
+        if (m_file.isOpen())
+            m_system->m_syscalls += m_data ? 2 : 1;
+    }
+
+    bool open(const QString &path)
+    {
+        m_file.setFileName(path);
+        if (!m_file.open(QIODevice::ReadOnly))
+            return false;
+        ++m_system->m_syscalls;
+        m_size = m_file.size();
+        if (!m_size)
+            return true;
+        m_data = m_file.map(0, m_size);
+        if (!m_data)
+            return false;
+        ++m_system->m_syscalls;
+        adviseSequential(m_data, m_size);
+        ++m_system->m_syscalls;
+        readAhead();
+        return true;
+    }
+
+    size_t Read(void *pvBuffer, size_t pSize, size_t pCount) override
+    {
+        // like fread only whole elements are read
+        if (!pSize || m_position >= m_size)
+            return 0;
+        const size_t count = qMin<size_t>(pCount, (size_t)(m_size - m_position) / pSize);
+        const qint64 bytes = (qint64)(count * pSize);
+        memcpy(pvBuffer, m_data + m_position, bytes);
+        m_position += bytes;
+        ++m_system->m_readCalls;
+        m_system->m_bytesRead += bytes;
+        if (m_position + MAPPED_IO_READ_AHEAD_BYTES / 2 > m_prefetched)
+            readAhead();
+        return count;
+    }
+
+    size_t Write(const void *, size_t, size_t) override { return 0; }
+
+    aiReturn Seek(size_t pOffset, aiOrigin pOrigin) override
+    {
+        qint64 position = (qint64)pOffset;
+        if (pOrigin == aiOrigin_CUR)
+            position += m_position;
+        else if (pOrigin == aiOrigin_END)
+            position = m_size - (qint64)pOffset;
+        if (position < 0 || position > m_size)
+            return aiReturn_FAILURE;
+        m_position = position;
+        // a jump past the prefetched window starts a new one where the reads continue
+        if (m_position >= m_prefetched || m_position + MAPPED_IO_READ_AHEAD_BYTES < m_prefetched)
+        {
+            m_prefetched = m_position;
+            readAhead();
+        }
+        return aiReturn_SUCCESS;
+    }
+
+    size_t Tell() const override { return (size_t)m_position; }
+    size_t FileSize() const override { return (size_t)m_size; }
+    void Flush() override {}
+
+private:
+    void readAhead()
+    {
+        const qint64 begin = qMax(m_position, m_prefetched);
+        const qint64 end = qMin(begin + MAPPED_IO_READ_AHEAD_BYTES, m_size);
+        if (begin >= end)
+            return;
+        prefetch(m_data + begin, end - begin);
+        ++m_system->m_syscalls;
+        m_prefetched = end;
+    }
+
+private:
+    MappedIOSystem *m_system;
+    QFile m_file;
+    const unsigned char *m_data = nullptr;
+    qint64 m_size = 0;
+    qint64 m_position = 0;
+    qint64 m_prefetched = 0; // end of the window handed to the os
+};
+
+bool MappedIOSystem::Exists(const char *pFile) const
+{
+    return QFileInfo::exists(QString::fromUtf8(pFile));
+}
+
+Assimp::IOStream *MappedIOSystem::Open(const char *pFile, const char *pMode)
+{
+    if (strchr(pMode, 'w') || strchr(pMode, 'a') || strchr(pMode, '+'))
+        return m_fallback.Open(pFile, pMode);
+
+    Stream *stream = new Stream(this);
+    if (!stream->open(QString::fromUtf8(pFile)))
+    {
+        delete stream;
+        // files that cannot be mapped are still read, through stdio
+        return QFileInfo::exists(QString::fromUtf8(pFile)) ? m_fallback.Open(pFile, pMode) : nullptr;
+    }
+    ++m_filesOpened;
+    return stream;
+}
+
+void MappedIOSystem::Close(Assimp::IOStream *pFile)
+{
+    delete pFile;
+}
+
+void MappedIOSystem::resetCounters()
+{
+    m_bytesRead = 0;
+    m_readCalls = 0;
+    m_syscalls = 0;
+    m_filesOpened = 0;
+}
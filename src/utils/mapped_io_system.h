@@ -0,0 +1,41 @@
+﻿#ifndef __MAPPED_IO_SYSTEM_H__
+#define __MAPPED_IO_SYSTEM_H__
+
+#include <QFile>
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+#include <assimp/DefaultIOSystem.h>
+
+#define MAPPED_IO_READ_AHEAD_BYTES (8ll << 20) // the os is asked to page in this much in front of the reads
+
+/////////////////////////////////////////////////////////////////
+// assimp file system that maps the files it reads, reads are copies out of the page cache instead of stdio calls
+// the mapping is advised as sequential and the next window is prefetched while the importer walks through the file
+// files opened for writing go to the default io system of assimp
+class MappedIOSystem : public Assimp::IOSystem
+{
+public:
+    bool Exists(const char *pFile) const override;
+    char getOsSeparator() const override { return '/'; }
+    Assimp::IOStream *Open(const char *pFile, const char *pMode = "rb") override;
+    void Close(Assimp::IOStream *pFile) override;
+
+    // what the streams did since the last reset, syscalls counts the opens, maps, read-ahead advice and closes
+    qint64 bytesRead() const { return m_bytesRead; }
+    qint64 readCalls() const { return m_readCalls; }
+    qint64 syscalls() const { return m_syscalls; }
+    qint64 filesOpened() const { return m_filesOpened; }
+    void resetCounters();
+
+private:
+    class Stream;
+    friend class Stream;
+
+    Assimp::DefaultIOSystem m_fallback;
+    qint64 m_bytesRead = 0;
+    qint64 m_readCalls = 0;
+    qint64 m_syscalls = 0;
+    qint64 m_filesOpened = 0;
+};
+
+#endif
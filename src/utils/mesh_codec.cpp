@@ -0,0 +1,583 @@
+﻿#include "mesh_codec.h"
+#include "parallel_for.h"
+#include "vertex_streams.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#ifdef VERTEX_STREAMS_SSE2
+#include <emmintrin.h>
+#endif
+
+#define MESH_CODEC_FIFO_SIZE 16
+#define MESH_CODEC_EDGE_SEARCH 15   // a code byte is edge << 4 | vertex, edge 15 marks a triangle that shares no edge
+#define MESH_CODEC_VERTEX_SEARCH 14 // vertex 0 is the next vertex, 1 to 14 the fifo, 15 an explicit index
+
+namespace
+{
+    // the last edges and vertices both sides have seen, a chunk starts from zeros
+    struct IndexFifo
+    {
+        quint32 m_edges[MESH_CODEC_FIFO_SIZE][2] = {};
+        quint32 m_vertices[MESH_CODEC_FIFO_SIZE] = {};
+        int m_edgeOffset = 0;
+        int m_vertexOffset = 0;
+
+        void pushEdge(quint32 a, quint32 b)
+        {
+            quint32 *edge = m_edges[m_edgeOffset++ & (MESH_CODEC_FIFO_SIZE - 1)];
+            edge[0] = a;
+            edge[1] = b;
+        }
+        void pushVertex(quint32 vertex) { m_vertices[m_vertexOffset++ & (MESH_CODEC_FIFO_SIZE - 1)] = vertex; }
+        const quint32 *edge(int distance) const { return m_edges[(m_edgeOffset - 1 - distance) & (MESH_CODEC_FIFO_SIZE - 1)]; }
+        quint32 vertex(int distance) const { return m_vertices[(m_vertexOffset - 1 - distance) & (MESH_CODEC_FIFO_SIZE - 1)]; }
+        int findVertex(quint32 vertex, int count) const
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                if (this->vertex(i) == vertex)
+                    return i;
+            }
+            return -1;
+        }
+    };
+
+    struct IndexChunk
+    {
+        quint32 m_next; // next unused vertex when the chunk starts
+        quint32 m_last; // last explicit index
+    };
+
+    static void writeVarint(QByteArray &out, quint32 value)
+    {
+        while (value >= 0x80)
+        {
+            out.append((char)(value | 0x80));
+            value >>= 7;
+        }
+        out.append((char)value);
+    }
+
+    static bool readVarint(const uchar *&ip, const uchar *end, quint32 &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 35; shift += 7)
+        {
+            if (ip == end)
+                return false;
+            const uchar byte = *ip++;
+            value |= (quint32)(byte & 0x7f) << shift;
+            if (byte < 0x80)
+                return true;
+        }
+        return false;
+    }
+
+    static quint32 zigzag(quint32 delta)
+    {
+        return (delta << 1) ^ (quint32)((qint32)delta >> 31);
+    }
+
+    static quint32 unzigzag(quint32 value)
+    {
+        return (value >> 1) ^ (0u - (value & 1));
+    }
+
+    static void encodeExplicit(QByteArray &out, quint32 index, IndexChunk &state)
+    {
+        writeVarint(out, zigzag(index - state.m_last));
+        state.m_last = index;
+    }
+
+    static void encodeIndexChunk(const unsigned int *indices, qint64 triangleCount, IndexChunk &state, QByteArray &out)
+    {
+        IndexFifo fifo;
+        for (qint64 i = 0; i < triangleCount; ++i)
+        {
+            const unsigned int *triangle = indices + i * 3;
+            int edgeDistance = -1, rotation = 0;
+            for (int distance = 0; distance < MESH_CODEC_EDGE_SEARCH && edgeDistance < 0; ++distance)
+            {
+                const quint32 *edge = fifo.edge(distance);
+                for (int r = 0; r < 3; ++r)
+                {
+                    if (triangle[r] == edge[0] && triangle[(r + 1) % 3] == edge[1])
+                    {
+                        edgeDistance = distance;
+                        rotation = r;
+                        break;
+                    }
+                }
+            }
+
+            if (edgeDistance >= 0)
+            {
+                const quint32 a = triangle[rotation], b = triangle[(rotation + 1) % 3], c = triangle[(rotation + 2) % 3];
+                const int vertexDistance = fifo.findVertex(c, MESH_CODEC_VERTEX_SEARCH);
+                if (c == state.m_next)
+                {
+                    out.append((char)(edgeDistance << 4));
+                    ++state.m_next;
+                    fifo.pushVertex(c);
+                }
+                else if (vertexDistance >= 0)
+                    out.append((char)(edgeDistance << 4 | (vertexDistance + 1)));
+                else
+                {
+                    out.append((char)(edgeDistance << 4 | 15));
+                    encodeExplicit(out, c, state);
+                    fifo.pushVertex(c);
+                }
+                fifo.pushEdge(c, b);
+                fifo.pushEdge(a, c);
+                continue;
+            }
+
+            // no shared edge, the vertex codes of the corners go into the code byte and the one after it, then the explicit indices
+            int codes[3];
+            QByteArray explicitIndices;
+            for (int j = 0; j < 3; ++j)
+            {
+                const quint32 v = triangle[j];
+                const int vertexDistance = fifo.findVertex(v, MESH_CODEC_VERTEX_SEARCH);
+                if (v == state.m_next)
+                {
+                    codes[j] = 0;
+                    ++state.m_next;
+                    fifo.pushVertex(v);
+                }
+                else if (vertexDistance >= 0)
+                    codes[j] = vertexDistance + 1;
+                else
+                {
+                    codes[j] = 15;
+                    encodeExplicit(explicitIndices, v, state);
+                    fifo.pushVertex(v);
+                }
+            }
+            out.append((char)(MESH_CODEC_EDGE_SEARCH << 4 | codes[0]));
+            out.append((char)(codes[1] | codes[2] << 4));
+            out.append(explicitIndices);
+            fifo.pushEdge(triangle[1], triangle[0]);
+            fifo.pushEdge(triangle[2], triangle[1]);
+            fifo.pushEdge(triangle[0], triangle[2]);
+        }
+    }
+
+    static bool decodeIndexChunk(const uchar *ip, const uchar *end, qint64 triangleCount, IndexChunk state, unsigned int *indices)
+    {
+        IndexFifo fifo;
+        for (qint64 i = 0; i < triangleCount; ++i, indices += 3)
+        {
+            if (ip == end)
+                return false;
+            const uchar code = *ip++;
+            const int edgeDistance = code >> 4;
+            if (edgeDistance < MESH_CODEC_EDGE_SEARCH)
+            {
+                const quint32 *edge = fifo.edge(edgeDistance);
+                const quint32 a = edge[0], b = edge[1];
+                const int vertexCode = code & 15;
+                quint32 c;
+                if (!vertexCode)
+                {
+                    c = state.m_next++;
+                    fifo.pushVertex(c);
+                }
+                else if (vertexCode < 15)
+                    c = fifo.vertex(vertexCode - 1);
+                else
+                {
+                    quint32 delta;
+                    if (!readVarint(ip, end, delta))
+                        return false;
+                    c = state.m_last += unzigzag(delta);
+                    fifo.pushVertex(c);
+                }
+                indices[0] = a;
+                indices[1] = b;
+                indices[2] = c;
+                fifo.pushEdge(c, b);
+                fifo.pushEdge(a, c);
+                continue;
+            }
+
+            if (ip == end)
+                return false;
+            const int codes[3] = {code & 15, *ip & 15, *ip >> 4};
+            ++ip;
+            for (int j = 0; j < 3; ++j)
+            {
+                if (!codes[j])
+                {
+                    indices[j] = state.m_next++;
+                    fifo.pushVertex(indices[j]);
+                }
+                else if (codes[j] < 15)
+                    indices[j] = fifo.vertex(codes[j] - 1);
+                else
+                {
+                    quint32 delta;
+                    if (!readVarint(ip, end, delta))
+                        return false;
+                    indices[j] = state.m_last += unzigzag(delta);
+                    fifo.pushVertex(indices[j]);
+                }
+            }
+            fifo.pushEdge(indices[1], indices[0]);
+            fifo.pushEdge(indices[2], indices[1]);
+            fifo.pushEdge(indices[0], indices[2]);
+        }
+        return ip == end;
+    }
+
+    // bits of a word difference in a group of 16 vertices: 0, 4, 8 or 16, two bits per word in the group header
+    static int widthBits(int width)
+    {
+        static const int bits[4] = {0, 4, 8, 16};
+        return bits[width];
+    }
+
+    static quint16 zigzag16(quint16 delta)
+    {
+        return (quint16)((delta << 1) ^ (quint16)((qint16)delta >> 15));
+    }
+
+    static void encodeVertexChunk(const quint16 *words, qint64 vertexCount, int vertexWords, QByteArray &out)
+    {
+        std::vector<quint16> previous(vertexWords, 0);
+        quint16 deltas[16];
+        for (qint64 group = 0; group < vertexCount; group += 16)
+        {
+            const int count = (int)qMin<qint64>(16, vertexCount - group);
+            const int headerAt = out.size();
+            out.append(QByteArray(vertexWords / 4, 0));
+            for (int w = 0; w < vertexWords; ++w)
+            {
+                quint16 largest = 0;
+                for (int k = 0; k < 16; ++k)
+                {
+                    deltas[k] = 0;
+                    if (k < count)
+                    {
+                        const quint16 value = words[(group + k) * vertexWords + w];
+                        deltas[k] = zigzag16((quint16)(value - previous[w]));
+                        previous[w] = value;
+                    }
+                    largest = qMax(largest, deltas[k]);
+                }
+                const int width = !largest ? 0 : (largest < 16 ? 1 : (largest < 256 ? 2 : 3));
+                out.data()[headerAt + w / 4] |= (char)(width << (w % 4 * 2));
+                if (width == 1)
+                {
+                    for (int k = 0; k < 16; k += 2)
+                        out.append((char)(deltas[k] | deltas[k + 1] << 4));
+                }
+                else if (width == 2)
+                {
+                    for (int k = 0; k < 16; ++k)
+                        out.append((char)deltas[k]);
+                }
+                else if (width == 3)
+                    out.append(reinterpret_cast<const char *>(deltas), sizeof(deltas));
+            }
+        }
+    }
+
+    // one word of 16 vertices, lane receives the running sum of the differences
+    static const uchar *decodeLane(const uchar *ip, int width, quint16 &previous, quint16 *lane)
+    {
+#ifdef VERTEX_STREAMS_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = zero, hi = zero;
+        if (width == 1)
+        {
+            const __m128i mask = _mm_set1_epi8(0x0f);
+            const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(ip));
+            const __m128i nibbles = _mm_unpacklo_epi8(_mm_and_si128(bytes, mask), _mm_and_si128(_mm_srli_epi16(bytes, 4), mask));
+            lo = _mm_unpacklo_epi8(nibbles, zero);
+            hi = _mm_unpackhi_epi8(nibbles, zero);
+        }
+        else if (width == 2)
+        {
+            const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ip));
+            lo = _mm_unpacklo_epi8(bytes, zero);
+            hi = _mm_unpackhi_epi8(bytes, zero);
+        }
+        else if (width == 3)
+        {
+            lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ip));
+            hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ip + 16));
+        }
+        const __m128i one = _mm_set1_epi16(1);
+        lo = _mm_xor_si128(_mm_srli_epi16(lo, 1), _mm_sub_epi16(zero, _mm_and_si128(lo, one)));
+        hi = _mm_xor_si128(_mm_srli_epi16(hi, 1), _mm_sub_epi16(zero, _mm_and_si128(hi, one)));
+        // prefix sums of eight differences, in three shifted adds
+        lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 2));
+        hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 2));
+        lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 4));
+        hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 4));
+        lo = _mm_add_epi16(lo, _mm_slli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_slli_si128(hi, 8));
+        lo = _mm_add_epi16(lo, _mm_set1_epi16((short)previous));
+        const __m128i last = _mm_shufflehi_epi16(lo, 0xff);
+        hi = _mm_add_epi16(hi, _mm_unpackhi_epi64(last, last));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lane), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(lane + 8), hi);
+        previous = lane[15];
+#else
+        for (int k = 0; k < 16; ++k)
+        {
+            quint16 value = 0;
+            if (width == 1)
+                value = (ip[k / 2] >> (k % 2 * 4)) & 15;
+            else if (width == 2)
+                value = ip[k];
+            else if (width == 3)
+                memcpy(&value, ip + k * 2, sizeof(value));
+            previous = (quint16)(previous + ((value >> 1) ^ (0u - (value & 1))));
+            lane[k] = previous;
+        }
+#endif
+        return ip + widthBits(width) * 2;
+    }
+
+    static bool decodeVertexChunk(const uchar *ip, const uchar *end, qint64 vertexCount, int vertexWords, quint16 *words)
+    {
+        std::vector<quint16> previous(vertexWords, 0);
+        // the words of a group, word after word
+        std::vector<quint16> lanes(vertexWords * 16);
+        for (qint64 group = 0; group < vertexCount; group += 16)
+        {
+            const int count = (int)qMin<qint64>(16, vertexCount - group);
+            const uchar *header = ip;
+            if (end - ip < vertexWords / 4)
+                return false;
+            ip += vertexWords / 4;
+            qint64 payload = 0;
+            for (int w = 0; w < vertexWords; ++w)
+                payload += widthBits(header[w / 4] >> (w % 4 * 2) & 3) * 2;
+            if (end - ip < payload)
+                return false;
+            for (int w = 0; w < vertexWords; ++w)
+                ip = decodeLane(ip, header[w / 4] >> (w % 4 * 2) & 3, previous[w], &lanes[w * 16]);
+
+            quint16 *out = words + group * vertexWords;
+#ifdef VERTEX_STREAMS_SSE2
+            if (count == 16)
+            {
+                // 8 by 8 transposes from words of 8 vertices to vertices of 8 words
+                for (int w = 0; w < vertexWords; w += 8)
+                {
+                    for (int v = 0; v < 16; v += 8)
+                    {
+                        __m128i r[8];
+                        for (int i = 0; i < 8; ++i)
+                            r[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&lanes[(w + i) * 16 + v]));
+                        const __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+                        const __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+                        const __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+                        const __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+                        const __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+                        const __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+                        const __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+                        const __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+                        const __m128i rows[8] = {_mm_unpacklo_epi64(b0, b4), _mm_unpackhi_epi64(b0, b4), _mm_unpacklo_epi64(b1, b5),
+                                                 _mm_unpackhi_epi64(b1, b5), _mm_unpacklo_epi64(b2, b6), _mm_unpackhi_epi64(b2, b6),
+                                                 _mm_unpacklo_epi64(b3, b7), _mm_unpackhi_epi64(b3, b7)};
+                        for (int i = 0; i < 8; ++i)
+                            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + (v + i) * vertexWords + w), rows[i]);
+                    }
+                }
+                continue;
+            }
+#endif
+            for (int k = 0; k < count; ++k)
+            {
+                for (int w = 0; w < vertexWords; ++w)
+                    out[k * vertexWords + w] = lanes[w * 16 + k];
+            }
+        }
+        return ip == end;
+    }
+
+    // chunk count, then the offset of every chunk and of the end relative to the data after the table
+    static bool readChunkTable(const char *data, qint64 size, qint64 chunkCount, qint64 tableBytes, std::vector<quint32> &offsets)
+    {
+        offsets.resize(chunkCount + 1);
+        const qint64 dataStart = sizeof(quint32) + tableBytes + offsets.size() * sizeof(quint32);
+        if (size < dataStart)
+            return false;
+        memcpy(offsets.data(), data + sizeof(quint32) + tableBytes, offsets.size() * sizeof(quint32));
+        for (qint64 i = 0; i < chunkCount; ++i)
+        {
+            if (offsets[i] > offsets[i + 1])
+                return false;
+        }
+        return offsets.back() == size - dataStart;
+    }
+}
+
+QByteArray MeshCodec::encodeIndices(const unsigned int *indices, qint64 indexCount)
+{
+    // lists with points or lines left in them are not triangle lists, they are stored as they are
+    const qint64 triangleCount = indexCount % 3 ? 0 : indexCount / 3;
+    const quint32 chunkCount = indexCount % 3 ? 0 : (quint32)((triangleCount + MESH_CODEC_CHUNK_TRIANGLES - 1) / MESH_CODEC_CHUNK_TRIANGLES);
+    QByteArray out(reinterpret_cast<const char *>(&chunkCount), sizeof(chunkCount));
+    if (indexCount % 3)
+    {
+        out.append(reinterpret_cast<const char *>(indices), indexCount * sizeof(unsigned int));
+        return out;
+    }
+
+    std::vector<IndexChunk> states(chunkCount);
+    std::vector<quint32> offsets(chunkCount + 1, 0);
+    QByteArray chunks;
+    IndexChunk state = {0, 0};
+    for (quint32 i = 0; i < chunkCount; ++i)
+    {
+        states[i] = state;
+        offsets[i] = chunks.size();
+        const qint64 first = (qint64)i * MESH_CODEC_CHUNK_TRIANGLES;
+        encodeIndexChunk(indices + first * 3, qMin<qint64>(MESH_CODEC_CHUNK_TRIANGLES, triangleCount - first), state, chunks);
+    }
+    offsets[chunkCount] = chunks.size();
+    out.append(reinterpret_cast<const char *>(states.data()), states.size() * sizeof(IndexChunk));
+    out.append(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(quint32));
+    out.append(chunks);
+    return out;
+}
+
+bool MeshCodec::decodeIndices(const char *data, qint64 size, unsigned int *indices, qint64 indexCount)
+{
+    quint32 chunkCount;
+    if (size < (qint64)sizeof(chunkCount))
+        return false;
+    memcpy(&chunkCount, data, sizeof(chunkCount));
+    if (indexCount % 3)
+    {
+        if (chunkCount || size != (qint64)(sizeof(chunkCount) + indexCount * sizeof(unsigned int)))
+            return false;
+        memcpy(indices, data + sizeof(chunkCount), indexCount * sizeof(unsigned int));
+        return true;
+    }
+
+    const qint64 triangleCount = indexCount / 3;
+    std::vector<quint32> offsets;
+    if (chunkCount != (quint32)((triangleCount + MESH_CODEC_CHUNK_TRIANGLES - 1) / MESH_CODEC_CHUNK_TRIANGLES) ||
+        !readChunkTable(data, size, chunkCount, chunkCount * sizeof(IndexChunk), offsets))
+        return false;
+    if (!chunkCount)
+        return true;
+    std::vector<IndexChunk> states(chunkCount);
+    memcpy(states.data(), data + sizeof(chunkCount), states.size() * sizeof(IndexChunk));
+    const uchar *chunks = reinterpret_cast<const uchar *>(data) + size - offsets.back();
+
+    std::atomic<bool> decoded(true);
+    parallelFor(0, (int)chunkCount, [&](int i)
+                {
+                    const qint64 first = (qint64)i * MESH_CODEC_CHUNK_TRIANGLES;
+                    if (!decodeIndexChunk(chunks + offsets[i], chunks + offsets[i + 1], qMin<qint64>(MESH_CODEC_CHUNK_TRIANGLES, triangleCount - first),
+                                          states[i], indices + first * 3))
+                        decoded = false; });
+    return decoded;
+}
+
+QByteArray MeshCodec::encodeVertices(const quint16 *words, qint64 vertexCount, int vertexWords)
+{
+    const quint32 chunkCount = (quint32)((vertexCount + MESH_CODEC_CHUNK_VERTICES - 1) / MESH_CODEC_CHUNK_VERTICES);
+    const quint32 header[2] = {chunkCount, (quint32)vertexWords};
+    std::vector<quint32> offsets(chunkCount + 1, 0);
+    QByteArray chunks;
+    for (quint32 i = 0; i < chunkCount; ++i)
+    {
+        offsets[i] = chunks.size();
+        const qint64 first = (qint64)i * MESH_CODEC_CHUNK_VERTICES;
+        encodeVertexChunk(words + first * vertexWords, qMin<qint64>(MESH_CODEC_CHUNK_VERTICES, vertexCount - first), vertexWords, chunks);
+    }
+    offsets[chunkCount] = chunks.size();
+    QByteArray out(reinterpret_cast<const char *>(header), sizeof(header));
+    out.append(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(quint32));
+    out.append(chunks);
+    return out;
+}
+
+bool MeshCodec::decodeVertices(const char *data, qint64 size, quint16 *words, qint64 vertexCount, int vertexWords)
+{
+    quint32 header[2];
+    if (size < (qint64)sizeof(header) || vertexWords <= 0 || vertexWords % 8)
+        return false;
+    memcpy(header, data, sizeof(header));
+    std::vector<quint32> offsets;
+    if (header[0] != (quint32)((vertexCount + MESH_CODEC_CHUNK_VERTICES - 1) / MESH_CODEC_CHUNK_VERTICES) || header[1] != (quint32)vertexWords ||
+        !readChunkTable(data, size, header[0], sizeof(quint32), offsets))
+        return false;
+    const uchar *chunks = reinterpret_cast<const uchar *>(data) + size - offsets.back();
+
+    std::atomic<bool> decoded(true);
+    parallelFor(0, (int)header[0], [&](int i)
+                {
+                    const qint64 first = (qint64)i * MESH_CODEC_CHUNK_VERTICES;
+                    if (!decodeVertexChunk(chunks + offsets[i], chunks + offsets[i + 1], qMin<qint64>(MESH_CODEC_CHUNK_VERTICES, vertexCount - first),
+                                           vertexWords, words + first * vertexWords))
+                        decoded = false; });
+    return decoded;
+}
+
+void MeshCodec::firstUseOrder(const unsigned int *indices, qint64 indexCount, qint64 vertexCount, unsigned int *remap)
+{
+    const unsigned int unused = ~0u;
+    std::fill(remap, remap + vertexCount, unused);
+    unsigned int next = 0;
+    for (qint64 i = 0; i < indexCount; ++i)
+    {
+        if (indices[i] < vertexCount && remap[indices[i]] == unused)
+            remap[indices[i]] = next++;
+    }
+    for (qint64 i = 0; i < vertexCount; ++i)
+    {
+        if (remap[i] == unused)
+            remap[i] = next++;
+    }
+}
+
+void MeshCodec::octEncode(const float *vector, quint16 *words)
+{
+    const float length = qAbs(vector[0]) + qAbs(vector[1]) + qAbs(vector[2]);
+    float x = 0.0f, y = 0.0f;
+    if (length > 0.0f)
+    {
+        x = vector[0] / length;
+        y = vector[1] / length;
+        if (vector[2] < 0.0f)
+        {
+            // the lower half is folded over the diagonals
+            const float fx = (1.0f - qAbs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+            const float fy = (1.0f - qAbs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+            x = fx;
+            y = fy;
+        }
+    }
+    words[0] = (quint16)std::lround((qBound(-1.0f, x, 1.0f) * 0.5f + 0.5f) * 65535.0f);
+    words[1] = (quint16)std::lround((qBound(-1.0f, y, 1.0f) * 0.5f + 0.5f) * 65535.0f);
+}
+
+void MeshCodec::octDecode(const quint16 *words, float *vector)
+{
+    float x = words[0] / 65535.0f * 2.0f - 1.0f;
+    float y = words[1] / 65535.0f * 2.0f - 1.0f;
+    const float z = 1.0f - qAbs(x) - qAbs(y);
+    if (z < 0.0f)
+    {
+        const float fx = (1.0f - qAbs(y)) * (x < 0.0f ? -1.0f : 1.0f);
+        const float fy = (1.0f - qAbs(x)) * (y < 0.0f ? -1.0f : 1.0f);
+        x = fx;
+        y = fy;
+    }
+    const float inverseLength = 1.0f / std::sqrt(x * x + y * y + z * z);
+    vector[0] = x * inverseLength;
+    vector[1] = y * inverseLength;
+    vector[2] = z * inverseLength;
+}
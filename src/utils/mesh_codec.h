@@ -0,0 +1,33 @@
+﻿#ifndef __MESH_CODEC_H__
+#define __MESH_CODEC_H__
+
+#include <QByteArray>
+
+#define MESH_CODEC_CHUNK_TRIANGLES 16384 // triangles and vertices of the chunks decoded in parallel
+#define MESH_CODEC_CHUNK_VERTICES 8192   // a multiple of the 16 vertex groups
+
+/////////////////////////////////////////////////////////////////
+// compression of index buffers and quantized vertices, in the manner of the meshoptimizer codecs
+// indices: a triangle usually shares an edge with one of the last triangles and adds the next unused vertex, which
+// takes one byte, two without a shared edge, the vertices must be numbered in the order the triangles first use them (see firstUseOrder)
+// vertices: fixed-size vertices of 16 bit words, the difference to the previous vertex is bit-packed per word and group of
+// 16 vertices, the groups are decoded with sse2 and transposed back to vertices
+// both buffers are cut into chunks that decode on their own, the chunks are decoded in parallel
+class MeshCodec
+{
+public:
+    // triangles may come back rotated, their winding is kept
+    static QByteArray encodeIndices(const unsigned int *indices, qint64 indexCount);
+    static bool decodeIndices(const char *data, qint64 size, unsigned int *indices, qint64 indexCount);
+    // vertexWords is a multiple of 8
+    static QByteArray encodeVertices(const quint16 *words, qint64 vertexCount, int vertexWords);
+    static bool decodeVertices(const char *data, qint64 size, quint16 *words, qint64 vertexCount, int vertexWords);
+
+    // new index of every vertex in the order the triangles reach it first, unused vertices go last
+    static void firstUseOrder(const unsigned int *indices, qint64 indexCount, qint64 vertexCount, unsigned int *remap);
+    // unit vector as two 16 bit octahedral coordinates, about 0.005 degree apart, zero vectors become +z
+    static void octEncode(const float *vector, quint16 *words);
+    static void octDecode(const quint16 *words, float *vector);
+};
+
+#endif
@@ -0,0 +1,63 @@
+﻿#include "model_disk_cache.h"
+#include <spdlog/spdlog.h>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QMutex>
+
+namespace
+{
+    static QString &cacheDirRef()
+    {
+        static QString sCacheDir;
+        return sCacheDir;
+    }
+
+    // models are imported on several threads, all of them ask for the dir
+    static QMutex &cacheDirMutex()
+    {
+        static QMutex sMutex;
+        return sMutex;
+    }
+}
+
+QString ModelDiskCache::cacheDir()
+{
+    QString dir;
+    {
+        QMutexLocker locker(&cacheDirMutex());
+        if (cacheDirRef().isEmpty())
+            cacheDirRef() = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/model_cache";
+        dir = cacheDirRef();
+    }
+    if (!QDir().mkpath(dir))
+        spdlog::error("create model cache dir failed. dir: {}", dir.toStdString());
+    return dir;
+}
+
+void ModelDiskCache::setCacheDir(const QString &dir)
+{
+    QMutexLocker locker(&cacheDirMutex());
+    cacheDirRef() = dir;
+}
+
+QString ModelDiskCache::cacheKey(const QString &modelPath)
+{
+    QFileInfo fileInfo(modelPath);
+    QByteArray source = fileInfo.absoluteFilePath().toUtf8();
+    source += '|' + QByteArray::number(fileInfo.size());
+    source += '|' + QByteArray::number(fileInfo.lastModified().toMSecsSinceEpoch());
+    return QString::fromLatin1(QCryptographicHash::hash(source, QCryptographicHash::Sha1).toHex());
+}
+
+QString ModelDiskCache::cacheFilePath(const QString &modelPath, const QString &suffix)
+{
+    return QString("%1/%2_%3.%4").arg(cacheDir(), QFileInfo(modelPath).completeBaseName(), cacheKey(modelPath), suffix);
+}
+
+bool ModelDiskCache::contains(const QString &modelPath, const QString &suffix)
+{
+    return QFileInfo::exists(cacheFilePath(modelPath, suffix));
+}
@@ -0,0 +1,20 @@
+﻿#ifndef __MODEL_DISK_CACHE_H__
+#define __MODEL_DISK_CACHE_H__
+
+#include <QString>
+
+// on-disk cache for data derived from a model file (page files, baked textures, ...)
+// the cache key contains the size and modification time of the source, so a changed model never hits a stale entry
+class ModelDiskCache
+{
+public:
+    static QString cacheDir();
+    static QString cacheFilePath(const QString &modelPath, const QString &suffix);
+    static bool contains(const QString &modelPath, const QString &suffix);
+    static void setCacheDir(const QString &dir);
+
+private:
+    static QString cacheKey(const QString &modelPath);
+};
+
+#endif
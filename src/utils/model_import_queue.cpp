@@ -0,0 +1,67 @@
+﻿#include "model_import_queue.h"
+#include <QThread>
+
+ModelImportQueue::ModelImportQueue(const DoneFunction &done, int threadCount, int capacity)
+    : m_done(done)
+{
+    m_pool.setMaxThreadCount(threadCount > 0 ? threadCount : qMax(QThread::idealThreadCount(), 1));
+    m_capacity = capacity > 0 ? capacity : m_pool.maxThreadCount() * 2;
+}
+
+ModelImportQueue::~ModelImportQueue()
+{
+    waitForDone();
+}
+
+void ModelImportQueue::push(const QString &modelPath)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        while (m_pending >= m_capacity)
+            m_changed.wait(&m_mutex);
+        ++m_pending;
+    }
+    start(modelPath);
+}
+
+bool ModelImportQueue::tryPush(const QString &modelPath)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_pending >= m_capacity)
+            return false;
+        ++m_pending;
+    }
+    start(modelPath);
+    return true;
+}
+
+void ModelImportQueue::waitForDone()
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_pending)
+        m_changed.wait(&m_mutex);
+}
+
+int ModelImportQueue::pendingCount() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_pending;
+}
+
+void ModelImportQueue::start(const QString &modelPath)
+{
+    m_pool.start([this, modelPath]()
+                 {
+                     std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> modelMeshsPtr;
+                     if (m_import)
+                         modelMeshsPtr = m_import(modelPath);
+                     else if (!ModelLoadManager::instance()->import3DModel(modelPath, modelMeshsPtr))
+                         modelMeshsPtr.reset();
+                     if (m_done)
+                         m_done(modelPath, modelMeshsPtr);
+
+                     QMutexLocker locker(&m_mutex);
+                     --m_pending;
+                     m_changed.wakeAll(); });
+}
@@ -0,0 +1,50 @@
+﻿#ifndef __MODEL_IMPORT_QUEUE_H__
+#define __MODEL_IMPORT_QUEUE_H__
+
+#include "model_loader_manager.h"
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <functional>
+#include <memory>
+
+/////////////////////////////////////////////////////////////////
+// imports models into the caches of ModelLoadManager on worker threads, one model per worker
+// at most capacity models are waiting or being imported, push blocks until a slot is free so a large batch never holds
+// more than that in memory. the workers have their own pool, the global pool stays free for the parallel loops of an import
+class ModelImportQueue
+{
+public:
+    // called on the worker thread, modelMeshsPtr is null if the import failed
+    using DoneFunction = std::function<void(const QString &modelPath, const std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> &modelMeshsPtr)>;
+    // reads one model on the worker thread, null if it failed
+    using ImportFunction = std::function<std::shared_ptr<QVector<ModelLoadManager::ModelMesh>>(const QString &modelPath)>;
+
+    // 0 threads is one per core, 0 capacity is twice the thread count
+    explicit ModelImportQueue(const DoneFunction &done = DoneFunction(), int threadCount = 0, int capacity = 0);
+    ~ModelImportQueue();
+
+    // ModelLoadManager::import3DModel unless set, call it before the first push
+    void setImportFunction(const ImportFunction &import) { m_import = import; }
+    void push(const QString &modelPath);
+    // returns false instead of blocking if the queue is full
+    bool tryPush(const QString &modelPath);
+    void waitForDone();
+    int pendingCount() const;
+    int capacity() const { return m_capacity; }
+
+private:
+    void start(const QString &modelPath);
+
+private:
+    DoneFunction m_done;
+    ImportFunction m_import;
+    QThreadPool m_pool;
+    mutable QMutex m_mutex;
+    QWaitCondition m_changed;
+    int m_capacity = 0;
+    int m_pending = 0;
+};
+
+#endif
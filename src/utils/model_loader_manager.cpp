@@ -1,8 +1,139 @@
 ﻿#include "model_loader_manager.h"
+#include "model_stream_importer.h"
+#include "model_disk_cache.h"
+#include "mesh_codec.h"
+#include "parallel_for.h"
+#include "scan_file.h"
+#include "tangent_space.h"
 #include <stb_image.h>
 #include <spdlog/spdlog.h>
 #include <QFile>
 #include <QFileInfo>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QScopeGuard>
+#include <unordered_map>
+#include <map>
+#include <cfloat>
+
+namespace
+{
+    // drops the low mantissa bits, so that nearly equal sizes hash the same while different scales do not
+    static quint32 quantizeFloat(float value)
+    {
+        quint32 bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return (bits + 0x800) & ~0xfffu;
+    }
+
+    static void hashCombine(quint64 &seed, quint64 value)
+    {
+        seed ^= value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+    }
+
+    // topology, material and size, the vertices are compared only when the hash matches
+    static quint64 hashGeometry(const ModelLoadManager::ModelMesh &modelMesh, unsigned int materialIndex, const float extent[3])
+    {
+        quint64 seed = modelMesh.m_vertices.size();
+        hashCombine(seed, materialIndex);
+        for (int i = 0; i < 3; ++i)
+            hashCombine(seed, quantizeFloat(extent[i]));
+        for (unsigned int index : modelMesh.m_indices)
+            hashCombine(seed, index);
+        return seed;
+    }
+
+    static bool isNearlyEqual(const float *a, const float *b, int count, float eps)
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            if (qAbs(a[i] - b[i]) > eps)
+                return false;
+        }
+        return true;
+    }
+
+    static bool isSameGeometry(const ModelLoadManager::ModelMesh &a, const ModelLoadManager::ModelMesh &b, float positionEps)
+    {
+        if (a.m_vertices.size() != b.m_vertices.size() || a.m_indices != b.m_indices)
+            return false;
+        for (size_t i = 0; i < a.m_vertices.size(); ++i)
+        {
+            const ModelLoadManager::Vertex &va = a.m_vertices[i];
+            const ModelLoadManager::Vertex &vb = b.m_vertices[i];
+            if (!isNearlyEqual(va.m_positions, vb.m_positions, 3, positionEps) || !isNearlyEqual(va.m_normals, vb.m_normals, 3, 1e-4f) ||
+                !isNearlyEqual(va.m_texCoords, vb.m_texCoords, 2, 1e-4f))
+                return false;
+        }
+        return true;
+    }
+}
+
+// state of one import, the meshes already placed in the scene are used to turn repeated geometry into instances
+struct ModelLoadManager::ImportContext
+{
+    explicit ImportContext(const QString &modelPath) : m_modelPath(modelPath) {}
+
+    struct UniqueMesh
+    {
+        int m_index;
+        float m_maxAbs; // largest coordinate before the mesh was moved to its origin, scales the compare tolerance
+    };
+
+    std::unordered_map<unsigned int, std::pair<int, QVector3D>> m_aiMeshes; // aiMesh index -> mesh index and offset
+    std::map<std::pair<int, int>, std::pair<int, QVector3D>> m_glbPrimitives; // glb mesh and primitive -> mesh index and offset
+    std::unordered_multimap<quint64, UniqueMesh> m_geometries;
+    std::shared_ptr<SceneGraph> m_sceneGraph = std::make_shared<SceneGraph>();
+    std::shared_ptr<ModelAnimation> m_animation = std::make_shared<ModelAnimation>();
+    std::unordered_map<std::string, int> m_boneIndices; // bone name -> palette index, bones are shared by the meshes of a skeleton
+    int m_instanceCount = 0;
+    QString m_modelPath;
+    bool m_tangents = false; // the meshes with a normal map get tangents if the file has none
+};
+
+VertexStreams::View ModelLoadManager::ModelMesh::positions() const
+{
+    if (!m_streams.empty())
+        return VertexStreams::View{m_streams.m_positions.data(), 3};
+    return VertexStreams::View{m_vertices.empty() ? nullptr : m_vertices[0].m_positions, sizeof(Vertex) / sizeof(float)};
+}
+
+VertexStreams::View ModelLoadManager::ModelMesh::normals() const
+{
+    if (!m_streams.empty())
+        return VertexStreams::View{m_streams.m_normals.data(), 3};
+    return VertexStreams::View{m_vertices.empty() ? nullptr : m_vertices[0].m_normals, sizeof(Vertex) / sizeof(float)};
+}
+
+VertexStreams::View ModelLoadManager::ModelMesh::texCoords() const
+{
+    // scans keep no texture coords, the view is then null
+    if (!m_streams.empty())
+        return VertexStreams::View{m_streams.m_texCoords.empty() ? nullptr : m_streams.m_texCoords.data(), 2};
+    return VertexStreams::View{m_vertices.empty() ? nullptr : m_vertices[0].m_texCoords, sizeof(Vertex) / sizeof(float)};
+}
+
+VertexStreams::Attribute ModelLoadManager::ModelMesh::vertexAttribute(VertexStreams::Stream stream, qint64 vertexCount) const
+{
+    if (!m_streams.empty())
+        return VertexStreams::packedAttribute(stream, vertexCount, m_streams.streamMask());
+
+    static const qint64 offsets[VertexStreams::StreamCount] = {
+        offsetof(Vertex, m_positions), offsetof(Vertex, m_normals), offsetof(Vertex, m_texCoords), offsetof(Vertex, m_tangents),
+        offsetof(Vertex, m_bitangents), offsetof(Vertex, m_boneIDs), offsetof(Vertex, m_weights)};
+    VertexStreams::Attribute attribute;
+    attribute.m_components = VertexStreams::componentCount(stream);
+    attribute.m_integer = stream == VertexStreams::BoneID;
+    attribute.m_offset = offsets[stream];
+    attribute.m_stride = sizeof(Vertex);
+    return attribute;
+}
+
+qint64 ModelLoadManager::ModelMesh::vertexBytes(qint64 vertexCount) const
+{
+    return m_streams.empty() ? vertexCount * (qint64)sizeof(Vertex) : VertexStreams::packedBytes(vertexCount, m_streams.streamMask());
+}
 
 ModelLoadManager* ModelLoadManager::instance()
 {
@@ -11,9 +142,10 @@ ModelLoadManager* ModelLoadManager::instance()
 }
 
 ModelLoadManager::ModelLoadManager()
-    : m_modelMeshMaps(20), m_byteArrayMaps(20)
+    : m_modelMeshMaps(20), m_packedModelMaps(200)
 {
-
+    // set once for every thread, imports never change it
+    stbi_set_flip_vertically_on_load(true);
 }
 
 ModelLoadManager::~ModelLoadManager()
@@ -176,85 +308,481 @@ bool ModelLoadManager::import3DModel(const QString &modelPath, std::shared_ptr<Q
         spdlog::error("model path is empty. modelPath: {0}", modelPath.toStdString());
         return false;
     }
-    else if (m_modelMeshMaps.contains(modelPath))
+
+    std::shared_ptr<std::vector<PackedMesh>> packedPtr;
+    QString meshPath;
     {
-        modelMeshsPtr = m_modelMeshMaps[modelPath];
-        return true;
+        // a model another thread is importing is waited for instead of read twice
+        QMutexLocker locker(&m_mutex);
+        while (m_importing.contains(modelPath))
+            m_importDone.wait(&m_mutex);
+        if (m_modelMeshMaps.contains(modelPath))
+        {
+            modelMeshsPtr = m_modelMeshMaps[modelPath];
+            return true;
+        }
+        if (m_packedModelMaps.contains(modelPath))
+            packedPtr = m_packedModelMaps[modelPath];
+        else if (m_meshFileMaps.contains(modelPath))
+            meshPath = ModelDiskCache::cacheFilePath(modelPath, QString("meshes%1").arg(MODEL_MESH_VERSION));
+        m_importing.insert(modelPath);
+    }
+    // the path leaves m_importing on every exit, also when reading throws, or the threads waiting for it block forever
+    // it is removed after the maps are filled, so a waiter that wakes up finds the model
+    auto importing = qScopeGuard([this, &modelPath]()
+                                 {
+                                     QMutexLocker locker(&m_mutex);
+                                     m_importing.remove(modelPath);
+                                     m_importDone.wakeAll(); });
+
+    // a model released as gpu only comes back from the model cache
+    if (!meshPath.isEmpty())
+    {
+        packedPtr = std::make_shared<std::vector<PackedMesh>>();
+        if (!loadMeshFile(meshPath, *packedPtr))
+            packedPtr.reset();
     }
-        
-    stbi_set_flip_vertically_on_load(true);
 
-    const aiScene *scene = m_importer.ReadFile(modelPath.toStdString(),
-                                                aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
+    std::shared_ptr<QVector<ModelMesh>> importedPtr = std::make_shared<QVector<ModelMesh>>();
+    if (packedPtr)
+    {
+        // the scene graph and the animation of the model are still in their maps, only the meshes dropped out
+        bool unpacked = true;
+        importedPtr->resize((int)packedPtr->size());
+        for (size_t i = 0; i < packedPtr->size() && unpacked; ++i)
+            unpacked = unpackMesh((*packedPtr)[i], m_vertexOptions.m_vertexStreams, (*importedPtr)[(int)i]);
+        if (unpacked)
+        {
+            // the exact copy gives the meshes back as they were imported, a quantized one only close to them
+            bool quantized = false;
+            for (const auto &packedMesh : *packedPtr)
+                quantized = quantized || packedMesh.m_quantized;
+            if (quantized)
+                spdlog::info("model name: {0}, meshes unpacked from the quantized copy.", modelPath.toStdString());
+
+            QMutexLocker locker(&m_mutex);
+            modelMeshsPtr = importedPtr;
+            m_modelMeshMaps.insert(modelPath, modelMeshsPtr);
+            return true;
+        }
+        spdlog::error("unpack model failed, it is imported again. file: {}", modelPath.toStdString());
+        importedPtr->clear();
+        packedPtr.reset();
+    }
+
+    ImportContext context(modelPath);
+    const bool imported = readModel(m_importOptions, context, *importedPtr);
+    if (imported)
+    {
+        // static pose of the instances, renderers keep their copy of the graph and update it when nodes move
+        context.m_sceneGraph->update();
+        for (auto &modelMesh : *importedPtr)
+        {
+            modelMesh.m_instances.resize(modelMesh.m_instanceNodes.size() * INSTANCE_FLOAT_COUNT);
+            context.m_sceneGraph->gatherWorlds(modelMesh.m_instanceNodes, modelMesh.m_instances.data());
+        }
+
+        // the packed copy shares the textures, decoded images included, they stay as long as one copy of the model
+        // scans come as position and normal streams, they are read from the file again instead
+        bool packable = m_vertexOptions.m_packedCache;
+        for (const auto &modelMesh : *importedPtr)
+            packable = packable && modelMesh.m_streams.empty();
+        if (packable)
+        {
+            packedPtr = std::make_shared<std::vector<PackedMesh>>();
+            packMeshes(*importedPtr, m_vertexOptions.m_quantizedCache, *packedPtr);
+        }
+
+        if (m_vertexOptions.m_vertexStreams)
+        {
+            // the meshes are compared as interleaved vertices while they are added, they change layout once all are in
+            for (auto &modelMesh : *importedPtr)
+            {
+                if (!modelMesh.m_streams.empty())
+                    continue;
+                toVertexStreams(modelMesh.m_vertices, modelMesh.m_skinned, modelMesh.m_streams);
+                std::vector<Vertex>().swap(modelMesh.m_vertices);
+            }
+        }
+    }
+
+    if (!imported)
+        return false;
+
+    QMutexLocker locker(&m_mutex);
+    modelMeshsPtr = importedPtr;
+    m_modelMeshMaps.insert(modelPath, modelMeshsPtr);
+    if (packedPtr)
+    {
+        qint64 vertexBytes = 0, packedBytes = 0;
+        for (int i = 0; i < importedPtr->size(); ++i)
+        {
+            const ModelMesh &modelMesh = (*importedPtr)[i];
+            vertexBytes += modelMesh.vertexBytes(modelMesh.vertexCount()) + modelMesh.m_indices.size() * sizeof(unsigned int);
+            packedBytes += (*packedPtr)[i].byteCount();
+        }
+        spdlog::info("model name: {0}, packed geometry: {1:.2f} MB of {2:.2f} MB.", modelPath.toStdString(), packedBytes / 1048576.0,
+                     vertexBytes / 1048576.0);
+        m_packedModelMaps.insert(modelPath, packedPtr);
+    }
+    m_sceneGraphMaps.insert(modelPath, context.m_sceneGraph);
+    const ModelAnimation &animation = *context.m_animation;
+    if (animation.boneCount() || !animation.m_clips.empty())
+    {
+        spdlog::info("model name: {0}, bones: {1}, animations: {2}.", modelPath.toStdString(), animation.boneCount(), animation.m_clips.size());
+        m_animationMaps.insert(modelPath, context.m_animation);
+    }
+    spdlog::info("model name: {0}, mesh instances: {1}, unique meshes: {2}.", modelPath.toStdString(), context.m_instanceCount, modelMeshsPtr->size());
+    return true;
+}
+
+bool ModelLoadManager::importUncached(const QString &modelPath, const ImportOptions &options, QVector<ModelMesh> &modelMeshs)
+{
+    ImportContext context(modelPath);
+    modelMeshs.clear();
+    return readModel(options, context, modelMeshs);
+}
+
+const char *ModelLoadManager::profileName(ImportOptions::Profile profile)
+{
+    switch (profile)
+    {
+    case ImportOptions::FastPreview:
+        return "fast preview";
+    case ImportOptions::FullQuality:
+        return "full quality";
+    case ImportOptions::RenderOptimized:
+        return "render optimized";
+    default:
+        return "unknown";
+    }
+}
+
+unsigned int ModelLoadManager::postProcessSteps(ImportOptions::Profile profile, const QString &modelPath)
+{
+    // normals and tangents the file does not have are generated after the import, in parallel, see addUniqueMesh
+    unsigned int steps = aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_LimitBoneWeights;
+    if (profile == ImportOptions::FastPreview)
+        return steps;
+
+    // glTF meshes are indexed already, the other formats arrive as one vertex per face corner
+    const QString suffix = QFileInfo(modelPath).suffix().toLower();
+    if (suffix != "gltf" && suffix != "glb")
+        steps |= aiProcess_JoinIdenticalVertices;
+    if (profile == ImportOptions::RenderOptimized)
+    {
+        // the node graph is kept, animations and the instancing of meshes used by several nodes rely on it
+        steps |= aiProcess_RemoveRedundantMaterials | aiProcess_OptimizeMeshes | aiProcess_ImproveCacheLocality | aiProcess_FindDegenerates |
+                 aiProcess_SortByPType;
+    }
+    return steps;
+}
+
+bool ModelLoadManager::readModel(const ImportOptions &options, ImportContext &context, QVector<ModelMesh> &modelMeshs)
+{
+    const QString modelPath = context.m_modelPath;
+    const QString suffix = QFileInfo(modelPath).suffix().toLower();
+    const bool glb = options.m_nativeGlb && suffix == "glb";
+    if (glb || (options.m_nativeScans && (suffix == "ply" || suffix == "stl")))
+    {
+        QString reason;
+        if (glb ? readGlbModel(context, modelMeshs, reason) : readScanModel(context, modelMeshs, reason))
+            return true;
+        spdlog::info("{0} file is imported by assimp. file: {1}, reason: {2}", suffix.toStdString(), modelPath.toStdString(), reason.toStdString());
+        context = ImportContext(modelPath);
+        modelMeshs.clear();
+    }
+
+    // the scene belongs to the leased importer, it is freed when the importer goes back to the pool
+    ImporterPool::Lease importer = m_importerPool.acquire();
+    importer->m_ioSystem->resetCounters();
+    const aiScene *scene = importer->m_importer.ReadFile(modelPath.toStdString(), postProcessSteps(options.m_profile, modelPath));
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
     {
-        spdlog::error("importer read file failed. file: {0}, reason: {1}", modelPath.toStdString(), m_importer.GetErrorString());
+        spdlog::error("importer read file failed. file: {0}, reason: {1}", modelPath.toStdString(), importer->m_importer.GetErrorString());
         return false;
     }
-    m_currentModelName = modelPath;
-    m_modelMeshMaps.insert(modelPath, std::make_shared<QVector<ModelMesh>>());
+    const MappedIOSystem &ioSystem = *importer->m_ioSystem;
+    spdlog::info("importer read file. file: {0}, files: {1}, bytes read: {2}, reads: {3}, syscalls: {4}", modelPath.toStdString(),
+                 ioSystem.filesOpened(), ioSystem.bytesRead(), ioSystem.readCalls(), ioSystem.syscalls());
+    context.m_tangents = options.m_profile != ImportOptions::FastPreview && options.m_normalMaps;
+    processNode(scene->mRootNode, scene, -1, context, modelMeshs);
 
-    processNode(scene->mRootNode, scene, *m_modelMeshMaps[modelPath]);
-    modelMeshsPtr = m_modelMeshMaps[modelPath];
+    // bones name the nodes that move them, which are known once the whole hierarchy was added
+    ModelAnimation &animation = *context.m_animation;
+    for (const auto &boneName : animation.m_boneNames)
+        animation.m_boneNodes.emplace_back(context.m_sceneGraph->findNode(boneName));
+    processAnimations(scene, context);
     return true;
 }
-    
-bool ModelLoadManager::import3DModel(const QString& modelPath, std::shared_ptr<QByteArray>& byteArrayPtr)
+
+bool ModelLoadManager::readGlbModel(ImportContext &context, QVector<ModelMesh> &modelMeshs, QString &reason)
 {
-    if (modelPath.isEmpty())
+    GlbFile glbFile;
+    if (!glbFile.open(context.m_modelPath))
     {
-        spdlog::error("model path is empty. modelPath: {0}", modelPath.toStdString());
+        reason = glbFile.errorString();
         return false;
     }
-    else if (m_byteArrayMaps.contains(modelPath))
+    for (int root : glbFile.rootNodes())
     {
-        byteArrayPtr = m_byteArrayMaps[modelPath];
-        return true;
+        if (!processGlbNode(glbFile, root, -1, context, modelMeshs))
+        {
+            reason = "invalid accessors";
+            return false;
+        }
     }
+    return true;
+}
 
-    std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr;
-    if (!import3DModel(modelPath, modelMeshsPtr))
+bool ModelLoadManager::readScanModel(ImportContext &context, QVector<ModelMesh> &modelMeshs, QString &reason)
+{
+    // a scan is one mesh without uvs or materials, only its position and normal streams are written straight from the mapped file
+    ScanFile scanFile;
+    ModelMesh modelMesh;
+    if (!scanFile.open(context.m_modelPath) || !scanFile.readIndices(modelMesh.m_indices))
+    {
+        reason = scanFile.errorString();
         return false;
+    }
+    VertexStreams &streams = modelMesh.m_streams;
+    streams.m_positions.resize((size_t)scanFile.vertexCount() * 3);
+    streams.m_normals.resize((size_t)scanFile.vertexCount() * 3);
+    scanFile.readPositions(streams.m_positions.data(), 3);
+    const bool normals = scanFile.readNormals(modelMesh.m_indices.data(), streams.m_normals.data(), 3);
+    scanFile.releaseWelding();
+    if (!normals)
+        generateNormals(modelMesh);
 
-    int totalCount = 0;
-    std::for_each(modelMeshsPtr->begin(), modelMeshsPtr->end(), [&totalCount, &modelMeshsPtr](const ModelMesh& modelMesh)
-        { totalCount += modelMesh.m_vertices.size(); });
-    if (!byteArrayPtr)
-        byteArrayPtr = std::make_shared<QByteArray>();
-    byteArrayPtr->resize(totalCount * OBJ_BYTE_COUNT);
-    char* p = byteArrayPtr->data();
-    for(const auto& modelMesh : *modelMeshsPtr)
+    // the same two nodes processNode adds for a root node holding one mesh
+    QMatrix4x4 identity;
+    const int sceneNode = context.m_sceneGraph->addNode(-1, identity.constData(), QFileInfo(context.m_modelPath).completeBaseName().toStdString());
+    modelMesh.m_instanceNodes.emplace_back(context.m_sceneGraph->addNode(sceneNode, identity.constData()));
+    ++context.m_instanceCount;
+    modelMeshs.emplace_back(std::move(modelMesh));
+    return true;
+}
+
+bool ModelLoadManager::processGlbNode(const GlbFile &glbFile, int node, int parentNode, ImportContext &context, QVector<ModelMesh> &modelMeshs)
+{
+    // same hierarchy as processNode builds from an assimp scene, every primitive is one mesh
+    const GlbFile::Node &glbNode = glbFile.nodes()[node];
+    const int sceneNode = context.m_sceneGraph->addNode(parentNode, glbNode.m_local, glbNode.m_name);
+    const int primitiveCount = glbNode.m_mesh < 0 ? 0 : (int)glbFile.meshes()[glbNode.m_mesh].size();
+    for (int i = 0; i < primitiveCount; ++i)
     {
-        for (const auto& vertice : modelMesh.m_vertices)
+        auto it = context.m_glbPrimitives.find(std::make_pair(glbNode.m_mesh, i));
+        if (it == context.m_glbPrimitives.end())
         {
-            memcpy(p, vertice.m_positions, 3 * sizeof(float));
-            memcpy(p + 3 * sizeof(float), vertice.m_texCoords, 2 * sizeof(float));
-            memcpy(p + 5 * sizeof(float), vertice.m_normals, 3 * sizeof(float));
-            p += 8 * sizeof(float);
+            const GlbFile::Primitive &primitive = glbFile.meshes()[glbNode.m_mesh][i];
+            ModelMesh modelMesh;
+            if (!processGlbPrimitive(glbFile, primitive, modelMesh))
+                return false;
+
+            QVector3D offset;
+            bool added = false;
+            const int index = addGeometry(modelMesh, (unsigned int)primitive.m_material, context, modelMeshs, offset, added);
+            if (added)
+                processGlbMaterial(glbFile, primitive.m_material, context, modelMeshs[index]);
+            it = context.m_glbPrimitives.emplace(std::make_pair(glbNode.m_mesh, i), std::make_pair(index, offset)).first;
         }
+
+        QMatrix4x4 instance;
+        instance.translate(it->second.second);
+        modelMeshs[it->second.first].m_instanceNodes.emplace_back(context.m_sceneGraph->addNode(sceneNode, instance.constData()));
+        ++context.m_instanceCount;
+    }
+    for (int child : glbNode.m_children)
+    {
+        if (!processGlbNode(glbFile, child, sceneNode, context, modelMeshs))
+            return false;
     }
+    return true;
+}
 
-    m_byteArrayMaps.insert(modelPath, byteArrayPtr);
+void ModelLoadManager::processGlbMaterial(const GlbFile &glbFile, int material, const ImportContext &context, ModelMesh &modelMesh)
+{
+    // the maps processMaterial finds in the scene assimp makes of a glb file
+    const std::pair<int, const char *> maps[] = {{glbFile.diffuseImage(material), "texture_diffuse"}, {glbFile.specularImage(material), "texture_specular"}};
+    for (const auto &map : maps)
+    {
+        if (map.first < 0)
+            continue;
+
+        // embedded images are decoded from the mapped file, named like assimp names them so that both share the baked cache
+        const GlbFile::Image &image = glbFile.images()[map.first];
+        Texture texture;
+        texture.m_type = map.second;
+        if (image.m_data)
+            loadTexture(context.m_modelPath, image.m_name, image.m_data, image.m_size, texture);
+        else
+            loadTexture(QFileInfo(context.m_modelPath).path() + '/' + image.m_uri, texture);
+        modelMesh.m_textures.emplace_back(texture);
+    }
+}
+
+bool ModelLoadManager::processGlbPrimitive(const GlbFile &glbFile, const GlbFile::Primitive &primitive, ModelMesh &modelMesh)
+{
+    // the accessors are read from the mapped file straight into the vertices, the uvs keep the glTF orientation like assimp leaves them
+    const qint64 vertexCount = glbFile.count(primitive.m_position);
+    const int stride = sizeof(Vertex) / sizeof(float);
+    modelMesh.m_vertices.resize(vertexCount);
+    if (!vertexCount)
+        return true;
+    memset(modelMesh.m_vertices.data(), 0, vertexCount * sizeof(Vertex));
+    float *vertices = reinterpret_cast<float *>(modelMesh.m_vertices.data());
+    if (!glbFile.readFloats(primitive.m_position, 3, vertices + offsetof(Vertex, m_positions) / sizeof(float), stride) ||
+        (primitive.m_normal >= 0 && !glbFile.readFloats(primitive.m_normal, 3, vertices + offsetof(Vertex, m_normals) / sizeof(float), stride)) ||
+        (primitive.m_texCoord >= 0 && !glbFile.readFloats(primitive.m_texCoord, 2, vertices + offsetof(Vertex, m_texCoords) / sizeof(float), stride)) ||
+        (primitive.m_tangent >= 0 && !glbFile.readFloats(primitive.m_tangent, 3, vertices + offsetof(Vertex, m_tangents) / sizeof(float), stride)))
+        return false;
+    if (primitive.m_tangent >= 0)
+    {
+        // glTF stores the handedness in w instead of the bitangent
+        std::vector<float> tangents(vertexCount * 4);
+        glbFile.readFloats(primitive.m_tangent, 4, tangents.data(), 4);
+        for (qint64 i = 0; i < vertexCount; ++i)
+        {
+            Vertex &vertex = modelMesh.m_vertices[i];
+            const QVector3D bitangent = QVector3D::crossProduct(QVector3D(vertex.m_normals[0], vertex.m_normals[1], vertex.m_normals[2]),
+                                                                QVector3D(vertex.m_tangents[0], vertex.m_tangents[1], vertex.m_tangents[2])) *
+                                        tangents[i * 4 + 3];
+            vertex.m_bitangents[0] = bitangent.x();
+            vertex.m_bitangents[1] = bitangent.y();
+            vertex.m_bitangents[2] = bitangent.z();
+        }
+    }
+
+    if (primitive.m_indices < 0)
+    {
+        modelMesh.m_indices.resize(vertexCount);
+        for (qint64 i = 0; i < vertexCount; ++i)
+            modelMesh.m_indices[i] = (unsigned int)i;
+    }
+    else
+    {
+        modelMesh.m_indices.resize(glbFile.count(primitive.m_indices));
+        if (!glbFile.readIndices(primitive.m_indices, modelMesh.m_indices.data()))
+            return false;
+    }
+    modelMesh.m_indices.resize(modelMesh.m_indices.size() / 3 * 3);
+    for (unsigned int index : modelMesh.m_indices)
+    {
+        if (index >= vertexCount)
+            return false;
+    }
+    if (primitive.m_normal < 0)
+        generateNormals(modelMesh);
     return true;
 }
 
-void ModelLoadManager::processNode(aiNode *node, const aiScene *scene, QVector<ModelMesh> &modelMeshs)
+void ModelLoadManager::processNode(aiNode *node, const aiScene *scene, int parentNode, ImportContext &context, QVector<ModelMesh> &modelMeshs)
 {
+    // assimp matrices are row-major
+    const QMatrix4x4 local(&node->mTransformation.a1);
+    const int sceneNode = context.m_sceneGraph->addNode(parentNode, local.constData(), node->mName.C_Str());
     // process each mesh located at the current node
     for (unsigned int i = 0; i < node->mNumMeshes; i++)
     {
         // the node object only contains indices to index the actual objects in the scene.
         // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        ModelMesh modelMesh;
-        processMesh(mesh, scene, modelMesh);
-        modelMeshs.emplace_back(std::move(modelMesh));
+        // a mesh referenced by several nodes, or with the same geometry as a mesh already seen, only adds an instance
+        auto it = context.m_aiMeshes.find(node->mMeshes[i]);
+        if (it == context.m_aiMeshes.end())
+        {
+            QVector3D offset;
+            int index = addUniqueMesh(scene->mMeshes[node->mMeshes[i]], scene, context, modelMeshs, offset);
+            it = context.m_aiMeshes.emplace(node->mMeshes[i], std::make_pair(index, offset)).first;
+        }
+
+        // the instance is a child node that moves the unique mesh back from its origin
+        // skinned vertices are placed by their bones, which already carry the transforms of the hierarchy
+        QMatrix4x4 instance;
+        instance.translate(it->second.second);
+        ModelMesh &modelMesh = modelMeshs[it->second.first];
+        modelMesh.m_instanceNodes.emplace_back(context.m_sceneGraph->addNode(modelMesh.m_skinned ? -1 : sceneNode, instance.constData()));
+        ++context.m_instanceCount;
     }
     // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
     for (unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        processNode(node->mChildren[i], scene, modelMeshs);
+        processNode(node->mChildren[i], scene, sceneNode, context, modelMeshs);
+    }
+}
+
+int ModelLoadManager::addUniqueMesh(aiMesh *mesh, const aiScene *scene, ImportContext &context, QVector<ModelMesh> &modelMeshs, QVector3D &offset)
+{
+    ModelMesh modelMesh;
+    processMesh(mesh, scene, modelMesh);
+    if (!mesh->HasNormals())
+        generateNormals(modelMesh);
+    // tangents are only worth their cost for the materials that have a normal map
+    const aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
+    if (context.m_tangents && mesh->mTextureCoords[0] && !mesh->HasTangentsAndBitangents() &&
+        (material->GetTextureCount(aiTextureType_NORMALS) || material->GetTextureCount(aiTextureType_HEIGHT)))
+        generateTangents(modelMesh);
+    offset = QVector3D();
+    if (mesh->HasBones())
+    {
+        // skinned meshes stay where their bones expect them and are never shared
+        processBones(mesh, context, modelMesh);
+        processMaterial(mesh, scene, context, modelMesh);
+        modelMeshs.emplace_back(std::move(modelMesh));
+        return modelMeshs.size() - 1;
+    }
+
+    bool added = false;
+    const int index = addGeometry(modelMesh, mesh->mMaterialIndex, context, modelMeshs, offset, added);
+    if (added)
+        processMaterial(mesh, scene, context, modelMeshs[index]);
+    return index;
+}
+
+int ModelLoadManager::addGeometry(ModelMesh &modelMesh, unsigned int materialIndex, ImportContext &context, QVector<ModelMesh> &modelMeshs, QVector3D &offset, bool &added)
+{
+    // move the mesh to its origin, so that translated copies share the same vertices
+    offset = QVector3D();
+    added = false;
+    float bmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    float bmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    float maxAbs = 0.0f;
+    for (const auto &vertex : modelMesh.m_vertices)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            bmin[i] = qMin(bmin[i], vertex.m_positions[i]);
+            bmax[i] = qMax(bmax[i], vertex.m_positions[i]);
+            maxAbs = qMax(maxAbs, qAbs(vertex.m_positions[i]));
+        }
+    }
+    float extent[3] = {0.0f, 0.0f, 0.0f};
+    if (!modelMesh.m_vertices.empty())
+    {
+        offset = QVector3D(bmin[0], bmin[1], bmin[2]);
+        for (int i = 0; i < 3; ++i)
+            extent[i] = bmax[i] - bmin[i];
+        for (auto &vertex : modelMesh.m_vertices)
+        {
+            for (int i = 0; i < 3; ++i)
+                vertex.m_positions[i] -= bmin[i];
+        }
+    }
+
+    const quint64 hash = hashGeometry(modelMesh, materialIndex, extent);
+    auto range = context.m_geometries.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        // a few float ulps of the original coordinates are lost when moving to the origin
+        const float eps = 8.0f * FLT_EPSILON * qMax(1.0f, qMax(maxAbs, it->second.m_maxAbs));
+        if (isSameGeometry(modelMesh, modelMeshs[it->second.m_index], eps))
+            return it->second.m_index;
     }
+
+    const int index = modelMeshs.size();
+    modelMeshs.emplace_back(std::move(modelMesh));
+    context.m_geometries.emplace(hash, ImportContext::UniqueMesh{index, maxAbs});
+    added = true;
+    return index;
 }
 
 void ModelLoadManager::processMesh(aiMesh *mesh, const aiScene *scene, ModelMesh &modelMesh)
@@ -262,6 +790,8 @@ void ModelLoadManager::processMesh(aiMesh *mesh, const aiScene *scene, ModelMesh
     for (unsigned int i = 0; i < mesh->mNumVertices; i++)
     {
         Vertex vertex;
+        memset(vertex.m_boneIDs, 0, sizeof(vertex.m_boneIDs));
+        memset(vertex.m_weights, 0, sizeof(vertex.m_weights));
         vertex.m_positions[0] = mesh->mVertices[i].x;
         vertex.m_positions[1] = mesh->mVertices[i].y;
         vertex.m_positions[2] = mesh->mVertices[i].z;
@@ -272,26 +802,36 @@ void ModelLoadManager::processMesh(aiMesh *mesh, const aiScene *scene, ModelMesh
             vertex.m_normals[1] = mesh->mNormals[i].y;
             vertex.m_normals[2] = mesh->mNormals[i].z;
         }
+        else
+        {
+            memset(vertex.m_normals, 0, sizeof(vertex.m_normals));
+        }
         // texture coordinates
         if (mesh->mTextureCoords[0])
         {
             vertex.m_texCoords[0] = mesh->mTextureCoords[0][i].x;
             vertex.m_texCoords[1] = mesh->mTextureCoords[0][i].y;
-
-            // tangent
+        }
+        else
+        {
+            vertex.m_texCoords[0] = 0.0f;
+            vertex.m_texCoords[1] = 0.0f;
+        }
+        // tangent space, generated after the import for meshes with normal maps if the file has none
+        if (mesh->HasTangentsAndBitangents())
+        {
             vertex.m_tangents[0] = mesh->mTangents[i].x;
             vertex.m_tangents[1] = mesh->mTangents[i].y;
             vertex.m_tangents[2] = mesh->mTangents[i].z;
 
-            // bitangent
             vertex.m_bitangents[0] = mesh->mBitangents[i].x;
             vertex.m_bitangents[1] = mesh->mBitangents[i].y;
             vertex.m_bitangents[2] = mesh->mBitangents[i].z;
         }
         else
         {
-            vertex.m_texCoords[0] = 0.0f;
-            vertex.m_texCoords[1] = 0.0f;
+            memset(vertex.m_tangents, 0, sizeof(vertex.m_tangents));
+            memset(vertex.m_bitangents, 0, sizeof(vertex.m_bitangents));
         }
 
         modelMesh.m_vertices.emplace_back(std::move(vertex));
@@ -303,28 +843,147 @@ void ModelLoadManager::processMesh(aiMesh *mesh, const aiScene *scene, ModelMesh
         for (unsigned int j = 0; j < face.mNumIndices; j++)
             modelMesh.m_indices.emplace_back(face.mIndices[j]);
     }
+}
+
+void ModelLoadManager::generateNormals(ModelMesh &modelMesh)
+{
+    if (!modelMesh.m_streams.empty())
+    {
+        VertexStreams &streams = modelMesh.m_streams;
+        TangentSpace::generateNormals(streams.m_positions.data(), 3, streams.vertexCount(), modelMesh.m_indices.data(), modelMesh.m_indices.size(),
+                                      streams.m_normals.data(), 3);
+        return;
+    }
+    const int stride = sizeof(Vertex) / sizeof(float);
+    float *vertices = reinterpret_cast<float *>(modelMesh.m_vertices.data());
+    TangentSpace::generateNormals(vertices + offsetof(Vertex, m_positions) / sizeof(float), stride, modelMesh.m_vertices.size(), modelMesh.m_indices.data(),
+                                  modelMesh.m_indices.size(), vertices + offsetof(Vertex, m_normals) / sizeof(float), stride);
+}
+
+void ModelLoadManager::generateTangents(ModelMesh &modelMesh)
+{
+    const int stride = sizeof(Vertex) / sizeof(float);
+    float *vertices = reinterpret_cast<float *>(modelMesh.m_vertices.data());
+    TangentSpace::generateTangents(vertices + offsetof(Vertex, m_positions) / sizeof(float), stride, vertices + offsetof(Vertex, m_normals) / sizeof(float),
+                                   stride, vertices + offsetof(Vertex, m_texCoords) / sizeof(float), stride, modelMesh.m_vertices.size(),
+                                   modelMesh.m_indices.data(), modelMesh.m_indices.size(), vertices + offsetof(Vertex, m_tangents) / sizeof(float), stride,
+                                   vertices + offsetof(Vertex, m_bitangents) / sizeof(float), stride);
+}
+
+void ModelLoadManager::processBones(aiMesh *mesh, ImportContext &context, ModelMesh &modelMesh)
+{
+    ModelAnimation &animation = *context.m_animation;
+    for (unsigned int i = 0; i < mesh->mNumBones; i++)
+    {
+        const aiBone *bone = mesh->mBones[i];
+        auto it = context.m_boneIndices.find(bone->mName.C_Str());
+        if (it == context.m_boneIndices.end())
+        {
+            // assimp matrices are row-major
+            const QMatrix4x4 offset(&bone->mOffsetMatrix.a1);
+            animation.m_boneNames.emplace_back(bone->mName.C_Str());
+            animation.m_boneOffsets.insert(animation.m_boneOffsets.end(), offset.constData(), offset.constData() + SCENE_MATRIX_FLOAT_COUNT);
+            it = context.m_boneIndices.emplace(bone->mName.C_Str(), (int)animation.m_boneNames.size() - 1).first;
+        }
+
+        // keep the four largest weights of every vertex
+        for (unsigned int j = 0; j < bone->mNumWeights; j++)
+        {
+            const aiVertexWeight &weight = bone->mWeights[j];
+            if (weight.mVertexId >= modelMesh.m_vertices.size())
+                continue;
+            Vertex &vertex = modelMesh.m_vertices[weight.mVertexId];
+            int slot = 0;
+            for (int k = 1; k < 4; k++)
+            {
+                if (vertex.m_weights[k] < vertex.m_weights[slot])
+                    slot = k;
+            }
+            if (weight.mWeight > vertex.m_weights[slot])
+            {
+                vertex.m_boneIDs[slot] = it->second;
+                vertex.m_weights[slot] = weight.mWeight;
+            }
+        }
+    }
+
+    for (auto &vertex : modelMesh.m_vertices)
+    {
+        const float sum = vertex.m_weights[0] + vertex.m_weights[1] + vertex.m_weights[2] + vertex.m_weights[3];
+        for (int k = 0; sum > 0.0f && k < 4; k++)
+            vertex.m_weights[k] /= sum;
+    }
+    modelMesh.m_skinned = true;
+}
+
+void ModelLoadManager::processAnimations(const aiScene *scene, ImportContext &context)
+{
+    for (unsigned int i = 0; i < scene->mNumAnimations; i++)
+    {
+        const aiAnimation *aiAnim = scene->mAnimations[i];
+        ModelAnimation::Clip clip;
+        clip.m_name = aiAnim->mName.C_Str();
+        clip.m_duration = aiAnim->mDuration;
+        if (aiAnim->mTicksPerSecond > 0.0)
+            clip.m_ticksPerSecond = aiAnim->mTicksPerSecond;
+
+        for (unsigned int j = 0; j < aiAnim->mNumChannels; j++)
+        {
+            const aiNodeAnim *nodeAnim = aiAnim->mChannels[j];
+            ModelAnimation::Channel channel;
+            channel.m_node = context.m_sceneGraph->findNode(nodeAnim->mNodeName.C_Str());
+            if (channel.m_node < 0)
+                continue;
+
+            for (unsigned int k = 0; k < nodeAnim->mNumPositionKeys; k++)
+            {
+                const aiVectorKey &key = nodeAnim->mPositionKeys[k];
+                channel.m_positionTimes.emplace_back((float)key.mTime);
+                channel.m_positions.insert(channel.m_positions.end(), {key.mValue.x, key.mValue.y, key.mValue.z, 0.0f});
+            }
+            for (unsigned int k = 0; k < nodeAnim->mNumRotationKeys; k++)
+            {
+                const aiQuatKey &key = nodeAnim->mRotationKeys[k];
+                channel.m_rotationTimes.emplace_back((float)key.mTime);
+                channel.m_rotations.insert(channel.m_rotations.end(), {key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w});
+            }
+            for (unsigned int k = 0; k < nodeAnim->mNumScalingKeys; k++)
+            {
+                const aiVectorKey &key = nodeAnim->mScalingKeys[k];
+                channel.m_scaleTimes.emplace_back((float)key.mTime);
+                channel.m_scales.insert(channel.m_scales.end(), {key.mValue.x, key.mValue.y, key.mValue.z, 0.0f});
+            }
+            clip.m_channels.emplace_back(std::move(channel));
+        }
+        context.m_animation->m_clips.emplace_back(std::move(clip));
+    }
+}
+
+void ModelLoadManager::processMaterial(aiMesh *mesh, const aiScene *scene, const ImportContext &context, ModelMesh &modelMesh)
+{
     // process materials
     aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
 
     // 1. diffuse maps
     std::vector<Texture> diffuseMaps;
-    loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", scene, diffuseMaps);
+    loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", scene, context, diffuseMaps);
     modelMesh.m_textures.insert(modelMesh.m_textures.end(), diffuseMaps.begin(), diffuseMaps.end());
     // 2. specular maps
     std::vector<Texture> specularMaps;
-    loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", scene, specularMaps);
+    loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", scene, context, specularMaps);
     modelMesh.m_textures.insert(modelMesh.m_textures.end(), specularMaps.begin(), specularMaps.end());
     // 3. normal maps
     std::vector<Texture> normalMaps;
-    loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", scene, normalMaps);
+    loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", scene, context, normalMaps);
     modelMesh.m_textures.insert(modelMesh.m_textures.end(), normalMaps.begin(), normalMaps.end());
     // 4. height maps
     std::vector<Texture> heightMaps;
-    loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", scene, heightMaps);
+    loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", scene, context, heightMaps);
     modelMesh.m_textures.insert(modelMesh.m_textures.end(), heightMaps.begin(), heightMaps.end());
 }
 
-void ModelLoadManager::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName, const aiScene *scene, std::vector<Texture> &textures)
+void ModelLoadManager::loadMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string &typeName, const aiScene *scene, const ImportContext &context,
+                                            std::vector<Texture> &textures)
 {
     for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
     {
@@ -340,21 +999,95 @@ void ModelLoadManager::loadMaterialTextures(aiMaterial *mat, aiTextureType type,
         const aiTexture *aiTex = scene->GetEmbeddedTexture(str.C_Str());
         if (aiTex)
         {
+            // glb格式文件的纹理信息直接在模型上，其它格式文件的纹理信息保存在单独的文件中
             bool iscompressed = aiTex->mHeight == 0;
             uint textureSize = aiTex->mWidth * (iscompressed ? 1 : aiTex->mHeight);
-            // glb格式文件的纹理信息直接在模型上，其它格式文件的纹理信息保存在单独的文件中
-            texture.m_data = stbi_load_from_memory(reinterpret_cast<unsigned char *>(aiTex->pcData), textureSize,
-                                                        &texture.m_width, &texture.m_height, &texture.m_channel, 0);
+            loadTexture(context.m_modelPath, str.C_Str(), reinterpret_cast<const unsigned char *>(aiTex->pcData), textureSize, texture);
         }
         else
         {
-            QString filename = QFileInfo(m_currentModelName).filePath() + '/' + filename;
-            texture.m_data = stbi_load(filename.toStdString().c_str(), &texture.m_width, &texture.m_height, &texture.m_channel, 0);
+            loadTexture(QFileInfo(context.m_modelPath).path() + '/' + QString::fromUtf8(str.C_Str()), texture);
         }
         textures.emplace_back(texture);
     }
 }
 
+void ModelLoadManager::loadTexture(const QString &modelPath, const std::string &name, const unsigned char *data, qint64 size, Texture &texture)
+{
+    // embedded textures are cached next to their model, one entry per texture name
+    const QString hash = QString::fromLatin1(QCryptographicHash::hash(QByteArray::fromStdString(name), QCryptographicHash::Sha1).toHex().left(16));
+    const QString bakedPath = ModelDiskCache::cacheFilePath(modelPath, hash + ".ktx");
+    if (loadBakedTexture(bakedPath, texture))
+        return;
+
+    texture.m_data.reset(stbi_load_from_memory(data, (int)size, &texture.m_width, &texture.m_height, &texture.m_channel, 0), stbi_image_free);
+    bakeTexture(bakedPath, texture);
+}
+
+void ModelLoadManager::loadTexture(const QString &filename, Texture &texture)
+{
+    const QString bakedPath = ModelDiskCache::cacheFilePath(filename, "ktx");
+    if (loadBakedTexture(bakedPath, texture))
+        return;
+
+    texture.m_data.reset(stbi_load(filename.toStdString().c_str(), &texture.m_width, &texture.m_height, &texture.m_channel, 0), stbi_image_free);
+    bakeTexture(bakedPath, texture);
+}
+
+bool ModelLoadManager::loadBakedTexture(const QString &bakedPath, Texture &texture)
+{
+    if (!m_textureOptions.m_bakeTextures || bakedPath.isEmpty() || !QFileInfo::exists(bakedPath))
+        return false;
+
+    // a streamed texture only reads its small mips, the others stay in the cache file
+    std::shared_ptr<BakedTexture> baked = std::make_shared<BakedTexture>();
+    const bool streamed = m_textureOptions.m_streamTextures;
+    if (!TextureBaker::load(bakedPath, *baked, streamed ? m_textureOptions.m_tailSize : 0))
+        return false;
+
+    if (streamed && baked->firstLoadedLevel() > 0)
+        texture.m_bakedPath = bakedPath;
+    texture.m_width = baked->width();
+    texture.m_height = baked->height();
+    texture.m_channel = baked->m_format == BakedTexture::BC5 ? 2 : 4;
+    texture.m_baked = baked;
+    texture.m_cachePath = bakedPath;
+    return true;
+}
+
+void ModelLoadManager::bakeTexture(const QString &bakedPath, Texture &texture)
+{
+    if (!m_textureOptions.m_bakeTextures || !texture.m_data)
+        return;
+
+    std::shared_ptr<BakedTexture> baked = std::make_shared<BakedTexture>();
+    BakedTexture::Format format = TextureBaker::chooseFormat(texture.m_type, texture.m_data.get(), texture.m_width, texture.m_height, texture.m_channel);
+    if (!TextureBaker::bake(texture.m_data.get(), texture.m_width, texture.m_height, texture.m_channel, format, *baked))
+        return;
+
+    // a failed save only costs the bake on the next import, but every mip has to stay in memory then
+    if (!bakedPath.isEmpty() && !TextureBaker::save(bakedPath, *baked))
+    {
+        spdlog::warn("save baked texture failed. path: {}", bakedPath.toStdString());
+    }
+    else if (!bakedPath.isEmpty())
+    {
+        texture.m_cachePath = bakedPath;
+        if (m_textureOptions.m_streamTextures)
+        {
+            const int tailLevel = baked->levelForSize(m_textureOptions.m_tailSize);
+            for (int level = 0; level < tailLevel; ++level)
+                baked->m_mips[level].m_data.clear();
+            if (tailLevel > 0)
+                texture.m_bakedPath = bakedPath;
+        }
+    }
+
+    texture.m_data.reset();
+    texture.m_channel = format == BakedTexture::BC5 ? 2 : 4;
+    texture.m_baked = baked;
+}
+
 float ModelLoadManager::getModelMaxPos(const QString &modelPath)
 {
     if (modelPath.isEmpty())
@@ -363,35 +1096,670 @@ float ModelLoadManager::getModelMaxPos(const QString &modelPath)
         return false;
     }
 
-    if (m_modelMaxPosMaps.contains(modelPath))
-        return m_modelMaxPosMaps[modelPath];
+    bool paged = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_modelMaxPosMaps.contains(modelPath))
+            return m_modelMaxPosMaps[modelPath];
+        paged = m_pageFileMaps.contains(modelPath);
+    }
 
     float maxPosition = 1.0;
-    if (!m_modelMeshMaps.contains(modelPath))
+    if (paged || isStreamingModel(modelPath))
     {
-        std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr;
-        import3DModel(modelPath, modelMeshsPtr);
-        if (!m_modelMeshMaps.contains(modelPath))
-            return maxPosition;
+        // never expand a paged model in memory, the page file knows its bounds
+        std::shared_ptr<ModelPageFile> pageFilePtr;
+        if (openPagedModel(modelPath, pageFilePtr))
+            maxPosition = pageFilePtr->maxPosition();
+        QMutexLocker locker(&m_mutex);
+        m_modelMaxPosMaps.insert(modelPath, maxPosition);
+        return maxPosition;
     }
-        
-    for (const auto &modelMesh : *m_modelMeshMaps[modelPath])
+
+    std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr;
+    if (!import3DModel(modelPath, modelMeshsPtr))
+        return maxPosition;
+
+    for (const auto &modelMesh : *modelMeshsPtr)
     {
-        for (const auto &vertex : modelMesh.m_vertices)
+        if (!modelMesh.vertexCount())
+            continue;
+
+        // the corners of the mesh bounds are placed by every instance
+        float min[3], max[3];
+        VertexStreams::bounds(modelMesh.positions(), modelMesh.vertexCount(), min, max);
+        const QVector3D bmin(min[0], min[1], min[2]), bmax(max[0], max[1], max[2]);
+        for (int i = 0; i < modelMesh.instanceCount(); ++i)
         {
-            maxPosition = qMax(qMax(qMax(qAbs(vertex.m_positions[0]), qAbs(vertex.m_positions[1])), qAbs(vertex.m_positions[2])), maxPosition);
+            QMatrix4x4 instance = modelMesh.instanceMatrix(i);
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                QVector3D position = instance.map(QVector3D(corner & 1 ? bmax.x() : bmin.x(), corner & 2 ? bmax.y() : bmin.y(), corner & 4 ? bmax.z() : bmin.z()));
+                maxPosition = qMax(qMax(qMax(qAbs(position.x()), qAbs(position.y())), qAbs(position.z())), maxPosition);
+            }
         }
     }
 
     spdlog::info("model name: {0}, max position: {1}.", modelPath.toStdString(), maxPosition);
+    QMutexLocker locker(&m_mutex);
     m_modelMaxPosMaps.insert(modelPath, maxPosition);
     return maxPosition;
 }
 
-void ModelLoadManager::cleanImageData(unsigned char *data)
+void ModelLoadManager::toVertexStreams(const std::vector<Vertex> &vertices, bool skinned, VertexStreams &streams)
+{
+    const int vertexCount = (int)vertices.size();
+    streams.resize(vertexCount, skinned);
+    parallelFor(0, vertexCount, [&](int i)
+                {
+                    const Vertex &vertex = vertices[i];
+                    memcpy(&streams.m_positions[i * 3], vertex.m_positions, 3 * sizeof(float));
+                    memcpy(&streams.m_normals[i * 3], vertex.m_normals, 3 * sizeof(float));
+                    memcpy(&streams.m_texCoords[i * 2], vertex.m_texCoords, 2 * sizeof(float));
+                    memcpy(&streams.m_tangents[i * 3], vertex.m_tangents, 3 * sizeof(float));
+                    memcpy(&streams.m_bitangents[i * 3], vertex.m_bitangents, 3 * sizeof(float));
+                    if (skinned)
+                    {
+                        memcpy(&streams.m_boneIDs[i * 4], vertex.m_boneIDs, 4 * sizeof(int));
+                        memcpy(&streams.m_weights[i * 4], vertex.m_weights, 4 * sizeof(float));
+                    } },
+                4096);
+}
+
+void ModelLoadManager::packMeshes(const QVector<ModelMesh> &modelMeshs, bool quantized, std::vector<PackedMesh> &packedMeshs)
+{
+    // the block codec of the exact copies runs in parallel itself, quantized meshes are packed one per thread
+    packedMeshs.resize(modelMeshs.size());
+    if (!quantized)
+    {
+        for (int i = 0; i < modelMeshs.size(); ++i)
+            packMesh(modelMeshs[i], false, packedMeshs[i]);
+        return;
+    }
+    parallelFor(0, (int)modelMeshs.size(), [&](int i)
+                { packMesh(modelMeshs[i], true, packedMeshs[i]); });
+}
+
+void ModelLoadManager::packMesh(const ModelMesh &modelMesh, bool quantized, PackedMesh &packedMesh)
+{
+    const std::vector<Vertex> &vertices = modelMesh.m_vertices;
+    const int vertexCount = (int)vertices.size();
+    packedMesh.m_vertexCount = vertexCount;
+    packedMesh.m_indexCount = (qint64)modelMesh.m_indices.size();
+    packedMesh.m_quantized = quantized;
+    packedMesh.m_skinned = modelMesh.m_skinned;
+    packedMesh.m_textures = modelMesh.m_textures;
+    packedMesh.m_instances = modelMesh.m_instances;
+    packedMesh.m_instanceNodes = modelMesh.m_instanceNodes;
+    if (!quantized)
+    {
+        packedMesh.m_vertices = BlockCodec::encode(reinterpret_cast<const char *>(vertices.data()), (qint64)vertexCount * sizeof(Vertex), sizeof(Vertex),
+                                                   BlockCodec::Fast);
+        packedMesh.m_indices = BlockCodec::encode(reinterpret_cast<const char *>(modelMesh.m_indices.data()), packedMesh.m_indexCount * sizeof(unsigned int),
+                                                  sizeof(unsigned int), BlockCodec::Fast);
+        return;
+    }
+
+    packedMesh.m_tangents = false;
+    for (const Vertex &vertex : vertices)
+    {
+        if (vertex.m_tangents[0] != 0.0f || vertex.m_tangents[1] != 0.0f || vertex.m_tangents[2] != 0.0f)
+        {
+            packedMesh.m_tangents = true;
+            break;
+        }
+    }
+    packedMesh.m_vertexWords = packedMesh.m_tangents || packedMesh.m_skinned ? 16 : 8;
+
+    float positionMax[3], texCoordMax[2] = {-FLT_MAX, -FLT_MAX};
+    VertexStreams::bounds(vertices.empty() ? nullptr : vertices[0].m_positions, vertexCount, sizeof(Vertex) / sizeof(float),
+                          packedMesh.m_positionMin, positionMax);
+    packedMesh.m_texCoordMin[0] = packedMesh.m_texCoordMin[1] = FLT_MAX;
+    for (const Vertex &vertex : vertices)
+    {
+        for (int k = 0; k < 2; ++k)
+        {
+            packedMesh.m_texCoordMin[k] = qMin(packedMesh.m_texCoordMin[k], vertex.m_texCoords[k]);
+            texCoordMax[k] = qMax(texCoordMax[k], vertex.m_texCoords[k]);
+        }
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+        if (!vertexCount)
+            packedMesh.m_positionMin[k] = 0.0f;
+        packedMesh.m_positionScale[k] = vertexCount ? (positionMax[k] - packedMesh.m_positionMin[k]) / 65535.0f : 0.0f;
+    }
+    for (int k = 0; k < 2; ++k)
+    {
+        if (!vertexCount)
+            packedMesh.m_texCoordMin[k] = 0.0f;
+        packedMesh.m_texCoordScale[k] = vertexCount ? (texCoordMax[k] - packedMesh.m_texCoordMin[k]) / 65535.0f : 0.0f;
+    }
+
+    // the index codec relies on the vertices following the order the triangles reach them
+    std::vector<unsigned int> remap(vertexCount);
+    MeshCodec::firstUseOrder(modelMesh.m_indices.data(), packedMesh.m_indexCount, vertexCount, remap.data());
+    std::vector<unsigned int> indices(modelMesh.m_indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+        indices[i] = modelMesh.m_indices[i] < (unsigned int)vertexCount ? remap[modelMesh.m_indices[i]] : modelMesh.m_indices[i];
+
+    auto quantize = [](float value, float min, float scale)
+    {
+        return scale > 0.0f ? (quint16)qBound(0L, std::lround((value - min) / scale), 65535L) : (quint16)0;
+    };
+    const int vertexWords = packedMesh.m_vertexWords;
+    std::vector<quint16> words((size_t)vertexCount * vertexWords, 0);
+    for (int i = 0; i < vertexCount; ++i)
+    {
+        const Vertex &vertex = vertices[i];
+        quint16 *word = &words[(size_t)remap[i] * vertexWords];
+        for (int k = 0; k < 3; ++k)
+            word[k] = quantize(vertex.m_positions[k], packedMesh.m_positionMin[k], packedMesh.m_positionScale[k]);
+        MeshCodec::octEncode(vertex.m_normals, word + 3);
+        for (int k = 0; k < 2; ++k)
+            word[5 + k] = quantize(vertex.m_texCoords[k], packedMesh.m_texCoordMin[k], packedMesh.m_texCoordScale[k]);
+        if (vertexWords < 16)
+            continue;
+
+        if (packedMesh.m_tangents)
+        {
+            // the bitangent is rebuilt from the normal and the tangent, only the side it points to is kept
+            MeshCodec::octEncode(vertex.m_tangents, word + 7);
+            const QVector3D cross = QVector3D::crossProduct(QVector3D(vertex.m_normals[0], vertex.m_normals[1], vertex.m_normals[2]),
+                                                            QVector3D(vertex.m_tangents[0], vertex.m_tangents[1], vertex.m_tangents[2]));
+            word[9] = QVector3D::dotProduct(cross, QVector3D(vertex.m_bitangents[0], vertex.m_bitangents[1], vertex.m_bitangents[2])) < 0.0f;
+        }
+        if (packedMesh.m_skinned)
+        {
+            for (int k = 0; k < 4; ++k)
+                word[10 + k] = (quint16)qBound(0, vertex.m_boneIDs[k], 65535);
+            quint8 weights[4];
+            for (int k = 0; k < 4; ++k)
+                weights[k] = (quint8)qBound(0L, std::lround(vertex.m_weights[k] * 255.0f), 255L);
+            word[14] = (quint16)(weights[0] | weights[1] << 8);
+            word[15] = (quint16)(weights[2] | weights[3] << 8);
+        }
+    }
+
+    packedMesh.m_indices = MeshCodec::encodeIndices(indices.data(), packedMesh.m_indexCount);
+    packedMesh.m_vertices = MeshCodec::encodeVertices(words.data(), vertexCount, vertexWords);
+}
+
+bool ModelLoadManager::unpackMesh(const PackedMesh &packedMesh, bool vertexStreams, ModelMesh &modelMesh)
 {
-    if (!data)
+    const int vertexCount = packedMesh.m_vertexCount;
+    const int vertexWords = packedMesh.m_quantized ? packedMesh.m_vertexWords : 0;
+    std::vector<quint16> words((size_t)vertexCount * vertexWords);
+    std::vector<Vertex> vertices(packedMesh.m_quantized ? 0 : vertexCount);
+    modelMesh.m_indices.resize(packedMesh.m_indexCount);
+    bool decoded = false;
+    if (packedMesh.m_quantized)
+        decoded = MeshCodec::decodeIndices(packedMesh.m_indices.constData(), packedMesh.m_indices.size(), modelMesh.m_indices.data(), packedMesh.m_indexCount) &&
+                  MeshCodec::decodeVertices(packedMesh.m_vertices.constData(), packedMesh.m_vertices.size(), words.data(), vertexCount, vertexWords);
+    else
+        decoded = BlockCodec::decode(packedMesh.m_indices.constData(), packedMesh.m_indices.size(), reinterpret_cast<char *>(modelMesh.m_indices.data()),
+                                     packedMesh.m_indexCount * sizeof(unsigned int)) &&
+                  BlockCodec::decode(packedMesh.m_vertices.constData(), packedMesh.m_vertices.size(), reinterpret_cast<char *>(vertices.data()),
+                                     (qint64)vertexCount * sizeof(Vertex));
+    if (!decoded)
+        return false;
+    for (unsigned int index : modelMesh.m_indices)
+    {
+        if (index >= (unsigned int)vertexCount)
+            return false;
+    }
+
+    modelMesh.m_textures = packedMesh.m_textures;
+    modelMesh.m_instances = packedMesh.m_instances;
+    modelMesh.m_instanceNodes = packedMesh.m_instanceNodes;
+    modelMesh.m_skinned = packedMesh.m_skinned;
+    modelMesh.m_vertices.clear();
+    modelMesh.m_streams.clear();
+    if (!packedMesh.m_quantized)
+    {
+        if (vertexStreams)
+            toVertexStreams(vertices, packedMesh.m_skinned, modelMesh.m_streams);
+        else
+            modelMesh.m_vertices.swap(vertices);
+        return true;
+    }
+
+    if (vertexStreams)
+        modelMesh.m_streams.resize(vertexCount, packedMesh.m_skinned);
+    else
+        modelMesh.m_vertices.resize(vertexCount);
+
+    parallelFor(0, vertexCount, [&](int i)
+                {
+                    const quint16 *word = &words[(size_t)i * vertexWords];
+                    Vertex vertex = {};
+                    for (int k = 0; k < 3; ++k)
+                        vertex.m_positions[k] = packedMesh.m_positionMin[k] + word[k] * packedMesh.m_positionScale[k];
+                    MeshCodec::octDecode(word + 3, vertex.m_normals);
+                    for (int k = 0; k < 2; ++k)
+                        vertex.m_texCoords[k] = packedMesh.m_texCoordMin[k] + word[5 + k] * packedMesh.m_texCoordScale[k];
+                    if (packedMesh.m_tangents)
+                    {
+                        MeshCodec::octDecode(word + 7, vertex.m_tangents);
+                        const float sign = word[9] ? -1.0f : 1.0f;
+                        const float *n = vertex.m_normals;
+                        const float *t = vertex.m_tangents;
+                        vertex.m_bitangents[0] = (n[1] * t[2] - n[2] * t[1]) * sign;
+                        vertex.m_bitangents[1] = (n[2] * t[0] - n[0] * t[2]) * sign;
+                        vertex.m_bitangents[2] = (n[0] * t[1] - n[1] * t[0]) * sign;
+                    }
+                    if (packedMesh.m_skinned)
+                    {
+                        for (int k = 0; k < 4; ++k)
+                        {
+                            vertex.m_boneIDs[k] = word[10 + k];
+                            vertex.m_weights[k] = (word[14 + k / 2] >> (k % 2 * 8) & 0xff) / 255.0f;
+                        }
+                        const float sum = vertex.m_weights[0] + vertex.m_weights[1] + vertex.m_weights[2] + vertex.m_weights[3];
+                        if (sum > 0.0f)
+                        {
+                            for (int k = 0; k < 4; ++k)
+                                vertex.m_weights[k] /= sum;
+                        }
+                    }
+
+                    if (!vertexStreams)
+                    {
+                        modelMesh.m_vertices[i] = vertex;
+                        return;
+                    }
+                    VertexStreams &streams = modelMesh.m_streams;
+                    memcpy(&streams.m_positions[i * 3], vertex.m_positions, 3 * sizeof(float));
+                    memcpy(&streams.m_normals[i * 3], vertex.m_normals, 3 * sizeof(float));
+                    memcpy(&streams.m_texCoords[i * 2], vertex.m_texCoords, 2 * sizeof(float));
+                    memcpy(&streams.m_tangents[i * 3], vertex.m_tangents, 3 * sizeof(float));
+                    memcpy(&streams.m_bitangents[i * 3], vertex.m_bitangents, 3 * sizeof(float));
+                    if (packedMesh.m_skinned)
+                    {
+                        memcpy(&streams.m_boneIDs[i * 4], vertex.m_boneIDs, 4 * sizeof(int));
+                        memcpy(&streams.m_weights[i * 4], vertex.m_weights, 4 * sizeof(float));
+                    } },
+                4096);
+    return true;
+}
+
+void ModelLoadManager::setResidency(const QString &modelPath, ResidencyOptions::Policy policy)
+{
+    QMutexLocker locker(&m_mutex);
+    m_residencyMaps.insert(modelPath, policy);
+}
+
+ModelLoadManager::ResidencyOptions::Policy ModelLoadManager::residency(const QString &modelPath)
+{
+    QMutexLocker locker(&m_mutex);
+    return m_residencyMaps.value(modelPath, m_residencyOptions.m_policy);
+}
+
+const char *ModelLoadManager::policyName(ResidencyOptions::Policy policy)
+{
+    switch (policy)
+    {
+    case ResidencyOptions::KeepCpu:
+        return "keep cpu";
+    case ResidencyOptions::KeepPacked:
+        return "keep packed";
+    case ResidencyOptions::GpuOnly:
+        return "gpu only";
+    default:
+        return "unknown";
+    }
+}
+
+void ModelLoadManager::releaseGeometry(const QString &modelPath)
+{
+    const ResidencyOptions::Policy policy = residency(modelPath);
+    if (policy == ResidencyOptions::KeepCpu)
         return;
-    stbi_image_free(data);
+
+    std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr; // freed outside the lock
+    std::shared_ptr<std::vector<PackedMesh>> packedPtr;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_modelMeshMaps.contains(modelPath))
+            modelMeshsPtr = m_modelMeshMaps[modelPath];
+        if (m_packedModelMaps.contains(modelPath))
+            packedPtr = m_packedModelMaps[modelPath];
+        m_modelMeshMaps.remove(modelPath);
+    }
+
+    qint64 meshFileBytes = 0;
+    if (policy == ResidencyOptions::GpuOnly && packedPtr)
+    {
+        // textures are read back from their bake cache files, a model with a texture that is only in memory stays packed
+        bool cached = true;
+        for (const auto &packedMesh : *packedPtr)
+        {
+            for (const auto &texture : packedMesh.m_textures)
+                cached = cached && !texture.m_cachePath.isEmpty();
+        }
+        const QString meshPath = ModelDiskCache::cacheFilePath(modelPath, QString("meshes%1").arg(MODEL_MESH_VERSION));
+        if (cached && saveMeshFile(meshPath, *packedPtr))
+            meshFileBytes = QFileInfo(meshPath).size();
+        else
+            spdlog::warn("write packed model failed, it stays packed in memory. file: {}", modelPath.toStdString());
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_packedModelMaps.remove(modelPath);
+        if (meshFileBytes)
+            m_meshFileMaps.insert(modelPath, meshFileBytes);
+        else if (packedPtr)
+            m_packedModelMaps.insert(modelPath, packedPtr);
+    }
+
+    const ResidencyStats stats = residencyStats();
+    spdlog::info("model name: {0}, residency: {1}, cpu: {2:.2f} MB, packed: {3:.2f} MB, disk: {4:.2f} MB, gpu: {5:.2f} MB.", modelPath.toStdString(),
+                 policyName(policy), stats.m_cpuBytes / 1048576.0, stats.m_packedBytes / 1048576.0, stats.m_diskBytes / 1048576.0,
+                 stats.m_gpuBytes / 1048576.0);
+}
+
+ModelLoadManager::ResidencyStats ModelLoadManager::residencyStats()
+{
+    ResidencyStats stats;
+    QMutexLocker locker(&m_mutex);
+    m_modelMeshMaps.forEach([&](const QString &, const std::shared_ptr<QVector<ModelMesh>> &modelMeshsPtr)
+                            {
+                                for (const auto &modelMesh : *modelMeshsPtr)
+                                    stats.m_cpuBytes += modelMesh.vertexBytes(modelMesh.vertexCount()) + modelMesh.m_indices.size() * sizeof(unsigned int); });
+    m_packedModelMaps.forEach([&](const QString &, const std::shared_ptr<std::vector<PackedMesh>> &packedPtr)
+                              {
+                                  for (const auto &packedMesh : *packedPtr)
+                                      stats.m_packedBytes += packedMesh.byteCount(); });
+    for (qint64 bytes : m_meshFileMaps)
+        stats.m_diskBytes += bytes;
+    stats.m_gpuBytes = m_gpuBytes;
+    return stats;
+}
+
+bool ModelLoadManager::saveMeshFile(const QString &meshPath, const std::vector<PackedMesh> &packedMeshs)
+{
+    QSaveFile file(meshPath);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        spdlog::error("open mesh file failed. path: {}", meshPath.toStdString());
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    stream << (quint32)MODEL_MESH_VERSION << (quint32)packedMeshs.size();
+    for (const auto &packedMesh : packedMeshs)
+    {
+        stream << packedMesh.m_vertices << packedMesh.m_indices << (qint32)packedMesh.m_vertexCount << packedMesh.m_indexCount << packedMesh.m_quantized
+               << (qint32)packedMesh.m_vertexWords << packedMesh.m_tangents << packedMesh.m_skinned;
+        for (int k = 0; k < 3; ++k)
+            stream << packedMesh.m_positionMin[k] << packedMesh.m_positionScale[k];
+        for (int k = 0; k < 2; ++k)
+            stream << packedMesh.m_texCoordMin[k] << packedMesh.m_texCoordScale[k];
+
+        // the textures are read again from the bake cache
+        stream << (quint32)packedMesh.m_textures.size();
+        for (const auto &texture : packedMesh.m_textures)
+            stream << QString::fromStdString(texture.m_type) << (qint32)texture.m_width << (qint32)texture.m_height
+                   << (qint32)texture.m_channel << texture.m_bakedPath << texture.m_cachePath;
+        stream << (quint32)packedMesh.m_instances.size();
+        stream.writeRawData(reinterpret_cast<const char *>(packedMesh.m_instances.data()), (int)(packedMesh.m_instances.size() * sizeof(float)));
+        stream << (quint32)packedMesh.m_instanceNodes.size();
+        stream.writeRawData(reinterpret_cast<const char *>(packedMesh.m_instanceNodes.data()), (int)(packedMesh.m_instanceNodes.size() * sizeof(int)));
+    }
+    return stream.status() == QDataStream::Ok && file.commit();
+}
+
+bool ModelLoadManager::loadMeshFile(const QString &meshPath, std::vector<PackedMesh> &packedMeshs)
+{
+    QFile file(meshPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    quint32 version = 0, meshCount = 0;
+    stream >> version >> meshCount;
+    if (version != MODEL_MESH_VERSION)
+        return false;
+    packedMeshs.clear();
+    for (quint32 i = 0; i < meshCount && stream.status() == QDataStream::Ok; ++i)
+    {
+        PackedMesh packedMesh;
+        qint32 vertexCount = 0, vertexWords = 0;
+        stream >> packedMesh.m_vertices >> packedMesh.m_indices >> vertexCount >> packedMesh.m_indexCount >> packedMesh.m_quantized >> vertexWords >>
+            packedMesh.m_tangents >> packedMesh.m_skinned;
+        packedMesh.m_vertexCount = vertexCount;
+        packedMesh.m_vertexWords = vertexWords;
+        for (int k = 0; k < 3; ++k)
+            stream >> packedMesh.m_positionMin[k] >> packedMesh.m_positionScale[k];
+        for (int k = 0; k < 2; ++k)
+            stream >> packedMesh.m_texCoordMin[k] >> packedMesh.m_texCoordScale[k];
+
+        quint32 textureCount = 0;
+        stream >> textureCount;
+        for (quint32 j = 0; j < textureCount && stream.status() == QDataStream::Ok; ++j)
+        {
+            Texture texture;
+            QString type;
+            qint32 width = 0, height = 0, channel = 0;
+            stream >> type >> width >> height >> channel >> texture.m_bakedPath >> texture.m_cachePath;
+            texture.m_type = type.toStdString();
+            texture.m_width = width;
+            texture.m_height = height;
+            texture.m_channel = channel;
+            texture.m_bakedPath.clear();
+            if (!loadBakedTexture(texture.m_cachePath, texture))
+            {
+                spdlog::warn("baked texture of a packed model is gone. path: {}", texture.m_cachePath.toStdString());
+                return false;
+            }
+            packedMesh.m_textures.emplace_back(texture);
+        }
+
+        quint32 instanceFloatCount = 0, instanceNodeCount = 0;
+        stream >> instanceFloatCount;
+        packedMesh.m_instances.resize(qMin<quint32>(instanceFloatCount, (quint32)(file.size() / sizeof(float))));
+        stream.readRawData(reinterpret_cast<char *>(packedMesh.m_instances.data()), (int)(packedMesh.m_instances.size() * sizeof(float)));
+        stream >> instanceNodeCount;
+        packedMesh.m_instanceNodes.resize(qMin<quint32>(instanceNodeCount, (quint32)(file.size() / sizeof(int))));
+        stream.readRawData(reinterpret_cast<char *>(packedMesh.m_instanceNodes.data()), (int)(packedMesh.m_instanceNodes.size() * sizeof(int)));
+        if (packedMesh.m_instances.size() != instanceFloatCount || packedMesh.m_instanceNodes.size() != instanceNodeCount)
+            return false;
+        packedMeshs.emplace_back(std::move(packedMesh));
+    }
+    return stream.status() == QDataStream::Ok && packedMeshs.size() == meshCount;
+}
+
+bool ModelLoadManager::getSceneGraph(const QString &modelPath, SceneGraph &sceneGraph)
+{
+    std::shared_ptr<SceneGraph> sceneGraphPtr;
+    {
+        QMutexLocker locker(&m_mutex);
+        sceneGraphPtr = m_sceneGraphMaps.value(modelPath);
+    }
+    if (!sceneGraphPtr)
+    {
+        std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr;
+        if (!import3DModel(modelPath, modelMeshsPtr))
+            return false;
+        QMutexLocker locker(&m_mutex);
+        sceneGraphPtr = m_sceneGraphMaps.value(modelPath);
+        if (!sceneGraphPtr)
+            return false;
+    }
+
+    sceneGraph = *sceneGraphPtr;
+    return true;
+}
+
+bool ModelLoadManager::getAnimation(const QString &modelPath, std::shared_ptr<const ModelAnimation> &animationPtr)
+{
+    bool imported = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        imported = m_sceneGraphMaps.contains(modelPath);
+    }
+    if (!imported)
+    {
+        std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr;
+        if (!import3DModel(modelPath, modelMeshsPtr))
+            return false;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (!m_animationMaps.contains(modelPath))
+        return false;
+    animationPtr = m_animationMaps[modelPath];
+    return true;
+}
+
+bool ModelLoadManager::isStreamingModel(const QString &modelPath) const
+{
+    QFileInfo fileInfo(modelPath);
+    return !fileInfo.suffix().compare("obj", Qt::CaseInsensitive) && fileInfo.size() > m_streamingOptions.m_fileSizeThreshold;
+}
+
+bool ModelLoadManager::openPagedModel(const QString &modelPath, std::shared_ptr<ModelPageFile> &pageFilePtr)
+{
+    if (modelPath.isEmpty())
+    {
+        spdlog::error("model path is empty. modelPath: {0}", modelPath.toStdString());
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_pageFileMaps.contains(modelPath))
+        {
+            pageFilePtr = m_pageFileMaps[modelPath];
+            return true;
+        }
+        if (m_unpagedModels.contains(modelPath))
+            return false;
+    }
+
+    const QString pagePath = ModelDiskCache::cacheFilePath(modelPath, QString("pages%1").arg(MODEL_PAGE_VERSION));
+    if (!QFileInfo::exists(pagePath))
+    {
+        if (isStreamingModel(modelPath))
+        {
+            ModelStreamImporter::Options options;
+            options.m_chunkBytes = m_streamingOptions.m_chunkBytes;
+            options.m_pageCodec = m_streamingOptions.m_pageCodec;
+            if (!ModelStreamImporter().importObj(modelPath, pagePath, options))
+            {
+                spdlog::error("stream import failed. file: {}", modelPath.toStdString());
+                return false;
+            }
+        }
+        else if (!buildClusterPages(modelPath, pagePath))
+        {
+            // the next renderers of the model do not import it again only to find out
+            QMutexLocker locker(&m_mutex);
+            m_unpagedModels.insert(modelPath);
+            return false;
+        }
+    }
+
+    auto pageFile = std::make_shared<ModelPageFile>();
+    if (!pageFile->open(pagePath))
+        return false;
+    // a thread that opened the same pages first keeps its file
+    QMutexLocker locker(&m_mutex);
+    if (!m_pageFileMaps.contains(modelPath))
+        m_pageFileMaps.insert(modelPath, pageFile);
+    pageFilePtr = m_pageFileMaps[modelPath];
+    return true;
 }
 
+bool ModelLoadManager::buildClusterPages(const QString &modelPath, const QString &pagePath)
+{
+    std::shared_ptr<QVector<ModelMesh>> modelMeshsPtr;
+    if (!import3DModel(modelPath, modelMeshsPtr))
+        return false;
+
+    // pages keep no materials and no bones, textured, skinned and animated models are drawn per mesh
+    bool animated = false;
+    {
+        QMutexLocker locker(&m_mutex);
+        animated = m_animationMaps.contains(modelPath) && !m_animationMaps[modelPath]->m_clips.empty();
+    }
+    quint64 triangleCount = 0;
+    for (const auto &modelMesh : *modelMeshsPtr)
+    {
+        if (!modelMesh.m_textures.empty() || modelMesh.m_skinned)
+            return false;
+        triangleCount += modelMesh.m_indices.size() / 3;
+    }
+    // the instances of a mesh are drawn from one copy, only the triangles a model stores count
+    if (animated || triangleCount <= m_streamingOptions.m_clusterTriangleThreshold)
+        return false;
+
+    // the bounds of the instances place the triangles in the grid of the importer
+    float min[3] = {FLT_MAX, FLT_MAX, FLT_MAX}, max[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (const auto &modelMesh : *modelMeshsPtr)
+    {
+        if (!modelMesh.vertexCount())
+            continue;
+        float bmin[3], bmax[3];
+        VertexStreams::bounds(modelMesh.positions(), modelMesh.vertexCount(), bmin, bmax);
+        for (int instanceIndex = 0; instanceIndex < modelMesh.instanceCount(); ++instanceIndex)
+        {
+            const QMatrix4x4 instance = modelMesh.instanceMatrix(instanceIndex);
+            for (int corner = 0; corner < 8; ++corner)
+            {
+                const QVector3D position = instance.map(QVector3D(corner & 1 ? bmax[0] : bmin[0], corner & 2 ? bmax[1] : bmin[1], corner & 4 ? bmax[2] : bmin[2]));
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    min[axis] = qMin(min[axis], position[axis]);
+                    max[axis] = qMax(max[axis], position[axis]);
+                }
+            }
+        }
+    }
+
+    spdlog::info("split model into cluster pages. file: {0}, triangles: {1}", modelPath.toStdString(), triangleCount);
+    // pages have no instances, every instance is written out in place, a bounded chunk at a time
+    ModelStreamImporter::Options options;
+    options.m_chunkBytes = m_streamingOptions.m_chunkBytes;
+    options.m_pageCodec = m_streamingOptions.m_pageCodec;
+    ModelStreamImporter importer;
+    if (!importer.beginTriangles(min, max, options))
+        return false;
+    const int stride = PAGE_VERTEX_BYTE_COUNT / sizeof(float);
+    float triangle[3 * stride];
+    for (const auto &modelMesh : *modelMeshsPtr)
+    {
+        const VertexStreams::View positions = modelMesh.positions();
+        const VertexStreams::View normals = modelMesh.normals();
+        const VertexStreams::View texCoords = modelMesh.texCoords();
+        for (int instanceIndex = 0; instanceIndex < modelMesh.instanceCount(); ++instanceIndex)
+        {
+            const QMatrix4x4 instance = modelMesh.instanceMatrix(instanceIndex);
+            const QMatrix3x3 normalMatrix = instance.normalMatrix();
+            for (size_t i = 0; i + 2 < modelMesh.m_indices.size(); i += 3)
+            {
+                for (size_t j = 0; j < 3; ++j)
+                {
+                    const unsigned int index = modelMesh.m_indices[i + j];
+                    const float *p = positions[index];
+                    const float *n = normals[index];
+                    const QVector3D position = instance.map(QVector3D(p[0], p[1], p[2]));
+                    float *vertex = triangle + j * stride;
+                    vertex[0] = position.x();
+                    vertex[1] = position.y();
+                    vertex[2] = position.z();
+                    vertex[3] = texCoords.m_data ? texCoords[index][0] : 0.0f;
+                    vertex[4] = texCoords.m_data ? texCoords[index][1] : 0.0f;
+                    for (int row = 0; row < 3; ++row)
+                        vertex[5 + row] = normalMatrix(row, 0) * n[0] + normalMatrix(row, 1) * n[1] + normalMatrix(row, 2) * n[2];
+                }
+                if (!importer.addTriangle(triangle))
+                    return false;
+            }
+        }
+    }
+    return importer.endTriangles(pagePath);
+}
@@ -1,17 +1,31 @@
 ﻿#ifndef __MODEL_LOAD_MANAGER_H__
 #define __MODEL_LOAD_MANAGER_H__
 
+#include "glb_file.h"
+#include "importer_pool.h"
 #include "lru_queue.h"
+#include "model_page_file.h"
+#include "scene_graph.h"
+#include "skeletal_animation.h"
+#include "texture_baker.h"
+#include "vertex_streams.h"
 #include <QString>
 #include <QVector>
 #include <QVector3D>
 #include <QMatrix4x4>
-#include <assimp/Importer.hpp>
+#include <QMutex>
+#include <QSet>
+#include <QWaitCondition>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <atomic>
 
 #define OBJ_BYTE_COUNT ((3 + 2 + 3) * sizeof(float))
+#define MESH_STREAM_BYTE_COUNT ((3 + 3) * sizeof(float)) // position and normal streams the vulkan renderer gathers from the meshes
+#define INSTANCE_FLOAT_COUNT 16
+#define MODEL_MESH_VERSION 3 // packed meshes of the model cache, see ResidencyOptions::GpuOnly
 
+// imports may run on any thread, concurrent imports of one model wait for the first and share its result
 class ModelLoadManager
 {
 public:
@@ -41,30 +55,191 @@ public:
         float m_weights[4];    // weights from each bone
     };
 
+    // read only once the model is in the caches, renderers keep their gpu copies of the textures themselves
     struct Texture
     {
-        unsigned int m_id;
         std::string m_type;
-        int m_width;
-        int m_height;
-        int m_channel;
-        unsigned char *m_data;
+        int m_width = 0;
+        int m_height = 0;
+        int m_channel = 0;
+        std::shared_ptr<unsigned char> m_data;     // decoded image, null if the texture is baked, freed with the last copy of the texture
+        std::shared_ptr<BakedTexture> m_baked;     // mip chain from the model cache, uploaded as is
+        QString m_bakedPath;                       // cache file the larger mips are streamed from, empty if m_baked holds every mip
+        QString m_cachePath;                       // cache file m_baked was read from or saved to, empty if it is only in memory
     };
 
     struct ModelMesh
     {
-        std::vector<Vertex> m_vertices;
+        std::vector<Vertex> m_vertices; // empty if the vertices are kept in m_streams
+        VertexStreams m_streams;        // the vertices as separate aligned streams, see VertexOptions
         std::vector<unsigned int> m_indices;
         std::vector<Texture> m_textures;
-        unsigned int m_VAO;
-        unsigned int m_VBO;
-        unsigned int m_EBO;
+        std::vector<float> m_instances; // column-major model matrix of every instance, a mesh repeated in the scene is stored once
+        std::vector<int> m_instanceNodes; // scene graph node of every instance, m_instances holds their world matrices at import
+        bool m_skinned = false;           // vertices are placed by the bone palette, its instance is the identity
+
+        int instanceCount() const { return (int)(m_instances.size() / INSTANCE_FLOAT_COUNT); }
+        QMatrix4x4 instanceMatrix(int index) const { return QMatrix4x4(&m_instances[index * INSTANCE_FLOAT_COUNT]).transposed(); }
+        int vertexCount() const { return m_streams.empty() ? (int)m_vertices.size() : m_streams.vertexCount(); }
+        // the attributes in whichever layout the mesh keeps its vertices
+        VertexStreams::View positions() const;
+        VertexStreams::View normals() const;
+        VertexStreams::View texCoords() const;
+        // where a stream is found in a vertex buffer holding vertexCount vertices in the layout of the mesh, m_vertices
+        // as they are or the streams it holds back to back (VertexStreams::packedAttribute), vertexCount can cover several meshes
+        VertexStreams::Attribute vertexAttribute(VertexStreams::Stream stream, qint64 vertexCount) const;
+        qint64 vertexBytes(qint64 vertexCount) const;
+    };
+
+    // compact copy of a mesh, exact unless quantized: the interleaved vertices and the indices as they are, compressed by BlockCodec
+    // a quantized mesh has its vertices quantized to 16 bit words and both buffers encoded by MeshCodec, positions are kept
+    // to 1/65535 of the mesh bounds, normals and tangents to about 0.005 degree, bone weights to 1/255
+    struct PackedMesh
+    {
+        QByteArray m_vertices;
+        QByteArray m_indices;
+        int m_vertexCount = 0;
+        qint64 m_indexCount = 0;
+        bool m_quantized = false;
+        int m_vertexWords = 0; // quantized meshes only, 16 if the mesh has tangents or bones, 8 otherwise
+        bool m_tangents = false;
+        bool m_skinned = false;
+        float m_positionMin[3] = {};
+        float m_positionScale[3] = {};
+        float m_texCoordMin[2] = {};
+        float m_texCoordScale[2] = {};
+        std::vector<Texture> m_textures;
+        std::vector<float> m_instances;
+        std::vector<int> m_instanceNodes;
+
+        qint64 byteCount() const { return m_vertices.size() + m_indices.size(); }
     };
 
+    // packs the interleaved vertices of modelMesh, quantized vertices are renumbered in the order the triangles use them
+    static void packMesh(const ModelMesh &modelMesh, bool quantized, PackedMesh &packedMesh);
+    static void packMeshes(const QVector<ModelMesh> &modelMeshs, bool quantized, std::vector<PackedMesh> &packedMeshs);
+    static bool unpackMesh(const PackedMesh &packedMesh, bool vertexStreams, ModelMesh &modelMesh);
+
+    // the one in-memory layout of a model, every backend reads its attributes through ModelMesh views instead of a copy
     bool import3DModel(const QString &modelPath, std::shared_ptr<QVector<ModelMesh>> &modelMeshsPtr);
-    bool import3DModel(const QString& modelPath, std::shared_ptr<QByteArray> &byteArrayPtr);
     float getModelMaxPos(const QString &modelPath);
-    void cleanImageData(unsigned char *data);
+    struct ImportOptions;
+    // reads the model again without looking at or filling the caches, for measurements
+    bool importUncached(const QString &modelPath, const ImportOptions &options, QVector<ModelMesh> &modelMeshs);
+    // splits interleaved vertices into streams, the bone streams are kept only for skinned meshes
+    static void toVertexStreams(const std::vector<Vertex> &vertices, bool skinned, VertexStreams &streams);
+    // node hierarchy of an imported model, callers get a copy they can animate
+    bool getSceneGraph(const QString &modelPath, SceneGraph &sceneGraph);
+    // returns false if the model has neither bones nor animation clips
+    bool getAnimation(const QString &modelPath, std::shared_ptr<const ModelAnimation> &animationPtr);
+
+public:
+    /////////////////////////////////////////////////////////////////
+    // out-of-core streaming for models larger than memory, and clustered pages for huge static scenes
+    struct StreamingOptions
+    {
+        qint64 m_fileSizeThreshold = 512ll * 1024 * 1024;    // obj files above this size are streamed into pages
+        qint64 m_chunkBytes = 64ll * 1024 * 1024;            // memory budget of the streaming importer
+        qint64 m_residencyBudget = 512ll * 1024 * 1024;      // page bytes a renderer keeps resident
+        quint64 m_clusterTriangleThreshold = 4 * 1024 * 1024; // static untextured models with more unique triangles are split into cluster pages
+        BlockCodec::Codec m_pageCodec = BlockCodec::Fast;     // Small makes the page cache smaller and slower to page in
+    };
+
+    void setStreamingOptions(const StreamingOptions &options) { m_streamingOptions = options; }
+    const StreamingOptions &streamingOptions() const { return m_streamingOptions; }
+    bool isStreamingModel(const QString &modelPath) const;
+    // returns false if the model is drawn from its meshes instead of pages
+    bool openPagedModel(const QString &modelPath, std::shared_ptr<ModelPageFile> &pageFilePtr);
+
+public:
+    /////////////////////////////////////////////////////////////////
+    // textures are baked at import into compressed mip chains kept in the model cache
+    struct TextureOptions
+    {
+        bool m_bakeTextures = true;                     // off uploads the decoded images and lets the driver build the mips
+        bool m_streamTextures = true;                   // baked textures start at a small mip, the larger ones are streamed in when seen
+        int m_tailSize = 64;                            // largest mip read at import, it stays resident
+        qint64 m_residencyBudget = 256ll * 1024 * 1024; // texture bytes the streamer keeps resident
+    };
+
+    void setTextureOptions(const TextureOptions &options) { m_textureOptions = options; }
+    const TextureOptions &textureOptions() const { return m_textureOptions; }
+
+public:
+    /////////////////////////////////////////////////////////////////
+    // how model files are read
+    struct ImportOptions
+    {
+        // the assimp post processing of an import
+        enum Profile
+        {
+            FastPreview = 0, // triangles, normals where the file has none and flipped uvs, meshes stay as the file stores them
+            FullQuality,     // welded vertices, and tangents if the shaders and the materials use normal maps
+            RenderOptimized, // full quality, with the meshes of a node merged and the triangles reordered for the vertex cache
+            ProfileCount,
+        };
+
+        bool m_nativeGlb = true;     // static .glb files are read by GlbFile, the ones it refuses and every other format by assimp
+        bool m_nativeScans = true;   // binary .ply and .stl files are read by ScanFile, ascii ones by assimp
+        Profile m_profile = FullQuality;
+        bool m_normalMaps = false;   // the active shaders sample normal maps, no tangents are computed otherwise
+    };
+
+    void setImportOptions(const ImportOptions &options) { m_importOptions = options; }
+    const ImportOptions &importOptions() const { return m_importOptions; }
+    static const char *profileName(ImportOptions::Profile profile);
+    // the steps run while the file is read, tangents are added afterwards for the files that need them
+    static unsigned int postProcessSteps(ImportOptions::Profile profile, const QString &modelPath);
+
+public:
+    /////////////////////////////////////////////////////////////////
+    // layout of the vertices kept by the imported meshes
+    struct VertexOptions
+    {
+        bool m_vertexStreams = false;  // structure of arrays in ModelMesh::m_streams instead of interleaved ModelMesh::m_vertices
+        bool m_packedCache = true;     // imported models are also kept packed, the ones that drop out of the mesh cache are unpacked from it
+        bool m_quantizedCache = false; // the packed copies are quantized (see PackedMesh), about half the size, meshes may crack along shared edges
+    };
+
+    void setVertexOptions(const VertexOptions &options) { m_vertexOptions = options; }
+    const VertexOptions &vertexOptions() const { return m_vertexOptions; }
+
+public:
+    /////////////////////////////////////////////////////////////////
+    // which copies of a model stay in memory once the renderers uploaded it
+    struct ResidencyOptions
+    {
+        enum Policy
+        {
+            KeepCpu = 0, // the meshes stay in the mesh cache next to the gpu buffers
+            KeepPacked,  // only the packed copy stays, a renderer that needs the meshes again unpacks it
+            GpuOnly,     // the packed copy is written to the model cache and read back from there when needed
+            PolicyCount,
+        };
+
+        Policy m_policy = KeepPacked; // models without a policy of their own, see setResidency
+    };
+
+    // bytes held by every tier, a model can be in several
+    struct ResidencyStats
+    {
+        qint64 m_cpuBytes = 0;    // meshes of the mesh cache
+        qint64 m_packedBytes = 0; // packed copies in memory
+        qint64 m_diskBytes = 0;   // packed copies written to the model cache
+        qint64 m_gpuBytes = 0;    // vertex and index buffers of the renderers
+    };
+
+    void setResidencyOptions(const ResidencyOptions &options) { m_residencyOptions = options; }
+    const ResidencyOptions &residencyOptions() const { return m_residencyOptions; }
+    void setResidency(const QString &modelPath, ResidencyOptions::Policy policy);
+    ResidencyOptions::Policy residency(const QString &modelPath);
+    static const char *policyName(ResidencyOptions::Policy policy);
+    // called by a renderer once its buffers hold the model, drops the copies the policy of the model does not keep
+    // the renderer drops its own reference to the vertices and indices, import3DModel fetches them again
+    void releaseGeometry(const QString &modelPath);
+    // renderers add the bytes of the vertex and index buffers they create, and subtract them when they delete them
+    void addGpuBytes(qint64 bytes) { m_gpuBytes += bytes; }
+    ResidencyStats residencyStats();
 
 public:
     static ModelLoadManager* instance();
@@ -75,16 +250,54 @@ private:
 
     bool parseObjModel(const QString& modelPath, QVector<float>& vertextPoints, QVector<float>& texturePoints, QVector<float>& normalPoints,
         QVector<std::tuple<int, int, int>>& facesIndexs);
-    void  processNode(aiNode* node, const aiScene* scene, QVector<ModelMesh>& modelMeshs);
+    struct ImportContext;
+    bool  readModel(const ImportOptions& options, ImportContext& context, QVector<ModelMesh>& modelMeshs);
+    bool  readGlbModel(ImportContext& context, QVector<ModelMesh>& modelMeshs, QString& reason);
+    bool  readScanModel(ImportContext& context, QVector<ModelMesh>& modelMeshs, QString& reason);
+    bool  processGlbNode(const GlbFile& glbFile, int node, int parentNode, ImportContext& context, QVector<ModelMesh>& modelMeshs);
+    bool  processGlbPrimitive(const GlbFile& glbFile, const GlbFile::Primitive& primitive, ModelMesh& modelMesh);
+    void  processGlbMaterial(const GlbFile& glbFile, int material, const ImportContext& context, ModelMesh& modelMesh);
+    void  processNode(aiNode* node, const aiScene* scene, int parentNode, ImportContext& context, QVector<ModelMesh>& modelMeshs);
     void  processMesh(aiMesh* mesh, const aiScene* scene, ModelMesh& modelMesh);
-    void  loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName, const aiScene* scene, std::vector<Texture>& textures);
+    static void generateNormals(ModelMesh& modelMesh);
+    static void generateTangents(ModelMesh& modelMesh);
+    void  processMaterial(aiMesh* mesh, const aiScene* scene, const ImportContext& context, ModelMesh& modelMesh);
+    void  processBones(aiMesh* mesh, ImportContext& context, ModelMesh& modelMesh);
+    void  processAnimations(const aiScene* scene, ImportContext& context);
+    int   addUniqueMesh(aiMesh* mesh, const aiScene* scene, ImportContext& context, QVector<ModelMesh>& modelMeshs, QVector3D& offset);
+    // returns the mesh with the same geometry and material, or adds modelMesh moved to its origin and sets added
+    int   addGeometry(ModelMesh& modelMesh, unsigned int materialIndex, ImportContext& context, QVector<ModelMesh>& modelMeshs, QVector3D& offset, bool& added);
+    bool  buildClusterPages(const QString& modelPath, const QString& pagePath);
+    bool  saveMeshFile(const QString& meshPath, const std::vector<PackedMesh>& packedMeshs);
+    bool  loadMeshFile(const QString& meshPath, std::vector<PackedMesh>& packedMeshs);
+    void  loadMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName, const aiScene* scene, const ImportContext& context,
+        std::vector<Texture>& textures);
+    void  loadTexture(const QString& modelPath, const std::string& name, const unsigned char* data, qint64 size, Texture& texture); // embedded image
+    void  loadTexture(const QString& filename, Texture& texture);
+    bool  loadBakedTexture(const QString& bakedPath, Texture& texture);
+    void  bakeTexture(const QString& bakedPath, Texture& texture);
 
 private:
+    // guards the maps, it is never held while a model is read
+    QMutex m_mutex;
+    QWaitCondition m_importDone;
+    QSet<QString> m_importing;
     LRUQueue<QString, std::shared_ptr<QVector<ModelMesh>>> m_modelMeshMaps;
-    LRUQueue<QString, std::shared_ptr<QByteArray>> m_byteArrayMaps;
+    LRUQueue<QString, std::shared_ptr<std::vector<PackedMesh>>> m_packedModelMaps;
     QMap<QString, float> m_modelMaxPosMaps;
-    QString m_currentModelName;
-    Assimp::Importer m_importer;
+    QMap<QString, std::shared_ptr<SceneGraph>> m_sceneGraphMaps;
+    QMap<QString, std::shared_ptr<ModelAnimation>> m_animationMaps;
+    QMap<QString, std::shared_ptr<ModelPageFile>> m_pageFileMaps;
+    QSet<QString> m_unpagedModels; // models openPagedModel found to be drawn from their meshes
+    QMap<QString, ResidencyOptions::Policy> m_residencyMaps;
+    QMap<QString, qint64> m_meshFileMaps; // models written to the model cache by releaseGeometry, bytes of the file
+    std::atomic<qint64> m_gpuBytes{0};
+    StreamingOptions m_streamingOptions;
+    TextureOptions m_textureOptions;
+    VertexOptions m_vertexOptions;
+    ImportOptions m_importOptions;
+    ResidencyOptions m_residencyOptions;
+    ImporterPool m_importerPool;
 };
 
 #endif
@@ -0,0 +1,306 @@
+﻿#include "model_page_file.h"
+#include <spdlog/spdlog.h>
+#include <QtMath>
+#include <cfloat>
+
+static_assert(sizeof(ModelPageFile::Header) == 72, "page file header layout changed");
+static_assert(sizeof(ModelPageFile::PageEntry) == 48, "page entry layout changed");
+static_assert(sizeof(ModelPageFile::ClusterEntry) == 48, "cluster entry layout changed");
+
+bool ModelPageFile::open(const QString &pagePath)
+{
+    m_file.setFileName(pagePath);
+    if (!m_file.open(QIODevice::ReadOnly))
+    {
+        spdlog::error("open page file failed. path: {}", pagePath.toStdString());
+        return false;
+    }
+
+    if (m_file.read(reinterpret_cast<char *>(&m_header), sizeof(Header)) != sizeof(Header) ||
+        memcmp(m_header.m_magic, MODEL_PAGE_MAGIC, sizeof(MODEL_PAGE_MAGIC)) ||
+        m_header.m_version != MODEL_PAGE_VERSION)
+    {
+        spdlog::error("page file header is invalid. path: {}", pagePath.toStdString());
+        m_file.close();
+        return false;
+    }
+
+    m_pages.resize(m_header.m_pageCount);
+    const qint64 directorySize = (qint64)m_pages.size() * sizeof(PageEntry);
+    if (!m_file.seek(m_header.m_directoryOffset) ||
+        m_file.read(reinterpret_cast<char *>(m_pages.data()), directorySize) != directorySize)
+    {
+        spdlog::error("read page directory failed. path: {}", pagePath.toStdString());
+        m_pages.clear();
+        m_file.close();
+        return false;
+    }
+
+    m_clusters.resize(m_header.m_clusterCount);
+    const qint64 clusterTableSize = (qint64)m_clusters.size() * sizeof(ClusterEntry);
+    if (!m_file.seek(m_header.m_clusterTableOffset) ||
+        m_file.read(reinterpret_cast<char *>(m_clusters.data()), clusterTableSize) != clusterTableSize)
+    {
+        spdlog::error("read cluster table failed. path: {}", pagePath.toStdString());
+        m_pages.clear();
+        m_clusters.clear();
+        m_file.close();
+        return false;
+    }
+
+    spdlog::info("open page file. path: {0}, pages: {1}, clusters: {2}, vertices: {3}", pagePath.toStdString(),
+                 m_header.m_pageCount, m_header.m_clusterCount, m_header.m_vertexCount);
+    return true;
+}
+
+bool ModelPageFile::loadPage(int index, QByteArray &data)
+{
+    if (index < 0 || index >= pageCount())
+    {
+        spdlog::error("page index out of range. index: {}, count: {}", index, pageCount());
+        return false;
+    }
+
+    data.resize(pageByteCount(index));
+    if (!loadPage(index, data.data()))
+    {
+        data.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ModelPageFile::loadPage(int index, char *dst)
+{
+    if (index < 0 || index >= pageCount())
+    {
+        spdlog::error("page index out of range. index: {}, count: {}", index, pageCount());
+        return false;
+    }
+
+    // the blocks of the page are decoded in parallel straight into dst
+    const qint64 packedBytes = m_pages[index].m_packedBytes;
+    m_packed.resize(packedBytes);
+    if (!m_file.seek(m_pages[index].m_offset) || m_file.read(m_packed.data(), packedBytes) != packedBytes)
+    {
+        spdlog::error("read page failed. path: {}, index: {}", m_file.fileName().toStdString(), index);
+        return false;
+    }
+    if (!BlockCodec::decode(m_packed.constData(), packedBytes, dst, pageByteCount(index)))
+    {
+        spdlog::error("decode page failed. path: {}, index: {}", m_file.fileName().toStdString(), index);
+        return false;
+    }
+    return true;
+}
+
+bool ModelPageFile::loadPage(int index, qint64 offset, qint64 bytes, char *dst) const
+{
+    if (index < 0 || index >= pageCount())
+    {
+        spdlog::error("page index out of range. index: {}, count: {}", index, pageCount());
+        return false;
+    }
+
+    QFile file(m_file.fileName());
+    const qint64 packedBytes = m_pages[index].m_packedBytes;
+    QByteArray packed(packedBytes, Qt::Uninitialized);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(m_pages[index].m_offset) || file.read(packed.data(), packedBytes) != packedBytes)
+    {
+        spdlog::error("read page failed. path: {}, index: {}", m_file.fileName().toStdString(), index);
+        return false;
+    }
+    if (!BlockCodec::decode(packed.constData(), packedBytes, pageByteCount(index), offset, bytes, dst))
+    {
+        spdlog::error("decode page failed. path: {}, index: {}", m_file.fileName().toStdString(), index);
+        return false;
+    }
+    return true;
+}
+
+float ModelPageFile::maxPosition() const
+{
+    float maxPosition = 1.0;
+    for (int i = 0; i < 3; ++i)
+        maxPosition = qMax(qMax(qAbs(m_header.m_min[i]), qAbs(m_header.m_max[i])), maxPosition);
+    return maxPosition;
+}
+
+ModelPageWriter::~ModelPageWriter()
+{
+    if (m_file.isOpen())
+        m_file.remove();
+}
+
+bool ModelPageWriter::open(const QString &pagePath, BlockCodec::Codec codec)
+{
+    m_pagePath = pagePath;
+    m_packedBytes = 0;
+    m_pages.clear();
+    m_clusters.clear();
+    memset(&m_header, 0, sizeof(m_header));
+    memcpy(m_header.m_magic, MODEL_PAGE_MAGIC, sizeof(MODEL_PAGE_MAGIC));
+    m_header.m_version = MODEL_PAGE_VERSION;
+    m_header.m_codec = codec;
+    for (int i = 0; i < 3; ++i)
+    {
+        m_header.m_min[i] = FLT_MAX;
+        m_header.m_max[i] = -FLT_MAX;
+    }
+
+    m_file.setFileName(pagePath + ".tmp");
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        spdlog::error("open page file for writing failed. path: {}", m_file.fileName().toStdString());
+        return false;
+    }
+    // the header is rewritten in close() once the directory offset is known
+    return m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(Header)) == sizeof(Header);
+}
+
+bool ModelPageWriter::addPage(const char *data, quint32 vertexCount, const std::vector<ModelPageFile::ClusterEntry> &clusters)
+{
+    if (!vertexCount)
+        return true;
+
+    ModelPageFile::PageEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.m_offset = m_file.pos();
+    entry.m_vertexCount = vertexCount;
+    entry.m_firstCluster = (quint32)m_clusters.size();
+    entry.m_clusterCount = (quint32)clusters.size();
+    for (int i = 0; i < 3; ++i)
+    {
+        entry.m_min[i] = FLT_MAX;
+        entry.m_max[i] = -FLT_MAX;
+    }
+
+    const float *p = reinterpret_cast<const float *>(data);
+    for (quint32 v = 0; v < vertexCount; ++v, p += PAGE_VERTEX_BYTE_COUNT / sizeof(float))
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            entry.m_min[i] = qMin(entry.m_min[i], p[i]);
+            entry.m_max[i] = qMax(entry.m_max[i], p[i]);
+        }
+    }
+
+    const QByteArray packed = BlockCodec::encode(data, (qint64)vertexCount * PAGE_VERTEX_BYTE_COUNT, PAGE_VERTEX_BYTE_COUNT,
+                                                 (BlockCodec::Codec)m_header.m_codec);
+    entry.m_packedBytes = (quint32)packed.size();
+    m_packedBytes += packed.size();
+    if (m_file.write(packed) != packed.size())
+    {
+        spdlog::error("write page failed. path: {}", m_file.fileName().toStdString());
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        m_header.m_min[i] = qMin(m_header.m_min[i], entry.m_min[i]);
+        m_header.m_max[i] = qMax(m_header.m_max[i], entry.m_max[i]);
+    }
+    m_header.m_vertexCount += vertexCount;
+    m_pages.emplace_back(entry);
+    m_clusters.insert(m_clusters.end(), clusters.begin(), clusters.end());
+    return true;
+}
+
+bool ModelPageWriter::close()
+{
+    m_header.m_pageCount = (quint32)m_pages.size();
+    m_header.m_clusterCount = (quint32)m_clusters.size();
+    m_header.m_directoryOffset = m_file.pos();
+    const qint64 directorySize = (qint64)m_pages.size() * sizeof(ModelPageFile::PageEntry);
+    m_header.m_clusterTableOffset = m_header.m_directoryOffset + directorySize;
+    const qint64 clusterTableSize = (qint64)m_clusters.size() * sizeof(ModelPageFile::ClusterEntry);
+    if (m_file.write(reinterpret_cast<const char *>(m_pages.data()), directorySize) != directorySize ||
+        m_file.write(reinterpret_cast<const char *>(m_clusters.data()), clusterTableSize) != clusterTableSize ||
+        !m_file.seek(0) ||
+        m_file.write(reinterpret_cast<const char *>(&m_header), sizeof(m_header)) != sizeof(m_header))
+    {
+        spdlog::error("write page directory failed. path: {}", m_file.fileName().toStdString());
+        return false;
+    }
+    m_file.close();
+
+    QFile::remove(m_pagePath);
+    if (!QFile::rename(m_file.fileName(), m_pagePath))
+    {
+        spdlog::error("rename page file failed. path: {}", m_pagePath.toStdString());
+        m_file.remove();
+        return false;
+    }
+    const qint64 byteCount = (qint64)m_header.m_vertexCount * PAGE_VERTEX_BYTE_COUNT;
+    spdlog::info("write page file. path: {0}, pages: {1}, codec: {2}, compression ratio: {3:.2f}", m_pagePath.toStdString(), m_pages.size(),
+                 BlockCodec::codecName((BlockCodec::Codec)m_header.m_codec), byteCount / (double)qMax<qint64>(m_packedBytes, 1));
+    return true;
+}
+
+ModelPageResidency::ModelPageResidency(qint64 budgetBytes, qint64 maxLoadBytesPerFrame)
+    : m_budgetBytes(budgetBytes), m_maxLoadBytesPerFrame(maxLoadBytesPerFrame)
+{
+}
+
+void ModelPageResidency::update(const std::vector<int> &visiblePages, const ModelPageFile &pageFile,
+                                std::vector<int> &loadPages, std::vector<int> &releasePages)
+{
+    ++m_frame;
+    m_pending = false;
+    for (int page : visiblePages)
+    {
+        auto it = m_residentPages.find(page);
+        if (it != m_residentPages.end())
+            it->second.m_lastUsedFrame = m_frame;
+    }
+
+    qint64 loadBytes = 0;
+    for (int page : visiblePages)
+    {
+        if (isResident(page))
+            continue;
+
+        const qint64 bytes = pageFile.pageByteCount(page);
+        if (!loadPages.empty() && loadBytes + bytes > m_maxLoadBytesPerFrame)
+        {
+            // spread big uploads over several frames
+            m_pending = true;
+            break;
+        }
+
+        while (m_residentBytes + bytes > m_budgetBytes)
+        {
+            auto victim = m_residentPages.end();
+            for (auto it = m_residentPages.begin(); it != m_residentPages.end(); ++it)
+            {
+                if (it->second.m_lastUsedFrame < m_frame &&
+                    (victim == m_residentPages.end() || it->second.m_lastUsedFrame < victim->second.m_lastUsedFrame))
+                    victim = it;
+            }
+            if (victim == m_residentPages.end())
+                break;
+            m_residentBytes -= victim->second.m_bytes;
+            releasePages.emplace_back(victim->first);
+            m_residentPages.erase(victim);
+        }
+
+        // every resident page is visible, the budget is exhausted for this view
+        if (m_residentBytes + bytes > m_budgetBytes)
+            break;
+
+        ResidentPage residentPage;
+        residentPage.m_bytes = bytes;
+        residentPage.m_lastUsedFrame = m_frame;
+        m_residentPages[page] = residentPage;
+        m_residentBytes += bytes;
+        loadBytes += bytes;
+        loadPages.emplace_back(page);
+    }
+}
+
+void ModelPageResidency::clear()
+{
+    m_residentPages.clear();
+    m_residentBytes = 0;
+    m_pending = false;
+}
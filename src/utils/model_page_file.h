@@ -0,0 +1,129 @@
+﻿#ifndef __MODEL_PAGE_FILE_H__
+#define __MODEL_PAGE_FILE_H__
+
+#include "block_codec.h"
+#include <QFile>
+#include <QString>
+#include <QByteArray>
+#include <vector>
+#include <unordered_map>
+
+// a page is a non-indexed triangle list: x, y, z, u, v, nx, ny, nz (same layout as OBJ_BYTE_COUNT)
+#define PAGE_VERTEX_BYTE_COUNT ((3 + 2 + 3) * sizeof(float))
+#define MODEL_PAGE_MAGIC "3DVPAGE"
+#define MODEL_PAGE_VERSION 3
+
+/////////////////////////////////////////////////////////////////
+// spatially partitioned page file, written by ModelStreamImporter and ClusterOctree and paged in by the renderers
+// every page is an octree leaf whose vertices are ordered by fixed-size triangle clusters, stored as BlockCodec blocks
+class ModelPageFile
+{
+public:
+    struct Header
+    {
+        char m_magic[8];
+        quint32 m_version;
+        quint32 m_pageCount;
+        float m_min[3];
+        float m_max[3];
+        quint64 m_vertexCount;
+        quint64 m_directoryOffset;
+        quint64 m_clusterTableOffset;
+        quint32 m_clusterCount;
+        quint32 m_codec; // BlockCodec::Codec the pages were written with
+    };
+
+    struct PageEntry
+    {
+        float m_min[3];
+        float m_max[3];
+        quint64 m_offset;
+        quint32 m_vertexCount;
+        quint32 m_firstCluster;
+        quint32 m_clusterCount;
+        quint32 m_packedBytes; // size of the page in the file
+    };
+
+    struct ClusterEntry
+    {
+        float m_min[3];
+        float m_max[3];
+        float m_coneAxis[3];
+        float m_coneCutoff;     // sine of the normal cone half angle, > 1 if the cone is too wide to cull
+        quint32 m_firstVertex;  // relative to the page
+        quint32 m_vertexCount;
+    };
+
+public:
+    bool open(const QString &pagePath);
+    bool loadPage(int index, QByteArray &data);
+    // decodes the page into dst, which holds pageByteCount(index) bytes, usually a mapped vertex buffer
+    bool loadPage(int index, char *dst);
+    // decodes bytes [offset, offset + bytes) of the page into dst, safe on several threads at once
+    // reads through its own file handle and decodes on the calling thread, e.g. in the fill function of an upload
+    bool loadPage(int index, qint64 offset, qint64 bytes, char *dst) const;
+    int pageCount() const { return (int)m_pages.size(); }
+    const PageEntry &page(int index) const { return m_pages[index]; }
+    const Header &header() const { return m_header; }
+    const ClusterEntry &cluster(int index) const { return m_clusters[index]; }
+    qint64 pageByteCount(int index) const { return (qint64)m_pages[index].m_vertexCount * PAGE_VERTEX_BYTE_COUNT; }
+    float maxPosition() const;
+
+private:
+    QFile m_file;
+    QByteArray m_packed; // the page being decoded
+    Header m_header;
+    std::vector<PageEntry> m_pages;
+    std::vector<ClusterEntry> m_clusters;
+};
+
+/////////////////////////////////////////////////////////////////
+// writes pages to a temporary file and renames it once the directory is complete
+class ModelPageWriter
+{
+public:
+    ~ModelPageWriter();
+    bool open(const QString &pagePath, BlockCodec::Codec codec = BlockCodec::Fast);
+    bool addPage(const char *data, quint32 vertexCount, const std::vector<ModelPageFile::ClusterEntry> &clusters);
+    bool close();
+
+private:
+    QString m_pagePath;
+    QFile m_file;
+    qint64 m_packedBytes = 0;
+    ModelPageFile::Header m_header;
+    std::vector<ModelPageFile::PageEntry> m_pages;
+    std::vector<ModelPageFile::ClusterEntry> m_clusters;
+};
+
+/////////////////////////////////////////////////////////////////
+// decides which pages are resident under a byte budget, least recently visible pages are released first
+class ModelPageResidency
+{
+public:
+    explicit ModelPageResidency(qint64 budgetBytes, qint64 maxLoadBytesPerFrame = 64 * 1024 * 1024);
+    void setBudget(qint64 budgetBytes) { m_budgetBytes = budgetBytes; }
+    // visiblePages must be sorted by priority, the caller uploads loadPages and releases releasePages
+    void update(const std::vector<int> &visiblePages, const ModelPageFile &pageFile,
+                std::vector<int> &loadPages, std::vector<int> &releasePages);
+    void clear();
+    bool isResident(int page) const { return m_residentPages.count(page) > 0; }
+    bool hasPending() const { return m_pending; }
+    qint64 residentBytes() const { return m_residentBytes; }
+
+private:
+    struct ResidentPage
+    {
+        qint64 m_bytes = 0;
+        quint64 m_lastUsedFrame = 0;
+    };
+
+    std::unordered_map<int, ResidentPage> m_residentPages;
+    qint64 m_budgetBytes;
+    qint64 m_maxLoadBytesPerFrame;
+    qint64 m_residentBytes = 0;
+    quint64 m_frame = 0;
+    bool m_pending = false;
+};
+
+#endif
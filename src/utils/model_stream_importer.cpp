@@ -0,0 +1,399 @@
+﻿#include "model_stream_importer.h"
+#include "model_page_file.h"
+#include "model_disk_cache.h"
+#include "cluster_octree.h"
+#include <spdlog/spdlog.h>
+#include <QFile>
+#include <QVector3D>
+#include <QElapsedTimer>
+#include <array>
+#include <cfloat>
+#include <cstdlib>
+
+#define POSITION_FILE_NAME "positions.bin"
+#define TEXCOORD_FILE_NAME "texcoords.bin"
+#define NORMAL_FILE_NAME "normals.bin"
+#define OBJ_LINE_SIZE (64 * 1024) // first size of the line buffer, longer lines grow it
+
+namespace
+{
+    static const char *skipSpace(const char *p)
+    {
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        return p;
+    }
+
+    // reads a whole line into line, which grows until the line fits, false at the end of the file or on a read error
+    static bool readObjLine(QFile &file, std::vector<char> &line)
+    {
+        qint64 length = 0;
+        while (true)
+        {
+            const qint64 read = file.readLine(line.data() + length, (qint64)line.size() - length);
+            if (read < 0)
+                return false;
+            if (read == 0)
+                return length > 0;
+            length += read;
+            if (line[length - 1] == '\n' || file.atEnd())
+                return true;
+            line.resize(line.size() * 2);
+        }
+    }
+
+    static int parseFloats(const char *p, float *values, int maxCount)
+    {
+        int count = 0;
+        while (count < maxCount)
+        {
+            char *end = nullptr;
+            float value = std::strtof(p, &end);
+            if (end == p)
+                break;
+            values[count++] = value;
+            p = end;
+        }
+        return count;
+    }
+
+    // OBJ indices are 1-based, negative indices are relative to the attributes read so far
+    static qint64 resolveIndex(long index, qint64 count)
+    {
+        if (index > 0)
+            return index - 1;
+        if (index < 0)
+            return count + index;
+        return -1;
+    }
+
+    struct MappedAttribute
+    {
+        QFile m_file;
+        const float *m_data = nullptr;
+        qint64 m_count = 0;
+        int m_components = 0;
+
+        bool map(const QString &path, int components)
+        {
+            m_components = components;
+            m_file.setFileName(path);
+            if (!m_file.open(QIODevice::ReadOnly))
+                return false;
+            m_count = m_file.size() / (components * sizeof(float));
+            if (!m_count)
+                return true;
+            // the attribute files can be larger than memory, the OS pages them in on demand
+            m_data = reinterpret_cast<const float *>(m_file.map(0, m_file.size()));
+            return m_data != nullptr;
+        }
+
+        const float *at(qint64 index) const
+        {
+            if (!m_data || index < 0 || index >= m_count)
+                return nullptr;
+            return m_data + index * m_components;
+        }
+    };
+}
+
+bool ModelStreamImporter::importObj(const QString &objPath, const QString &pagePath, const Options &options)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const bool imported = begin(options) && scanObjAttributes(objPath) && binObjFaces(objPath) && writePages(pagePath);
+    m_temporaryDir.reset();
+    if (!imported)
+        return false;
+
+    spdlog::info("stream import finished. file: {0}, faces: {1}, cost: {2} ms", objPath.toStdString(), m_faceCount, timer.elapsed());
+    return true;
+}
+
+bool ModelStreamImporter::beginTriangles(const float *min, const float *max, const Options &options)
+{
+    if (!begin(options))
+        return false;
+    for (int i = 0; i < 3; ++i)
+    {
+        m_min[i] = min[i];
+        m_max[i] = max[i];
+    }
+    return true;
+}
+
+bool ModelStreamImporter::addTriangle(const float *vertices)
+{
+    const int stride = PAGE_VERTEX_BYTE_COUNT / sizeof(float);
+    std::vector<float> &cell = m_cellBuffers[cellIndex(vertices, vertices + stride, vertices + 2 * stride)];
+    cell.insert(cell.end(), vertices, vertices + 3 * stride);
+    ++m_faceCount;
+    m_bufferedBytes += 3 * PAGE_VERTEX_BYTE_COUNT;
+    return m_bufferedBytes < m_options.m_chunkBytes || flushCells();
+}
+
+bool ModelStreamImporter::endTriangles(const QString &pagePath)
+{
+    const bool written = flushCells() && writePages(pagePath);
+    m_temporaryDir.reset();
+    m_cellBuffers.clear();
+    return written;
+}
+
+bool ModelStreamImporter::begin(const Options &options)
+{
+    m_temporaryDir.reset(new QTemporaryDir(ModelDiskCache::cacheDir() + "/stream_XXXXXX"));
+    if (!m_temporaryDir->isValid())
+    {
+        spdlog::error("create temporary dir failed. path: {}", m_temporaryDir->path().toStdString());
+        m_temporaryDir.reset();
+        return false;
+    }
+
+    m_options = options;
+    m_options.m_gridResolution = qMax(1, m_options.m_gridResolution);
+    m_options.m_maxPageVertices = qMax(3u, m_options.m_maxPageVertices / 3 * 3);
+    m_tempDir = m_temporaryDir->path();
+    m_faceCount = 0;
+    m_bufferedBytes = 0;
+    m_cellBuffers.clear();
+    m_cellBuffers.resize(m_options.m_gridResolution * m_options.m_gridResolution * m_options.m_gridResolution);
+    return true;
+}
+
+bool ModelStreamImporter::scanObjAttributes(const QString &objPath)
+{
+    QFile objFile(objPath);
+    QFile positionFile(m_tempDir + "/" POSITION_FILE_NAME);
+    QFile texCoordFile(m_tempDir + "/" TEXCOORD_FILE_NAME);
+    QFile normalFile(m_tempDir + "/" NORMAL_FILE_NAME);
+    if (!objFile.open(QIODevice::ReadOnly) || !positionFile.open(QIODevice::WriteOnly) ||
+        !texCoordFile.open(QIODevice::WriteOnly) || !normalFile.open(QIODevice::WriteOnly))
+    {
+        spdlog::error("open files for stream import failed. path: {}", objPath.toStdString());
+        return false;
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        m_min[i] = FLT_MAX;
+        m_max[i] = -FLT_MAX;
+    }
+
+    std::vector<char> line(OBJ_LINE_SIZE);
+    while (!objFile.atEnd())
+    {
+        if (!readObjLine(objFile, line))
+            break;
+
+        const char *p = skipSpace(line.data());
+        float values[3] = {0.0f, 0.0f, 0.0f};
+        if (p[0] != 'v')
+            continue;
+        if (p[1] == ' ' || p[1] == '\t')
+        {
+            parseFloats(p + 2, values, 3);
+            positionFile.write(reinterpret_cast<const char *>(values), 3 * sizeof(float));
+            for (int i = 0; i < 3; ++i)
+            {
+                m_min[i] = qMin(m_min[i], values[i]);
+                m_max[i] = qMax(m_max[i], values[i]);
+            }
+        }
+        else if (p[1] == 't')
+        {
+            parseFloats(p + 2, values, 2);
+            texCoordFile.write(reinterpret_cast<const char *>(values), 2 * sizeof(float));
+        }
+        else if (p[1] == 'n')
+        {
+            parseFloats(p + 2, values, 3);
+            normalFile.write(reinterpret_cast<const char *>(values), 3 * sizeof(float));
+        }
+    }
+
+    if (positionFile.size() == 0)
+    {
+        spdlog::error("obj file has no vertex. path: {}", objPath.toStdString());
+        return false;
+    }
+    return true;
+}
+
+bool ModelStreamImporter::binObjFaces(const QString &objPath)
+{
+    MappedAttribute positions, texCoords, normals;
+    if (!positions.map(m_tempDir + "/" POSITION_FILE_NAME, 3) || !texCoords.map(m_tempDir + "/" TEXCOORD_FILE_NAME, 2) ||
+        !normals.map(m_tempDir + "/" NORMAL_FILE_NAME, 3))
+    {
+        spdlog::error("map attribute files failed. path: {}", m_tempDir.toStdString());
+        return false;
+    }
+
+    QFile objFile(objPath);
+    if (!objFile.open(QIODevice::ReadOnly))
+    {
+        spdlog::error("open model path failed. path: {}", objPath.toStdString());
+        return false;
+    }
+
+    // attribute counters of the second pass, needed to resolve relative indices
+    qint64 positionCount = 0, texCoordCount = 0, normalCount = 0;
+    std::vector<char> line(OBJ_LINE_SIZE);
+    std::vector<std::array<qint64, 3>> polygon;
+    while (!objFile.atEnd())
+    {
+        if (!readObjLine(objFile, line))
+            break;
+
+        const char *p = skipSpace(line.data());
+        if (p[0] == 'v')
+        {
+            if (p[1] == ' ' || p[1] == '\t')
+                ++positionCount;
+            else if (p[1] == 't')
+                ++texCoordCount;
+            else if (p[1] == 'n')
+                ++normalCount;
+            continue;
+        }
+        if (p[0] != 'f' || (p[1] != ' ' && p[1] != '\t'))
+            continue;
+
+        polygon.clear();
+        p = skipSpace(p + 1);
+        while (*p && *p != '\r' && *p != '\n')
+        {
+            std::array<qint64, 3> corner = {-1, -1, -1};
+            char *end = nullptr;
+            corner[0] = resolveIndex(std::strtol(p, &end, 10), positionCount);
+            if (end == p)
+                break;
+            p = end;
+            for (int i = 1; i < 3 && *p == '/'; ++i)
+            {
+                ++p;
+                if (*p != '/')
+                {
+                    corner[i] = resolveIndex(std::strtol(p, &end, 10), i == 1 ? texCoordCount : normalCount);
+                    p = end;
+                }
+            }
+            polygon.emplace_back(corner);
+            p = skipSpace(p);
+        }
+
+        for (size_t i = 2; i < polygon.size(); ++i)
+        {
+            const std::array<qint64, 3> *corners[3] = {&polygon[0], &polygon[i - 1], &polygon[i]};
+            const float *pos[3];
+            bool valid = true;
+            for (int c = 0; c < 3; ++c)
+            {
+                pos[c] = positions.at((*corners[c])[0]);
+                valid = valid && pos[c];
+            }
+            if (!valid)
+                continue;
+
+            QVector3D faceNormal = QVector3D::normal(QVector3D(pos[0][0], pos[0][1], pos[0][2]),
+                                                     QVector3D(pos[1][0], pos[1][1], pos[1][2]),
+                                                     QVector3D(pos[2][0], pos[2][1], pos[2][2]));
+            std::vector<float> &cell = m_cellBuffers[cellIndex(pos[0], pos[1], pos[2])];
+            for (int c = 0; c < 3; ++c)
+            {
+                const float *uv = texCoords.at((*corners[c])[1]);
+                const float *normal = normals.at((*corners[c])[2]);
+                cell.insert(cell.end(), pos[c], pos[c] + 3);
+                cell.push_back(uv ? uv[0] : 0.0f);
+                cell.push_back(uv ? uv[1] : 0.0f);
+                if (normal)
+                    cell.insert(cell.end(), normal, normal + 3);
+                else
+                    cell.insert(cell.end(), {faceNormal.x(), faceNormal.y(), faceNormal.z()});
+            }
+            ++m_faceCount;
+            m_bufferedBytes += 3 * PAGE_VERTEX_BYTE_COUNT;
+        }
+
+        if (m_bufferedBytes >= m_options.m_chunkBytes && !flushCells())
+            return false;
+    }
+
+    return flushCells();
+}
+
+bool ModelStreamImporter::flushCells()
+{
+    for (int i = 0; i < m_cellBuffers.size(); ++i)
+    {
+        std::vector<float> &cell = m_cellBuffers[i];
+        if (cell.empty())
+            continue;
+
+        QFile cellFile(QString("%1/cell_%2.bin").arg(m_tempDir).arg(i));
+        const qint64 byteCount = cell.size() * sizeof(float);
+        if (!cellFile.open(QIODevice::WriteOnly | QIODevice::Append) ||
+            cellFile.write(reinterpret_cast<const char *>(cell.data()), byteCount) != byteCount)
+        {
+            spdlog::error("spill cell failed. path: {}", cellFile.fileName().toStdString());
+            return false;
+        }
+        // release the memory instead of keeping the capacity around
+        std::vector<float>().swap(cell);
+    }
+    m_bufferedBytes = 0;
+    return true;
+}
+
+bool ModelStreamImporter::writePages(const QString &pagePath)
+{
+    ModelPageWriter writer;
+    if (!writer.open(pagePath, m_options.m_pageCodec))
+        return false;
+
+    ClusterOctree::Options clusterOptions;
+    clusterOptions.m_clusterTriangles = m_options.m_clusterTriangles;
+    clusterOptions.m_leafTriangles = m_options.m_leafTriangles;
+    QByteArray pageData;
+    const qint64 pageByteCount = (qint64)m_options.m_maxPageVertices * PAGE_VERTEX_BYTE_COUNT;
+    for (int i = 0; i < m_cellBuffers.size(); ++i)
+    {
+        QFile cellFile(QString("%1/cell_%2.bin").arg(m_tempDir).arg(i));
+        if (!cellFile.exists())
+            continue;
+        if (!cellFile.open(QIODevice::ReadOnly))
+        {
+            spdlog::error("open cell file failed. path: {}", cellFile.fileName().toStdString());
+            return false;
+        }
+
+        // a dense cell is read back in bounded blocks, every block is split into its own octree
+        while (!cellFile.atEnd())
+        {
+            pageData = cellFile.read(pageByteCount);
+            if (!ClusterOctree::writePages(reinterpret_cast<const float *>(pageData.constData()), pageData.size() / PAGE_VERTEX_BYTE_COUNT,
+                                           writer, clusterOptions))
+                return false;
+        }
+        cellFile.close();
+        cellFile.remove();
+    }
+
+    return writer.close();
+}
+
+int ModelStreamImporter::cellIndex(const float *a, const float *b, const float *c) const
+{
+    const int resolution = m_options.m_gridResolution;
+    int cell[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        float extent = m_max[i] - m_min[i];
+        float centroid = (a[i] + b[i] + c[i]) / 3.0f;
+        int index = extent > 0.0f ? (int)((centroid - m_min[i]) / extent * resolution) : 0;
+        cell[i] = qBound(0, index, resolution - 1);
+    }
+    return (cell[2] * resolution + cell[1]) * resolution + cell[0];
+}
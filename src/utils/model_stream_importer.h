@@ -0,0 +1,52 @@
+﻿#ifndef __MODEL_STREAM_IMPORTER_H__
+#define __MODEL_STREAM_IMPORTER_H__
+
+#include "block_codec.h"
+#include <QString>
+#include <QVector>
+#include <QTemporaryDir>
+#include <memory>
+
+// out-of-core importer for models that do not fit in memory
+// the source is read in bounded chunks, triangles are binned into a spatial grid and every cell is split into clustered octree pages
+class ModelStreamImporter
+{
+public:
+    struct Options
+    {
+        qint64 m_chunkBytes = 64 * 1024 * 1024;     // triangles buffered in memory before they are spilled to disk
+        int m_gridResolution = 8;                   // grid cells per axis
+        quint32 m_maxPageVertices = 3 * 256 * 1024; // vertices of a cell read back at once, must be a multiple of 3
+        quint32 m_clusterTriangles = 128;
+        quint32 m_leafTriangles = 64 * 1024;
+        BlockCodec::Codec m_pageCodec = BlockCodec::Fast;
+    };
+
+public:
+    bool importObj(const QString &objPath, const QString &pagePath, const Options &options);
+    // pages of triangles produced by the caller, e.g. the meshes of a large imported model, binned like the obj faces
+    // min and max bound the positions, every triangle is three vertices in the PAGE_VERTEX_BYTE_COUNT layout
+    bool beginTriangles(const float *min, const float *max, const Options &options);
+    bool addTriangle(const float *vertices);
+    bool endTriangles(const QString &pagePath);
+
+private:
+    bool begin(const Options &options);
+    bool scanObjAttributes(const QString &objPath);
+    bool binObjFaces(const QString &objPath);
+    bool flushCells();
+    bool writePages(const QString &pagePath);
+    int cellIndex(const float *a, const float *b, const float *c) const;
+
+private:
+    Options m_options;
+    std::unique_ptr<QTemporaryDir> m_temporaryDir;
+    QString m_tempDir;
+    float m_min[3];
+    float m_max[3];
+    qint64 m_faceCount = 0;
+    qint64 m_bufferedBytes = 0;
+    QVector<std::vector<float>> m_cellBuffers;
+};
+
+#endif
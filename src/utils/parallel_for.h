@@ -0,0 +1,43 @@
+﻿#ifndef __PARALLEL_FOR_H__
+#define __PARALLEL_FOR_H__
+
+#include <QThreadPool>
+#include <QSemaphore>
+
+// calls function(i) for every i in [begin, end) on the global thread pool, the calling thread takes the first chunk
+// returns when every call finished, chunks hold at least minChunk indices so that tiny loops stay on one thread
+template <typename Function>
+void parallelFor(int begin, int end, const Function &function, int minChunk = 1)
+{
+    const int count = end - begin;
+    if (count <= 0)
+        return;
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int chunkCount = qMin(qMax(pool->maxThreadCount(), 1), (count + minChunk - 1) / qMax(minChunk, 1));
+    const int chunkSize = (count + chunkCount - 1) / qMax(chunkCount, 1);
+    chunkCount = (count + chunkSize - 1) / chunkSize;
+    if (chunkCount <= 1)
+    {
+        for (int i = begin; i < end; ++i)
+            function(i);
+        return;
+    }
+
+    QSemaphore done;
+    for (int chunk = 1; chunk < chunkCount; ++chunk)
+    {
+        const int first = begin + chunk * chunkSize;
+        const int last = qMin(end, first + chunkSize);
+        pool->start([&function, &done, first, last]()
+                    {
+                        for (int i = first; i < last; ++i)
+                            function(i);
+                        done.release(); });
+    }
+    for (int i = begin; i < begin + chunkSize; ++i)
+        function(i);
+    done.acquire(chunkCount - 1);
+}
+
+#endif
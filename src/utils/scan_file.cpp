@@ -0,0 +1,524 @@
+﻿#include "scan_file.h"
+#include "parallel_for.h"
+#include <QByteArray>
+#include <QList>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+#define SCAN_FILE_FIRST_CORNER 0x80000000u // marks the first corners while the stl corners are numbered
+#define SCAN_FILE_NO_CORNER 0xffffffffu
+
+namespace
+{
+    static int plyTypeBytes(const QByteArray &type)
+    {
+        if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+            return 1;
+        else if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+            return 2;
+        else if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32")
+            return 4;
+        else if (type == "double" || type == "float64")
+            return 8;
+        return 0;
+    }
+
+    static bool isPlyFloat(const QByteArray &type)
+    {
+        return type == "float" || type == "float32";
+    }
+
+    static bool isPlyInteger(const QByteArray &type)
+    {
+        return plyTypeBytes(type) && !isPlyFloat(type) && type != "double" && type != "float64";
+    }
+
+    // little endian, like every file this reader accepts
+    static quint32 readUint(const unsigned char *data, int bytes)
+    {
+        quint32 value = 0;
+        memcpy(&value, data, bytes);
+        return value;
+    }
+
+    // position bits with -0 folded into 0, the key the stl corners are welded by
+    static inline void positionKey(const unsigned char *data, quint32 key[3])
+    {
+        float value[3];
+        memcpy(value, data, sizeof(value));
+        for (int axis = 0; axis < 3; ++axis)
+            value[axis] += 0.0f;
+        memcpy(key, value, sizeof(value));
+    }
+
+    // unit normal of the triangle whose corners start at data, false if it is degenerate
+    static inline bool triangleNormal(const unsigned char *data, float normal[3])
+    {
+        float p[3][3];
+        memcpy(p, data, sizeof(p));
+        const float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+        const float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        const float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (!(length > 0.0f))
+            return false;
+        for (int axis = 0; axis < 3; ++axis)
+            normal[axis] /= length;
+        return true;
+    }
+
+    static inline quint32 positionHash(const quint32 key[3])
+    {
+        quint64 seed = key[0];
+        seed = seed * 0x9e3779b97f4a7c15ull ^ key[1];
+        seed = seed * 0x9e3779b97f4a7c15ull ^ key[2];
+        return (quint32)((seed * 0x9e3779b97f4a7c15ull) >> 32);
+    }
+
+    // the high bits of the hash pick the partition, the low bits the slot in its table
+    static inline int partitionOf(quint32 hash)
+    {
+        return (int)(((quint64)hash * SCAN_FILE_PARTITIONS) >> 32);
+    }
+
+    // calls function(chunk, first, last) for the chunks of [0, count) in parallel
+    template <typename Function>
+    static void forChunks(qint64 count, const Function &function)
+    {
+        const int chunkCount = (int)((count + SCAN_FILE_CHUNK - 1) / SCAN_FILE_CHUNK);
+        parallelFor(0, chunkCount, [&](int chunk)
+                    {
+                        const qint64 first = (qint64)chunk * SCAN_FILE_CHUNK;
+                        function(chunk, first, qMin(count, first + SCAN_FILE_CHUNK)); });
+    }
+}
+
+bool ScanFile::open(const QString &path)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail("open file failed");
+    const qint64 fileSize = m_file.size();
+    if (fileSize < 84)
+        return fail("file is too small");
+    m_data = m_file.map(0, fileSize);
+    if (!m_data)
+        return fail("map file failed");
+    m_end = m_data + fileSize;
+
+    // the content decides, not the suffix
+    if (!memcmp(m_data, "ply", 3) && (m_data[3] == '\n' || m_data[3] == '\r'))
+        return parsePly(fileSize);
+    return parseStl(fileSize);
+}
+
+bool ScanFile::fail(const QString &error)
+{
+    m_error = error;
+    return false;
+}
+
+bool ScanFile::parseStl(qint64 fileSize)
+{
+    // 80 byte header and the triangle count, then 50 bytes per triangle: the facet normal, three corners and an attribute word
+    // ascii files may start like a binary header too, their size does not match the count
+    m_stl = true;
+    m_triangleCount = readUint(m_data + 80, 4);
+    if (84 + m_triangleCount * 50 != fileSize)
+        return fail("not a binary stl file, ascii or truncated");
+    if (m_triangleCount * 3 >= SCAN_FILE_FIRST_CORNER)
+        return fail("too many triangles");
+    return true;
+}
+
+bool ScanFile::parsePly(qint64 fileSize)
+{
+    const QByteArray start = QByteArray::fromRawData(reinterpret_cast<const char *>(m_data), (int)qMin<qint64>(fileSize, SCAN_FILE_MAX_HEADER));
+    const int headerEnd = start.indexOf("end_header");
+    const int dataStart = headerEnd < 0 ? -1 : start.indexOf('\n', headerEnd);
+    if (dataStart < 0)
+        return fail("ply header has no end");
+
+    // the elements before the faces need a fixed size, the ones after them are not read
+    struct Element
+    {
+        QByteArray m_name;
+        qint64 m_count = 0;
+        int m_bytes = 0; // of the scalar properties
+        bool m_list = false;
+    };
+    std::vector<Element> elements;
+    bool binary = false;
+    for (const QByteArray &line : start.left(headerEnd).split('\n'))
+    {
+        const QList<QByteArray> words = line.simplified().split(' ');
+        if (words[0] == "format")
+        {
+            if (words.size() < 2 || words[1] != "binary_little_endian")
+                return fail("ply file is not binary little endian");
+            binary = true;
+        }
+        else if (words[0] == "element" && words.size() == 3)
+        {
+            elements.emplace_back();
+            elements.back().m_name = words[1];
+            elements.back().m_count = words[2].toLongLong();
+        }
+        else if (words[0] == "property" && !elements.empty())
+        {
+            Element &element = elements.back();
+            if (words.size() == 5 && words[1] == "list")
+            {
+                // the index list of the faces is the only list
+                if (element.m_name != "face" || element.m_list || (words[4] != "vertex_indices" && words[4] != "vertex_index"))
+                    return fail("unsupported list " + QString::fromLatin1(words[4]));
+                if (!isPlyInteger(words[2]) || !isPlyInteger(words[3]) || plyTypeBytes(words[3]) != 4)
+                    return fail("face indices are not 32 bit integers");
+                m_listCountBytes = plyTypeBytes(words[2]);
+                m_faceHead = element.m_bytes;
+                element.m_list = true;
+            }
+            else if (words.size() == 3 && plyTypeBytes(words[1]))
+            {
+                if (element.m_name == "vertex")
+                {
+                    static const char *const positions[] = {"x", "y", "z"};
+                    static const char *const normals[] = {"nx", "ny", "nz"};
+                    for (int axis = 0; axis < 3; ++axis)
+                    {
+                        if (words[2] == positions[axis])
+                        {
+                            if (!isPlyFloat(words[1]))
+                                return fail("positions are not float");
+                            m_positionOffsets[axis] = element.m_bytes;
+                        }
+                        else if (words[2] == normals[axis] && isPlyFloat(words[1]))
+                            m_normalOffsets[axis] = element.m_bytes;
+                    }
+                }
+                element.m_bytes += plyTypeBytes(words[1]);
+            }
+            else
+                return fail("unsupported property " + QString::fromLatin1(line.simplified()));
+        }
+    }
+    if (!binary)
+        return fail("ply header has no format");
+
+    const unsigned char *data = m_data + dataStart + 1;
+    for (const Element &element : elements)
+    {
+        if (element.m_name == "face")
+        {
+            if (!element.m_list)
+                return fail("faces have no index list");
+            m_faces = data;
+            m_faceCount = element.m_count;
+            m_faceTail = element.m_bytes - m_faceHead;
+            break;
+        }
+        if (element.m_list)
+            return fail("faces before the vertices");
+        if (element.m_count < 0 || element.m_count * element.m_bytes > m_end - data)
+            return fail("ply file is truncated");
+        if (element.m_name == "vertex")
+        {
+            m_vertices = data;
+            m_vertexCount = element.m_count;
+            m_vertexStride = element.m_bytes;
+        }
+        data += element.m_count * element.m_bytes;
+    }
+    if (!m_vertices || !m_faces || m_faceCount < 0)
+        return fail("no vertices or faces");
+    if (m_positionOffsets[0] < 0 || m_positionOffsets[1] < 0 || m_positionOffsets[2] < 0)
+        return fail("vertices have no position");
+    if (m_vertexCount > INT_MAX)
+        return fail("too many vertices");
+    if (m_normalOffsets[0] < 0 || m_normalOffsets[1] < 0 || m_normalOffsets[2] < 0)
+        m_normalOffsets[0] = m_normalOffsets[1] = m_normalOffsets[2] = -1;
+    return true;
+}
+
+bool ScanFile::readIndices(std::vector<unsigned int> &indices)
+{
+    return m_stl ? readStlIndices(indices) : readPlyIndices(indices);
+}
+
+bool ScanFile::readPlyIndices(std::vector<unsigned int> &indices)
+{
+    // scanners write triangles, whose records have a fixed size and are read in parallel
+    const int triangleBytes = m_faceHead + m_listCountBytes + 3 * sizeof(unsigned int) + m_faceTail;
+    if (m_faceCount * triangleBytes <= m_end - m_faces)
+    {
+        indices.resize(m_faceCount * 3);
+        std::atomic<bool> polygons(false), invalid(false);
+        forChunks(m_faceCount, [&](int, qint64 first, qint64 last)
+                  {
+                      for (qint64 face = first; face < last; ++face)
+                      {
+                          const unsigned char *record = m_faces + face * triangleBytes + m_faceHead;
+                          if (readUint(record, m_listCountBytes) != 3)
+                          {
+                              polygons = true;
+                              return;
+                          }
+                          unsigned int *triangle = &indices[face * 3];
+                          memcpy(triangle, record + m_listCountBytes, 3 * sizeof(unsigned int));
+                          if (triangle[0] >= m_vertexCount || triangle[1] >= m_vertexCount || triangle[2] >= m_vertexCount)
+                              invalid = true;
+                      } });
+        // the records after a polygon are misread, only a file of triangles is decided here
+        if (!polygons)
+            return invalid ? fail("face index out of range") : true;
+    }
+
+    // polygons are fanned around their first corner, the records are walked one after the other
+    indices.clear();
+    const unsigned char *record = m_faces;
+    for (qint64 face = 0; face < m_faceCount; ++face)
+    {
+        if (m_end - record < m_faceHead + m_listCountBytes)
+            return fail("ply file is truncated");
+        const qint64 count = readUint(record + m_faceHead, m_listCountBytes);
+        const unsigned char *list = record + m_faceHead + m_listCountBytes;
+        if (m_end - list < count * 4 + m_faceTail)
+            return fail("ply file is truncated");
+        for (qint64 corner = 2; corner < count; ++corner)
+        {
+            for (const qint64 i : {(qint64)0, corner - 1, corner})
+            {
+                const quint32 index = readUint(list + i * 4, 4);
+                if (index >= m_vertexCount)
+                    return fail("face index out of range");
+                indices.emplace_back(index);
+            }
+        }
+        record = list + count * 4 + m_faceTail;
+    }
+    return true;
+}
+
+bool ScanFile::readStlIndices(std::vector<unsigned int> &indices)
+{
+    const qint64 cornerCount = m_triangleCount * 3;
+    const int chunkCount = (int)((cornerCount + SCAN_FILE_CHUNK - 1) / SCAN_FILE_CHUNK);
+
+    // corners of every chunk in every partition, turned into the offsets that list the corners of a partition in file order
+    std::vector<quint32> chunkOffsets((size_t)chunkCount * SCAN_FILE_PARTITIONS);
+    forChunks(cornerCount, [&](int chunk, qint64 first, qint64 last)
+              {
+                  quint32 *counts = &chunkOffsets[(size_t)chunk * SCAN_FILE_PARTITIONS];
+                  quint32 key[3];
+                  for (qint64 corner = first; corner < last; ++corner)
+                  {
+                      positionKey(stlCorner(corner), key);
+                      ++counts[partitionOf(positionHash(key))];
+                  } });
+    m_partitionOffsets.assign(SCAN_FILE_PARTITIONS + 1, 0);
+    quint32 offset = 0;
+    for (int partition = 0; partition < SCAN_FILE_PARTITIONS; ++partition)
+    {
+        m_partitionOffsets[partition] = offset;
+        for (int chunk = 0; chunk < chunkCount; ++chunk)
+        {
+            quint32 &count = chunkOffsets[(size_t)chunk * SCAN_FILE_PARTITIONS + partition];
+            const quint32 next = offset + count;
+            count = offset;
+            offset = next;
+        }
+    }
+    m_partitionOffsets[SCAN_FILE_PARTITIONS] = offset;
+
+    // the corners are copied next to the others of their partition with the normal of their triangle,
+    // the partitions then read them in sequence instead of all over the file. both buffers are written before they are read
+    m_records.reset(new WeldRecord[cornerCount]);
+    std::unique_ptr<qint16[]> cornerNormals(new qint16[cornerCount * 3]);
+    forChunks(cornerCount, [&](int chunk, qint64 first, qint64 last)
+              {
+                  quint32 *next = &chunkOffsets[(size_t)chunk * SCAN_FILE_PARTITIONS];
+                  qint16 normal[3] = {0, 0, 0};
+                  for (qint64 corner = first; corner < last; ++corner)
+                  {
+                      if (corner == first || corner % 3 == 0)
+                      {
+                          float unit[3];
+                          const bool flat = !triangleNormal(stlCorner(corner / 3 * 3), unit);
+                          for (int axis = 0; axis < 3; ++axis)
+                              normal[axis] = flat ? 0 : (qint16)(unit[axis] * 32767.0f);
+                      }
+                      quint32 key[3];
+                      positionKey(stlCorner(corner), key);
+                      const quint32 i = next[partitionOf(positionHash(key))]++;
+                      WeldRecord &record = m_records[i];
+                      memcpy(record.m_key, key, sizeof(key));
+                      record.m_corner = (quint32)corner;
+                      memcpy(&cornerNormals[(size_t)i * 3], normal, sizeof(normal));
+                  } });
+
+    // every corner points to the first corner at its position, no position is in two partitions
+    // the unit normals of the triangles around a position are added up like TangentSpace::generateNormals does, in 16 bit
+    // fixed point, the facet normals of the file are often left zero. the welded vertices then take the front of the records of their partition
+    indices.resize(cornerCount);
+    m_partitionVertices.assign(SCAN_FILE_PARTITIONS, 0);
+    parallelFor(0, SCAN_FILE_PARTITIONS, [&](int partition)
+                {
+                    struct Slot
+                    {
+                        quint32 m_key[3];
+                        quint32 m_corner;
+                        float m_normal[3];
+                    };
+                    const Slot empty = {{0, 0, 0}, SCAN_FILE_NO_CORNER, {0.0f, 0.0f, 0.0f}};
+                    const quint32 first = m_partitionOffsets[partition], last = m_partitionOffsets[partition + 1];
+                    // a scan shares a position between about six corners, the table doubles when it is half full
+                    quint64 size = 16;
+                    while (size < (last - first) / 2)
+                        size *= 2;
+                    std::vector<Slot> table(size, empty);
+                    quint64 used = 0;
+                    auto find = [&table](const quint32 *key) -> Slot &
+                    {
+                        const quint64 mask = table.size() - 1;
+                        quint64 s = positionHash(key) & mask;
+                        while (table[s].m_corner != SCAN_FILE_NO_CORNER && memcmp(table[s].m_key, key, sizeof(table[s].m_key)))
+                            s = (s + 1) & mask;
+                        return table[s];
+                    };
+                    for (quint32 i = first; i < last; ++i)
+                    {
+                        if ((used + 1) * 2 > table.size())
+                        {
+                            std::vector<Slot> slots(table.size() * 2, empty);
+                            slots.swap(table);
+                            for (const Slot &slot : slots)
+                            {
+                                if (slot.m_corner != SCAN_FILE_NO_CORNER)
+                                    find(slot.m_key) = slot;
+                            }
+                        }
+
+                        const WeldRecord &record = m_records[i];
+                        const quint32 corner = record.m_corner;
+                        Slot &slot = find(record.m_key);
+                        if (slot.m_corner == SCAN_FILE_NO_CORNER)
+                        {
+                            memcpy(slot.m_key, record.m_key, sizeof(slot.m_key));
+                            slot.m_corner = corner;
+                            ++used;
+                        }
+                        indices[corner] = slot.m_corner;
+                        for (int axis = 0; axis < 3; ++axis)
+                            slot.m_normal[axis] += cornerNormals[(size_t)i * 3 + axis];
+                    }
+
+                    quint32 vertex = first;
+                    for (const Slot &slot : table)
+                    {
+                        if (slot.m_corner == SCAN_FILE_NO_CORNER)
+                            continue;
+                        const float length = std::sqrt(slot.m_normal[0] * slot.m_normal[0] + slot.m_normal[1] * slot.m_normal[1] +
+                                                       slot.m_normal[2] * slot.m_normal[2]);
+                        WeldRecord &record = m_records[vertex++];
+                        for (int axis = 0; axis < 3; ++axis)
+                        {
+                            const float value = length > 0.0f ? slot.m_normal[axis] / length : 0.0f;
+                            memcpy(&record.m_key[axis], &value, sizeof(float));
+                        }
+                        record.m_corner = slot.m_corner;
+                    }
+                    m_partitionVertices[partition] = vertex - first; });
+    cornerNormals.reset();
+
+    // the first corners are numbered in file order, then the other corners take the vertex of their first corner
+    std::vector<quint32> firstCounts(chunkCount + 1, 0);
+    forChunks(cornerCount, [&](int chunk, qint64 first, qint64 last)
+              {
+                  quint32 count = 0;
+                  for (qint64 corner = first; corner < last; ++corner)
+                      count += indices[corner] == corner;
+                  firstCounts[chunk + 1] = count; });
+    for (int chunk = 0; chunk < chunkCount; ++chunk)
+        firstCounts[chunk + 1] += firstCounts[chunk];
+    m_vertexCount = firstCounts[chunkCount];
+    m_firstCorners.resize(m_vertexCount);
+    forChunks(cornerCount, [&](int chunk, qint64 first, qint64 last)
+              {
+                  quint32 vertex = firstCounts[chunk];
+                  for (qint64 corner = first; corner < last; ++corner)
+                  {
+                      if (indices[corner] != corner)
+                          continue;
+                      m_firstCorners[vertex] = (quint32)corner;
+                      indices[corner] = vertex++ | SCAN_FILE_FIRST_CORNER;
+                  } });
+    // a pass only writes the corners no other chunk reads in it
+    forChunks(cornerCount, [&](int, qint64 first, qint64 last)
+              {
+                  for (qint64 corner = first; corner < last; ++corner)
+                  {
+                      if (!(indices[corner] & SCAN_FILE_FIRST_CORNER))
+                          indices[corner] = indices[indices[corner]] & ~SCAN_FILE_FIRST_CORNER;
+                  } });
+    forChunks(cornerCount, [&](int, qint64 first, qint64 last)
+              {
+                  for (qint64 corner = first; corner < last; ++corner)
+                      indices[corner] &= ~SCAN_FILE_FIRST_CORNER; });
+    return true;
+}
+
+void ScanFile::readPositions(float *dst, int dstStride) const
+{
+    if (!m_stl)
+    {
+        readPlyFloats(m_positionOffsets, dst, dstStride);
+        return;
+    }
+    forChunks(m_vertexCount, [&](int, qint64 first, qint64 last)
+              {
+                  for (qint64 vertex = first; vertex < last; ++vertex)
+                      memcpy(dst + vertex * dstStride, stlCorner(m_firstCorners[vertex]), 3 * sizeof(float)); });
+}
+
+bool ScanFile::readNormals(const unsigned int *indices, float *dst, int dstStride) const
+{
+    if (!m_stl)
+    {
+        if (m_normalOffsets[0] < 0)
+            return false;
+        readPlyFloats(m_normalOffsets, dst, dstStride);
+        return true;
+    }
+
+    // the welded vertices at the front of every partition hold their normal since readIndices
+    parallelFor(0, SCAN_FILE_PARTITIONS, [&](int partition)
+                {
+                    const WeldRecord *records = m_records.get() + m_partitionOffsets[partition];
+                    for (quint32 i = 0; i < m_partitionVertices[partition]; ++i)
+                        memcpy(dst + (size_t)indices[records[i].m_corner] * dstStride, records[i].m_key, 3 * sizeof(float)); });
+    return true;
+}
+
+void ScanFile::releaseWelding()
+{
+    std::vector<quint32>().swap(m_partitionOffsets);
+    std::vector<quint32>().swap(m_partitionVertices);
+    m_records.reset();
+    std::vector<quint32>().swap(m_firstCorners);
+}
+
+void ScanFile::readPlyFloats(const int *offsets, float *dst, int dstStride) const
+{
+    forChunks(m_vertexCount, [&](int, qint64 first, qint64 last)
+              {
+                  for (qint64 vertex = first; vertex < last; ++vertex)
+                  {
+                      const unsigned char *record = m_vertices + vertex * m_vertexStride;
+                      for (int axis = 0; axis < 3; ++axis)
+                          memcpy(dst + vertex * dstStride + axis, record + offsets[axis], sizeof(float));
+                  } });
+}
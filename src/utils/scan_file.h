@@ -0,0 +1,75 @@
+﻿#ifndef __SCAN_FILE_H__
+#define __SCAN_FILE_H__
+
+#include <QFile>
+#include <QString>
+#include <memory>
+#include <vector>
+
+#define SCAN_FILE_CHUNK 65536          // corners, faces or vertices of one task of the parallel passes
+#define SCAN_FILE_PARTITIONS 1024      // stl corners are welded in this many groups, split by the hash of their position
+#define SCAN_FILE_MAX_HEADER (1 << 20) // bytes searched for the end of a PLY header
+
+/////////////////////////////////////////////////////////////////
+// reader of the binary PLY and STL files 3D scanners write, the file is mapped and the vertices are read straight from it
+// PLY files need float x, y, z vertices and 32 bit face indices, float nx, ny, nz normals are read if present, polygons are fanned
+// STL files are indexed by welding the corners at bitwise equal positions, in parallel over partitions of the position hash
+// ASCII files, big endian PLY files and other layouts are refused with a reason, the caller imports them with assimp instead
+class ScanFile
+{
+public:
+    bool open(const QString &path);
+    const QString &errorString() const { return m_error; }
+    // the vertex count of an STL file is known once readIndices welded it
+    qint64 vertexCount() const { return m_vertexCount; }
+    // triangle list of the whole file, false if an index is out of range or the faces are truncated
+    bool readIndices(std::vector<unsigned int> &indices);
+    void readPositions(float *dst, int dstStride) const;
+    // the normals of a PLY file, or the smooth normals of the triangles around every welded STL vertex, dstStride in floats
+    // false if the PLY file has none, indices are the ones readIndices returned
+    bool readNormals(const unsigned int *indices, float *dst, int dstStride) const;
+    // frees the stl welding tables, readPositions and readNormals can't be called after it
+    void releaseWelding();
+
+private:
+    struct WeldRecord
+    {
+        quint32 m_key[3];
+        quint32 m_corner;
+    };
+
+    bool fail(const QString &error);
+    bool parsePly(qint64 fileSize);
+    bool parseStl(qint64 fileSize);
+    bool readPlyIndices(std::vector<unsigned int> &indices);
+    bool readStlIndices(std::vector<unsigned int> &indices);
+    void readPlyFloats(const int *offsets, float *dst, int dstStride) const;
+    const unsigned char *stlCorner(qint64 corner) const { return m_data + 84 + corner / 3 * 50 + 12 + corner % 3 * 12; }
+
+private:
+    QFile m_file;
+    QString m_error;
+    const unsigned char *m_data = nullptr;
+    const unsigned char *m_end = nullptr;
+    bool m_stl = false;
+    qint64 m_vertexCount = 0;
+    // ply layout, offsets in bytes
+    const unsigned char *m_vertices = nullptr;
+    int m_vertexStride = 0;
+    int m_positionOffsets[3] = {-1, -1, -1};
+    int m_normalOffsets[3] = {-1, -1, -1};
+    const unsigned char *m_faces = nullptr;
+    qint64 m_faceCount = 0;
+    int m_faceHead = 0; // bytes of the face properties before and after the index list
+    int m_faceTail = 0;
+    int m_listCountBytes = 0;
+    // stl welding, m_records holds the corners of every partition in file order, each partition then keeps its welded vertices
+    // at the front of its range, with the normal in place of the key
+    qint64 m_triangleCount = 0;
+    std::vector<quint32> m_partitionOffsets;
+    std::vector<quint32> m_partitionVertices;
+    std::unique_ptr<WeldRecord[]> m_records;
+    std::vector<quint32> m_firstCorners;
+};
+
+#endif
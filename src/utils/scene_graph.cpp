@@ -0,0 +1,94 @@
+﻿#include "scene_graph.h"
+#include <cstring>
+#ifdef SCENE_GRAPH_SSE2
+#include <emmintrin.h>
+#endif
+
+int SceneGraph::addNode(int parent, const float *local, const std::string &name)
+{
+    const int node = nodeCount();
+    Matrix matrix;
+    memcpy(matrix.m_data, local, sizeof(matrix.m_data));
+    m_parents.emplace_back(parent < node ? parent : -1);
+    m_locals.emplace_back(matrix);
+    m_worlds.emplace_back(matrix);
+    m_dirty.emplace_back(1);
+    m_firstDirty = qMin(m_firstDirty, node);
+    if (!name.empty())
+        m_nameIndices.emplace(name, node);
+    return node;
+}
+
+void SceneGraph::setLocal(int node, const float *local)
+{
+    memcpy(m_locals[node].m_data, local, sizeof(m_locals[node].m_data));
+    m_dirty[node] = 1;
+    m_firstDirty = qMin(m_firstDirty, node);
+}
+
+bool SceneGraph::update()
+{
+    const int count = nodeCount();
+    if (m_firstDirty >= count)
+        return false;
+
+    // after a node is visited its flag means the world matrix changed, which makes its children dirty as well
+    for (int node = m_firstDirty; node < count; ++node)
+    {
+        const int parent = m_parents[node];
+        if (!m_dirty[node] && (parent < m_firstDirty || !m_dirty[parent]))
+            continue;
+
+        m_dirty[node] = 1;
+        if (parent < 0)
+            m_worlds[node] = m_locals[node];
+        else
+            multiply(m_worlds[parent].m_data, m_locals[node].m_data, m_worlds[node].m_data);
+    }
+
+    memset(m_dirty.data() + m_firstDirty, 0, count - m_firstDirty);
+    m_firstDirty = INT_MAX;
+    return true;
+}
+
+int SceneGraph::findNode(const std::string &name) const
+{
+    auto it = m_nameIndices.find(name);
+    return it == m_nameIndices.end() ? -1 : it->second;
+}
+
+void SceneGraph::gatherWorlds(const std::vector<int> &nodes, float *transforms) const
+{
+    for (int node : nodes)
+    {
+        memcpy(transforms, m_worlds[node].m_data, sizeof(Matrix::m_data));
+        transforms += SCENE_MATRIX_FLOAT_COUNT;
+    }
+}
+
+void SceneGraph::multiply(const float *a, const float *b, float *out)
+{
+    // out = a * b, out must not alias a or b
+#ifdef SCENE_GRAPH_SSE2
+    const __m128 a0 = _mm_loadu_ps(a);
+    const __m128 a1 = _mm_loadu_ps(a + 4);
+    const __m128 a2 = _mm_loadu_ps(a + 8);
+    const __m128 a3 = _mm_loadu_ps(a + 12);
+    for (int column = 0; column < 4; ++column)
+    {
+        const float *bc = b + column * 4;
+        __m128 result = _mm_mul_ps(a0, _mm_set1_ps(bc[0]));
+        result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_set1_ps(bc[1])));
+        result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_set1_ps(bc[2])));
+        result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_set1_ps(bc[3])));
+        _mm_storeu_ps(out + column * 4, result);
+    }
+#else
+    for (int column = 0; column < 4; ++column)
+    {
+        const float *bc = b + column * 4;
+        for (int row = 0; row < 4; ++row)
+            out[column * 4 + row] = a[row] * bc[0] + a[4 + row] * bc[1] + a[8 + row] * bc[2] + a[12 + row] * bc[3];
+    }
+#endif
+}
@@ -0,0 +1,48 @@
+﻿#ifndef __SCENE_GRAPH_H__
+#define __SCENE_GRAPH_H__
+
+#include <QtGlobal>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <climits>
+
+#define SCENE_MATRIX_FLOAT_COUNT 16
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SCENE_GRAPH_SSE2
+#endif
+
+// flat scene graph stored as arrays, matrices are column-major
+// every parent is added before its children, so one forward pass from the first dirty node updates all changed subtrees
+class SceneGraph
+{
+public:
+    int addNode(int parent, const float *local, const std::string &name = std::string());
+    void setLocal(int node, const float *local);
+    // recomputes the world matrices of the dirty nodes and their subtrees, returns false if nothing changed
+    bool update();
+    int nodeCount() const { return (int)m_parents.size(); }
+    int parent(int node) const { return m_parents[node]; }
+    const float *local(int node) const { return m_locals[node].m_data; }
+    const float *world(int node) const { return m_worlds[node].m_data; }
+    int findNode(const std::string &name) const;
+    // copies the world matrices of nodes into a tightly packed transform buffer
+    void gatherWorlds(const std::vector<int> &nodes, float *transforms) const;
+    static void multiply(const float *a, const float *b, float *out);
+
+private:
+    struct Matrix
+    {
+        alignas(16) float m_data[SCENE_MATRIX_FLOAT_COUNT];
+    };
+
+    std::vector<int> m_parents;
+    std::vector<Matrix> m_locals;
+    std::vector<Matrix> m_worlds;
+    std::vector<quint8> m_dirty;
+    std::unordered_map<std::string, int> m_nameIndices;
+    int m_firstDirty = INT_MAX;
+};
+
+#endif
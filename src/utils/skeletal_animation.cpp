@@ -0,0 +1,138 @@
+﻿#include "skeletal_animation.h"
+#include <algorithm>
+#include <cmath>
+#ifdef SCENE_GRAPH_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // key before time and the blend factor towards the next key
+    static int findKey(const std::vector<float> &times, float time, float &factor)
+    {
+        factor = 0.0f;
+        auto it = std::upper_bound(times.begin(), times.end(), time);
+        if (it == times.begin())
+            return 0;
+        if (it == times.end())
+            return (int)times.size() - 1;
+
+        const int key = (int)(it - times.begin()) - 1;
+        const float span = times[key + 1] - times[key];
+        if (span > 0.0f)
+            factor = (time - times[key]) / span;
+        return key;
+    }
+
+    static void lerp4(const float *a, const float *b, float factor, float *out)
+    {
+#ifdef SCENE_GRAPH_SSE2
+        const __m128 va = _mm_loadu_ps(a);
+        _mm_storeu_ps(out, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b), va), _mm_set1_ps(factor))));
+#else
+        for (int i = 0; i < 4; ++i)
+            out[i] = a[i] + (b[i] - a[i]) * factor;
+#endif
+    }
+
+    // normalized lerp along the shorter arc, close enough to slerp between dense keys
+    static void nlerp(const float *a, const float *b, float factor, float *out)
+    {
+        const float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+        float target[4] = {b[0], b[1], b[2], b[3]};
+        if (dot < 0.0f)
+        {
+            for (float &value : target)
+                value = -value;
+        }
+        lerp4(a, target, factor, out);
+        const float length = std::sqrt(out[0] * out[0] + out[1] * out[1] + out[2] * out[2] + out[3] * out[3]);
+        const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+        for (int i = 0; i < 4; ++i)
+            out[i] *= scale;
+    }
+
+    static void sampleKeys(const std::vector<float> &times, const std::vector<float> &values, float time, bool rotation, float *out)
+    {
+        if (times.empty())
+            return;
+
+        float factor;
+        const int key = findKey(times, time, factor);
+        const float *current = &values[key * 4];
+        if (factor <= 0.0f)
+            std::copy(current, current + 4, out);
+        else if (rotation)
+            nlerp(current, current + 4, factor, out);
+        else
+            lerp4(current, current + 4, factor, out);
+    }
+
+    // column-major translation * rotation * scale
+    static void composeMatrix(const float *t, const float *r, const float *s, float *m)
+    {
+        const float x = r[0], y = r[1], z = r[2], w = r[3];
+        m[0] = (1.0f - 2.0f * (y * y + z * z)) * s[0];
+        m[1] = 2.0f * (x * y + w * z) * s[0];
+        m[2] = 2.0f * (x * z - w * y) * s[0];
+        m[3] = 0.0f;
+        m[4] = 2.0f * (x * y - w * z) * s[1];
+        m[5] = (1.0f - 2.0f * (x * x + z * z)) * s[1];
+        m[6] = 2.0f * (y * z + w * x) * s[1];
+        m[7] = 0.0f;
+        m[8] = 2.0f * (x * z + w * y) * s[2];
+        m[9] = 2.0f * (y * z - w * x) * s[2];
+        m[10] = (1.0f - 2.0f * (x * x + y * y)) * s[2];
+        m[11] = 0.0f;
+        m[12] = t[0];
+        m[13] = t[1];
+        m[14] = t[2];
+        m[15] = 1.0f;
+    }
+}
+
+void SkeletalAnimation::sample(const ModelAnimation::Clip &clip, double seconds, SceneGraph &sceneGraph)
+{
+    double ticks = seconds * clip.m_ticksPerSecond;
+    if (clip.m_duration > 0.0)
+        ticks = std::fmod(ticks, clip.m_duration);
+    const float time = (float)ticks;
+
+    for (const auto &channel : clip.m_channels)
+    {
+        if (channel.m_node < 0)
+            continue;
+
+        float position[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float rotation[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        float scale[4] = {1.0f, 1.0f, 1.0f, 0.0f};
+        sampleKeys(channel.m_positionTimes, channel.m_positions, time, false, position);
+        sampleKeys(channel.m_rotationTimes, channel.m_rotations, time, true, rotation);
+        sampleKeys(channel.m_scaleTimes, channel.m_scales, time, false, scale);
+
+        float local[SCENE_MATRIX_FLOAT_COUNT];
+        composeMatrix(position, rotation, scale, local);
+        sceneGraph.setLocal(channel.m_node, local);
+    }
+}
+
+void SkeletalAnimation::computePalette(const ModelAnimation &animation, const SceneGraph &sceneGraph, float *palette)
+{
+    for (int bone = 0; bone < animation.boneCount(); ++bone)
+    {
+        float *boneMatrix = palette + bone * SCENE_MATRIX_FLOAT_COUNT;
+        const int node = animation.m_boneNodes[bone];
+        if (node < 0)
+            std::copy(&animation.m_boneOffsets[bone * SCENE_MATRIX_FLOAT_COUNT], &animation.m_boneOffsets[(bone + 1) * SCENE_MATRIX_FLOAT_COUNT], boneMatrix);
+        else
+            SceneGraph::multiply(sceneGraph.world(node), &animation.m_boneOffsets[bone * SCENE_MATRIX_FLOAT_COUNT], boneMatrix);
+    }
+}
+
+void SkeletalAnimation::evaluate(const ModelAnimation &animation, int clip, double seconds, SceneGraph &sceneGraph, float *palette)
+{
+    if (clip >= 0 && clip < (int)animation.m_clips.size())
+        sample(animation.m_clips[clip], seconds, sceneGraph);
+    if (sceneGraph.update())
+        computePalette(animation, sceneGraph, palette);
+}
@@ -0,0 +1,50 @@
+﻿#ifndef __SKELETAL_ANIMATION_H__
+#define __SKELETAL_ANIMATION_H__
+
+#include "scene_graph.h"
+#include <vector>
+#include <string>
+
+// skeleton and keyframe clips of an imported model, shared by every renderer of the model
+struct ModelAnimation
+{
+    // keys of one animated node, vectors are x, y, z, 0 and rotations are quaternions x, y, z, w
+    struct Channel
+    {
+        int m_node = -1;
+        std::vector<float> m_positionTimes;
+        std::vector<float> m_positions;
+        std::vector<float> m_rotationTimes;
+        std::vector<float> m_rotations;
+        std::vector<float> m_scaleTimes;
+        std::vector<float> m_scales;
+    };
+
+    struct Clip
+    {
+        std::string m_name;
+        double m_duration = 0.0; // ticks
+        double m_ticksPerSecond = 25.0;
+        std::vector<Channel> m_channels;
+    };
+
+    std::vector<std::string> m_boneNames;
+    std::vector<int> m_boneNodes;    // scene graph node that moves every bone
+    std::vector<float> m_boneOffsets; // inverse bind matrix of every bone, column-major
+    std::vector<Clip> m_clips;
+
+    int boneCount() const { return (int)m_boneNodes.size(); }
+};
+
+class SkeletalAnimation
+{
+public:
+    // writes the local matrices of the animated nodes at seconds, the clip loops
+    static void sample(const ModelAnimation::Clip &clip, double seconds, SceneGraph &sceneGraph);
+    // bone matrices in model space, world of the bone node times its offset, SCENE_MATRIX_FLOAT_COUNT floats per bone
+    static void computePalette(const ModelAnimation &animation, const SceneGraph &sceneGraph, float *palette);
+    // sample, update and palette of one character
+    static void evaluate(const ModelAnimation &animation, int clip, double seconds, SceneGraph &sceneGraph, float *palette);
+};
+
+#endif
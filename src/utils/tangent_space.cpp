@@ -0,0 +1,347 @@
+﻿#include "tangent_space.h"
+#include "parallel_for.h"
+#include "vertex_streams.h"
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#ifdef VERTEX_STREAMS_SSE2
+#include <emmintrin.h>
+#endif
+
+#define TANGENT_SPACE_LANES 4 // triangles per step of the triangle passes
+
+namespace
+{
+    // four values computed together, one sse register if the cpu has it
+#ifdef VERTEX_STREAMS_SSE2
+    struct Lanes
+    {
+        __m128 m_v;
+
+        static Lanes load(const float *data) { return {_mm_load_ps(data)}; }
+        static Lanes splat(float value) { return {_mm_set1_ps(value)}; }
+        void store(float *data) const { _mm_store_ps(data, m_v); }
+    };
+
+    static inline Lanes operator+(Lanes a, Lanes b) { return {_mm_add_ps(a.m_v, b.m_v)}; }
+    static inline Lanes operator-(Lanes a, Lanes b) { return {_mm_sub_ps(a.m_v, b.m_v)}; }
+    static inline Lanes operator*(Lanes a, Lanes b) { return {_mm_mul_ps(a.m_v, b.m_v)}; }
+
+    // 1 / sqrt(x), 0 where x is 0
+    static inline Lanes inverseLength(Lanes squared)
+    {
+        const __m128 nonZero = _mm_cmpgt_ps(squared.m_v, _mm_setzero_ps());
+        return {_mm_and_ps(nonZero, _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(squared.m_v)))};
+    }
+
+    // 1 or -1 with the sign of x
+    static inline Lanes signOf(Lanes x)
+    {
+        return {_mm_or_ps(_mm_and_ps(x.m_v, _mm_set1_ps(-0.0f)), _mm_set1_ps(1.0f))};
+    }
+#else
+    struct Lanes
+    {
+        float m_v[TANGENT_SPACE_LANES];
+
+        static Lanes load(const float *data)
+        {
+            Lanes lanes;
+            memcpy(lanes.m_v, data, sizeof(lanes.m_v));
+            return lanes;
+        }
+        static Lanes splat(float value) { return {{value, value, value, value}}; }
+        void store(float *data) const { memcpy(data, m_v, sizeof(m_v)); }
+    };
+
+    template <typename Function>
+    static inline Lanes apply(Lanes a, Lanes b, const Function &function)
+    {
+        Lanes result;
+        for (int lane = 0; lane < TANGENT_SPACE_LANES; ++lane)
+            result.m_v[lane] = function(a.m_v[lane], b.m_v[lane]);
+        return result;
+    }
+
+    static inline Lanes operator+(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x + y; }); }
+    static inline Lanes operator-(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x - y; }); }
+    static inline Lanes operator*(Lanes a, Lanes b) { return apply(a, b, [](float x, float y) { return x * y; }); }
+
+    static inline Lanes inverseLength(Lanes squared)
+    {
+        return apply(squared, squared, [](float x, float) { return x > 0.0f ? 1.0f / std::sqrt(x) : 0.0f; });
+    }
+
+    static inline Lanes signOf(Lanes x)
+    {
+        return apply(x, x, [](float v, float) { return std::signbit(v) ? -1.0f : 1.0f; });
+    }
+#endif
+
+    struct LaneVector
+    {
+        Lanes m_x, m_y, m_z;
+    };
+
+    static inline LaneVector operator-(const LaneVector &a, const LaneVector &b) { return {a.m_x - b.m_x, a.m_y - b.m_y, a.m_z - b.m_z}; }
+    static inline LaneVector operator*(const LaneVector &a, Lanes s) { return {a.m_x * s, a.m_y * s, a.m_z * s}; }
+
+    static inline LaneVector cross(const LaneVector &a, const LaneVector &b)
+    {
+        return {a.m_y * b.m_z - a.m_z * b.m_y, a.m_z * b.m_x - a.m_x * b.m_z, a.m_x * b.m_y - a.m_y * b.m_x};
+    }
+
+    static inline LaneVector normalized(const LaneVector &a)
+    {
+        return a * inverseLength(a.m_x * a.m_x + a.m_y * a.m_y + a.m_z * a.m_z);
+    }
+
+    // gathers the corners of up to four triangles, the missing lanes read as zeros
+    struct TriangleLanes
+    {
+        alignas(16) float m_values[3][3][TANGENT_SPACE_LANES]; // corner, component, lane
+
+        void gather(const float *attribute, int stride, int components, const unsigned int *indices, qint64 firstTriangle, int laneCount)
+        {
+            memset(m_values, 0, sizeof(m_values));
+            for (int lane = 0; lane < laneCount; ++lane)
+            {
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    const float *value = attribute + (size_t)indices[(firstTriangle + lane) * 3 + corner] * stride;
+                    for (int component = 0; component < components; ++component)
+                        m_values[corner][component][lane] = value[component];
+                }
+            }
+        }
+
+        LaneVector vector(int corner) const
+        {
+            return {Lanes::load(m_values[corner][0]), Lanes::load(m_values[corner][1]), Lanes::load(m_values[corner][2])};
+        }
+        Lanes component(int corner, int component) const { return Lanes::load(m_values[corner][component]); }
+    };
+
+    static void scatter(const LaneVector &vector, qint64 firstTriangle, int laneCount, float *dst)
+    {
+        alignas(16) float values[3][TANGENT_SPACE_LANES];
+        vector.m_x.store(values[0]);
+        vector.m_y.store(values[1]);
+        vector.m_z.store(values[2]);
+        for (int lane = 0; lane < laneCount; ++lane)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+                dst[(firstTriangle + lane) * 3 + axis] = values[axis][lane];
+        }
+    }
+
+    // calls function(firstTriangle, laneCount) for the triangles four at a time, in parallel
+    template <typename Function>
+    static void forTriangleLanes(qint64 triangleCount, const Function &function)
+    {
+        const int stepCount = (int)((triangleCount + TANGENT_SPACE_LANES - 1) / TANGENT_SPACE_LANES);
+        parallelFor(0, stepCount, [&](int step)
+                    {
+                        const qint64 firstTriangle = (qint64)step * TANGENT_SPACE_LANES;
+                        function(firstTriangle, (int)qMin<qint64>(TANGENT_SPACE_LANES, triangleCount - firstTriangle)); },
+                    1024);
+    }
+
+    // the corners (3 * triangle + corner) of every group are m_corners[m_offsets[group]] to m_corners[m_offsets[group + 1]]
+    struct CornerLists
+    {
+        std::vector<qint64> m_offsets;
+        std::vector<qint64> m_corners;
+
+        template <typename GroupOf>
+        void build(qint64 cornerCount, qint64 groupCount, const GroupOf &groupOf)
+        {
+            m_offsets.assign(groupCount + 1, 0);
+            for (qint64 corner = 0; corner < cornerCount; ++corner)
+                ++m_offsets[groupOf(corner) + 1];
+            for (qint64 group = 0; group < groupCount; ++group)
+                m_offsets[group + 1] += m_offsets[group];
+            std::vector<qint64> next(m_offsets.begin(), m_offsets.end() - 1);
+            m_corners.resize(cornerCount);
+            for (qint64 corner = 0; corner < cornerCount; ++corner)
+                m_corners[next[groupOf(corner)]++] = corner;
+        }
+    };
+
+    struct PositionKey
+    {
+        quint32 m_bits[3];
+
+        bool operator==(const PositionKey &other) const { return !memcmp(m_bits, other.m_bits, sizeof(m_bits)); }
+    };
+
+    struct PositionKeyHash
+    {
+        size_t operator()(const PositionKey &key) const
+        {
+            quint64 seed = key.m_bits[0];
+            seed = seed * 0x9e3779b97f4a7c15ull ^ key.m_bits[1];
+            seed = seed * 0x9e3779b97f4a7c15ull ^ key.m_bits[2];
+            return (size_t)(seed ^ (seed >> 29));
+        }
+    };
+
+    // vertices at bitwise equal positions share a group, returns the group count
+    static qint64 positionGroups(const float *positions, int stride, qint64 vertexCount, std::vector<qint64> &groups)
+    {
+        std::unordered_map<PositionKey, qint64, PositionKeyHash> lookup;
+        lookup.reserve(vertexCount);
+        groups.resize(vertexCount);
+        for (qint64 i = 0; i < vertexCount; ++i)
+        {
+            PositionKey key;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                // -0 and 0 are the same position
+                const float value = positions[i * stride + axis] + 0.0f;
+                memcpy(&key.m_bits[axis], &value, sizeof(float));
+            }
+            groups[i] = lookup.emplace(key, (qint64)lookup.size()).first->second;
+        }
+        return (qint64)lookup.size();
+    }
+
+    static void orthogonalTo(const float *normal, float *tangent)
+    {
+        // any unit vector in the plane of the normal
+        const float axis[3] = {qAbs(normal[0]) < 0.9f ? 1.0f : 0.0f, qAbs(normal[0]) < 0.9f ? 0.0f : 1.0f, 0.0f};
+        float t[3] = {axis[1] * normal[2] - axis[2] * normal[1], axis[2] * normal[0] - axis[0] * normal[2], axis[0] * normal[1] - axis[1] * normal[0]};
+        const float length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+        for (int i = 0; i < 3; ++i)
+            tangent[i] = length > 0.0f ? t[i] / length : axis[i];
+    }
+}
+
+void TangentSpace::generateNormals(const float *positions, int positionStride, qint64 vertexCount, const unsigned int *indices, qint64 indexCount,
+                                   float *normals, int normalStride)
+{
+    // unit normal of every triangle, every triangle counts the same like in assimp
+    const qint64 triangleCount = indexCount / 3;
+    std::vector<float> faceNormals(triangleCount * 3);
+    forTriangleLanes(triangleCount, [&](qint64 firstTriangle, int laneCount)
+                     {
+                         TriangleLanes p;
+                         p.gather(positions, positionStride, 3, indices, firstTriangle, laneCount);
+                         const LaneVector p0 = p.vector(0);
+                         scatter(normalized(cross(p.vector(1) - p0, p.vector(2) - p0)), firstTriangle, laneCount, faceNormals.data()); });
+
+    std::vector<qint64> groups;
+    const qint64 groupCount = positionGroups(positions, positionStride, vertexCount, groups);
+    CornerLists lists;
+    lists.build(triangleCount * 3, groupCount, [&](qint64 corner)
+                { return groups[indices[corner]]; });
+
+    std::vector<float> groupNormals(groupCount * 3);
+    parallelFor(0, (int)groupCount, [&](int group)
+                {
+                    float sum[3] = {0.0f, 0.0f, 0.0f};
+                    for (qint64 i = lists.m_offsets[group]; i < lists.m_offsets[group + 1]; ++i)
+                    {
+                        const float *faceNormal = &faceNormals[lists.m_corners[i] / 3 * 3];
+                        for (int axis = 0; axis < 3; ++axis)
+                            sum[axis] += faceNormal[axis];
+                    }
+                    const float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    for (int axis = 0; axis < 3; ++axis)
+                        groupNormals[group * 3 + axis] = length > 0.0f ? sum[axis] / length : 0.0f; },
+                1024);
+    parallelFor(0, (int)vertexCount, [&](int vertex)
+                { memcpy(normals + (size_t)vertex * normalStride, &groupNormals[groups[vertex] * 3], 3 * sizeof(float)); },
+                4096);
+}
+
+void TangentSpace::generateTangents(const float *positions, int positionStride, const float *normals, int normalStride, const float *texCoords,
+                                    int texCoordStride, qint64 vertexCount, const unsigned int *indices, qint64 indexCount, float *tangents,
+                                    int tangentStride, float *bitangents, int bitangentStride)
+{
+    // unit direction of increasing u of every triangle, with the sign of its uv area, 0 if its uvs are degenerate
+    const qint64 triangleCount = indexCount / 3;
+    std::vector<float> faceTangents(triangleCount * 3);
+    std::vector<float> faceAreas(triangleCount * 3); // uv area, its sign, unused
+    forTriangleLanes(triangleCount, [&](qint64 firstTriangle, int laneCount)
+                     {
+                         TriangleLanes p, uv;
+                         p.gather(positions, positionStride, 3, indices, firstTriangle, laneCount);
+                         uv.gather(texCoords, texCoordStride, 2, indices, firstTriangle, laneCount);
+                         const LaneVector p0 = p.vector(0);
+                         const LaneVector d1 = p.vector(1) - p0, d2 = p.vector(2) - p0;
+                         const Lanes t21x = uv.component(1, 0) - uv.component(0, 0), t21y = uv.component(1, 1) - uv.component(0, 1);
+                         const Lanes t31x = uv.component(2, 0) - uv.component(0, 0), t31y = uv.component(2, 1) - uv.component(0, 1);
+                         const Lanes area = t21x * t31y - t21y * t31x;
+                         const Lanes sign = signOf(area);
+                         // MikkTSpace equation 18, scaled by the sign of the area so that mirrored uvs still point along u
+                         const LaneVector os = {t31y * d1.m_x - t21y * d2.m_x, t31y * d1.m_y - t21y * d2.m_y, t31y * d1.m_z - t21y * d2.m_z};
+                         scatter(normalized(os) * sign, firstTriangle, laneCount, faceTangents.data());
+                         scatter(LaneVector{area, sign, Lanes::splat(0.0f)}, firstTriangle, laneCount, faceAreas.data()); });
+
+    CornerLists lists;
+    lists.build(triangleCount * 3, vertexCount, [&](qint64 corner)
+                { return (qint64)indices[corner]; });
+
+    parallelFor(0, (int)vertexCount, [&](int vertex)
+                {
+                    const float *n = normals + (size_t)vertex * normalStride;
+                    float sum[3] = {0.0f, 0.0f, 0.0f};
+                    float handedness = 0.0f;
+                    for (qint64 i = lists.m_offsets[vertex]; i < lists.m_offsets[vertex + 1]; ++i)
+                    {
+                        const qint64 corner = lists.m_corners[i];
+                        const qint64 triangle = corner / 3;
+                        if (faceAreas[triangle * 3] == 0.0f)
+                            continue;
+
+                        // the tangent and the edges leaving the corner are projected into the plane of the vertex normal
+                        auto project = [n](const float *v, float *out)
+                        {
+                            const float d = n[0] * v[0] + n[1] * v[1] + n[2] * v[2];
+                            float length = 0.0f;
+                            for (int axis = 0; axis < 3; ++axis)
+                            {
+                                out[axis] = v[axis] - n[axis] * d;
+                                length += out[axis] * out[axis];
+                            }
+                            length = std::sqrt(length);
+                            for (int axis = 0; axis < 3; ++axis)
+                                out[axis] = length > 0.0f ? out[axis] / length : 0.0f;
+                        };
+                        float tangent[3];
+                        project(&faceTangents[triangle * 3], tangent);
+
+                        const float *p = positions + (size_t)indices[corner] * positionStride;
+                        const float *prev = positions + (size_t)indices[triangle * 3 + (corner + 2) % 3] * positionStride;
+                        const float *next = positions + (size_t)indices[triangle * 3 + (corner + 1) % 3] * positionStride;
+                        const float e1[3] = {next[0] - p[0], next[1] - p[1], next[2] - p[2]};
+                        const float e2[3] = {prev[0] - p[0], prev[1] - p[1], prev[2] - p[2]};
+                        float v1[3], v2[3];
+                        project(e1, v1);
+                        project(e2, v2);
+                        const float angle = std::acos(qBound(-1.0f, v1[0] * v2[0] + v1[1] * v2[1] + v1[2] * v2[2], 1.0f));
+                        for (int axis = 0; axis < 3; ++axis)
+                            sum[axis] += tangent[axis] * angle;
+                        handedness += faceAreas[triangle * 3 + 1] * angle;
+                    }
+
+                    float *t = tangents + (size_t)vertex * tangentStride;
+                    const float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    if (length > 0.0f)
+                    {
+                        for (int axis = 0; axis < 3; ++axis)
+                            t[axis] = sum[axis] / length;
+                    }
+                    else
+                    {
+                        orthogonalTo(n, t);
+                    }
+                    const float sign = handedness < 0.0f ? -1.0f : 1.0f;
+                    float *b = bitangents + (size_t)vertex * bitangentStride;
+                    b[0] = (n[1] * t[2] - n[2] * t[1]) * sign;
+                    b[1] = (n[2] * t[0] - n[0] * t[2]) * sign;
+                    b[2] = (n[0] * t[1] - n[1] * t[0]) * sign; },
+                1024);
+}
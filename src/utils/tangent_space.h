@@ -0,0 +1,26 @@
+﻿#ifndef __TANGENT_SPACE_H__
+#define __TANGENT_SPACE_H__
+
+#include <QtGlobal>
+
+/////////////////////////////////////////////////////////////////
+// normals and tangent frames of indexed triangle lists, computed in parallel on the global thread pool
+// the imports run them for the meshes whose file has no normals or tangents, in place of the serial assimp steps
+// every attribute is a strided float array, stride in floats
+class TangentSpace
+{
+public:
+    // smooth normals like aiProcess_GenSmoothNormals: the unit normals of the triangles around a position are averaged,
+    // vertices at the same position get the same normal even if the mesh is not welded
+    static void generateNormals(const float *positions, int positionStride, qint64 vertexCount, const unsigned int *indices, qint64 indexCount,
+                                float *normals, int normalStride);
+
+    // tangents by the MikkTSpace rules: the uv directions of every corner are projected into the plane of the vertex normal
+    // and weighted by the corner angle, the tangent is orthogonal to the normal and the bitangent is cross(normal, tangent)
+    // flipped where the uvs are mirrored. vertices are not split at mirrored seams, they keep the majority handedness
+    static void generateTangents(const float *positions, int positionStride, const float *normals, int normalStride, const float *texCoords,
+                                 int texCoordStride, qint64 vertexCount, const unsigned int *indices, qint64 indexCount, float *tangents,
+                                 int tangentStride, float *bitangents, int bitangentStride);
+};
+
+#endif
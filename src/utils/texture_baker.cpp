@@ -0,0 +1,304 @@
+﻿#include "texture_baker.h"
+#include "parallel_for.h"
+#include <spdlog/spdlog.h>
+#include <QFile>
+#include <QSaveFile>
+#include <cstring>
+#ifdef TEXTURE_BAKER_SSE2
+#include <emmintrin.h>
+#endif
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+
+namespace
+{
+    static int blockByteCount(BakedTexture::Format format)
+    {
+        return format == BakedTexture::BC1 ? 8 : 16;
+    }
+
+    // texel of an RGBA8 image, coordinates outside are clamped to the edge
+    static const unsigned char *texel(const unsigned char *rgba, int width, int height, int x, int y)
+    {
+        return rgba + ((qsizetype)qMin(y, height - 1) * width + qMin(x, width - 1)) * 4;
+    }
+}
+
+int BakedTexture::firstLoadedLevel() const
+{
+    for (int level = 0; level < mipCount(); ++level)
+    {
+        if (!m_mips[level].m_data.isEmpty())
+            return level;
+    }
+    return mipCount();
+}
+
+int BakedTexture::levelForSize(int maxSize) const
+{
+    for (int level = 0; level < mipCount(); ++level)
+    {
+        if (qMax(m_mips[level].m_width, m_mips[level].m_height) <= maxSize)
+            return level;
+    }
+    return qMax(0, mipCount() - 1);
+}
+
+qint64 BakedTexture::byteCount(int firstLevel) const
+{
+    qint64 byteCount = 0;
+    for (int level = qMax(0, firstLevel); level < mipCount(); ++level)
+        byteCount += m_mips[level].m_byteCount;
+    return byteCount;
+}
+
+BakedTexture::Format TextureBaker::chooseFormat(const std::string &type, const unsigned char *pixels, int width, int height, int channel)
+{
+    if ("texture_normal" == type)
+        return BakedTexture::BC5;
+    if (channel != 4)
+        return BakedTexture::BC1;
+
+    const qsizetype texelCount = (qsizetype)width * height;
+    for (qsizetype i = 0; i < texelCount; ++i)
+    {
+        if (pixels[i * 4 + 3] != 255)
+            return BakedTexture::BC3;
+    }
+    return BakedTexture::BC1;
+}
+
+bool TextureBaker::bake(const unsigned char *pixels, int width, int height, int channel, BakedTexture::Format format, BakedTexture &baked)
+{
+    if (!pixels || width <= 0 || height <= 0 || channel < 1 || channel > 4)
+    {
+        spdlog::error("texture can not be baked. width: {0}, height: {1}, channel: {2}", width, height, channel);
+        return false;
+    }
+
+    // every level is built from the previous one in RGBA8, then compressed on its own
+    QByteArray level((qsizetype)width * height * 4, Qt::Uninitialized);
+    unsigned char *rgba = reinterpret_cast<unsigned char *>(level.data());
+    const qsizetype texelCount = (qsizetype)width * height;
+    for (qsizetype i = 0; i < texelCount; ++i)
+    {
+        const unsigned char *src = pixels + i * channel;
+        unsigned char *dst = rgba + i * 4;
+        dst[0] = src[0];
+        dst[1] = channel > 2 ? src[1] : src[0];
+        dst[2] = channel > 2 ? src[2] : src[0];
+        dst[3] = channel == 4 ? src[3] : (channel == 2 ? src[1] : 255);
+    }
+
+    baked.m_format = format;
+    baked.m_mips.clear();
+    int levelWidth = width, levelHeight = height;
+    while (true)
+    {
+        BakedTexture::Mip mip;
+        mip.m_width = levelWidth;
+        mip.m_height = levelHeight;
+        if (format == BakedTexture::RGBA8)
+            mip.m_data = level;
+        else
+            compress(reinterpret_cast<const unsigned char *>(level.constData()), levelWidth, levelHeight, format, mip.m_data);
+        baked.m_mips.emplace_back(mip);
+        if (levelWidth == 1 && levelHeight == 1)
+            break;
+
+        const int nextWidth = qMax(1, levelWidth / 2);
+        const int nextHeight = qMax(1, levelHeight / 2);
+        QByteArray next((qsizetype)nextWidth * nextHeight * 4, Qt::Uninitialized);
+        downsample(reinterpret_cast<const unsigned char *>(level.constData()), levelWidth, levelHeight, reinterpret_cast<unsigned char *>(next.data()));
+        level = next;
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+    layout(baked);
+    return true;
+}
+
+void TextureBaker::layout(BakedTexture &baked)
+{
+    // the mips follow the header and the size table in the file, largest first
+    qint64 offset = sizeof(Header) + baked.m_mips.size() * sizeof(quint64);
+    for (auto &mip : baked.m_mips)
+    {
+        if (!mip.m_data.isEmpty())
+            mip.m_byteCount = mip.m_data.size();
+        mip.m_offset = offset;
+        offset += mip.m_byteCount;
+    }
+}
+
+void TextureBaker::downsample(const unsigned char *src, int width, int height, unsigned char *dst)
+{
+    const int dstWidth = qMax(1, width / 2);
+    const int dstHeight = qMax(1, height / 2);
+    parallelFor(0, dstHeight, [&](int y)
+                {
+                    const unsigned char *row0 = src + (qsizetype)(2 * y) * width * 4;
+                    const unsigned char *row1 = src + (qsizetype)qMin(2 * y + 1, height - 1) * width * 4;
+                    unsigned char *out = dst + (qsizetype)y * dstWidth * 4;
+                    int x = 0;
+#ifdef TEXTURE_BAKER_SSE2
+                    // four output texels from eight input texels of both rows, sums are kept in 16 bits
+                    const __m128i zero = _mm_setzero_si128();
+                    const __m128i round = _mm_set1_epi16(2);
+                    for (; width >= 2 && x + 4 <= dstWidth; x += 4)
+                    {
+                        const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8));
+                        const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + x * 8 + 16));
+                        const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8));
+                        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + x * 8 + 16));
+                        const __m128i s0 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(a1, zero));
+                        const __m128i s1 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(a1, zero));
+                        const __m128i s2 = _mm_add_epi16(_mm_unpacklo_epi8(b0, zero), _mm_unpacklo_epi8(b1, zero));
+                        const __m128i s3 = _mm_add_epi16(_mm_unpackhi_epi8(b0, zero), _mm_unpackhi_epi8(b1, zero));
+                        // every half of s holds one input texel, adding the upper half gives the 2x2 sum in the lower one
+                        const __m128i h0 = _mm_add_epi16(s0, _mm_srli_si128(s0, 8));
+                        const __m128i h1 = _mm_add_epi16(s1, _mm_srli_si128(s1, 8));
+                        const __m128i h2 = _mm_add_epi16(s2, _mm_srli_si128(s2, 8));
+                        const __m128i h3 = _mm_add_epi16(s3, _mm_srli_si128(s3, 8));
+                        const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(h0, h1), round), 2);
+                        const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(h2, h3), round), 2);
+                        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + x * 4), _mm_packus_epi16(lo, hi));
+                    }
+#endif
+                    for (; x < dstWidth; ++x)
+                    {
+                        const int x0 = 2 * x;
+                        const int x1 = qMin(2 * x + 1, width - 1);
+                        for (int c = 0; c < 4; ++c)
+                            out[x * 4 + c] = (unsigned char)((row0[x0 * 4 + c] + row0[x1 * 4 + c] + row1[x0 * 4 + c] + row1[x1 * 4 + c] + 2) >> 2);
+                    } },
+                16);
+}
+
+void TextureBaker::compress(const unsigned char *rgba, int width, int height, BakedTexture::Format format, QByteArray &blocks)
+{
+    const int blockWidth = (width + 3) / 4;
+    const int blockHeight = (height + 3) / 4;
+    const int blockBytes = blockByteCount(format);
+    blocks.resize((qsizetype)blockWidth * blockHeight * blockBytes);
+    unsigned char *dst = reinterpret_cast<unsigned char *>(blocks.data());
+    parallelFor(0, blockHeight, [&](int by)
+                {
+                    unsigned char block[16 * 4];
+                    unsigned char rg[16 * 2];
+                    for (int bx = 0; bx < blockWidth; ++bx)
+                    {
+                        // edge blocks repeat the last texels of the image
+                        for (int y = 0; y < 4; ++y)
+                        {
+                            for (int x = 0; x < 4; ++x)
+                            {
+                                const unsigned char *src = texel(rgba, width, height, bx * 4 + x, by * 4 + y);
+                                memcpy(block + (y * 4 + x) * 4, src, 4);
+                                rg[(y * 4 + x) * 2] = src[0];
+                                rg[(y * 4 + x) * 2 + 1] = src[1];
+                            }
+                        }
+
+                        unsigned char *out = dst + ((qsizetype)by * blockWidth + bx) * blockBytes;
+                        if (format == BakedTexture::BC5)
+                            stb_compress_bc5_block(out, rg);
+                        else
+                            stb_compress_dxt_block(out, block, format == BakedTexture::BC3, STB_DXT_HIGHQUAL);
+                    } },
+                4);
+}
+
+bool TextureBaker::load(const QString &path, BakedTexture &baked, int maxSize)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    Header header;
+    if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header) ||
+        memcmp(header.m_magic, BAKED_TEXTURE_MAGIC, sizeof(BAKED_TEXTURE_MAGIC)) || header.m_version != BAKED_TEXTURE_VERSION ||
+        header.m_format > BakedTexture::BC5 || !header.m_mipCount)
+    {
+        spdlog::warn("baked texture is out of date. path: {}", path.toStdString());
+        return false;
+    }
+
+    std::vector<quint64> mipSizes(header.m_mipCount);
+    if (file.read(reinterpret_cast<char *>(mipSizes.data()), mipSizes.size() * sizeof(quint64)) != (qint64)(mipSizes.size() * sizeof(quint64)))
+        return false;
+
+    baked.m_format = (BakedTexture::Format)header.m_format;
+    baked.m_mips.assign(header.m_mipCount, BakedTexture::Mip());
+    int width = header.m_width, height = header.m_height;
+    for (quint32 i = 0; i < header.m_mipCount; ++i)
+    {
+        BakedTexture::Mip &mip = baked.m_mips[i];
+        mip.m_width = width;
+        mip.m_height = height;
+        mip.m_byteCount = (qint64)mipSizes[i];
+        width = qMax(1, width / 2);
+        height = qMax(1, height / 2);
+    }
+    layout(baked);
+
+    const int firstLevel = maxSize > 0 ? baked.levelForSize(maxSize) : 0;
+    for (int level = firstLevel; level < baked.mipCount(); ++level)
+    {
+        BakedTexture::Mip &mip = baked.m_mips[level];
+        mip.m_data = file.seek(mip.m_offset) ? file.read(mip.m_byteCount) : QByteArray();
+        if (mip.m_data.size() != mip.m_byteCount)
+        {
+            spdlog::error("baked texture is truncated. path: {}", path.toStdString());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool TextureBaker::loadMip(const QString &path, const BakedTexture::Mip &mip, char *data)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(mip.m_offset))
+    {
+        spdlog::error("open baked texture failed. path: {}", path.toStdString());
+        return false;
+    }
+    return file.read(data, mip.m_byteCount) == mip.m_byteCount;
+}
+
+bool TextureBaker::save(const QString &path, const BakedTexture &baked)
+{
+    if (baked.m_mips.empty())
+        return false;
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.m_magic, BAKED_TEXTURE_MAGIC, sizeof(BAKED_TEXTURE_MAGIC));
+    header.m_version = BAKED_TEXTURE_VERSION;
+    header.m_format = baked.m_format;
+    header.m_width = baked.width();
+    header.m_height = baked.height();
+    header.m_mipCount = (quint32)baked.m_mips.size();
+
+    // every mip must be in memory, save runs right after bake
+    std::vector<quint64> mipSizes;
+    for (const auto &mip : baked.m_mips)
+    {
+        if (mip.m_data.size() != mip.m_byteCount)
+            return false;
+        mipSizes.emplace_back(mip.m_byteCount);
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        spdlog::error("open baked texture failed. path: {}", path.toStdString());
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(mipSizes.data()), mipSizes.size() * sizeof(quint64));
+    for (const auto &mip : baked.m_mips)
+        file.write(mip.m_data);
+    return file.commit();
+}
@@ -0,0 +1,85 @@
+﻿#ifndef __TEXTURE_BAKER_H__
+#define __TEXTURE_BAKER_H__
+
+#include <QString>
+#include <QByteArray>
+#include <vector>
+#include <string>
+
+#define BAKED_TEXTURE_MAGIC "3DVTEX"
+#define BAKED_TEXTURE_VERSION 1
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_BAKER_SSE2
+#endif
+
+// texture with its whole mip chain, level 0 first, ready to be uploaded without any work on the render thread
+struct BakedTexture
+{
+    enum Format
+    {
+        RGBA8 = 0,
+        BC1,  // rgb, 4 bits per texel
+        BC3,  // rgba, 8 bits per texel
+        BC5,  // two channels, normal maps
+    };
+
+    struct Mip
+    {
+        int m_width = 0;
+        int m_height = 0;
+        qint64 m_offset = 0;    // position in the baked file
+        qint64 m_byteCount = 0; // size in the baked file, m_data is empty while the mip stays on disk
+        QByteArray m_data;
+    };
+
+    Format m_format = RGBA8;
+    std::vector<Mip> m_mips;
+
+    int width() const { return m_mips.empty() ? 0 : m_mips.front().m_width; }
+    int height() const { return m_mips.empty() ? 0 : m_mips.front().m_height; }
+    int mipCount() const { return (int)m_mips.size(); }
+    // first mip with data in memory, mipCount() if none
+    int firstLoadedLevel() const;
+    // first mip whose larger side is at most maxSize, the last mip if every one is larger
+    int levelForSize(int maxSize) const;
+    // bytes of the mips from firstLevel to the smallest one
+    qint64 byteCount(int firstLevel = 0) const;
+};
+
+/////////////////////////////////////////////////////////////////
+// builds mip chains and block compresses them on the cpu at import, the result is kept in the model cache
+// the file is a small KTX2 like container: header, a table with the byte size of every mip, then the mips
+class TextureBaker
+{
+public:
+    struct Header
+    {
+        char m_magic[8];
+        quint32 m_version;
+        quint32 m_format;
+        quint32 m_width;
+        quint32 m_height;
+        quint32 m_mipCount;
+        quint32 m_reserved;
+    };
+
+public:
+    // normal maps keep x and y in BC5, textures with transparent texels use BC3 and every other one BC1
+    static BakedTexture::Format chooseFormat(const std::string &type, const unsigned char *pixels, int width, int height, int channel);
+    // pixels are stb_image output with channel bytes per texel
+    static bool bake(const unsigned char *pixels, int width, int height, int channel, BakedTexture::Format format, BakedTexture &baked);
+    // mips larger than maxSize are left on disk and read later by loadMip, 0 loads every mip
+    static bool load(const QString &path, BakedTexture &baked, int maxSize = 0);
+    // reads the m_byteCount bytes of the mip to data, e.g. straight into a mapped upload buffer
+    static bool loadMip(const QString &path, const BakedTexture::Mip &mip, char *data);
+    static bool save(const QString &path, const BakedTexture &baked);
+    // 2x2 box filter of an RGBA8 image into the next mip, the last row or column of odd sizes is repeated
+    static void downsample(const unsigned char *src, int width, int height, unsigned char *dst);
+
+private:
+    static void layout(BakedTexture &baked);
+    static void compress(const unsigned char *rgba, int width, int height, BakedTexture::Format format, QByteArray &blocks);
+};
+
+#endif
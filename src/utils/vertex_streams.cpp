@@ -0,0 +1,239 @@
+﻿#include "vertex_streams.h"
+#include <cfloat>
+#include <cstring>
+#ifdef VERTEX_STREAMS_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef VERTEX_STREAMS_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define VERTEX_STREAMS_TARGET_AVX2
+#else
+#define VERTEX_STREAMS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace
+{
+    // lane l of the k-th register of a block of packed points holds coordinate (k * width + l) % 3
+    static void mergeLanes(const float *mins, const float *maxs, int width, int registerIndex, float *min, float *max)
+    {
+        for (int lane = 0; lane < width; ++lane)
+        {
+            const int axis = (registerIndex * width + lane) % 3;
+            min[axis] = qMin(min[axis], mins[lane]);
+            max[axis] = qMax(max[axis], maxs[lane]);
+        }
+    }
+
+#ifdef VERTEX_STREAMS_AVX2
+    // eight points are three registers, so every register keeps its own running min and max
+    VERTEX_STREAMS_TARGET_AVX2 static qint64 packedBoundsAvx2(const float *positions, qint64 count, float *min, float *max)
+    {
+        const qint64 blockCount = count / 8;
+        if (!blockCount)
+            return 0;
+
+        __m256 mins[3], maxs[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            mins[k] = _mm256_set1_ps(FLT_MAX);
+            maxs[k] = _mm256_set1_ps(-FLT_MAX);
+        }
+        for (qint64 block = 0; block < blockCount; ++block)
+        {
+            const float *p = positions + block * 24;
+            for (int k = 0; k < 3; ++k)
+            {
+                const __m256 v = _mm256_loadu_ps(p + k * 8);
+                mins[k] = _mm256_min_ps(mins[k], v);
+                maxs[k] = _mm256_max_ps(maxs[k], v);
+            }
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            alignas(32) float laneMins[8], laneMaxs[8];
+            _mm256_store_ps(laneMins, mins[k]);
+            _mm256_store_ps(laneMaxs, maxs[k]);
+            mergeLanes(laneMins, laneMaxs, 8, k, min, max);
+        }
+        return blockCount * 8;
+    }
+#endif
+
+#ifdef VERTEX_STREAMS_SSE2
+    static qint64 packedBoundsSse2(const float *positions, qint64 count, float *min, float *max)
+    {
+        const qint64 blockCount = count / 4;
+        if (!blockCount)
+            return 0;
+
+        __m128 mins[3], maxs[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            mins[k] = _mm_set1_ps(FLT_MAX);
+            maxs[k] = _mm_set1_ps(-FLT_MAX);
+        }
+        for (qint64 block = 0; block < blockCount; ++block)
+        {
+            const float *p = positions + block * 12;
+            for (int k = 0; k < 3; ++k)
+            {
+                const __m128 v = _mm_loadu_ps(p + k * 4);
+                mins[k] = _mm_min_ps(mins[k], v);
+                maxs[k] = _mm_max_ps(maxs[k], v);
+            }
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            alignas(16) float laneMins[4], laneMaxs[4];
+            _mm_store_ps(laneMins, mins[k]);
+            _mm_store_ps(laneMaxs, maxs[k]);
+            mergeLanes(laneMins, laneMaxs, 4, k, min, max);
+        }
+        return blockCount * 4;
+    }
+#endif
+}
+
+void VertexStreams::resize(int vertexCount, bool skinned)
+{
+    m_positions.resize((size_t)vertexCount * 3);
+    m_normals.resize((size_t)vertexCount * 3);
+    m_texCoords.resize((size_t)vertexCount * 2);
+    m_tangents.resize((size_t)vertexCount * 3);
+    m_bitangents.resize((size_t)vertexCount * 3);
+    m_boneIDs.resize(skinned ? (size_t)vertexCount * 4 : 0);
+    m_weights.resize(skinned ? (size_t)vertexCount * 4 : 0);
+}
+
+const void *VertexStreams::data(Stream stream) const
+{
+    switch (stream)
+    {
+    case Position:
+        return m_positions.data();
+    case Normal:
+        return m_normals.data();
+    case TexCoord:
+        return m_texCoords.data();
+    case Tangent:
+        return m_tangents.data();
+    case Bitangent:
+        return m_bitangents.data();
+    case BoneID:
+        return m_boneIDs.data();
+    case Weight:
+        return m_weights.data();
+    default:
+        return nullptr;
+    }
+}
+
+int VertexStreams::streamMask() const
+{
+    const size_t sizes[StreamCount] = {m_positions.size(), m_normals.size(), m_texCoords.size(), m_tangents.size(),
+                                       m_bitangents.size(), m_boneIDs.size(), m_weights.size()};
+    int mask = 0;
+    for (int stream = 0; stream < StreamCount; ++stream)
+    {
+        if (sizes[stream])
+            mask |= 1 << stream;
+    }
+    return mask;
+}
+
+VertexStreams::Attribute VertexStreams::packedAttribute(Stream stream, qint64 vertexCount, int streamMask)
+{
+    Attribute attribute;
+    if (!(streamMask & (1 << stream)))
+        return attribute;
+
+    attribute.m_components = componentCount(stream);
+    attribute.m_integer = stream == BoneID;
+    attribute.m_stride = (int)elementBytes(stream);
+    for (int previous = 0; previous < stream; ++previous)
+    {
+        if (streamMask & (1 << previous))
+            attribute.m_offset += elementBytes((Stream)previous) * vertexCount;
+    }
+    return attribute;
+}
+
+qint64 VertexStreams::packedBytes(qint64 vertexCount, int streamMask)
+{
+    qint64 bytes = 0;
+    for (int stream = 0; stream < StreamCount; ++stream)
+    {
+        if (streamMask & (1 << stream))
+            bytes += elementBytes((Stream)stream) * vertexCount;
+    }
+    return bytes;
+}
+
+void VertexStreams::gather(const View &view, qint64 count, int components, float *dst)
+{
+    if (!count)
+        return;
+    if (view.m_stride == components)
+    {
+        memcpy(dst, view.m_data, count * components * sizeof(float));
+        return;
+    }
+    for (qint64 i = 0; i < count; ++i)
+        memcpy(dst + i * components, view[i], components * sizeof(float));
+}
+
+void VertexStreams::bounds(const float *positions, qint64 count, int stride, float *min, float *max)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        min[axis] = FLT_MAX;
+        max[axis] = -FLT_MAX;
+    }
+
+    qint64 first = 0;
+    if (stride == 3)
+    {
+#ifdef VERTEX_STREAMS_AVX2
+        if (hasAvx2())
+            first = packedBoundsAvx2(positions, count, min, max);
+#endif
+#ifdef VERTEX_STREAMS_SSE2
+        if (!first)
+            first = packedBoundsSse2(positions, count, min, max);
+#endif
+    }
+    for (qint64 i = first; i < count; ++i)
+    {
+        const float *p = positions + i * stride;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            min[axis] = qMin(min[axis], p[axis]);
+            max[axis] = qMax(max[axis], p[axis]);
+        }
+    }
+}
+
+bool VertexStreams::hasAvx2()
+{
+#if defined(VERTEX_STREAMS_AVX2) && defined(_MSC_VER)
+    // the cpu has avx2 and the os saves the ymm registers
+    static const bool sAvx2 = []()
+    {
+        int info[4];
+        __cpuid(info, 1);
+        if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+            return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return sAvx2;
+#elif defined(VERTEX_STREAMS_AVX2)
+    static const bool sAvx2 = __builtin_cpu_supports("avx2");
+    return sAvx2;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,106 @@
+﻿#ifndef __VERTEX_STREAMS_H__
+#define __VERTEX_STREAMS_H__
+
+#include <QtGlobal>
+#include <new>
+#include <vector>
+
+#define VERTEX_STREAM_ALIGNMENT 32 // one AVX2 register
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VERTEX_STREAMS_SSE2
+#endif
+// the avx2 passes are compiled for every x64 build and picked at run time, the binary still starts on cpus without it
+#if defined(_M_X64) || defined(__x86_64__)
+#define VERTEX_STREAMS_AVX2
+#endif
+
+// allocator of the streams, every stream starts on a VERTEX_STREAM_ALIGNMENT boundary
+template <typename T>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U> &) {}
+    T *allocate(size_t count) { return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(VERTEX_STREAM_ALIGNMENT))); }
+    void deallocate(T *data, size_t) { ::operator delete(data, std::align_val_t(VERTEX_STREAM_ALIGNMENT)); }
+    template <typename U>
+    bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+
+/////////////////////////////////////////////////////////////////
+// structure of arrays storage of the vertices of a mesh, one tightly packed stream per attribute
+// cpu passes over one attribute read only that attribute, and a stream is uploaded or bound as it is
+struct VertexStreams
+{
+    // the stream index is also the attribute location of the OpenGL shaders
+    enum Stream
+    {
+        Position = 0,
+        Normal,
+        TexCoord,
+        Tangent,
+        Bitangent,
+        BoneID,
+        Weight,
+        StreamCount,
+    };
+
+    // one attribute of a vertex buffer, stride and offset in bytes, a stream the buffer does not hold has no components
+    struct Attribute
+    {
+        int m_components = 0;
+        bool m_integer = false;
+        qint64 m_offset = 0;
+        int m_stride = 0;
+    };
+
+    // read only view of one attribute in either layout, stride in floats
+    struct View
+    {
+        const float *m_data = nullptr;
+        int m_stride = 0;
+
+        const float *operator[](size_t index) const { return m_data + index * m_stride; }
+    };
+
+    template <typename T>
+    using Array = std::vector<T, AlignedAllocator<T>>;
+
+    Array<float> m_positions;  // x, y, z
+    Array<float> m_normals;    // x, y, z
+    Array<float> m_texCoords;  // u, v
+    Array<float> m_tangents;   // x, y, z
+    Array<float> m_bitangents; // x, y, z
+    Array<int> m_boneIDs;      // 4 per vertex, empty unless the mesh is skinned
+    Array<float> m_weights;    // 4 per vertex, empty unless the mesh is skinned
+
+    int vertexCount() const { return (int)(m_positions.size() / 3); }
+    bool empty() const { return m_positions.empty(); }
+    bool isSkinned() const { return !m_boneIDs.empty(); }
+    void resize(int vertexCount, bool skinned);
+    void clear() { *this = VertexStreams(); }
+    const void *data(Stream stream) const;
+    // one bit per stream that holds data, e.g. scans only keep positions and normals
+    int streamMask() const;
+
+    static int componentCount(Stream stream) { return stream == TexCoord ? 2 : (stream >= BoneID ? 4 : 3); }
+    static qint64 elementBytes(Stream stream) { return componentCount(stream) * (qint64)sizeof(float); }
+    // a buffer of vertexCount vertices holding the streams of streamMask back to back in Stream order
+    static Attribute packedAttribute(Stream stream, qint64 vertexCount, int streamMask);
+    static qint64 packedBytes(qint64 vertexCount, int streamMask);
+
+    // smallest and largest coordinate of count points, stride in floats
+    // packed points (stride 3) are read eight at a time with avx2 when the cpu has it
+    static void bounds(const float *positions, qint64 count, int stride, float *min, float *max);
+    static void bounds(const View &positions, qint64 count, float *min, float *max) { bounds(positions.m_data, count, positions.m_stride, min, max); }
+    // copies count elements of a view tightly packed into dst, e.g. a mapped gpu buffer, a packed view is one memcpy
+    static void gather(const View &view, qint64 count, int components, float *dst);
+    static bool hasAvx2();
+};
+
+#endif
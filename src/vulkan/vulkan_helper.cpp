@@ -2,26 +2,124 @@
 #include <spdlog/spdlog.h>
 #include <QFile>
 #include <QFileInfo>
+#include <QDir>
+#include <QSaveFile>
+#include <QHash>
 #include <QVulkanFunctions>
+#include "utils/model_disk_cache.h"
+
+namespace
+{
+    static QHash<QString, QByteArray> sShaderCodes;
+    static QHash<QString, QByteArray> sPipelineCacheDatas;
+}
 
 
 bool VulkanMesh::load(const QString &modelPath)
 {
-    if (!ModelLoadManager::instance()->import3DModel(modelPath, m_data.geom))
+    m_modelPath = modelPath;
+    if (ModelLoadManager::instance()->openPagedModel(modelPath, m_data.pages))
+    {
+        m_data.vertexCount = (int)qMin<quint64>(m_data.pages->header().m_vertexCount, INT_MAX);
+        // pages are not instanced, they are drawn with a single identity transform
+        QMatrix4x4 identity;
+        m_data.instances.assign(identity.constData(), identity.constData() + INSTANCE_FLOAT_COUNT);
+        return true;
+    }
+    else if (ModelLoadManager::instance()->isStreamingModel(modelPath))
+        return false;
+
+    if (!ModelLoadManager::instance()->import3DModel(modelPath, m_data.meshes) ||
+        !ModelLoadManager::instance()->getSceneGraph(modelPath, m_data.sceneGraph))
         return false;
-    m_data.vertexCount = m_data.geom->size() / OBJ_BYTE_COUNT;
+    ModelLoadManager::instance()->getAnimation(modelPath, m_data.animation);
+
+    // the block buffers hold the vertices and indices of every unique mesh in order
+    int32_t vertexOffset = 0;
+    uint32_t firstIndex = 0;
+    for (const auto &modelMesh : *m_data.meshes)
+    {
+        MeshData::Draw draw;
+        draw.indexCount = (uint32_t)modelMesh.m_indices.size();
+        draw.firstIndex = firstIndex;
+        draw.vertexOffset = vertexOffset;
+        draw.instanceCount = (uint32_t)modelMesh.instanceCount();
+        draw.firstInstance = (uint32_t)(m_data.instances.size() / INSTANCE_FLOAT_COUNT);
+        if (draw.indexCount && draw.instanceCount)
+            m_data.draws.emplace_back(draw);
+        m_data.instances.insert(m_data.instances.end(), modelMesh.m_instances.begin(), modelMesh.m_instances.end());
+        m_data.instanceNodes.insert(m_data.instanceNodes.end(), modelMesh.m_instanceNodes.begin(), modelMesh.m_instanceNodes.end());
+        vertexOffset += (int32_t)modelMesh.vertexCount();
+        firstIndex += draw.indexCount;
+    }
+    m_data.vertexCount = vertexOffset;
+    m_data.indexCount = firstIndex;
+    if (m_data.instances.empty())
+    {
+        QMatrix4x4 identity;
+        m_data.instances.assign(identity.constData(), identity.constData() + INSTANCE_FLOAT_COUNT);
+    }
     return true;
 }
 
-void VulkanShader::load(QVulkanInstance *inst, VkDevice dev, const QString &fn)
+bool VulkanMesh::ensureGeometry()
 {
-    QFile f(fn);
-    if (!f.open(QIODevice::ReadOnly))
+    if (m_data.pages || m_data.meshes)
+        return true;
+
+    // the draws keep the counts and offsets of the first load, a model fetched again has the same meshes
+    uint32_t indexCount = 0;
+    int vertexCount = 0;
+    if (ModelLoadManager::instance()->import3DModel(m_modelPath, m_data.meshes))
+    {
+        for (const auto &modelMesh : *m_data.meshes)
+        {
+            indexCount += (uint32_t)modelMesh.m_indices.size();
+            vertexCount += modelMesh.vertexCount();
+        }
+    }
+    if (!m_data.meshes || indexCount != m_data.indexCount || vertexCount != m_data.vertexCount)
     {
-        qWarning("Failed to open %s", qPrintable(fn));
+        spdlog::error("fetch model geometry failed. path: {}", m_modelPath.toStdString());
+        m_data.meshes.reset();
+        return false;
+    }
+    return true;
+}
+
+void VulkanMesh::releaseGeometry()
+{
+    if (m_data.pages || !m_data.meshes || ModelLoadManager::instance()->residency(m_modelPath) == ModelLoadManager::ResidencyOptions::KeepCpu)
         return;
+
+    m_data.meshes.reset();
+    ModelLoadManager::instance()->releaseGeometry(m_modelPath);
+}
+
+void VulkanMesh::writeGeometry(void *vertices, void *indices) const
+{
+    // gathered through the views of the meshes, whichever layout they keep, no copy of the model is made on the way
+    float *positions = static_cast<float *>(vertices);
+    float *normals = positions + (qint64)m_data.vertexCount * 3;
+    uint32_t *out = static_cast<uint32_t *>(indices);
+    for (const auto &modelMesh : *m_data.meshes)
+    {
+        const qint64 vertexCount = modelMesh.vertexCount();
+        VertexStreams::gather(modelMesh.positions(), vertexCount, 3, positions);
+        VertexStreams::gather(modelMesh.normals(), vertexCount, 3, normals);
+        positions += vertexCount * 3;
+        normals += vertexCount * 3;
+        if (!modelMesh.m_indices.empty())
+            memcpy(out, modelMesh.m_indices.data(), modelMesh.m_indices.size() * sizeof(uint32_t));
+        out += modelMesh.m_indices.size();
     }
-    QByteArray blob = f.readAll();
+}
+
+void VulkanShader::load(QVulkanInstance *inst, VkDevice dev, const QString &fn)
+{
+    QByteArray blob = VulkanPipelineRegistry::shaderCode(fn);
+    if (blob.isEmpty())
+        return;
     VkShaderModuleCreateInfo shaderInfo;
     memset(&shaderInfo, 0, sizeof(shaderInfo));
     shaderInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -32,6 +130,57 @@ void VulkanShader::load(QVulkanInstance *inst, VkDevice dev, const QString &fn)
         qWarning("Failed to create shader module: %d", err);
 }
 
+QByteArray VulkanPipelineRegistry::shaderCode(const QString &path)
+{
+    auto it = sShaderCodes.find(path);
+    if (it != sShaderCodes.end())
+        return *it;
+
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        qWarning("Failed to open %s", qPrintable(path));
+        return QByteArray();
+    }
+    return sShaderCodes.insert(path, f.readAll()).value();
+}
+
+QByteArray VulkanPipelineRegistry::pipelineCacheData(const VkPhysicalDeviceProperties &properties)
+{
+    const QString path = pipelineCachePath(properties);
+    auto it = sPipelineCacheDatas.find(path);
+    if (it != sPipelineCacheDatas.end())
+        return *it;
+
+    // the driver checks the header of the data and ignores a cache of another device or driver version
+    QFile f(path);
+    QByteArray data;
+    if (f.open(QIODevice::ReadOnly))
+        data = f.readAll();
+    sPipelineCacheDatas.insert(path, data);
+    return data;
+}
+
+void VulkanPipelineRegistry::savePipelineCacheData(const VkPhysicalDeviceProperties &properties, const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    const QString path = pipelineCachePath(properties);
+    sPipelineCacheDatas.insert(path, data);
+    QSaveFile f(path);
+    if (!f.open(QIODevice::WriteOnly) || f.write(data) != data.size() || !f.commit())
+        spdlog::warn("save pipeline cache failed. path: {}", path.toStdString());
+}
+
+QString VulkanPipelineRegistry::pipelineCachePath(const VkPhysicalDeviceProperties &properties)
+{
+    const QString dir = ModelDiskCache::cacheDir() + "/shader_cache";
+    QDir().mkpath(dir);
+    const QByteArray uuid(reinterpret_cast<const char *>(properties.pipelineCacheUUID), VK_UUID_SIZE);
+    return QString("%1/vulkan_%2_%3_%4.bin").arg(dir).arg(properties.vendorID, 0, 16).arg(properties.deviceID, 0, 16).arg(QString::fromLatin1(uuid.toHex()));
+}
+
 
 Camera::Camera(const QVector3D &pos)
     : m_forward(0.0f, 0.0f, -1.0f),
@@ -13,16 +13,39 @@ class VulkanMesh
 public:
     struct MeshData
     {
+        // one instanced indexed draw per unique mesh
+        struct Draw
+        {
+            uint32_t indexCount = 0;
+            uint32_t firstIndex = 0;
+            int32_t vertexOffset = 0;
+            uint32_t instanceCount = 0;
+            uint32_t firstInstance = 0;
+        };
+
         int vertexCount = 0;
-        std::shared_ptr<QByteArray> geom; // x, y, z, u, v, nx, ny, nz
+        uint32_t indexCount = 0;
+        std::shared_ptr<QVector<ModelLoadManager::ModelMesh>> meshes; // the imported meshes themselves, null once released
+        std::vector<Draw> draws;
+        std::vector<float> instances; // column-major model matrices, INSTANCE_FLOAT_COUNT floats each
+        std::vector<int> instanceNodes; // scene graph node of every instance, empty for pages
+        SceneGraph sceneGraph;
+        std::shared_ptr<const ModelAnimation> animation; // clips move the nodes of sceneGraph, skinning is not bound yet
+        std::shared_ptr<ModelPageFile> pages; // streamed models are paged in by the renderer instead of meshes
     };
 
 public:
     bool load(const QString & modelPath);
+    // the meshes are dropped once the buffers hold them, unless the model keeps them, and fetched again if needed
+    bool ensureGeometry();
+    void releaseGeometry();
+    // x, y, z of every vertex, then nx, ny, nz of every vertex, and the indices of every mesh, e.g. into mapped buffers
+    void writeGeometry(void *vertices, void *indices) const;
     MeshData *data(){ return &m_data; }
     bool isValid() { return m_data.vertexCount > 0; }
 
 private:
+    QString m_modelPath;
     MeshData m_data;
 };
 
@@ -38,6 +61,21 @@ private:
     VkShaderModule m_shaderModule = VK_NULL_HANDLE;
 };
 
+// shaders and pipeline cache data shared by every vulkan window
+// each QVulkanWindow creates its own VkDevice, so the pipelines themselves cannot be shared between windows,
+// instead the pipeline cache data of a physical device seeds the cache of every new window and is kept on disk for later runs
+class VulkanPipelineRegistry
+{
+public:
+    // spir-v of a resource, read once per process
+    static QByteArray shaderCode(const QString &path);
+    static QByteArray pipelineCacheData(const VkPhysicalDeviceProperties &properties);
+    static void savePipelineCacheData(const VkPhysicalDeviceProperties &properties, const QByteArray &data);
+
+private:
+    static QString pipelineCachePath(const VkPhysicalDeviceProperties &properties);
+};
+
 
 class Camera
 {
@@ -1,25 +1,26 @@
 ﻿#include "vulkan_render.h"
-#include <QRandomGenerator>
+#include "utils/cluster_octree.h"
 #include <QVulkanFunctions>
+#include <QThreadPool>
 
 
-const VkDeviceSize PER_INSTANCE_DATA_SIZE = 6 * sizeof(float); // instTranslate, instDiffuseAdjust
+const VkDeviceSize PER_INSTANCE_DATA_SIZE = INSTANCE_FLOAT_COUNT * sizeof(float); // column-major model matrix
+
+// the per frame steps of the camera animations were tuned at this rate, they are scaled by the measured frame time
+#define ANIMATION_FRAME_RATE 60.0
 
 static inline VkDeviceSize aligned(VkDeviceSize v, VkDeviceSize byteAlign)
 {
     return (v + byteAlign - 1) & ~(byteAlign - 1);
 }
 
-static inline float gen(int a, int b)
-{
-    return float(QRandomGenerator::global()->bounded(double(b - a)) + a);
-}
-
 VulkanRenderer::VulkanRenderer(QVulkanWindow *w, const QColor& color, std::shared_ptr<VulkanMesh>& vulkanMeshPtr)
     : m_window(w),
       m_lightPos(0.0f, 0.0f, 25.0f),
       m_cam(QVector3D(0.0f, 0.0f, 20.0f)),
-      m_vulkanMeshPtr(vulkanMeshPtr)
+      m_vulkanMeshPtr(vulkanMeshPtr),
+      m_frameScheduler([w]()
+                       { w->requestUpdate(); })
 {
     QRgb rgba = color.rgba();
     m_bgColor = { (float)qRed(rgba) / 255, (float)qGreen(rgba) / 255, (float)qBlue(rgba) / 255, (float)qAlpha(rgba) / 255 };
@@ -38,13 +39,17 @@ void VulkanRenderer::initResources()
     m_itemMaterial.vertUniSize = aligned(2 * 64 + 48, uniAlign);
     m_itemMaterial.fragUniSize = aligned(6 * 16 + 12 + 2 * 4, uniAlign);
     if (!m_itemMaterial.vs.isValid())
-        m_itemMaterial.vs.load(inst, dev, QStringLiteral(":/color_phong_vert.spv"));
+        m_itemMaterial.vs.load(inst, dev, QStringLiteral(":/instanced_phong_vert.spv"));
     if (!m_itemMaterial.fs.isValid())
         m_itemMaterial.fs.load(inst, dev, QStringLiteral(":/color_phong_frag.spv"));
 
+    // pipelines built by earlier windows and runs come out of the cache instead of being compiled again
+    const QByteArray pipelineCacheData = VulkanPipelineRegistry::pipelineCacheData(*m_window->physicalDeviceProperties());
     VkPipelineCacheCreateInfo pipelineCacheInfo;
     memset(&pipelineCacheInfo, 0, sizeof(pipelineCacheInfo));
     pipelineCacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheInfo.initialDataSize = pipelineCacheData.size();
+    pipelineCacheInfo.pInitialData = pipelineCacheData.isEmpty() ? nullptr : pipelineCacheData.constData();
     VkResult err = m_devFuncs->vkCreatePipelineCache(dev, &pipelineCacheInfo, nullptr, &m_pipelineCache);
     if (err != VK_SUCCESS)
         qFatal("Failed to create pipeline cache: %d", err);
@@ -52,6 +57,10 @@ void VulkanRenderer::initResources()
     createItemPipeline();
     ensureBuffers();
     ensureInstanceBuffer();
+    if (isPaged())
+        m_pageResidency.reset(new ModelPageResidency(ModelLoadManager::instance()->streamingOptions().m_residencyBudget));
+    m_frameScheduler.setAnimating(m_animationType || hasClips());
+    markDirty(DirtyResize);
 }
 
 bool VulkanRenderer::checkValid()
@@ -69,7 +78,7 @@ void VulkanRenderer::initSwapChainResources()
     m_proj = m_window->clipCorrectionMatrix();
     const QSize sz = m_window->swapChainImageSize();
     m_proj.perspective(45.0f, sz.width() / (float)sz.height(), 0.01f, 1000.0f);
-    markViewProjDirty();
+    markDirty(DirtyResize);
 }
 
 void VulkanRenderer::releaseSwapChainResources()
@@ -113,10 +122,12 @@ void VulkanRenderer::startNextFrame()
         {uint32_t(sz.width()), uint32_t(sz.height())} };
     m_devFuncs->vkCmdSetScissor(cb, 0, 1, &scissor);
 
-    buildDrawCall();
+    ++m_frameCount;
+    buildDrawCall(m_frameScheduler.beginFrame());
     m_devFuncs->vkCmdEndRenderPass(cmdBuf);
     m_window->frameReady();
-    m_window->requestUpdate();
+    // static scenes are drawn again only when something marks them dirty
+    m_frameScheduler.endFrame();
 }
 
 void VulkanRenderer::releaseResources()
@@ -126,6 +137,9 @@ void VulkanRenderer::releaseResources()
 
     VkDevice dev = m_window->device();
 
+    releasePages(true);
+    m_pageResidency.reset();
+
     if (m_itemMaterial.descSetLayout)
     {
         m_devFuncs->vkDestroyDescriptorSetLayout(dev, m_itemMaterial.descSetLayout, nullptr);
@@ -152,6 +166,13 @@ void VulkanRenderer::releaseResources()
 
     if (m_pipelineCache)
     {
+        size_t dataSize = 0;
+        if (m_devFuncs->vkGetPipelineCacheData(dev, m_pipelineCache, &dataSize, nullptr) == VK_SUCCESS && dataSize)
+        {
+            QByteArray data((qsizetype)dataSize, Qt::Uninitialized);
+            if (m_devFuncs->vkGetPipelineCacheData(dev, m_pipelineCache, &dataSize, data.data()) == VK_SUCCESS)
+                VulkanPipelineRegistry::savePipelineCacheData(*m_window->physicalDeviceProperties(), data.left((qsizetype)dataSize));
+        }
         m_devFuncs->vkDestroyPipelineCache(dev, m_pipelineCache, nullptr);
         m_pipelineCache = VK_NULL_HANDLE;
     }
@@ -160,6 +181,14 @@ void VulkanRenderer::releaseResources()
     {
         m_devFuncs->vkDestroyBuffer(dev, m_blockVertexBuf, nullptr);
         m_blockVertexBuf = VK_NULL_HANDLE;
+        ModelLoadManager::instance()->addGpuBytes(-m_gpuBytes);
+        m_gpuBytes = 0;
+    }
+
+    if (m_indexBuf)
+    {
+        m_devFuncs->vkDestroyBuffer(dev, m_indexBuf, nullptr);
+        m_indexBuf = VK_NULL_HANDLE;
     }
 
     if (m_uniBuf)
@@ -203,13 +232,18 @@ void VulkanRenderer::createItemPipeline()
     VkDevice dev = m_window->device();
 
     // Vertex layout.
+    // positions and normals are bound as two streams, pages interleave them in one buffer with the uvs in between
+    const uint32_t vertexStride = isPaged() ? PAGE_VERTEX_BYTE_COUNT : 3 * sizeof(float);
     VkVertexInputBindingDescription vertexBindingDesc[] = {
         {0, // binding
-         8 * sizeof(float),
+         vertexStride,
          VK_VERTEX_INPUT_RATE_VERTEX},
         {1,
-         6 * sizeof(float),
-         VK_VERTEX_INPUT_RATE_INSTANCE} };
+         PER_INSTANCE_DATA_SIZE,
+         VK_VERTEX_INPUT_RATE_INSTANCE},
+        {2,
+         vertexStride,
+         VK_VERTEX_INPUT_RATE_VERTEX} };
     VkVertexInputAttributeDescription vertexAttrDesc[] = {
         {
             // position
@@ -220,19 +254,26 @@ void VulkanRenderer::createItemPipeline()
         },
         {// normal
          1,
-         0,
+         2,
          VK_FORMAT_R32G32B32_SFLOAT,
-         5 * sizeof(float)},
-        {// instTranslate
+         0},
+        {// instModel, one column per location
          2,
          1,
-         VK_FORMAT_R32G32B32_SFLOAT,
+         VK_FORMAT_R32G32B32A32_SFLOAT,
          0},
-        {// instDiffuseAdjust
-         3,
+        {3,
          1,
-         VK_FORMAT_R32G32B32_SFLOAT,
-         3 * sizeof(float)} };
+         VK_FORMAT_R32G32B32A32_SFLOAT,
+         4 * sizeof(float)},
+        {4,
+         1,
+         VK_FORMAT_R32G32B32A32_SFLOAT,
+         8 * sizeof(float)},
+        {5,
+         1,
+         VK_FORMAT_R32G32B32A32_SFLOAT,
+         12 * sizeof(float)} };
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo;
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -391,15 +432,35 @@ void VulkanRenderer::ensureBuffers()
     VkBufferCreateInfo bufInfo;
     memset(&bufInfo, 0, sizeof(bufInfo));
     bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    const int blockMeshByteCount = m_vulkanMeshPtr->data()->vertexCount * 8 * sizeof(float);
-    bufInfo.size = blockMeshByteCount;
-    bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    VkResult err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_blockVertexBuf);
-    if (err != VK_SUCCESS)
-        qFatal("Failed to create vertex buffer: %d", err);
+    // a device created again needs the geometry released after the first upload
+    if (!isPaged() && !m_vulkanMeshPtr->ensureGeometry())
+        qFatal("Failed to fetch model geometry");
+    const int blockMeshByteCount = m_vulkanMeshPtr->data()->vertexCount * MESH_STREAM_BYTE_COUNT;
+    const VkDeviceSize indexByteCount = m_vulkanMeshPtr->data()->indexCount * sizeof(uint32_t);
+    VkResult err = VK_SUCCESS;
+    VkMemoryRequirements blockVertMemReq, indexMemReq;
+    memset(&blockVertMemReq, 0, sizeof(blockVertMemReq));
+    memset(&indexMemReq, 0, sizeof(indexMemReq));
+    VkDeviceSize indexMemOffset = 0;
+    // paged models get one vertex buffer per resident page instead of a single block
+    if (!isPaged())
+    {
+        bufInfo.size = blockMeshByteCount;
+        bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_blockVertexBuf);
+        if (err != VK_SUCCESS)
+            qFatal("Failed to create vertex buffer: %d", err);
+        m_devFuncs->vkGetBufferMemoryRequirements(dev, m_blockVertexBuf, &blockVertMemReq);
+
+        bufInfo.size = indexByteCount;
+        bufInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+        err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_indexBuf);
+        if (err != VK_SUCCESS)
+            qFatal("Failed to create index buffer: %d", err);
+        m_devFuncs->vkGetBufferMemoryRequirements(dev, m_indexBuf, &indexMemReq);
+        indexMemOffset = aligned(blockVertMemReq.size, indexMemReq.alignment);
+    }
 
-    VkMemoryRequirements blockVertMemReq;
-    m_devFuncs->vkGetBufferMemoryRequirements(dev, m_blockVertexBuf, &blockVertMemReq);
     bufInfo.size = (m_itemMaterial.vertUniSize + m_itemMaterial.fragUniSize) * concurrentFrameCount;
     bufInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
     err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_uniBuf);
@@ -408,7 +469,7 @@ void VulkanRenderer::ensureBuffers()
 
     VkMemoryRequirements uniMemReq;
     m_devFuncs->vkGetBufferMemoryRequirements(dev, m_uniBuf, &uniMemReq);
-    m_itemMaterial.uniMemStartOffset = aligned(blockVertMemReq.size, uniMemReq.alignment);
+    m_itemMaterial.uniMemStartOffset = aligned(indexMemOffset + indexMemReq.size, uniMemReq.alignment);
     VkMemoryAllocateInfo memAllocInfo = {
         VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
         nullptr,
@@ -418,20 +479,30 @@ void VulkanRenderer::ensureBuffers()
     if (err != VK_SUCCESS)
         qFatal("Failed to allocate memory: %d", err);
 
-    err = m_devFuncs->vkBindBufferMemory(dev, m_blockVertexBuf, m_bufMem, 0);
-    if (err != VK_SUCCESS)
-        qFatal("Failed to bind vertex buffer memory: %d", err);
     err = m_devFuncs->vkBindBufferMemory(dev, m_uniBuf, m_bufMem, m_itemMaterial.uniMemStartOffset);
     if (err != VK_SUCCESS)
         qFatal("Failed to bind uniform buffer memory: %d", err);
 
-    // Copy vertex data.
-    quint8 *p;
-    err = m_devFuncs->vkMapMemory(dev, m_bufMem, 0, m_itemMaterial.uniMemStartOffset, 0, reinterpret_cast<void **>(&p));
-    if (err != VK_SUCCESS)
-        qFatal("Failed to map memory: %d", err);
-    memcpy(p, m_vulkanMeshPtr->data()->geom->constData(), blockMeshByteCount);
-    m_devFuncs->vkUnmapMemory(dev, m_bufMem);
+    if (m_blockVertexBuf)
+    {
+        err = m_devFuncs->vkBindBufferMemory(dev, m_blockVertexBuf, m_bufMem, 0);
+        if (err != VK_SUCCESS)
+            qFatal("Failed to bind vertex buffer memory: %d", err);
+        err = m_devFuncs->vkBindBufferMemory(dev, m_indexBuf, m_bufMem, indexMemOffset);
+        if (err != VK_SUCCESS)
+            qFatal("Failed to bind index buffer memory: %d", err);
+
+        // Copy vertex and index data.
+        quint8 *p;
+        err = m_devFuncs->vkMapMemory(dev, m_bufMem, 0, m_itemMaterial.uniMemStartOffset, 0, reinterpret_cast<void **>(&p));
+        if (err != VK_SUCCESS)
+            qFatal("Failed to map memory: %d", err);
+        m_vulkanMeshPtr->writeGeometry(p, p + indexMemOffset);
+        m_devFuncs->vkUnmapMemory(dev, m_bufMem);
+        m_gpuBytes = blockMeshByteCount + indexByteCount;
+        ModelLoadManager::instance()->addGpuBytes(m_gpuBytes);
+        m_vulkanMeshPtr->releaseGeometry();
+    }
 
     // Write descriptors for the uniform buffers in the vertex and fragment shaders.
     VkDescriptorBufferInfo vertUni = {m_uniBuf, 0, m_itemMaterial.vertUniSize};
@@ -462,10 +533,11 @@ void VulkanRenderer::ensureInstanceBuffer()
     VkBufferCreateInfo bufInfo;
     memset(&bufInfo, 0, sizeof(bufInfo));
     bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufInfo.size = PER_INSTANCE_DATA_SIZE;
+    const std::vector<float> &instances = m_vulkanMeshPtr->data()->instances;
+    m_instFrameSize = instances.size() * sizeof(float);
+    bufInfo.size = m_instFrameSize * m_window->concurrentFrameCount();
     bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
 
-    m_instData.resize(bufInfo.size);
     VkResult err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &m_instBuf);
     if (err != VK_SUCCESS)
         qFatal("Failed to create instance buffer: %d", err);
@@ -486,20 +558,41 @@ void VulkanRenderer::ensureInstanceBuffer()
     if (err != VK_SUCCESS)
         qFatal("Failed to bind instance buffer memory: %d", err);
 
+    quint8 *p;
+    err = m_devFuncs->vkMapMemory(dev, m_instBufMem, 0, bufInfo.size, 0, reinterpret_cast<void **>(&p));
+    if (err != VK_SUCCESS)
+        qFatal("Failed to map memory: %d", err);
+    for (int i = 0; i < m_window->concurrentFrameCount(); ++i)
+        memcpy(p + i * m_instFrameSize, instances.data(), m_instFrameSize);
+    m_devFuncs->vkUnmapMemory(dev, m_instBufMem);
+}
+
+void VulkanRenderer::updateInstances(double seconds)
+{
+    VulkanMesh::MeshData *data = m_vulkanMeshPtr->data();
+    if (hasClips())
+    {
+        m_clipSeconds += seconds;
+        SkeletalAnimation::sample(data->animation->m_clips.front(), m_clipSeconds, data->sceneGraph);
+    }
+
+    // only the subtrees of nodes whose local matrix changed are recomputed
+    if (!data->instanceNodes.empty() && data->sceneGraph.update())
     {
-        char *p = m_instData.data();
-        float t[] = {gen(-5, 5), gen(-4, 6), gen(-30, 5)};
-        memcpy(p, t, 12);
-        float d[] = {gen(-6, 3) / 10.0f, gen(-6, 3) / 10.0f, gen(-6, 3) / 10.0f};
-        memcpy(p + 12, d, 12);
+        data->sceneGraph.gatherWorlds(data->instanceNodes, data->instances.data());
+        m_instDirty = m_window->concurrentFrameCount();
     }
+    if (!m_instDirty)
+        return;
 
+    --m_instDirty;
     quint8 *p;
-    err = m_devFuncs->vkMapMemory(dev, m_instBufMem, 0, PER_INSTANCE_DATA_SIZE, 0, reinterpret_cast<void **>(&p));
+    VkResult err = m_devFuncs->vkMapMemory(m_window->device(), m_instBufMem, m_window->currentFrame() * m_instFrameSize, m_instFrameSize,
+                                           0, reinterpret_cast<void **>(&p));
     if (err != VK_SUCCESS)
         qFatal("Failed to map memory: %d", err);
-    memcpy(p, m_instData.constData(), m_instData.size());
-    m_devFuncs->vkUnmapMemory(dev, m_instBufMem);
+    memcpy(p, data->instances.data(), m_instFrameSize);
+    m_devFuncs->vkUnmapMemory(m_window->device(), m_instBufMem);
 }
 
 void VulkanRenderer::getMatrices(QMatrix4x4 *vp, QMatrix4x4 *model, QMatrix3x3 *modelNormal, QVector3D *eyePos)
@@ -553,7 +646,7 @@ void VulkanRenderer::writeFragUni(quint8 *p, const QVector3D &eyePos)
     p += 4;
 }
 
-void VulkanRenderer::buildDrawCall()
+void VulkanRenderer::buildDrawCall(double seconds)
 {
     VkDevice dev = m_window->device();
     VkCommandBuffer cb = m_window->currentCommandBuffer();
@@ -561,20 +654,28 @@ void VulkanRenderer::buildDrawCall()
     uint32_t frameUniOffset = m_window->currentFrame() * (m_itemMaterial.vertUniSize + m_itemMaterial.fragUniSize);
     uint32_t frameUniOffsets[] = { frameUniOffset, frameUniOffset };
     m_devFuncs->vkCmdBindPipeline(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_itemMaterial.pipeline);
-    m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_blockVertexBuf, &vbOffset);
-    m_devFuncs->vkCmdBindVertexBuffers(cb, 1, 1, &m_instBuf, &vbOffset);
+    if (m_blockVertexBuf)
+    {
+        const VkDeviceSize normalOffset = m_vulkanMeshPtr->data()->vertexCount * 3 * sizeof(float);
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &m_blockVertexBuf, &vbOffset);
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 2, 1, &m_blockVertexBuf, &normalOffset);
+        m_devFuncs->vkCmdBindIndexBuffer(cb, m_indexBuf, 0, VK_INDEX_TYPE_UINT32);
+    }
+    updateInstances(seconds);
+    VkDeviceSize instOffset = m_window->currentFrame() * m_instFrameSize;
+    m_devFuncs->vkCmdBindVertexBuffers(cb, 1, 1, &m_instBuf, &instOffset);
     m_devFuncs->vkCmdBindDescriptorSets(cb, VK_PIPELINE_BIND_POINT_GRAPHICS, m_itemMaterial.pipelineLayout, 0, 1,
                                         &m_itemMaterial.descSet, 2, frameUniOffsets);
 
-    setAnimationType();
+    advanceAnimation(seconds);
+    QMatrix4x4 vp, model;
+    QMatrix3x3 modelNormal;
+    QVector3D eyePos;
+    getMatrices(&vp, &model, &modelNormal, &eyePos);
     if (m_animationType || m_vpDirty)
     {
         if (m_vpDirty)
             --m_vpDirty;
-        QMatrix4x4 vp, model;
-        QMatrix3x3 modelNormal;
-        QVector3D eyePos;
-        getMatrices(&vp, &model, &modelNormal, &eyePos);
 
         quint8 *p;
         VkResult err = m_devFuncs->vkMapMemory(dev, m_bufMem,
@@ -599,63 +700,296 @@ void VulkanRenderer::buildDrawCall()
         m_devFuncs->vkUnmapMemory(dev, m_bufMem);
     }
 
-    m_devFuncs->vkCmdDraw(cb, m_vulkanMeshPtr->data()->vertexCount, 1, 0, 0);
+    if (isPaged())
+        drawPages(vp * model, model.inverted().map(eyePos));
+    else
+    {
+        // every unique mesh is drawn once for all of its instances
+        for (const auto &draw : m_vulkanMeshPtr->data()->draws)
+            m_devFuncs->vkCmdDrawIndexed(cb, draw.indexCount, draw.instanceCount, draw.firstIndex, draw.vertexOffset, draw.firstInstance);
+    }
+}
+
+void VulkanRenderer::drawPages(const QMatrix4x4 &mvp, const QVector3D &eye)
+{
+    if (!m_pageResidency)
+        return;
+
+    releasePages(false);
+    finishPages();
+
+    // visible pages, nearest first
+    ModelPageFile *pageFile = m_vulkanMeshPtr->data()->pages.get();
+    Frustum frustum(mvp);
+    std::vector<std::pair<float, int>> visibleDepths;
+    for (int i = 0; i < pageFile->pageCount(); ++i)
+    {
+        const ModelPageFile::PageEntry &page = pageFile->page(i);
+        if (!frustum.intersects(page.m_min, page.m_max))
+            continue;
+        QVector3D center = (QVector3D(page.m_min[0], page.m_min[1], page.m_min[2]) + QVector3D(page.m_max[0], page.m_max[1], page.m_max[2])) * 0.5f;
+        visibleDepths.emplace_back((mvp * QVector4D(center, 1.0f)).w(), i);
+    }
+    std::sort(visibleDepths.begin(), visibleDepths.end());
+
+    std::vector<int> visiblePages, loadPages, releasedPages;
+    visiblePages.reserve(visibleDepths.size());
+    for (const auto &visibleDepth : visibleDepths)
+        visiblePages.emplace_back(visibleDepth.second);
+    m_pageResidency->update(visiblePages, *pageFile, loadPages, releasedPages);
+    for (int page : releasedPages)
+    {
+        auto loading = m_loadingPages.find(page);
+        if (loading != m_loadingPages.end())
+            loading->second.released = true;
+        auto it = m_pages.find(page);
+        if (it == m_pages.end())
+            continue;
+        // the page may still be referenced by frames in flight
+        it->second.releaseFrames = m_window->concurrentFrameCount();
+        m_releasedPages.emplace_back(it->second);
+        m_pages.erase(it);
+    }
+    for (int page : loadPages)
+        uploadPage(page);
+
+    VkCommandBuffer cb = m_window->currentCommandBuffer();
+    VkDeviceSize vbOffset = 0;
+    const VkDeviceSize pageNormalOffset = 5 * sizeof(float);
+    for (int page : visiblePages)
+    {
+        auto it = m_pages.find(page);
+        if (it == m_pages.end())
+            continue;
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 0, 1, &it->second.buf, &vbOffset);
+        m_devFuncs->vkCmdBindVertexBuffers(cb, 2, 1, &it->second.buf, &pageNormalOffset);
+
+        // adjacent visible clusters are merged into one draw
+        const ModelPageFile::PageEntry &pageEntry = pageFile->page(page);
+        uint32_t runFirst = 0;
+        uint32_t runCount = 0;
+        for (quint32 i = 0; i < pageEntry.m_clusterCount; ++i)
+        {
+            const ModelPageFile::ClusterEntry &cluster = pageFile->cluster(pageEntry.m_firstCluster + i);
+            if (!ClusterOctree::isClusterVisible(cluster, frustum, eye))
+                continue;
+            if (runCount && cluster.m_firstVertex == runFirst + runCount)
+            {
+                runCount += cluster.m_vertexCount;
+                continue;
+            }
+            if (runCount)
+                m_devFuncs->vkCmdDraw(cb, runCount, 1, runFirst, 0);
+            runFirst = cluster.m_firstVertex;
+            runCount = cluster.m_vertexCount;
+        }
+        if (runCount)
+            m_devFuncs->vkCmdDraw(cb, runCount, 1, runFirst, 0);
+    }
+
+    // keep paging in until the visible set is resident, and let released pages run out of their frames
+    if (m_pageResidency->hasPending() || !m_loadingPages.empty() || !m_releasedPages.empty())
+        markDirty(DirtyPages);
+}
+
+void VulkanRenderer::uploadPage(int page)
+{
+    // dropped and wanted again while it loads, the load in flight is kept
+    auto loading = m_loadingPages.find(page);
+    if (loading != m_loadingPages.end())
+    {
+        loading->second.released = false;
+        return;
+    }
+
+    // a worker of the global pool reads and decodes the page straight into the mapped buffer, it is drawn once the worker is done
+    std::shared_ptr<const ModelPageFile> pageFilePtr = m_vulkanMeshPtr->data()->pages;
+    const qint64 byteCount = pageFilePtr->pageByteCount(page);
+    VkDevice dev = m_window->device();
+    VulkanPage vulkanPage;
+    vulkanPage.vertexCount = byteCount / PAGE_VERTEX_BYTE_COUNT;
+
+    VkBufferCreateInfo bufInfo;
+    memset(&bufInfo, 0, sizeof(bufInfo));
+    bufInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufInfo.size = byteCount;
+    bufInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+    VkResult err = m_devFuncs->vkCreateBuffer(dev, &bufInfo, nullptr, &vulkanPage.buf);
+    if (err != VK_SUCCESS)
+        qFatal("Failed to create page buffer: %d", err);
+
+    VkMemoryRequirements memReq;
+    m_devFuncs->vkGetBufferMemoryRequirements(dev, vulkanPage.buf, &memReq);
+    VkMemoryAllocateInfo memAllocInfo = {
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        nullptr,
+        memReq.size,
+        m_window->hostVisibleMemoryIndex()};
+    err = m_devFuncs->vkAllocateMemory(dev, &memAllocInfo, nullptr, &vulkanPage.mem);
+    if (err != VK_SUCCESS)
+        qFatal("Failed to allocate memory: %d", err);
+    err = m_devFuncs->vkBindBufferMemory(dev, vulkanPage.buf, vulkanPage.mem, 0);
+    if (err != VK_SUCCESS)
+        qFatal("Failed to bind page buffer memory: %d", err);
+
+    quint8 *p;
+    err = m_devFuncs->vkMapMemory(dev, vulkanPage.mem, 0, byteCount, 0, reinterpret_cast<void **>(&p));
+    if (err != VK_SUCCESS)
+        qFatal("Failed to map memory: %d", err);
+
+    LoadingPage loadingPage;
+    loadingPage.page = vulkanPage;
+    loadingPage.state = std::make_shared<std::atomic<int>>(PageLoading);
+    m_loadingPages[page] = loadingPage;
+    std::shared_ptr<std::atomic<int>> state = loadingPage.state;
+    char *dst = reinterpret_cast<char *>(p);
+    QThreadPool::globalInstance()->start([pageFilePtr, page, byteCount, dst, state]()
+                                         { *state = pageFilePtr->loadPage(page, 0, byteCount, dst) ? PageLoaded : PageFailed; });
+}
+
+void VulkanRenderer::finishPages()
+{
+    // the memory is host coherent, a finished page only needs to be unmapped
+    VkDevice dev = m_window->device();
+    for (auto it = m_loadingPages.begin(); it != m_loadingPages.end();)
+    {
+        const int state = *it->second.state;
+        if (state == PageLoading)
+        {
+            ++it;
+            continue;
+        }
+
+        const VulkanPage &vulkanPage = it->second.page;
+        m_devFuncs->vkUnmapMemory(dev, vulkanPage.mem);
+        if (state == PageLoaded && !it->second.released)
+        {
+            m_pages[it->first] = vulkanPage;
+        }
+        else
+        {
+            m_devFuncs->vkDestroyBuffer(dev, vulkanPage.buf, nullptr);
+            m_devFuncs->vkFreeMemory(dev, vulkanPage.mem, nullptr);
+        }
+        it = m_loadingPages.erase(it);
+    }
+}
+
+void VulkanRenderer::releasePages(bool all)
+{
+    VkDevice dev = m_window->device();
+    auto destroyPage = [this, dev](const VulkanPage &page)
+    {
+        m_devFuncs->vkDestroyBuffer(dev, page.buf, nullptr);
+        m_devFuncs->vkFreeMemory(dev, page.mem, nullptr);
+    };
+
+    if (all)
+    {
+        // the workers still write to the mapped pages
+        QThreadPool::globalInstance()->waitForDone();
+        finishPages();
+        for (const auto &page : m_pages)
+            destroyPage(page.second);
+        m_pages.clear();
+    }
+
+    for (auto it = m_releasedPages.begin(); it != m_releasedPages.end();)
+    {
+        if (all || --it->releaseFrames <= 0)
+        {
+            destroyPage(*it);
+            it = m_releasedPages.erase(it);
+        }
+        else
+            ++it;
+    }
 }
 
 void VulkanRenderer::yaw(float degrees)
 {
     m_cam.yaw(degrees);
-    markViewProjDirty();
+    markDirty(DirtyCamera);
 }
 
 void VulkanRenderer::pitch(float degrees)
 {
     m_cam.pitch(degrees);
-    markViewProjDirty();
+    markDirty(DirtyCamera);
 }
 
 void VulkanRenderer::walk(float amount)
 {
     m_cam.walk(amount);
-    markViewProjDirty();
+    markDirty(DirtyCamera);
 }
 
 void VulkanRenderer::strafe(float amount)
 {
     m_cam.strafe(amount);
-    markViewProjDirty();
+    markDirty(DirtyCamera);
 }
 
 void VulkanRenderer::setBgColor(const QColor& color)
 {
     QRgb rgba = color.rgba();
     m_bgColor = { (float)qRed(rgba) / 255, (float)qGreen(rgba) / 255, (float)qBlue(rgba) / 255, (float)qAlpha(rgba) / 255 };
+    markDirty(DirtyBackground);
+}
+
+void VulkanRenderer::startAnimation(int animationType)
+{
+    m_animationType = animationType;
+    m_frameScheduler.setAnimating(true);
+    markDirty(DirtyAnimation);
+}
+
+void VulkanRenderer::stopAnimation()
+{
+    m_animationType = 0;
+    m_frameScheduler.setAnimating(hasClips());
+    // the last animated pose is in the uniforms of only one frame in flight
+    markDirty(DirtyAnimation | DirtyCamera);
+}
+
+void VulkanRenderer::markDirty(int dirtyFlags)
+{
+    if (dirtyFlags & (DirtyCamera | DirtyResize))
+        m_vpDirty = m_window->concurrentFrameCount();
+    m_frameScheduler.requestFrame();
+}
+
+bool VulkanRenderer::hasClips()
+{
+    const VulkanMesh::MeshData *data = m_vulkanMeshPtr ? m_vulkanMeshPtr->data() : nullptr;
+    return data && data->animation && !data->animation->m_clips.empty() && !data->instanceNodes.empty();
 }
 
-void VulkanRenderer::setAnimationType()
+void VulkanRenderer::advanceAnimation(double seconds)
 {
+    const float steps = (float)(seconds * ANIMATION_FRAME_RATE);
     switch ((AnimationHelper::AnimationType)(m_animationType))
     {
     case AnimationHelper::Turntable:
-        m_rotation += 0.5;
+        m_rotation += 0.5f * steps;
         if (m_rotation > 360)
             m_rotation -= 360;
         break;
     case AnimationHelper::Sway:
         if (m_swayLoopNum <= 180 / 0.5)
-            m_rotation += 0.5;
+            m_rotation += 0.5f * steps;
         else if (m_swayLoopNum <= 180 / 0.5 * 2)
-            m_rotation -= 0.5;
+            m_rotation -= 0.5f * steps;
         else
             m_swayLoopNum -= 180 / 0.5 * 2;
-        ++m_swayLoopNum;
+        m_swayLoopNum += steps;
         break;
     case AnimationHelper::Hover:
-        m_hoverHeight += 0.05;
+        m_hoverHeight += 0.05f * steps;
         if (m_hoverHeight <= 5)
-            pitch(0.3f);
+            pitch(0.3f * steps);
         else
-            pitch(-0.3f);
+            pitch(-0.3f * steps);
         if (m_hoverHeight > 10)
             m_hoverHeight -= 10;
         break;
@@ -2,10 +2,24 @@
 #define __VULKAN_RENDER_H__
 
 #include "vulkan_helper.h"
+#include "utils/frame_scheduler.h"
 #include <QVulkanWindowRenderer>
+#include <atomic>
+#include <unordered_map>
 
 class VulkanRenderer : public QVulkanWindowRenderer
 {
+public:
+    // reasons to draw a new frame, without one the renderer stays idle
+    enum DirtyFlag
+    {
+        DirtyCamera = 0x01,
+        DirtyBackground = 0x02,
+        DirtyAnimation = 0x04,
+        DirtyResize = 0x08,
+        DirtyPages = 0x10,
+    };
+
 public:
     VulkanRenderer(QVulkanWindow *w, const QColor& color, std::shared_ptr<VulkanMesh>& vulkanMeshPtr);
     void initResources() override;
@@ -14,24 +28,32 @@ public:
     void releaseResources() override;
     void startNextFrame() override;
 
-    void startAnimation(int animationType) { m_animationType = animationType; };
-    void stopAnimation(){ m_animationType = 0; }
+    void startAnimation(int animationType);
+    void stopAnimation();
     void yaw(float degrees);
     void pitch(float degrees);
     void walk(float amount);
     void strafe(float amount);
     void setBgColor(const QColor& color);
+    quint64 frameCount() const { return m_frameCount; }
 
 private:
     bool checkValid();
     void createItemPipeline();
     void ensureBuffers();
     void ensureInstanceBuffer();
+    void updateInstances(double seconds);
     void getMatrices(QMatrix4x4 *mvp, QMatrix4x4 *model, QMatrix3x3 *modelNormal, QVector3D *eyePos);
     void writeFragUni(quint8 *p, const QVector3D &eyePos);
-    void buildDrawCall();
-    void markViewProjDirty() { m_vpDirty = m_window->concurrentFrameCount(); }
-    void setAnimationType();
+    void buildDrawCall(double seconds);
+    void markDirty(int dirtyFlags);
+    void advanceAnimation(double seconds);
+    bool hasClips();
+    bool isPaged() { return m_vulkanMeshPtr->data()->pages != nullptr; }
+    void drawPages(const QMatrix4x4 &mvp, const QVector3D &eye);
+    void uploadPage(int page);
+    void finishPages();
+    void releasePages(bool all);
 
 private:
     struct VulkanRenderMaterial
@@ -48,10 +70,35 @@ private:
         VkPipeline pipeline = VK_NULL_HANDLE;
     };
 
+    struct VulkanPage
+    {
+        VkBuffer buf = VK_NULL_HANDLE;
+        VkDeviceMemory mem = VK_NULL_HANDLE;
+        uint32_t vertexCount = 0;
+        int releaseFrames = 0; // frames left before a released page is no longer used by the gpu
+    };
+
+    enum PageState
+    {
+        PageLoading = 0,
+        PageLoaded,
+        PageFailed,
+    };
+
+    // a page a worker of the global pool decodes into its mapped memory
+    struct LoadingPage
+    {
+        VulkanPage page;
+        std::shared_ptr<std::atomic<int>> state; // PageState, written by the worker
+        bool released = false;                   // the residency dropped the page, it is destroyed once the worker is done
+    };
+
 private:
     QVulkanWindow *m_window = nullptr;
     QVulkanDeviceFunctions *m_devFuncs = nullptr;
     VkBuffer m_blockVertexBuf = VK_NULL_HANDLE;
+    VkBuffer m_indexBuf = VK_NULL_HANDLE;
+    qint64 m_gpuBytes = 0; // vertex and index bytes of the block buffers, counted by ModelLoadManager::residencyStats
     VulkanRenderMaterial m_itemMaterial;
     VkDeviceMemory m_bufMem = VK_NULL_HANDLE;
     VkBuffer m_uniBuf = VK_NULL_HANDLE;
@@ -59,16 +106,24 @@ private:
     QVector3D m_lightPos;
     Camera m_cam;
     QMatrix4x4 m_proj;
-    int m_vpDirty = 0;
+    int m_vpDirty = 0; // frames in flight whose uniforms still hold an old camera
+    quint64 m_frameCount = 0;
     int m_animationType = 0;
     float m_rotation = 0.0f;
-    int m_swayLoopNum = 0;
+    float m_swayLoopNum = 0;
     float m_hoverHeight = 0;
-    QByteArray m_instData;
     VkBuffer m_instBuf = VK_NULL_HANDLE;
     VkDeviceMemory m_instBufMem = VK_NULL_HANDLE;
+    VkDeviceSize m_instFrameSize = 0; // every frame in flight reads its own copy of the instance transforms
+    int m_instDirty = 0;
+    double m_clipSeconds = 0.0;
     std::array<float, 4> m_bgColor;
     std::shared_ptr<VulkanMesh> m_vulkanMeshPtr;
+    std::unique_ptr<ModelPageResidency> m_pageResidency;
+    std::unordered_map<int, VulkanPage> m_pages;
+    std::vector<VulkanPage> m_releasedPages;
+    std::unordered_map<int, LoadingPage> m_loadingPages;
+    FrameScheduler m_frameScheduler;
 };
 
 #endif
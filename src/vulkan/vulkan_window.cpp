@@ -76,6 +76,11 @@ void VulkanWindowContainer::stopAnimation()
     m_vulkanWindow->stopAnimation();
 }
 
+quint64 VulkanWindowContainer::frameCount() const
+{
+    return m_vulkanWindow->frameCount();
+}
+
 
 /// <summary>
 /// 
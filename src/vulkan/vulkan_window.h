@@ -20,7 +20,8 @@ public:
     void setWheelScale(float wheelScale) override;
     void startAnimation(int animationType) override;
     void stopAnimation() override;
-    QString getModelPath() const override { return m_modelPath; }
+    QStringList getModelPaths() const override { return m_modelPath.isEmpty() ? QStringList() : QStringList{m_modelPath}; }
+    quint64 frameCount() const;
 
 private:
     QString m_modelPath;
@@ -36,6 +37,7 @@ public:
     void setBgColor(const QColor& color);
     void startAnimation(int animationType);
     void stopAnimation();
+    quint64 frameCount() const { return m_renderer ? m_renderer->frameCount() : 0; }
 
 protected:
     void mousePressEvent(QMouseEvent *) override;
@@ -45,7 +47,7 @@ protected:
     void wheelEvent(QWheelEvent* e) override;
 
 private:
-    VulkanRenderer *m_renderer;
+    VulkanRenderer *m_renderer = nullptr;
     QColor m_bgColor;
     std::shared_ptr<VulkanMesh> m_vulkanMeshPtr;
     bool m_mousePress = false;